@@ -0,0 +1,378 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <boost/format.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file ball_tree_cpu.cpp
+	\brief ball-tree search, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! Functor to compare point indices on a given dimension of a cloud
+	template<typename T>
+	struct CompareIndicesOnDim
+	{
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		
+		const Matrix& cloud; //!< reference to data points used to compare
+		const Index dim; //!< dimension on which to compare
+		
+		//! Build the functor for a specific dimension on a specific cloud
+		CompareIndicesOnDim(const Matrix& cloud, const Index dim): cloud(cloud), dim(dim) {}
+		//! Compare the values of p0 and p1 on dim, and return whether p0[dim] < p1[dim]
+		bool operator() (const Index p0, const Index p1) const { return cloud.coeff(dim, p0) < cloud.coeff(dim, p1); }
+	};
+	
+	//! Number of points from which building a subtree is worth spawning a task
+	static const int BALL_TREE_PARALLEL_BUILD_MIN_COUNT = 4096;
+	
+	template<typename T, typename Heap>
+	unsigned BallTree<T, Heap>::getNodeCount(const unsigned count, const unsigned bucketSize)
+	{
+		if (count <= bucketSize)
+			return 1;
+		return 1 + getNodeCount(count / 2, bucketSize) + getNodeCount(count - count / 2, bucketSize);
+	}
+	
+	template<typename T, typename Heap>
+	void BallTree<T, Heap>::buildNodes(const BuildPointsIt begin, const BuildPointsIt first, const BuildPointsIt last, const unsigned pos)
+	{
+		const int count(last - first);
+		assert(count >= 1);
+		
+		// compute centroid and extent of the points
+		Vector centroid(Vector::Zero(dim));
+		Vector minValues(Vector::Constant(dim, numeric_limits<T>::max()));
+		Vector maxValues(Vector::Constant(dim, -numeric_limits<T>::max()));
+		for (BuildPointsIt it(first); it != last; ++it)
+		{
+			const T* pt(&cloud.coeff(0, *it));
+			for (int d = 0; d < dim; ++d)
+			{
+				centroid(d) += pt[d];
+				minValues(d) = min(minValues(d), pt[d]);
+				maxValues(d) = max(maxValues(d), pt[d]);
+			}
+		}
+		centroid /= T(count);
+		
+		// compute radius, slightly enlarged so that rounding errors never prune a point
+		T radius2(0);
+		for (BuildPointsIt it(first); it != last; ++it)
+		{
+			const T* pt(&cloud.coeff(0, *it));
+			T dist(0);
+			for (int d = 0; d < dim; ++d)
+			{
+				const T diff(pt[d] - centroid(d));
+				dist += diff*diff;
+			}
+			radius2 = max(radius2, dist);
+		}
+		copy(&centroid.coeff(0), &centroid.coeff(0) + dim, centroids.begin() + size_t(pos) * dim);
+		radii[pos] = sqrt(radius2) * (1 + 16 * numeric_limits<T>::epsilon());
+		
+		if (count <= int(bucketSize))
+		{
+			const uint32_t bucketIndex(first - begin);
+			for (int i = 0; i < count; ++i)
+			{
+				const Index index(*(first+i));
+				buckets[bucketIndex + i] = BucketEntry(&cloud.coeff(0, index), index);
+			}
+			nodes[pos] = Node(bucketIndex, count);
+			return;
+		}
+		
+		// split at the median of the dimension of largest extent
+		const Index cutDim(argMax<T>(maxValues - minValues));
+		const int leftCount(count / 2);
+		const BuildPointsIt middle(first + leftCount);
+		nth_element(first, middle, last, CompareIndicesOnDim<T>(cloud, cutDim));
+		
+		// the layout is fully determined by counts, so children can be built independently
+		const unsigned rightChild(pos + 1 + getNodeCount(leftCount, bucketSize));
+		nodes[pos] = Node(rightChild, 0);
+		if (count >= BALL_TREE_PARALLEL_BUILD_MIN_COUNT)
+		{
+			#pragma omp task
+			buildNodes(begin, first, middle, pos + 1);
+		}
+		else
+			buildNodes(begin, first, middle, pos + 1);
+		buildNodes(begin, middle, last, rightChild);
+	}
+	
+	template<typename T, typename Heap>
+	BallTree<T, Heap>::BallTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		bucketSize(additionalParameters.get<unsigned>("bucketSize", 8))
+	{
+		if (bucketSize < 2)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
+		
+#ifdef EIGEN3_API
+		const_cast<Vector&>(minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
+		const_cast<Vector&>(maxBound) = cloud.topRows(this->dim).rowwise().maxCoeff();
+#else // EIGEN3_API
+		for (int i = 0; i < cloud.cols(); ++i)
+		{
+			const Vector& v(cloud.block(0,i,this->dim,1));
+			const_cast<Vector&>(minBound) = minBound.cwise().min(v);
+			const_cast<Vector&>(maxBound) = maxBound.cwise().max(v);
+		}
+#endif // EIGEN3_API
+		
+		// allocate all storage at once
+		const unsigned nodeCount(getNodeCount(cloud.cols(), bucketSize));
+		nodes.resize(nodeCount);
+		centroids.resize(size_t(nodeCount) * this->dim);
+		radii.resize(nodeCount);
+		buckets.resize(cloud.cols());
+		
+		// create nodes, in parallel if possible
+		BuildPoints buildPoints(cloud.cols());
+		for (int i = 0; i < cloud.cols(); ++i)
+			buildPoints[i] = i;
+#pragma omp parallel
+		{
+#pragma omp single
+			buildNodes(buildPoints.begin(), buildPoints.begin(), buildPoints.end(), 0);
+		}
+	}
+	
+	template<typename T, typename Heap>
+	size_t BallTree<T, Heap>::memoryUsage() const
+	{
+		return nodes.capacity() * sizeof(Node) + centroids.capacity() * sizeof(T) + radii.capacity() * sizeof(T) + buckets.capacity() * sizeof(BucketEntry);
+	}
+	
+	template<typename T, typename Heap>
+	typename NearestNeighbourSearch<T>::MemoryEstimate BallTree<T, Heap>::estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters)
+	{
+		const unsigned bucketSize(additionalParameters.get<unsigned>("bucketSize", 8));
+		if (bucketSize < 2)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
+		
+		// the tree is balanced, so its size only depends on the number of points
+		const size_t nodeCount(getNodeCount(pointCount, bucketSize));
+		typename NearestNeighbourSearch<T>::MemoryEstimate estimate;
+		estimate.nodes = nodeCount * (sizeof(Node) + (size_t(dim) + 1) * sizeof(T));
+		estimate.buckets = size_t(pointCount) * sizeof(BucketEntry);
+		return estimate;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long BallTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const T maxRadius2(maxRadius * maxRadius);
+		const T maxError2((1+epsilon)*(1+epsilon));
+		const int colCount(query.cols());
+		
+		unsigned long leafTouchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		Heap heap(k);
+		
+#pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+		}
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long BallTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const T maxError2((1+epsilon)*(1+epsilon));
+		const int colCount(query.cols());
+		
+		unsigned long leafTouchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		Heap heap(k);
+		
+#pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const T maxRadius(maxRadii[i]);
+			const T maxRadius2(maxRadius * maxRadius);
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+		}
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long BallTree<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const
+	{
+		heap.reset();
+		unsigned long leafTouchedCount(0);
+		
+		const T* q(&query.coeff(0, i));
+		if (ballDist2(q, 0) <= maxRadius2)
+		{
+			if (allowSelfMatch)
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnn<true, true>(q, 0, heap, maxError2, maxRadius2);
+				else
+					recurseKnn<true, false>(q, 0, heap, maxError2, maxRadius2);
+			}
+			else
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnn<false, true>(q, 0, heap, maxError2, maxRadius2);
+				else
+					recurseKnn<false, false>(q, 0, heap, maxError2, maxRadius2);
+			}
+		}
+		
+		if (sortResults)
+			heap.sort();
+		
+		heap.getData(indices.col(i), dists2.col(i));
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	T BallTree<T, Heap>::ballDist2(const T* query, const unsigned n) const
+	{
+		const T* centroid(&centroids[size_t(n) * dim]);
+		T dist(0);
+		for (int i = 0; i < dim; ++i)
+		{
+			const T diff(query[i] - centroid[i]);
+			dist += diff*diff;
+		}
+		const T offset(sqrt(dist) - radii[n]);
+		return offset > 0 ? offset * offset : 0;
+	}
+	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long BallTree<T, Heap>::recurseKnn(const T* query, const unsigned n, Heap& heap, const T maxError2, const T maxRadius2) const
+	{
+		const Node& node(nodes[n]);
+		
+		if (node.bucketSize)
+		{
+			const BucketEntry* bucket(&buckets[node.rightChildBucketIndex]);
+			for (uint32_t i = 0; i < node.bucketSize; ++i)
+			{
+				T dist(0);
+				const T* qPtr(query);
+				const T* dPtr(bucket->pt);
+				for (int j = 0; j < this->dim; ++j)
+				{
+					const T diff(*qPtr - *dPtr);
+					dist += diff*diff;
+					qPtr++; dPtr++;
+				}
+				if ((dist <= maxRadius2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > numeric_limits<T>::epsilon()))
+				)
+					heap.replaceHead(bucket->index, dist);
+				++bucket;
+			}
+			return (unsigned long)(node.bucketSize);
+		}
+		else
+		{
+			// visit the closest ball first, then the other one if it can still contain neighbours
+			unsigned long leafVisitedCount(0);
+			const unsigned leftChild(n + 1);
+			const unsigned rightChild(node.rightChildBucketIndex);
+			const T leftDist2(ballDist2(query, leftChild));
+			const T rightDist2(ballDist2(query, rightChild));
+			const bool leftFirst(leftDist2 <= rightDist2);
+			const unsigned firstChild(leftFirst ? leftChild : rightChild);
+			const unsigned secondChild(leftFirst ? rightChild : leftChild);
+			const T firstDist2(leftFirst ? leftDist2 : rightDist2);
+			const T secondDist2(leftFirst ? rightDist2 : leftDist2);
+			if ((firstDist2 <= maxRadius2) &&
+				(firstDist2 * maxError2 < heap.headValue()))
+			{
+				if (collectStatistics)
+					leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, firstChild, heap, maxError2, maxRadius2);
+				else
+					recurseKnn<allowSelfMatch, false>(query, firstChild, heap, maxError2, maxRadius2);
+			}
+			if ((secondDist2 <= maxRadius2) &&
+				(secondDist2 * maxError2 < heap.headValue()))
+			{
+				if (collectStatistics)
+					leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, secondChild, heap, maxError2, maxRadius2);
+				else
+					recurseKnn<allowSelfMatch, false>(query, secondChild, heap, maxError2, maxRadius2);
+			}
+			return leafVisitedCount;
+		}
+	}
+	
+	template struct BallTree<float,IndexHeapBruteForceVector<int,float> >;
+	template struct BallTree<double,IndexHeapBruteForceVector<int,double> >;
+	
+	//@}
+}
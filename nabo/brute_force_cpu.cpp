@@ -41,9 +41,13 @@ namespace Nabo
 {
 	using namespace std;
 	
+	//! number of points whose distances to the query are computed together, before their insertion in the heap
+	const int BRUTE_FORCE_TILE_SIZE = 256;
+	
 	template<typename T>
-	BruteForceSearch<T>::BruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags):
-		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags)
+	BruteForceSearch<T>::BruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		kernels(selectCpuKernelSet(additionalParameters))
 	{
 #ifdef EIGEN3_API
 		const_cast<Vector&>(this->minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
@@ -76,21 +80,32 @@ namespace Nabo
 		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
 		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
 		
+		const int pointCount(this->cloud.cols());
+		const int stride(this->cloud.rows());
+		
 		IndexHeapSTL<Index, T> heap(k);
+		std::vector<T> tileDists2(BRUTE_FORCE_TILE_SIZE);
+		std::vector<int> candidates(BRUTE_FORCE_TILE_SIZE);
 		
 		for (int c = 0; c < query.cols(); ++c)
 		{
 			const T maxRadius(maxRadii[c]);
 			const T maxRadius2(maxRadius * maxRadius);
-			const Vector& q(query.block(0,c,dim,1));
+			const T* q(&query.coeff(0, c));
 			heap.reset();
-			for (int i = 0; i < this->cloud.cols(); ++i)
+			for (int first = 0; first < pointCount; first += BRUTE_FORCE_TILE_SIZE)
 			{
-				const T dist(dist2<T>(this->cloud.block(0,i,dim,1), q));
-				if ((dist <= maxRadius2) &&
-					(dist < heap.headValue()) &&
-					(allowSelfMatch || (dist > numeric_limits<T>::epsilon())))
-					heap.replaceHead(i, dist);
+				// compute distances for the whole tile, and only consider those that can enter the heap
+				const int tileSize(min(BRUTE_FORCE_TILE_SIZE, pointCount - first));
+				kernels.tileDist2(q, &this->cloud.coeff(0, first), dim, stride, tileSize, &tileDists2[0]);
+				const int candidateCount(kernels.selectBelow(&tileDists2[0], tileSize, min(maxRadius2, heap.headValue()), &candidates[0]));
+				for (int j = 0; j < candidateCount; ++j)
+				{
+					const T dist(tileDists2[candidates[j]]);
+					if ((dist < heap.headValue()) &&
+						(allowSelfMatch || (dist > numeric_limits<T>::epsilon())))
+						heap.replaceHead(first + candidates[j], dist);
+				}
 			}
 			if (sortResults)
 				heap.sort();	
@@ -0,0 +1,316 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <boost/format.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file cover_tree_cpu.cpp
+	\brief cover-tree search, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! Predicate returning whether a build point is within a given distance of the current center
+	template<typename BuildPoint, typename T>
+	struct IsWithinDist
+	{
+		const T radius; //!< radius of the ball
+		//! Build the predicate for a given radius
+		IsWithinDist(const T radius): radius(radius) {}
+		//! Return whether p is within radius
+		bool operator() (const BuildPoint& p) const { return p.dist <= radius; }
+	};
+	
+	template<typename T, typename Heap>
+	T CoverTree<T, Heap>::pointDist(const Index i0, const Index i1) const
+	{
+		return queryDist(&cloud.coeff(0, i0), i1);
+	}
+	
+	template<typename T, typename Heap>
+	T CoverTree<T, Heap>::queryDist(const T* query, const Index i) const
+	{
+		// use Eigen for the distance, as it vectorizes the reduction in high dimensions
+		typedef Eigen::Map<const Vector> ConstVectorMap;
+		return sqrt((ConstVectorMap(query, dim) - ConstVectorMap(&cloud.coeff(0, i), dim)).squaredNorm());
+	}
+	
+	template<typename T, typename Heap>
+	void CoverTree<T, Heap>::buildChildren(const unsigned n, const BuildPointsIt first, const BuildPointsIt last)
+	{
+		typedef IsWithinDist<BuildPoint, T> IsWithin;
+		
+		// centers of the children and the ranges of points they cover
+		vector<Index> centers;
+		vector<pair<BuildPointsIt, BuildPointsIt> > ranges;
+		
+		// the maximum distance is slightly enlarged so that rounding errors never prune a point
+		T maxDist(0);
+		for (BuildPointsIt it(first); it != last; ++it)
+			maxDist = max(maxDist, it->dist);
+		nodes[n].maxDist = maxDist * (1 + 16 * numeric_limits<T>::epsilon());
+		
+		BuildPointsIt nearLast(last);
+		while (first != nearLast)
+		{
+			T radius(0);
+			for (BuildPointsIt it(first); it != nearLast; ++it)
+				radius = max(radius, it->dist);
+			
+			// few or duplicated points left, they all become leaves
+			if ((nearLast - first <= int(bucketSize)) || (radius == 0))
+			{
+				for (BuildPointsIt it(first); it != nearLast; ++it)
+				{
+					centers.push_back(it->index);
+					ranges.push_back(make_pair(it, it));
+				}
+				break;
+			}
+			
+			// halve the covering radius, points further away are grouped around new centers,
+			// which are separated by more than the radius
+			radius /= 2;
+			const BuildPointsIt farFirst(partition(first, nearLast, IsWithin(radius)));
+			BuildPointsIt center(farFirst);
+			while (center != nearLast)
+			{
+				const BuildPointsIt groupFirst(center + 1);
+				for (BuildPointsIt it(groupFirst); it != nearLast; ++it)
+					it->dist = pointDist(center->index, it->index);
+				const BuildPointsIt groupLast(partition(groupFirst, nearLast, IsWithin(radius)));
+				centers.push_back(center->index);
+				ranges.push_back(make_pair(groupFirst, groupLast));
+				center = groupLast;
+			}
+			nearLast = farFirst;
+		}
+		
+		// children are stored contiguously, then built recursively
+		const uint32_t firstChild(nodes.size());
+		nodes[n].firstChild = firstChild;
+		nodes[n].childCount = centers.size();
+		for (size_t i = 0; i < centers.size(); ++i)
+			nodes.push_back(Node(centers[i]));
+		for (size_t i = 0; i < centers.size(); ++i)
+			if (ranges[i].first != ranges[i].second)
+				buildChildren(firstChild + i, ranges[i].first, ranges[i].second);
+	}
+	
+	template<typename T, typename Heap>
+	CoverTree<T, Heap>::CoverTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		bucketSize(additionalParameters.get<unsigned>("bucketSize", 8))
+	{
+		if (bucketSize < 1)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be at least 1") % bucketSize).str());
+		
+#ifdef EIGEN3_API
+		const_cast<Vector&>(minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
+		const_cast<Vector&>(maxBound) = cloud.topRows(this->dim).rowwise().maxCoeff();
+#else // EIGEN3_API
+		for (int i = 0; i < cloud.cols(); ++i)
+		{
+			const Vector& v(cloud.block(0,i,this->dim,1));
+			const_cast<Vector&>(minBound) = minBound.cwise().min(v);
+			const_cast<Vector&>(maxBound) = maxBound.cwise().max(v);
+		}
+#endif // EIGEN3_API
+		
+		// the first point is the root, all other points are built below it
+		BuildPoints buildPoints;
+		buildPoints.reserve(cloud.cols() - 1);
+		for (int i = 1; i < cloud.cols(); ++i)
+			buildPoints.push_back(BuildPoint(i, pointDist(0, i)));
+		nodes.reserve(cloud.cols());
+		nodes.push_back(Node(0));
+		if (!buildPoints.empty())
+			buildChildren(0, buildPoints.begin(), buildPoints.end());
+	}
+	
+	template<typename T, typename Heap>
+	size_t CoverTree<T, Heap>::memoryUsage() const
+	{
+		return nodes.capacity() * sizeof(Node);
+	}
+	
+	template<typename T, typename Heap>
+	typename NearestNeighbourSearch<T>::MemoryEstimate CoverTree<T, Heap>::estimateMemory(const Index pointCount, const Index /*dim*/, const Parameters& /*additionalParameters*/)
+	{
+		// every point is a node, whatever the bucket size
+		typename NearestNeighbourSearch<T>::MemoryEstimate estimate;
+		estimate.nodes = size_t(pointCount) * sizeof(Node);
+		return estimate;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long CoverTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		const Vector maxRadii(Vector::Constant(query.cols(), maxRadius));
+		return knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags);
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long CoverTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const T maxError2((1+epsilon)*(1+epsilon));
+		const int colCount(query.cols());
+		
+		unsigned long leafTouchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		Heap heap(k);
+		Candidates candidates;
+		
+#pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const T maxRadius(maxRadii[i]);
+			const T maxRadius2(maxRadius * maxRadius);
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, candidates, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+		}
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long CoverTree<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, Candidates& candidates, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const
+	{
+		heap.reset();
+		candidates.clear();
+		unsigned long leafTouchedCount(0);
+		
+		// consider the root, then its descendants
+		const T* q(&query.coeff(0, i));
+		const T rootDist(queryDist(q, nodes[0].index));
+		const T rootDist2(rootDist * rootDist);
+		if ((rootDist2 <= maxRadius2) &&
+			(allowSelfMatch || (rootDist2 > numeric_limits<T>::epsilon())))
+			heap.replaceHead(nodes[0].index, rootDist2);
+		const T rootLowerBound(max(rootDist - nodes[0].maxDist, T(0)));
+		if (rootLowerBound * rootLowerBound <= maxRadius2)
+		{
+			if (allowSelfMatch)
+			{
+				if (collectStatistics)
+					leafTouchedCount += 1 + recurseKnn<true, true>(q, 0, heap, candidates, maxError2, maxRadius2);
+				else
+					recurseKnn<true, false>(q, 0, heap, candidates, maxError2, maxRadius2);
+			}
+			else
+			{
+				if (collectStatistics)
+					leafTouchedCount += 1 + recurseKnn<false, true>(q, 0, heap, candidates, maxError2, maxRadius2);
+				else
+					recurseKnn<false, false>(q, 0, heap, candidates, maxError2, maxRadius2);
+			}
+		}
+		
+		if (sortResults)
+			heap.sort();
+		
+		heap.getData(indices.col(i), dists2.col(i));
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long CoverTree<T, Heap>::recurseKnn(const T* query, const unsigned n, Heap& heap, Candidates& candidates, const T maxError2, const T maxRadius2) const
+	{
+		const Node& node(nodes[n]);
+		const size_t candidatesBegin(candidates.size());
+		unsigned long pointTouchedCount(node.childCount);
+		
+		// consider leaf children immediately, queue the others
+		for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+		{
+			const Node& child(nodes[c]);
+			const T dist(queryDist(query, child.index));
+			if (child.childCount == 0)
+			{
+				const T dist2(dist * dist);
+				if ((dist2 <= maxRadius2) &&
+					(dist2 < heap.headValue()) &&
+					(allowSelfMatch || (dist2 > numeric_limits<T>::epsilon())))
+					heap.replaceHead(child.index, dist2);
+			}
+			else
+				candidates.push_back(Candidate(max(dist - child.maxDist, T(0)), dist, c));
+		}
+		
+		// visit queued children by increasing lower bound
+		sort(candidates.begin() + candidatesBegin, candidates.end());
+		for (size_t i = candidatesBegin; i < candidates.size(); ++i)
+		{
+			const Candidate candidate(candidates[i]);
+			const T lowerBound2(candidate.lowerBound * candidate.lowerBound);
+			if ((lowerBound2 > maxRadius2) ||
+				(lowerBound2 * maxError2 >= heap.headValue()))
+				break;
+			const T dist2(candidate.dist * candidate.dist);
+			if ((dist2 <= maxRadius2) &&
+				(dist2 < heap.headValue()) &&
+				(allowSelfMatch || (dist2 > numeric_limits<T>::epsilon())))
+				heap.replaceHead(nodes[candidate.node].index, dist2);
+			if (collectStatistics)
+				pointTouchedCount += recurseKnn<allowSelfMatch, true>(query, candidate.node, heap, candidates, maxError2, maxRadius2);
+			else
+				recurseKnn<allowSelfMatch, false>(query, candidate.node, heap, candidates, maxError2, maxRadius2);
+		}
+		candidates.erase(candidates.begin() + candidatesBegin, candidates.end());
+		return pointTouchedCount;
+	}
+	
+	template struct CoverTree<float,IndexHeapBruteForceVector<int,float> >;
+	template struct CoverTree<double,IndexHeapBruteForceVector<int,double> >;
+	
+	//@}
+}
@@ -0,0 +1,692 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include <stdexcept>
+#include <cstdlib>
+#include <string>
+#include <boost/format.hpp>
+
+// x86 kernels need function-level target attributes and CPU feature detection
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8)))
+	#define NABO_DISTANCE_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+// NEON is part of the base instruction set on 64-bit ARM
+#if defined(__aarch64__)
+	#define NABO_DISTANCE_NEON_KERNELS
+	#include <arm_neon.h>
+#endif
+
+/*!	\file distance_cpu.cpp
+	\brief vectorized distance kernels and their selection at runtime, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! names of the kernel sets, in the order of CpuKernelSet
+	static const char* cpuKernelSetNames[CPU_KERNELS_COUNT] = { "scalar", "sse4.2", "avx2", "avx512", "neon" };
+	
+	const char* getCpuKernelSetName(const CpuKernelSet kernelSet)
+	{
+		return cpuKernelSetNames[kernelSet];
+	}
+	
+	bool isCpuKernelSetSupported(const CpuKernelSet kernelSet)
+	{
+		switch (kernelSet)
+		{
+			case CPU_KERNELS_SCALAR: return true;
+#ifdef NABO_DISTANCE_X86_KERNELS
+			case CPU_KERNELS_SSE42: __builtin_cpu_init(); return __builtin_cpu_supports("sse4.2");
+			case CPU_KERNELS_AVX2: __builtin_cpu_init(); return __builtin_cpu_supports("avx2");
+			case CPU_KERNELS_AVX512: __builtin_cpu_init(); return __builtin_cpu_supports("avx512f");
+#endif // NABO_DISTANCE_X86_KERNELS
+#ifdef NABO_DISTANCE_NEON_KERNELS
+			case CPU_KERNELS_NEON: return true;
+#endif // NABO_DISTANCE_NEON_KERNELS
+			default: return false;
+		}
+	}
+	
+	CpuKernelSet selectCpuKernelSet(const Parameters& additionalParameters)
+	{
+		string name(additionalParameters.get<string>("cpuKernels", ""));
+		if (name.empty())
+		{
+			const char* envName(getenv("NABO_CPU_KERNELS"));
+			if (envName)
+				name = envName;
+		}
+		if (name.empty() || name == "auto")
+		{
+			// best supported set
+			for (int kernelSet = CPU_KERNELS_COUNT - 1; kernelSet > CPU_KERNELS_SCALAR; --kernelSet)
+				if (isCpuKernelSetSupported(CpuKernelSet(kernelSet)))
+					return CpuKernelSet(kernelSet);
+			return CPU_KERNELS_SCALAR;
+		}
+		for (int kernelSet = 0; kernelSet < CPU_KERNELS_COUNT; ++kernelSet)
+		{
+			if (name != cpuKernelSetNames[kernelSet])
+				continue;
+			if (!isCpuKernelSetSupported(CpuKernelSet(kernelSet)))
+				throw runtime_error((boost::format("Requested cpu kernels %1% are not supported by this processor or build") % name).str());
+			return CpuKernelSet(kernelSet);
+		}
+		throw runtime_error((boost::format("Unknown cpu kernels %1%, valid ones are auto, scalar, sse4.2, avx2, avx512 and neon") % name).str());
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, portable implementation
+	template<typename T>
+	static T dist2Scalar(const T* a, const T* b, const int dim)
+	{
+		T dist(0);
+		for (int d = 0; d < dim; ++d)
+		{
+			const T diff(a[d] - b[d]);
+			dist += diff * diff;
+		}
+		return dist;
+	}
+	
+	//! Compute into dists2 the squared distances between query and count points, whose coordinates start every stride values from points, portable implementation
+	template<typename T>
+	static void tileDist2Scalar(const T* query, const T* points, const int dim, const int stride, const int count, T* dists2)
+	{
+		for (int j = 0; j < count; ++j)
+			dists2[j] = dist2Scalar(query, points + j * stride, dim);
+	}
+	
+	//! Write into selected the indices of the count values lower or equal to threshold, and return their number, portable implementation
+	template<typename T>
+	static int selectBelowScalar(const T* values, const int count, const T threshold, int* selected)
+	{
+		int selectedCount(0);
+		for (int j = 0; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+#ifdef NABO_DISTANCE_X86_KERNELS
+	
+	//! Append to selected the base + position of the bits set in mask, and return the new number of selected values
+	static inline int appendMaskBits(unsigned mask, const int base, int* selected, int selectedCount)
+	{
+		while (mask)
+		{
+			selected[selectedCount++] = base + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+		return selectedCount;
+	}
+	
+	//! Return the sum of the lanes of v
+	static inline float horizontalSum(const __m128 v)
+	{
+		const __m128 pairs(_mm_add_ps(v, _mm_movehl_ps(v, v)));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+	}
+	
+	//! Return the sum of the lanes of v
+	static inline double horizontalSum(const __m128d v)
+	{
+		return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using SSE4.2
+	__attribute__((target("sse4.2")))
+	static float dist2Sse42(const float* a, const float* b, const int dim)
+	{
+		__m128 acc(_mm_setzero_ps());
+		int d(0);
+		for (; d + 4 <= dim; d += 4)
+		{
+			const __m128 diff(_mm_sub_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d)));
+			acc = _mm_add_ps(acc, _mm_mul_ps(diff, diff));
+		}
+		float dist(horizontalSum(acc));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using SSE4.2
+	__attribute__((target("sse4.2")))
+	static double dist2Sse42(const double* a, const double* b, const int dim)
+	{
+		__m128d acc(_mm_setzero_pd());
+		int d(0);
+		for (; d + 2 <= dim; d += 2)
+		{
+			const __m128d diff(_mm_sub_pd(_mm_loadu_pd(a + d), _mm_loadu_pd(b + d)));
+			acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+		}
+		double dist(horizontalSum(acc));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Compute squared distances from query to a tile of points, using SSE4.2; low-dimensional points are processed four at a time, others one at a time
+	__attribute__((target("sse4.2")))
+	static void tileDist2Sse42(const float* query, const float* points, const int dim, const int stride, const int count, float* dists2)
+	{
+		int j(0);
+		if (dim < 4)
+		{
+			for (; j + 4 <= count; j += 4)
+			{
+				const float* p(points + j * stride);
+				__m128 acc(_mm_setzero_ps());
+				for (int d = 0; d < dim; ++d)
+				{
+					const __m128 coords(_mm_set_ps(p[3 * stride + d], p[2 * stride + d], p[stride + d], p[d]));
+					const __m128 diff(_mm_sub_ps(coords, _mm_set1_ps(query[d])));
+					acc = _mm_add_ps(acc, _mm_mul_ps(diff, diff));
+				}
+				_mm_storeu_ps(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Sse42(query, points + j * stride, dim);
+	}
+	
+	//! Compute squared distances from query to a tile of points, using SSE4.2; points are processed one at a time
+	__attribute__((target("sse4.2")))
+	static void tileDist2Sse42(const double* query, const double* points, const int dim, const int stride, const int count, double* dists2)
+	{
+		for (int j = 0; j < count; ++j)
+			dists2[j] = dist2Sse42(query, points + j * stride, dim);
+	}
+	
+	//! Select values lower or equal to threshold, using SSE4.2
+	__attribute__((target("sse4.2")))
+	static int selectBelowSse42(const float* values, const int count, const float threshold, int* selected)
+	{
+		const __m128 limit(_mm_set1_ps(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 4 <= count; j += 4)
+			selectedCount = appendMaskBits(_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(values + j), limit)), j, selected, selectedCount);
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Select values lower or equal to threshold, using SSE4.2
+	__attribute__((target("sse4.2")))
+	static int selectBelowSse42(const double* values, const int count, const double threshold, int* selected)
+	{
+		const __m128d limit(_mm_set1_pd(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 2 <= count; j += 2)
+			selectedCount = appendMaskBits(_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(values + j), limit)), j, selected, selectedCount);
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using AVX2
+	__attribute__((target("avx2")))
+	static float dist2Avx2(const float* a, const float* b, const int dim)
+	{
+		__m256 acc(_mm256_setzero_ps());
+		int d(0);
+		for (; d + 8 <= dim; d += 8)
+		{
+			const __m256 diff(_mm256_sub_ps(_mm256_loadu_ps(a + d), _mm256_loadu_ps(b + d)));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+		}
+		float dist(horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1))));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using AVX2
+	__attribute__((target("avx2")))
+	static double dist2Avx2(const double* a, const double* b, const int dim)
+	{
+		__m256d acc(_mm256_setzero_pd());
+		int d(0);
+		for (; d + 4 <= dim; d += 4)
+		{
+			const __m256d diff(_mm256_sub_pd(_mm256_loadu_pd(a + d), _mm256_loadu_pd(b + d)));
+			acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+		}
+		double dist(horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1))));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Compute squared distances from query to a tile of points, using AVX2; low-dimensional points are gathered eight at a time, others processed one at a time
+	__attribute__((target("avx2")))
+	static void tileDist2Avx2(const float* query, const float* points, const int dim, const int stride, const int count, float* dists2)
+	{
+		int j(0);
+		if (dim < 8)
+		{
+			const __m256i offsets(_mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride)));
+			// masked gathers with an explicit source, the unmasked ones leave it undefined, which GCC reports as uninitialized
+			const __m256 allLanes(_mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+			for (; j + 8 <= count; j += 8)
+			{
+				const float* p(points + j * stride);
+				__m256 acc(_mm256_setzero_ps());
+				for (int d = 0; d < dim; ++d)
+				{
+					const __m256 diff(_mm256_sub_ps(_mm256_mask_i32gather_ps(_mm256_setzero_ps(), p + d, offsets, allLanes, 4), _mm256_set1_ps(query[d])));
+					acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+				}
+				_mm256_storeu_ps(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Avx2(query, points + j * stride, dim);
+	}
+	
+	//! Compute squared distances from query to a tile of points, using AVX2; low-dimensional points are gathered four at a time, others processed one at a time
+	__attribute__((target("avx2")))
+	static void tileDist2Avx2(const double* query, const double* points, const int dim, const int stride, const int count, double* dists2)
+	{
+		int j(0);
+		if (dim < 4)
+		{
+			const __m128i offsets(_mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(stride)));
+			// masked gathers with an explicit source, the unmasked ones leave it undefined, which GCC reports as uninitialized
+			const __m256d allLanes(_mm256_castsi256_pd(_mm256_set1_epi64x(-1)));
+			for (; j + 4 <= count; j += 4)
+			{
+				const double* p(points + j * stride);
+				__m256d acc(_mm256_setzero_pd());
+				for (int d = 0; d < dim; ++d)
+				{
+					const __m256d diff(_mm256_sub_pd(_mm256_mask_i32gather_pd(_mm256_setzero_pd(), p + d, offsets, allLanes, 8), _mm256_set1_pd(query[d])));
+					acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+				}
+				_mm256_storeu_pd(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Avx2(query, points + j * stride, dim);
+	}
+	
+	//! Select values lower or equal to threshold, using AVX2
+	__attribute__((target("avx2")))
+	static int selectBelowAvx2(const float* values, const int count, const float threshold, int* selected)
+	{
+		const __m256 limit(_mm256_set1_ps(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 8 <= count; j += 8)
+			selectedCount = appendMaskBits(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(values + j), limit, _CMP_LE_OQ)), j, selected, selectedCount);
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Select values lower or equal to threshold, using AVX2
+	__attribute__((target("avx2")))
+	static int selectBelowAvx2(const double* values, const int count, const double threshold, int* selected)
+	{
+		const __m256d limit(_mm256_set1_pd(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 4 <= count; j += 4)
+			selectedCount = appendMaskBits(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + j), limit, _CMP_LE_OQ)), j, selected, selectedCount);
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Return the sum of the lanes of values, adding halves as _mm512_reduce_add_ps() does, whose extractions GCC reports as uninitialized
+	__attribute__((target("avx512f")))
+	static float horizontalSumAvx512(const __m512 values)
+	{
+		float lanes[16];
+		_mm512_storeu_ps(lanes, values);
+		for (int width = 8; width > 0; width /= 2)
+			for (int i = 0; i < width; ++i)
+				lanes[i] += lanes[i + width];
+		return lanes[0];
+	}
+	
+	//! Return the sum of the lanes of values, adding halves as _mm512_reduce_add_pd() does, whose extractions GCC reports as uninitialized
+	__attribute__((target("avx512f")))
+	static double horizontalSumAvx512(const __m512d values)
+	{
+		double lanes[8];
+		_mm512_storeu_pd(lanes, values);
+		for (int width = 4; width > 0; width /= 2)
+			for (int i = 0; i < width; ++i)
+				lanes[i] += lanes[i + width];
+		return lanes[0];
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using AVX-512
+	__attribute__((target("avx512f")))
+	static float dist2Avx512(const float* a, const float* b, const int dim)
+	{
+		__m512 acc(_mm512_setzero_ps());
+		int d(0);
+		for (; d + 16 <= dim; d += 16)
+		{
+			const __m512 diff(_mm512_sub_ps(_mm512_loadu_ps(a + d), _mm512_loadu_ps(b + d)));
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(diff, diff));
+		}
+		if (d < dim)
+		{
+			// masked loads read zeros beyond the end
+			const __mmask16 tail(__mmask16((1u << (dim - d)) - 1));
+			const __m512 diff(_mm512_sub_ps(_mm512_maskz_loadu_ps(tail, a + d), _mm512_maskz_loadu_ps(tail, b + d)));
+			acc = _mm512_add_ps(acc, _mm512_mul_ps(diff, diff));
+		}
+		return horizontalSumAvx512(acc);
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using AVX-512
+	__attribute__((target("avx512f")))
+	static double dist2Avx512(const double* a, const double* b, const int dim)
+	{
+		__m512d acc(_mm512_setzero_pd());
+		int d(0);
+		for (; d + 8 <= dim; d += 8)
+		{
+			const __m512d diff(_mm512_sub_pd(_mm512_loadu_pd(a + d), _mm512_loadu_pd(b + d)));
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+		}
+		if (d < dim)
+		{
+			// masked loads read zeros beyond the end
+			const __mmask8 tail(__mmask8((1u << (dim - d)) - 1));
+			const __m512d diff(_mm512_sub_pd(_mm512_maskz_loadu_pd(tail, a + d), _mm512_maskz_loadu_pd(tail, b + d)));
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+		}
+		return horizontalSumAvx512(acc);
+	}
+	
+	//! Compute squared distances from query to a tile of points, using AVX-512; low-dimensional points are gathered sixteen at a time, others processed one at a time
+	__attribute__((target("avx512f")))
+	static void tileDist2Avx512(const float* query, const float* points, const int dim, const int stride, const int count, float* dists2)
+	{
+		int j(0);
+		if (dim < 16)
+		{
+			const __m512i offsets(_mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(stride)));
+			for (; j + 16 <= count; j += 16)
+			{
+				const float* p(points + j * stride);
+				__m512 acc(_mm512_setzero_ps());
+				for (int d = 0; d < dim; ++d)
+				{
+					const __m512 diff(_mm512_sub_ps(_mm512_mask_i32gather_ps(_mm512_setzero_ps(), __mmask16(0xFFFF), offsets, p + d, 4), _mm512_set1_ps(query[d])));
+					acc = _mm512_add_ps(acc, _mm512_mul_ps(diff, diff));
+				}
+				_mm512_storeu_ps(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Avx512(query, points + j * stride, dim);
+	}
+	
+	//! Compute squared distances from query to a tile of points, using AVX-512; low-dimensional points are gathered eight at a time, others processed one at a time
+	__attribute__((target("avx512f")))
+	static void tileDist2Avx512(const double* query, const double* points, const int dim, const int stride, const int count, double* dists2)
+	{
+		int j(0);
+		if (dim < 8)
+		{
+			const __m256i offsets(_mm256_setr_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride, 5 * stride, 6 * stride, 7 * stride));
+			for (; j + 8 <= count; j += 8)
+			{
+				const double* p(points + j * stride);
+				__m512d acc(_mm512_setzero_pd());
+				for (int d = 0; d < dim; ++d)
+				{
+					const __m512d diff(_mm512_sub_pd(_mm512_mask_i32gather_pd(_mm512_setzero_pd(), __mmask8(0xFF), offsets, p + d, 8), _mm512_set1_pd(query[d])));
+					acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+				}
+				_mm512_storeu_pd(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Avx512(query, points + j * stride, dim);
+	}
+	
+	//! Select values lower or equal to threshold, using AVX-512 compressed stores
+	__attribute__((target("avx512f")))
+	static int selectBelowAvx512(const float* values, const int count, const float threshold, int* selected)
+	{
+		const __m512 limit(_mm512_set1_ps(threshold));
+		const __m512i sixteen(_mm512_set1_epi32(16));
+		__m512i positions(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 16 <= count; j += 16)
+		{
+			const __mmask16 mask(_mm512_cmp_ps_mask(_mm512_loadu_ps(values + j), limit, _CMP_LE_OQ));
+			_mm512_mask_compressstoreu_epi32(selected + selectedCount, mask, positions);
+			selectedCount += __builtin_popcount(mask);
+			positions = _mm512_add_epi32(positions, sixteen);
+		}
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Select values lower or equal to threshold, using AVX-512
+	__attribute__((target("avx512f")))
+	static int selectBelowAvx512(const double* values, const int count, const double threshold, int* selected)
+	{
+		const __m512d limit(_mm512_set1_pd(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 8 <= count; j += 8)
+			selectedCount = appendMaskBits(_mm512_cmp_pd_mask(_mm512_loadu_pd(values + j), limit, _CMP_LE_OQ), j, selected, selectedCount);
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+#endif // NABO_DISTANCE_X86_KERNELS
+	
+#ifdef NABO_DISTANCE_NEON_KERNELS
+	
+	//! Return the squared distance between the dim coordinates at a and b, using NEON
+	static float dist2Neon(const float* a, const float* b, const int dim)
+	{
+		float32x4_t acc(vdupq_n_f32(0));
+		int d(0);
+		for (; d + 4 <= dim; d += 4)
+		{
+			const float32x4_t diff(vsubq_f32(vld1q_f32(a + d), vld1q_f32(b + d)));
+			acc = vaddq_f32(acc, vmulq_f32(diff, diff));
+		}
+		float dist(vaddvq_f32(acc));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Return the squared distance between the dim coordinates at a and b, using NEON
+	static double dist2Neon(const double* a, const double* b, const int dim)
+	{
+		float64x2_t acc(vdupq_n_f64(0));
+		int d(0);
+		for (; d + 2 <= dim; d += 2)
+		{
+			const float64x2_t diff(vsubq_f64(vld1q_f64(a + d), vld1q_f64(b + d)));
+			acc = vaddq_f64(acc, vmulq_f64(diff, diff));
+		}
+		double dist(vaddvq_f64(acc));
+		for (; d < dim; ++d)
+			dist += (a[d] - b[d]) * (a[d] - b[d]);
+		return dist;
+	}
+	
+	//! Compute squared distances from query to a tile of points, using NEON; low-dimensional points are processed four at a time, others one at a time
+	static void tileDist2Neon(const float* query, const float* points, const int dim, const int stride, const int count, float* dists2)
+	{
+		int j(0);
+		if (dim < 4)
+		{
+			for (; j + 4 <= count; j += 4)
+			{
+				const float* p(points + j * stride);
+				float32x4_t acc(vdupq_n_f32(0));
+				for (int d = 0; d < dim; ++d)
+				{
+					float32x4_t coords(vdupq_n_f32(p[d]));
+					coords = vsetq_lane_f32(p[stride + d], coords, 1);
+					coords = vsetq_lane_f32(p[2 * stride + d], coords, 2);
+					coords = vsetq_lane_f32(p[3 * stride + d], coords, 3);
+					const float32x4_t diff(vsubq_f32(coords, vdupq_n_f32(query[d])));
+					acc = vaddq_f32(acc, vmulq_f32(diff, diff));
+				}
+				vst1q_f32(dists2 + j, acc);
+			}
+		}
+		for (; j < count; ++j)
+			dists2[j] = dist2Neon(query, points + j * stride, dim);
+	}
+	
+	//! Compute squared distances from query to a tile of points, using NEON; points are processed one at a time
+	static void tileDist2Neon(const double* query, const double* points, const int dim, const int stride, const int count, double* dists2)
+	{
+		for (int j = 0; j < count; ++j)
+			dists2[j] = dist2Neon(query, points + j * stride, dim);
+	}
+	
+	//! Select values lower or equal to threshold, using NEON to skip groups of four values above it
+	static int selectBelowNeon(const float* values, const int count, const float threshold, int* selected)
+	{
+		const float32x4_t limit(vdupq_n_f32(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 4 <= count; j += 4)
+		{
+			if (vmaxvq_u32(vcleq_f32(vld1q_f32(values + j), limit)) == 0)
+				continue;
+			for (int l = j; l < j + 4; ++l)
+				if (values[l] <= threshold)
+					selected[selectedCount++] = l;
+		}
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+	//! Select values lower or equal to threshold, using NEON to skip pairs of values above it
+	static int selectBelowNeon(const double* values, const int count, const double threshold, int* selected)
+	{
+		const float64x2_t limit(vdupq_n_f64(threshold));
+		int selectedCount(0);
+		int j(0);
+		for (; j + 2 <= count; j += 2)
+		{
+			if (vmaxvq_u32(vreinterpretq_u32_u64(vcleq_f64(vld1q_f64(values + j), limit))) == 0)
+				continue;
+			for (int l = j; l < j + 2; ++l)
+				if (values[l] <= threshold)
+					selected[selectedCount++] = l;
+		}
+		for (; j < count; ++j)
+			if (values[j] <= threshold)
+				selected[selectedCount++] = j;
+		return selectedCount;
+	}
+	
+#endif // NABO_DISTANCE_NEON_KERNELS
+	
+	template<typename T>
+	DistanceKernels<T>::DistanceKernels(const CpuKernelSet kernelSet):
+		dist2(dist2Scalar<T>),
+		tileDist2(tileDist2Scalar<T>),
+		selectBelow(selectBelowScalar<T>),
+		kernelSet(CPU_KERNELS_SCALAR)
+	{
+		switch (kernelSet)
+		{
+#ifdef NABO_DISTANCE_X86_KERNELS
+			case CPU_KERNELS_SSE42:
+				dist2 = dist2Sse42;
+				tileDist2 = tileDist2Sse42;
+				selectBelow = selectBelowSse42;
+				break;
+				
+			case CPU_KERNELS_AVX2:
+				dist2 = dist2Avx2;
+				tileDist2 = tileDist2Avx2;
+				selectBelow = selectBelowAvx2;
+				break;
+				
+			case CPU_KERNELS_AVX512:
+				dist2 = dist2Avx512;
+				tileDist2 = tileDist2Avx512;
+				selectBelow = selectBelowAvx512;
+				break;
+#endif // NABO_DISTANCE_X86_KERNELS
+#ifdef NABO_DISTANCE_NEON_KERNELS
+			case CPU_KERNELS_NEON:
+				dist2 = dist2Neon;
+				tileDist2 = tileDist2Neon;
+				selectBelow = selectBelowNeon;
+				break;
+#endif // NABO_DISTANCE_NEON_KERNELS
+			default:
+				return;
+		}
+		this->kernelSet = kernelSet;
+	}
+	
+	template struct DistanceKernels<float>;
+	template struct DistanceKernels<double>;
+	
+	//@}
+}
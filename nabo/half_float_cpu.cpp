@@ -0,0 +1,223 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include <cstring>
+
+// x86 kernels need function-level target attributes and CPU feature detection
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8)))
+	#define NABO_HALF_FLOAT_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+/*!	\file half_float_cpu.cpp
+	\brief conversions between float and 16-bit floating-point formats, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	uint16_t floatToHalf(const float v)
+	{
+		uint32_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		const uint16_t sign((bits >> 16) & 0x8000);
+		const uint32_t absBits(bits & 0x7FFFFFFF);
+		// infinity and NaN
+		if (absBits >= 0x7F800000)
+			return sign | 0x7C00 | (absBits > 0x7F800000 ? 0x200 : 0);
+		// values rounding above the largest half, 65504
+		if (absBits >= 0x477FF000)
+			return sign | 0x7C00;
+		// normal halves, from 2^-14: rebias the exponent and round the mantissa, a carry correctly increments the exponent
+		if (absBits >= 0x38800000)
+			return sign | uint16_t((absBits + 0xFFF + ((absBits >> 13) & 1) - 0x38000000) >> 13);
+		// values rounding to 0, up to half of the smallest subnormal half, 2^-25
+		if (absBits <= 0x33000000)
+			return sign;
+		// subnormal halves, in units of 2^-24
+		const uint32_t exponent(absBits >> 23);
+		const uint32_t mantissa((absBits & 0x7FFFFF) | 0x800000);
+		const uint32_t shift(126 - exponent);
+		const uint32_t remainder(mantissa & ((1u << shift) - 1));
+		const uint32_t halfway(1u << (shift - 1));
+		uint32_t result(mantissa >> shift);
+		if (remainder > halfway || (remainder == halfway && (result & 1)))
+			++result;
+		return sign | uint16_t(result);
+	}
+	
+	uint16_t floatToBfloat16(const float v)
+	{
+		uint32_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		// keep NaN quiet, as rounding could turn it into infinity
+		if ((bits & 0x7FFFFFFF) > 0x7F800000)
+			return uint16_t((bits >> 16) | 0x40);
+		return uint16_t((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+	}
+	
+	//! Return the float value of half-precision value h, portable implementation
+	static inline float halfToFloat(const uint16_t h)
+	{
+		const uint32_t sign(uint32_t(h & 0x8000) << 16);
+		const uint32_t exponent((h >> 10) & 0x1F);
+		uint32_t mantissa(h & 0x3FF);
+		uint32_t bits;
+		if (exponent == 0x1F)
+			bits = sign | 0x7F800000 | (mantissa << 13);
+		else if (exponent != 0)
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else if (mantissa == 0)
+			bits = sign;
+		else
+		{
+			// subnormal half, normalize it
+			uint32_t floatExponent(113);
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				--floatExponent;
+			}
+			bits = sign | (floatExponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+		float v;
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+	
+	//! Return the float value of bfloat16 value h, portable implementation
+	static inline float bfloat16ToFloat(const uint16_t h)
+	{
+		const uint32_t bits(uint32_t(h) << 16);
+		float v;
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+	
+	//! Convert count half-precision values to float, portable implementation
+	static void halfToFloatScalar(const uint16_t* src, float* dst, const int count)
+	{
+		for (int i = 0; i < count; ++i)
+			dst[i] = halfToFloat(src[i]);
+	}
+	
+	//! Convert count bfloat16 values to float, portable implementation
+	static void bfloat16ToFloatScalar(const uint16_t* src, float* dst, const int count)
+	{
+		for (int i = 0; i < count; ++i)
+			dst[i] = bfloat16ToFloat(src[i]);
+	}
+	
+#ifdef NABO_HALF_FLOAT_X86_KERNELS
+	
+	//! Convert count half-precision values to float, using F16C
+	__attribute__((target("avx,f16c")))
+	static void halfToFloatF16c(const uint16_t* src, float* dst, const int count)
+	{
+		int i(0);
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+		for (; i < count; ++i)
+			dst[i] = halfToFloat(src[i]);
+	}
+	
+	//! Convert count bfloat16 values to float, using AVX2
+	__attribute__((target("avx2")))
+	static void bfloat16ToFloatAvx2(const uint16_t* src, float* dst, const int count)
+	{
+		int i(0);
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256i words(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+			_mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(words, 16)));
+		}
+		for (; i < count; ++i)
+			dst[i] = bfloat16ToFloat(src[i]);
+	}
+	
+	//! Convert count half-precision values to float, using AVX-512
+	__attribute__((target("avx512f")))
+	static void halfToFloatAvx512(const uint16_t* src, float* dst, const int count)
+	{
+		// masked forms with a zero source, as GCC reports the undefined source of the plain ones as uninitialized
+		int i(0);
+		for (; i + 16 <= count; i += 16)
+			_mm512_storeu_ps(dst + i, _mm512_mask_cvtph_ps(_mm512_setzero_ps(), __mmask16(0xFFFF), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+		for (; i < count; ++i)
+			dst[i] = halfToFloat(src[i]);
+	}
+	
+	//! Convert count bfloat16 values to float, using AVX-512
+	__attribute__((target("avx512f")))
+	static void bfloat16ToFloatAvx512(const uint16_t* src, float* dst, const int count)
+	{
+		int i(0);
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m512i words(_mm512_mask_cvtepu16_epi32(_mm512_setzero_si512(), __mmask16(0xFFFF), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+			_mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_mask_slli_epi32(_mm512_setzero_si512(), __mmask16(0xFFFF), words, 16)));
+		}
+		for (; i < count; ++i)
+			dst[i] = bfloat16ToFloat(src[i]);
+	}
+	
+#endif // NABO_HALF_FLOAT_X86_KERNELS
+	
+	HalfFloatKernels::HalfFloatKernels(const CpuKernelSet kernelSet):
+		halfToFloat(halfToFloatScalar),
+		bfloat16ToFloat(bfloat16ToFloatScalar),
+		name("scalar")
+	{
+#ifdef NABO_HALF_FLOAT_X86_KERNELS
+		__builtin_cpu_init();
+		if (kernelSet == CPU_KERNELS_AVX512)
+		{
+			halfToFloat = halfToFloatAvx512;
+			bfloat16ToFloat = bfloat16ToFloatAvx512;
+			name = "AVX-512";
+		}
+		else if (kernelSet == CPU_KERNELS_AVX2 && __builtin_cpu_supports("f16c"))
+		{
+			halfToFloat = halfToFloatF16c;
+			bfloat16ToFloat = bfloat16ToFloatAvx2;
+			name = "F16C and AVX2";
+		}
+#endif // NABO_HALF_FLOAT_X86_KERNELS
+	}
+	
+	//@}
+}
@@ -0,0 +1,451 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <boost/format.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+// x86 kernels need function-level target attributes and CPU feature detection
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8)))
+	#define NABO_HAMMING_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+/*!	\file hamming_cpu.cpp
+	\brief Hamming-distance search for binary descriptors, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	typedef BinaryNearestNeighbourSearch::Word Word;
+	typedef BinaryNearestNeighbourSearch::Index Index;
+	typedef BinaryNearestNeighbourSearch::Distance Distance;
+	
+	//! number of descriptors whose distances brute-force search computes at once, before updating the heap
+	const Index BINARY_BRUTE_FORCE_BLOCK_SIZE = 256;
+	
+	//! Return the number of bits set in w, portable implementation
+	inline Distance popCount64(Word w)
+	{
+		w = w - ((w >> 1) & Word(0x5555555555555555ULL));
+		w = (w & Word(0x3333333333333333ULL)) + ((w >> 2) & Word(0x3333333333333333ULL));
+		w = (w + (w >> 4)) & Word(0x0F0F0F0F0F0F0F0FULL);
+		return Distance((w * Word(0x0101010101010101ULL)) >> 56);
+	}
+	
+	//! Return the Hamming distance between d0 and d1, portable implementation
+	static Distance distanceScalar(const Word* d0, const Word* d1, const Index wordCount)
+	{
+		Distance dist(0);
+		for (Index w = 0; w < wordCount; ++w)
+			dist += popCount64(d0[w] ^ d1[w]);
+		return dist;
+	}
+	
+	//! Compute the Hamming distances between query and count descriptors, portable implementation
+	static void distancesScalar(const Word* query, const Word* data, const Index count, const Index wordCount, Distance* dists)
+	{
+		for (Index i = 0; i < count; ++i)
+			dists[i] = distanceScalar(query, data + i * wordCount, wordCount);
+	}
+	
+#ifdef NABO_HAMMING_X86_KERNELS
+	
+	//! Return the Hamming distance between d0 and d1, using the POPCNT instruction
+	__attribute__((target("popcnt")))
+	static Distance distancePopcnt(const Word* d0, const Word* d1, const Index wordCount)
+	{
+		Distance dist(0);
+		for (Index w = 0; w < wordCount; ++w)
+			dist += __builtin_popcountll(d0[w] ^ d1[w]);
+		return dist;
+	}
+	
+	//! Compute the Hamming distances between query and count descriptors, using the POPCNT instruction
+	__attribute__((target("popcnt")))
+	static void distancesPopcnt(const Word* query, const Word* data, const Index count, const Index wordCount, Distance* dists)
+	{
+		for (Index i = 0; i < count; ++i)
+		{
+			const Word* d(data + i * wordCount);
+			Distance dist(0);
+			for (Index w = 0; w < wordCount; ++w)
+				dist += __builtin_popcountll(query[w] ^ d[w]);
+			dists[i] = dist;
+		}
+	}
+	
+	//! Compute the Hamming distances between query and count descriptors, using AVX-512 VPOPCNTDQ
+	/** 256-bit descriptors are processed two per register, other sizes by chunks of 512 bits. */
+	__attribute__((target("avx512f,avx512vpopcntdq")))
+	static void distancesAvx512(const Word* query, const Word* data, const Index count, const Index wordCount, Distance* dists)
+	{
+		Word counts[8];
+		Index i(0);
+		if (wordCount == 4)
+		{
+			const __m512i q(_mm512_maskz_broadcast_i64x4(0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query))));
+			for (; i + 1 < count; i += 2)
+			{
+				const __m512i d(_mm512_loadu_si512(data + i * 4));
+				_mm512_storeu_si512(counts, _mm512_popcnt_epi64(_mm512_xor_si512(q, d)));
+				dists[i] = Distance(counts[0] + counts[1] + counts[2] + counts[3]);
+				dists[i + 1] = Distance(counts[4] + counts[5] + counts[6] + counts[7]);
+			}
+		}
+		for (; i < count; ++i)
+		{
+			const Word* d(data + i * wordCount);
+			__m512i acc(_mm512_setzero_si512());
+			for (Index w = 0; w < wordCount; w += 8)
+			{
+				const Index remaining(wordCount - w);
+				const __mmask8 mask(remaining >= 8 ? 0xFF : ((1u << remaining) - 1));
+				const __m512i x(_mm512_xor_si512(_mm512_maskz_loadu_epi64(mask, query + w), _mm512_maskz_loadu_epi64(mask, d + w)));
+				acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+			}
+			_mm512_storeu_si512(counts, acc);
+			dists[i] = Distance(counts[0] + counts[1] + counts[2] + counts[3] + counts[4] + counts[5] + counts[6] + counts[7]);
+		}
+	}
+	
+#endif // NABO_HAMMING_X86_KERNELS
+	
+	HammingKernels::HammingKernels():
+		distances(distancesScalar),
+		distance(distanceScalar),
+		name("scalar")
+	{
+#ifdef NABO_HAMMING_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("popcnt"))
+		{
+			distances = distancesPopcnt;
+			distance = distancePopcnt;
+			name = "POPCNT";
+		}
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+		{
+			distances = distancesAvx512;
+			name = "AVX-512 VPOPCNTDQ";
+		}
+#endif // NABO_HAMMING_X86_KERNELS
+	}
+	
+	BinaryBruteForceSearch::BinaryBruteForceSearch(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags):
+		BinaryNearestNeighbourSearch(descriptors, creationOptionFlags)
+	{
+	}
+	
+	unsigned long BinaryBruteForceSearch::knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const Index k, const unsigned optionFlags, const Distance maxDist) const
+	{
+		const DistanceVector maxDists(DistanceVector::Constant(query.cols(), maxDist));
+		return knn(query, indices, dists, maxDists, k, optionFlags);
+	}
+	
+	unsigned long BinaryBruteForceSearch::knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const DistanceVector& maxDists, const Index k, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists, k, optionFlags, &maxDists);
+		
+		const bool allowSelfMatch(optionFlags & ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & TOUCH_STATISTICS);
+		const int colCount(query.cols());
+		const Index descriptorCount(descriptors.cols());
+		
+#pragma omp parallel
+		{
+		
+		IndexHeapBruteForceVector<Index, Distance> heap(k);
+		vector<Distance> blockDists(BINARY_BRUTE_FORCE_BLOCK_SIZE);
+		
+#pragma omp for schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const Word* q(&query.coeff(0, i));
+			const Distance maxDist(maxDists[i]);
+			heap.reset();
+			for (Index first = 0; first < descriptorCount; first += BINARY_BRUTE_FORCE_BLOCK_SIZE)
+			{
+				const Index blockCount(min(BINARY_BRUTE_FORCE_BLOCK_SIZE, descriptorCount - first));
+				kernels.distances(q, &descriptors.coeff(0, first), blockCount, wordCount, &blockDists[0]);
+				for (Index j = 0; j < blockCount; ++j)
+				{
+					const Distance dist(blockDists[j]);
+					if ((dist <= maxDist) &&
+						(dist < heap.headValue()) &&
+						(allowSelfMatch || (dist > 0)))
+						heap.replaceHead(first + j, dist);
+				}
+			}
+			if (sortResults)
+				heap.sort();
+			heap.getData(indices.col(i), dists.col(i));
+		}
+		}
+		if (collectStatistics)
+			return (unsigned long)query.cols() * (unsigned long)descriptorCount;
+		else
+			return 0;
+	}
+	
+	//! search state of multi-index hashing, one per thread
+	struct BinaryMultiIndexHashing::SearchState
+	{
+		//! heap of nearest neighbours
+		IndexHeapBruteForceVector<Index, Distance> heap;
+		//! descriptors verified by the current query, sized to their number rather than to the descriptors
+		VisitedSet visited;
+		//! positions of the flipped bits, when enumerating the keys at a given radius
+		vector<int> flips;
+		
+		//! construct a state for k neighbours
+		SearchState(const Index k):
+			heap(k)
+		{}
+		
+		//! prepare for a new query
+		void reset()
+		{
+			heap.reset();
+			visited.clear();
+		}
+	};
+	
+	//! maximal ratio of the number of possible substring values to the number of descriptors for a table to be directly addressed
+	const int BINARY_MIH_DIRECT_TABLE_RATIO = 4;
+	
+	//! Pair of substring value and descriptor index, sorted by substring value
+	typedef pair<Word, Index> KeyIndex;
+	
+	BinaryMultiIndexHashing::BinaryMultiIndexHashing(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		BinaryNearestNeighbourSearch(descriptors, creationOptionFlags)
+	{
+		const int bitCount(wordCount * 64);
+		const Index descriptorCount(descriptors.cols());
+		const double log2Count(max(log(double(descriptorCount)) / log(2.), 1.));
+		const unsigned defaultSubstringCount(max(unsigned(floor(double(bitCount) / log2Count + 0.5)), unsigned((bitCount + 63) / 64)));
+		const unsigned substringCount(additionalParameters.get<unsigned>("substringCount", defaultSubstringCount));
+		if (substringCount == 0 || int(substringCount) > bitCount)
+			throw runtime_error((boost::format("Substring count (%1%) must be between 1 and the number of bits (%2%)") % substringCount % bitCount).str());
+		if ((bitCount + int(substringCount) - 1) / int(substringCount) > 64)
+			throw runtime_error((boost::format("Substring count (%1%) is too small, substrings would be longer than 64 bits") % substringCount).str());
+		
+		// split bits in substringCount substrings of almost equal lengths
+		tables.resize(substringCount);
+		int firstBit(0);
+		for (unsigned t = 0; t < substringCount; ++t)
+		{
+			tables[t].firstBit = firstBit;
+			tables[t].bitCount = bitCount / substringCount + (int(t) < bitCount % int(substringCount) ? 1 : 0);
+			firstBit += tables[t].bitCount;
+		}
+		minBitCount = tables.back().bitCount;
+		
+		// fill tables
+		const int tableCount(tables.size());
+#pragma omp parallel for schedule(dynamic)
+		for (int t = 0; t < tableCount; ++t)
+		{
+			Table& table(tables[t]);
+			vector<KeyIndex> entries;
+			entries.reserve(descriptorCount);
+			for (Index i = 0; i < descriptorCount; ++i)
+				entries.push_back(KeyIndex(substring(&descriptors.coeff(0, i), table), i));
+			sort(entries.begin(), entries.end());
+			table.indices.reserve(descriptorCount);
+			for (size_t i = 0; i < entries.size(); ++i)
+				table.indices.push_back(entries[i].second);
+			if (table.bitCount < 32 && (Word(1) << table.bitCount) <= Word(BINARY_MIH_DIRECT_TABLE_RATIO) * Word(descriptorCount))
+			{
+				// directly addressed: offsets[key] is the first entry with a value not smaller than key
+				const Word keyCount(Word(1) << table.bitCount);
+				table.offsets.resize(keyCount + 1);
+				size_t i(0);
+				for (Word key = 0; key <= keyCount; ++key)
+				{
+					while (i < entries.size() && entries[i].first < key)
+						++i;
+					table.offsets[key] = i;
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < entries.size(); ++i)
+				{
+					if (table.keys.empty() || table.keys.back() != entries[i].first)
+					{
+						table.keys.push_back(entries[i].first);
+						table.offsets.push_back(i);
+					}
+				}
+				table.offsets.push_back(entries.size());
+			}
+		}
+	}
+	
+	Word BinaryMultiIndexHashing::substring(const Word* d, const Table& t) const
+	{
+		const int word(t.firstBit / 64);
+		const int shift(t.firstBit % 64);
+		Word value(d[word] >> shift);
+		if (shift + t.bitCount > 64)
+			value |= d[word + 1] << (64 - shift);
+		if (t.bitCount < 64)
+			value &= (Word(1) << t.bitCount) - 1;
+		return value;
+	}
+	
+	unsigned long BinaryMultiIndexHashing::knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const Index k, const unsigned optionFlags, const Distance maxDist) const
+	{
+		const DistanceVector maxDists(DistanceVector::Constant(query.cols(), maxDist));
+		return knn(query, indices, dists, maxDists, k, optionFlags);
+	}
+	
+	unsigned long BinaryMultiIndexHashing::knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const DistanceVector& maxDists, const Index k, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists, k, optionFlags, &maxDists);
+		
+		const bool sortResults(optionFlags & SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & TOUCH_STATISTICS);
+		const int colCount(query.cols());
+		
+		unsigned long touchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		SearchState state(k);
+		
+#pragma omp for reduction(+:touchedCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			touchedCount += onePointKnn(&query.coeff(0, i), state, optionFlags, maxDists[i]);
+			if (sortResults)
+				state.heap.sort();
+			state.heap.getData(indices.col(i), dists.col(i));
+		}
+		}
+		if (collectStatistics)
+			return touchedCount;
+		else
+			return 0;
+	}
+	
+	unsigned long BinaryMultiIndexHashing::probe(const Word* query, const Table& table, const Word key, SearchState& state, const bool allowSelfMatch, const Distance maxDist) const
+	{
+		size_t keyIndex(key);
+		if (!table.keys.empty())
+		{
+			const vector<Word>::const_iterator it(lower_bound(table.keys.begin(), table.keys.end(), key));
+			if (it == table.keys.end() || *it != key)
+				return 0;
+			keyIndex = it - table.keys.begin();
+		}
+		unsigned long touchedCount(0);
+		for (uint32_t j = table.offsets[keyIndex]; j < table.offsets[keyIndex + 1]; ++j)
+		{
+			const Index index(table.indices[j]);
+			if (!state.visited.insert(index))
+				continue;
+			++touchedCount;
+			const Distance dist(kernels.distance(query, &descriptors.coeff(0, index), wordCount));
+			if ((dist <= maxDist) &&
+				(dist < state.heap.headValue()) &&
+				(allowSelfMatch || (dist > 0)))
+				state.heap.replaceHead(index, dist);
+		}
+		return touchedCount;
+	}
+	
+	unsigned long BinaryMultiIndexHashing::onePointKnn(const Word* query, SearchState& state, const unsigned optionFlags, const Distance maxDist) const
+	{
+		const bool allowSelfMatch(optionFlags & ALLOW_SELF_MATCH);
+		const Distance substringCount(tables.size());
+		unsigned long touchedCount(0);
+		state.reset();
+		
+		for (int radius = 0; ; ++radius)
+		{
+			// probe all keys at exactly radius bits from the query substring, in every table
+			for (size_t t = 0; t < tables.size(); ++t)
+			{
+				const Table& table(tables[t]);
+				if (radius > table.bitCount)
+					continue;
+				const Word key(substring(query, table));
+				vector<int>& flips(state.flips);
+				flips.resize(radius);
+				for (int f = 0; f < radius; ++f)
+					flips[f] = f;
+				while (true)
+				{
+					Word mask(0);
+					for (int f = 0; f < radius; ++f)
+						mask |= Word(1) << flips[f];
+					touchedCount += probe(query, table, key ^ mask, state, allowSelfMatch, maxDist);
+					// next combination of flipped bits
+					int f(radius - 1);
+					while (f >= 0 && flips[f] == table.bitCount - radius + f)
+						--f;
+					if (f < 0)
+						break;
+					++flips[f];
+					for (int g = f + 1; g < radius; ++g)
+						flips[g] = flips[g - 1] + 1;
+				}
+			}
+			
+			// every descriptor at distance < substringCount * (radius + 1) has been verified
+			const Distance verifiedBound(substringCount * (radius + 1));
+			if (radius >= minBitCount ||
+				state.heap.headValue() <= verifiedBound ||
+				maxDist < verifiedBound)
+				break;
+		}
+		return touchedCount;
+	}
+	
+	//@}
+}
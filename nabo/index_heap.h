@@ -45,6 +45,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace Nabo
 {
+	//! value of empty heap entries: infinity if VT has one (floating-point types), its maximal value otherwise (integer types)
+	template<typename VT>
+	inline VT heapInfinity()
+	{
+		return std::numeric_limits<VT>::has_infinity ? std::numeric_limits<VT>::infinity() : std::numeric_limits<VT>::max();
+	}
+	
 	//! balanced-tree implementation of heap
 	/** It uses a binary heap, which provides replacement in O(log(n)),
 	 * 	however the constant overhead is significative. */
@@ -83,7 +90,7 @@ namespace Nabo
 		//! Constructor
 		/*! \param size number of elements in the heap */
 		IndexHeapSTL(const size_t size):
-			data(1, Entry(0, std::numeric_limits<VT>::infinity())),
+			data(1, Entry(0, heapInfinity<VT>())),
 			nbNeighbours(size)
 		{
 			data.reserve(size);
@@ -93,7 +100,7 @@ namespace Nabo
 		inline void reset()
 		{
 			data.clear();
-			data.push_back(Entry(0, std::numeric_limits<VT>::infinity()));
+			data.push_back(Entry(0, heapInfinity<VT>()));
 		}
 		
 		//! get the largest value of the heap
@@ -144,7 +151,7 @@ namespace Nabo
 			for (; i < nbNeighbours; ++i)
 			{
 				const_cast<Eigen::MatrixBase<DI>&>(indices).coeffRef(i) = 0;
-				const_cast<Eigen::MatrixBase<DV>&>(values).coeffRef(i) = std::numeric_limits<VT>::infinity();
+				const_cast<Eigen::MatrixBase<DV>&>(values).coeffRef(i) = heapInfinity<VT>();
 			}
 		}
 		
@@ -202,7 +209,7 @@ namespace Nabo
 		//! Constructor
 		/*! \param size number of elements in the heap */
 		IndexHeapBruteForceVector(const size_t size):
-			data(size, Entry(0, std::numeric_limits<VT>::infinity())),
+			data(size, Entry(0, heapInfinity<VT>())),
 			headValueRef((data.end() - 1)->value),
 			sizeMinusOne(data.size() - 1)
 		{
@@ -213,7 +220,7 @@ namespace Nabo
 		{
 			for (typename Entries::iterator it(data.begin()); it != data.end(); ++it)
 			{
-				it->value = std::numeric_limits<VT>::infinity();
+				it->value = heapInfinity<VT>();
 				it->index = 0;
 			}
 		}
@@ -296,7 +303,7 @@ namespace Nabo
 		//! Constructor
 		/*! \param size number of elements in the heap */
 		IndexHeapBruteForceVector(const size_t size):
-		data(size, Entry(0, std::numeric_limits<VT>::infinity())),
+		data(size, Entry(0, heapInfinity<VT>())),
 		headValueRef((data.end() - 1)->value),
 		sizeMinusOne(data.size() - 1)
 		{
@@ -307,7 +314,7 @@ namespace Nabo
 		{
 			for (typename Entries::iterator it(data.begin()); it != data.end(); ++it)
 			{
-				it->value = std::numeric_limits<VT>::infinity();
+				it->value = heapInfinity<VT>();
 				it->index = 0;
 			}
 		}
@@ -0,0 +1,347 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <boost/format.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file integer_cpu.cpp
+	\brief nearest neighbour search for points with integer coordinates, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! largest squared distance, larger ones saturate to it; the maximum of the type marks empty entries
+	const boost::uint64_t INTEGER_SATURATED_DIST2(numeric_limits<boost::uint64_t>::max() - 1);
+	
+	//! Return the square of a difference of integer coordinates, exact as differences of 32-bit coordinates fit in 33 bits
+	inline boost::uint64_t integerDiff2(const boost::int64_t diff)
+	{
+		const boost::uint64_t absDiff(diff < 0 ? boost::uint64_t(-diff) : boost::uint64_t(diff));
+		return absDiff * absDiff;
+	}
+	
+	//! Return a + b, saturated to the maximum of the type instead of wrapping around
+	inline boost::uint64_t saturatedAdd(const boost::uint64_t a, const boost::uint64_t b)
+	{
+		const boost::uint64_t sum(a + b);
+		return sum < b ? numeric_limits<boost::uint64_t>::max() : sum;
+	}
+	
+	//! Return the squared distance between the dim integer coordinates at a and b, in unsigned 64 bits, saturated to INTEGER_SATURATED_DIST2
+	template<typename T>
+	inline boost::uint64_t integerDist2(const T* a, const T* b, const int dim)
+	{
+		boost::uint64_t dist(0);
+		for (int d = 0; d < dim; ++d)
+			dist = saturatedAdd(dist, integerDiff2(boost::int64_t(a[d]) - boost::int64_t(b[d])));
+		return min(dist, INTEGER_SATURATED_DIST2);
+	}
+	
+	//! Return the squared distance between the dim 16-bit coordinates at a and b; squares have at most 32 bits, so the sum cannot overflow
+	/** The loop has no dependency but the sum, so that compilers can vectorize it. */
+	template<>
+	inline boost::uint64_t integerDist2<boost::int16_t>(const boost::int16_t* a, const boost::int16_t* b, const int dim)
+	{
+		boost::uint64_t dist(0);
+		for (int d = 0; d < dim; ++d)
+		{
+			const boost::int64_t diff(boost::int64_t(a[d]) - boost::int64_t(b[d]));
+			dist += boost::uint64_t(diff * diff);
+		}
+		return dist;
+	}
+	
+	template<typename T>
+	IntegerBruteForceSearch<T>::IntegerBruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags):
+		IntegerNearestNeighbourSearch<T>(cloud, dim, creationOptionFlags)
+	{
+	}
+	
+	template<typename T>
+	unsigned long IntegerBruteForceSearch<T>::knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const Distance maxDist2) const
+	{
+		const DistanceVector maxDists2(DistanceVector::Constant(query.cols(), maxDist2));
+		return knn(query, indices, dists2, maxDists2, k, optionFlags);
+	}
+	
+	template<typename T>
+	unsigned long IntegerBruteForceSearch<T>::knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const DistanceVector& maxDists2, const Index k, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxDists2);
+		
+		const bool allowSelfMatch(optionFlags & IntegerNearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & IntegerNearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & IntegerNearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const int colCount(query.cols());
+		const Index pointCount(cloud.cols());
+		
+#pragma omp parallel
+		{
+		
+		IndexHeapBruteForceVector<Index, Distance> heap(k);
+		
+#pragma omp for schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const T* q(&query.coeff(0, i));
+			const Distance maxDist2(maxDists2[i]);
+			heap.reset();
+			for (Index j = 0; j < pointCount; ++j)
+			{
+				const Distance dist(integerDist2(q, &cloud.coeff(0, j), dim));
+				if ((dist <= maxDist2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > 0)))
+					heap.replaceHead(j, dist);
+			}
+			if (sortResults)
+				heap.sort();
+			heap.getData(indices.col(i), dists2.col(i));
+		}
+		}
+		if (collectStatistics)
+			return (unsigned long)query.cols() * (unsigned long)pointCount;
+		else
+			return 0;
+	}
+	
+	template struct IntegerBruteForceSearch<boost::int16_t>;
+	template struct IntegerBruteForceSearch<boost::int32_t>;
+	
+	template<typename T, typename Heap>
+	struct IntegerKDTree<T, Heap>::CompareDim
+	{
+		const Matrix& cloud; //!< data-point cloud
+		const Index dim; //!< dimension along which to compare
+		
+		//! constructor
+		CompareDim(const Matrix& cloud, const Index dim): cloud(cloud), dim(dim) {}
+		//! return whether point a is lower than point b along dim
+		bool operator()(const Index a, const Index b) const
+		{
+			return cloud.coeff(dim, a) < cloud.coeff(dim, b);
+		}
+	};
+	
+	template<typename T, typename Heap>
+	unsigned IntegerKDTree<T, Heap>::buildNodes(const BuildPointsIt first, const BuildPointsIt last)
+	{
+		const int count(last - first);
+		const unsigned pos(nodes.size());
+		
+		// find the dimension of largest spread
+		unsigned cutDim(0);
+		Distance maxSpread(0);
+		if (count > int(bucketSize))
+		{
+			for (int d = 0; d < dim; ++d)
+			{
+				T minVal(cloud.coeff(d, *first));
+				T maxVal(minVal);
+				for (BuildPointsIt it(first + 1); it != last; ++it)
+				{
+					minVal = min(minVal, cloud.coeff(d, *it));
+					maxVal = max(maxVal, cloud.coeff(d, *it));
+				}
+				const Distance spread(Distance(maxVal) - Distance(minVal));
+				if (spread > maxSpread)
+				{
+					maxSpread = spread;
+					cutDim = d;
+				}
+			}
+		}
+		
+		// small or degenerate sets of points become buckets
+		if (count <= int(bucketSize) || maxSpread == 0)
+		{
+			const uint32_t initBucketsSize(buckets.size());
+			for (BuildPointsIt it(first); it != last; ++it)
+				buckets.push_back(BucketEntry(&cloud.coeff(0, *it), *it));
+			nodes.push_back(Node(createDimChildBucketSize(dim, count), initBucketsSize));
+			return pos;
+		}
+		
+		// split at the median, left points are lower or equal and right points larger or equal to it
+		const BuildPointsIt middle(first + count / 2);
+		nth_element(first, middle, last, CompareDim(cloud, cutDim));
+		const T cutVal(cloud.coeff(cutDim, *middle));
+		nodes.push_back(Node(0, cutVal));
+		buildNodes(first, middle);
+		const unsigned rightChild(buildNodes(middle, last));
+		nodes[pos].dimChildBucketSize = createDimChildBucketSize(cutDim, rightChild);
+		return pos;
+	}
+	
+	template<typename T, typename Heap>
+	IntegerKDTree<T, Heap>::IntegerKDTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		IntegerNearestNeighbourSearch<T>(cloud, dim, creationOptionFlags),
+		bucketSize(additionalParameters.get<unsigned>("bucketSize", 8)),
+		dimBitCount(getStorageBitCount<uint32_t>(this->dim)),
+		dimMask((1<<dimBitCount)-1)
+	{
+		if (bucketSize < 2)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
+		const uint64_t maxCount((0x1ULL << (32-dimBitCount)) - 1);
+		if (uint64_t(cloud.cols()) > maxCount)
+			throw runtime_error((boost::format("Cloud has more points (%1%) than the kd-tree allows (%2%). The kd-tree has %3% bits for dimensions and %4% bits for node indices") % cloud.cols() % maxCount % dimBitCount % (32-dimBitCount)).str());
+		
+		BuildPoints buildPoints(cloud.cols());
+		for (int i = 0; i < cloud.cols(); ++i)
+			buildPoints[i] = i;
+		buckets.reserve(cloud.cols());
+		buildNodes(buildPoints.begin(), buildPoints.end());
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long IntegerKDTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const Distance maxDist2) const
+	{
+		const DistanceVector maxDists2(DistanceVector::Constant(query.cols(), maxDist2));
+		return knn(query, indices, dists2, maxDists2, k, optionFlags);
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long IntegerKDTree<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const DistanceVector& maxDists2, const Index k, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxDists2);
+		
+		const bool allowSelfMatch(optionFlags & IntegerNearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & IntegerNearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & IntegerNearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const int colCount(query.cols());
+		unsigned long leafTouchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		Heap heap(k);
+		std::vector<boost::int64_t> off(dim, 0);
+		
+#pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const T* q(&query.coeff(0, i));
+			const Distance maxDist2(maxDists2[i]);
+			fill(off.begin(), off.end(), 0);
+			heap.reset();
+			if (allowSelfMatch)
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnn<true, true>(q, 0, 0, heap, off, maxDist2);
+				else
+					recurseKnn<true, false>(q, 0, 0, heap, off, maxDist2);
+			}
+			else
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnn<false, true>(q, 0, 0, heap, off, maxDist2);
+				else
+					recurseKnn<false, false>(q, 0, 0, heap, off, maxDist2);
+			}
+			if (sortResults)
+				heap.sort();
+			heap.getData(indices.col(i), dists2.col(i));
+		}
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long IntegerKDTree<T, Heap>::recurseKnn(const T* query, const unsigned n, Distance rd, Heap& heap, std::vector<boost::int64_t>& off, const Distance maxDist2) const
+	{
+		const Node& node(nodes[n]);
+		const uint32_t cd(getDim(node.dimChildBucketSize));
+		
+		if (cd == uint32_t(dim))
+		{
+			const BucketEntry* bucket(&buckets[node.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			for (uint32_t i = 0; i < bucketSize; ++i)
+			{
+				const Distance dist(integerDist2(query, bucket->pt, dim));
+				if ((dist <= maxDist2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > 0))
+				)
+					heap.replaceHead(bucket->index, dist);
+				++bucket;
+			}
+			return (unsigned long)(bucketSize);
+		}
+		else
+		{
+			const unsigned rightChild(getChildBucketSize(node.dimChildBucketSize));
+			unsigned long leafVisitedCount(0);
+			boost::int64_t& offcd(off[cd]);
+			const boost::int64_t old_off(offcd);
+			const boost::int64_t new_off(boost::int64_t(query[cd]) - boost::int64_t(node.cutVal));
+			const unsigned nearChild(new_off > 0 ? rightChild : n + 1);
+			const unsigned farChild(new_off > 0 ? n + 1 : rightChild);
+			if (collectStatistics)
+				leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, nearChild, rd, heap, off, maxDist2);
+			else
+				recurseKnn<allowSelfMatch, false>(query, nearChild, rd, heap, off, maxDist2);
+			// the offset to the far cell is at least the one to the current cell, so rd only grows, saturating
+			const Distance oldOff2(integerDiff2(old_off));
+			const Distance newOff2(integerDiff2(new_off));
+			rd = newOff2 >= oldOff2 ? saturatedAdd(rd, newOff2 - oldOff2) : rd - (oldOff2 - newOff2);
+			if ((rd <= maxDist2) &&
+				(rd < heap.headValue()))
+			{
+				offcd = new_off;
+				if (collectStatistics)
+					leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, farChild, rd, heap, off, maxDist2);
+				else
+					recurseKnn<allowSelfMatch, false>(query, farChild, rd, heap, off, maxDist2);
+				offcd = old_off;
+			}
+			return leafVisitedCount;
+		}
+	}
+	
+	template struct IntegerKDTree<boost::int16_t,IndexHeapBruteForceVector<int,boost::uint64_t> >;
+	template struct IntegerKDTree<boost::int32_t,IndexHeapBruteForceVector<int,boost::uint64_t> >;
+	
+	//@}
+}
@@ -36,7 +36,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <limits>
 #include <queue>
 #include <algorithm>
+#include <functional>
 #include <utility>
+#include <cmath>
 #include <boost/numeric/conversion/bounds.hpp>
 #include <boost/limits.hpp>
 #include <boost/format.hpp>
@@ -56,42 +58,33 @@ namespace Nabo
 	
 	using namespace std;
 	
-	//! Return the number of bit required to store a value
-	/** \param v value to store
-	 * \return number of bits required
-	 */
+	//! Return the distance from v to [minValue..maxValue] in a domain of period size, infinity if not periodic
 	template<typename T>
-	T getStorageBitCount(T v)
+	inline T periodicOffset(const T v, const T minValue, const T maxValue, const T size)
 	{
-		for (T i = 0; i < 64; ++i)
-		{
-			if (v == 0)
-				return i;
-			v >>= 1;
-		}
-		return 64;
+		const bool periodic(size < numeric_limits<T>::infinity());
+		if (v < minValue)
+			return periodic ? min(minValue - v, v + size - maxValue) : minValue - v;
+		if (v > maxValue)
+			return periodic ? min(v - maxValue, minValue + size - v) : v - maxValue;
+		return 0;
 	}
 	
-	//! Return the index of the maximum value of a vector of positive values
-	/** \param v vector of positive values
-	 * \return index of maximum value, 0 if the vector is empty
-	 */
+	//! Return v wrapped into [0..size[
 	template<typename T>
-	size_t argMax(const typename NearestNeighbourSearch<T>::Vector& v)
+	inline T wrapIntoDomain(T v, const T size)
 	{
-		T maxVal(0);
-		size_t maxIdx(0);
-		for (int i = 0; i < v.size(); ++i)
-		{
-			if (v[i] > maxVal)
-			{
-				maxVal = v[i];
-				maxIdx = i;
-			}
-		}
-		return maxIdx;
+		v -= floor(v / size) * size;
+		return v < size ? v : 0;
 	}
 	
+	//! factor of the machine epsilon bounding the relative rounding errors of distances computed from compact leaf coordinates
+	const int LEAF_ROUNDING_MARGIN = 4;
+	//! number of dimensions from which leaves compute distances with the vectorized kernels, below it the inlined loop is faster
+	const int DISTANCE_KERNEL_MIN_DIM = 16;
+	//! average number of points in a leaf relative to the bucket size, for memory estimation; observed between 0.6 on scans and 0.75 on uniform clouds, the lower value overestimating rather than underestimating
+	const double KDTREE_LEAF_FILL_RATIO = 0.6;
+	
 	// OPT
 	template<typename T, typename Heap>
 	pair<T,T> KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::getBounds(const BuildPointsIt first, const BuildPointsIt last, const unsigned dim)
@@ -115,6 +108,10 @@ namespace Nabo
 		const int count(last - first);
 		assert(count >= 1);
 		const unsigned pos(nodes.size());
+		const bool timePhases(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const double startTime(timePhases ? getWallTime() : 0);
+		const size_t oldNodesCapacity(nodes.capacity());
+		const size_t oldBucketsCapacity(buckets.capacity());
 		
 		//cerr << count << endl;
 		if (count <= int(bucketSize))
@@ -130,6 +127,9 @@ namespace Nabo
 			}
 			//cerr << "at address " << bucketStart << endl;
 			nodes.push_back(Node(createDimChildBucketSize(dim, count),initBucketsSize));
+			updatePeakBuildMemory(oldNodesCapacity, oldBucketsCapacity);
+			if (timePhases)
+				this->buildStatistics.nodeEmissionDuration += getWallTime() - startTime;
 			return pos;
 		}
 		
@@ -215,7 +215,14 @@ namespace Nabo
 		rightMinValues[cutDim] = cutVal;
 		
 		// add this
+		const double partitionEndTime(timePhases ? getWallTime() : 0);
 		nodes.push_back(Node(0, cutVal));
+		updatePeakBuildMemory(oldNodesCapacity, oldBucketsCapacity);
+		if (timePhases)
+		{
+			this->buildStatistics.partitionDuration += partitionEndTime - startTime;
+			this->buildStatistics.nodeEmissionDuration += getWallTime() - partitionEndTime;
+		}
 		
 		// recurse
 		const unsigned _UNUSED leftChild = buildNodes(first, first + leftCount, minValues, leftMaxValues);
@@ -228,49 +235,193 @@ namespace Nabo
 	}
 
 	template<typename T, typename Heap>
-	KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+	void KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::updatePeakBuildMemory(const size_t oldNodesCapacity, const size_t oldBucketsCapacity)
+	{
+		size_t memory(buildPointsMemory + nodes.capacity() * sizeof(Node) + buckets.capacity() * sizeof(BucketEntry));
+		// while a vector grows, its old and new storage coexist
+		if (nodes.capacity() != oldNodesCapacity)
+			memory += oldNodesCapacity * sizeof(Node);
+		if (buckets.capacity() != oldBucketsCapacity)
+			memory += oldBucketsCapacity * sizeof(BucketEntry);
+		this->buildStatistics.peakBuildMemory = max(this->buildStatistics.peakBuildMemory, memory);
+	}
+	
+	template<typename T, typename Heap>
+	void KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::buildLeafStorage()
+	{
+		leafCoordinates.resize(buckets.size() * dim);
+		leafErrors.resize(buckets.size());
+		const HalfFloatKernels::ToFloatFunction toFloat(leafStorage == LEAF_STORAGE_HALF ? leafKernels.halfToFloat : leafKernels.bfloat16ToFloat);
+		std::vector<float> decoded(dim);
+		for (size_t n = 0; n < nodes.size(); ++n)
+		{
+			const Node& node(nodes[n]);
+			if (getDim(node.dimChildBucketSize) != uint32_t(dim))
+				continue;
+			// coordinates are relative to the first point of the bucket, which the search reads in full precision
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			const T* origin(buckets[node.bucketIndex].pt);
+			for (uint32_t i = 0; i < bucketSize; ++i)
+			{
+				const uint32_t entry(node.bucketIndex + i);
+				const T* pt(buckets[entry].pt);
+				uint16_t* coordinates(&leafCoordinates[entry * dim]);
+				for (int d = 0; d < dim; ++d)
+				{
+					const float v(pt[d] - origin[d]);
+					coordinates[d] = (leafStorage == LEAF_STORAGE_HALF) ? floatToHalf(v) : floatToBfloat16(v);
+				}
+				toFloat(coordinates, &decoded[0], dim);
+				T error2(0);
+				T magnitude(0);
+				for (int d = 0; d < dim; ++d)
+				{
+					const T diff((pt[d] - origin[d]) - T(decoded[d]));
+					error2 += diff * diff;
+					magnitude += fabs(T(decoded[d]));
+				}
+				// add the rounding errors of the search due to these coordinates, and round up as the error is stored in float
+				const T error(sqrt(error2) + LEAF_ROUNDING_MARGIN * numeric_limits<T>::epsilon() * magnitude);
+				leafErrors[entry] = float(error) * (1 + 4 * numeric_limits<float>::epsilon());
+			}
+		}
+	}
+	
+	template<typename T, typename Heap>
+	KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters, const Index pointCount):
 		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
 		bucketSize(additionalParameters.get<unsigned>("bucketSize", 8)),
+		leafStorage(additionalParameters.get<unsigned>("leafStorage", LEAF_STORAGE_FULL)),
+		leafKernels(selectCpuKernelSet(additionalParameters)),
+		distanceKernels(selectCpuKernelSet(additionalParameters)),
 		dimBitCount(getStorageBitCount<uint32_t>(this->dim)),
-		dimMask((1<<dimBitCount)-1)
+		dimMask((1<<dimBitCount)-1),
+		buildPointsMemory(0)
 	{
+		const double startTime(getWallTime());
+		const Index indexedCount(pointCount < 0 ? Index(cloud.cols()) : min(pointCount, Index(cloud.cols())));
 		if (bucketSize < 2)
 			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
-		if (cloud.cols() <= bucketSize)
+		if (leafStorage >= LEAF_STORAGE_COUNT)
+			throw runtime_error((boost::format("Requested leaf storage %1%, but must be smaller than %2%") % leafStorage % LEAF_STORAGE_COUNT).str());
+		const Vector periodicBox(additionalParameters.get<Vector>("periodicBox", Vector()));
+		if (periodicBox.size() != 0)
 		{
-			// make a single-bucket tree
-			for (int i = 0; i < cloud.cols(); ++i)
-				buckets.push_back(BucketEntry(&cloud.coeff(0, i), i));
-			nodes.push_back(Node(createDimChildBucketSize(this->dim, cloud.cols()),uint32_t(0)));
-			return;
+			if (leafStorage != LEAF_STORAGE_FULL)
+				throw runtime_error("Compact leaf storage is not supported in periodic domains");
+			if (periodicBox.size() != this->dim)
+				throw runtime_error((boost::format("Periodic box has %1% sizes, but the kd-tree has %2% dimensions") % periodicBox.size() % this->dim).str());
+			periodicSizes.resize(this->dim);
+			for (int d = 0; d < this->dim; ++d)
+			{
+				if (!(periodicBox[d] >= 0))
+					throw runtime_error((boost::format("Periodic box has a negative size (%1%) along dimension %2%") % periodicBox[d] % d).str());
+				if (periodicBox[d] == 0)
+				{
+					periodicSizes[d] = numeric_limits<T>::infinity();
+					continue;
+				}
+				periodicSizes[d] = periodicBox[d];
+				for (int i = 0; i < indexedCount; ++i)
+				{
+					const T v(cloud.coeff(d, i));
+					if (!(v >= 0 && v < periodicBox[d]))
+						throw runtime_error((boost::format("Point %1% has coordinate %2% outside of the periodic domain [0, %3%[ along dimension %4%") % i % v % periodicBox[d] % d).str());
+				}
+			}
 		}
-		
-		const uint64_t maxNodeCount((0x1ULL << (32-dimBitCount)) - 1);
-		const uint64_t estimatedNodeCount(cloud.cols() / (bucketSize / 2));
-		if (estimatedNodeCount > maxNodeCount)
+		if (indexedCount <= Index(bucketSize))
 		{
-			throw runtime_error((boost::format("Cloud has a risk to have more nodes (%1%) than the kd-tree allows (%2%). The kd-tree has %3% bits for dimensions and %4% bits for node indices") % estimatedNodeCount % maxNodeCount % dimBitCount % (32-dimBitCount)).str());
+			// make a single-bucket tree
+			for (int i = 0; i < indexedCount; ++i)
+				buckets.push_back(BucketEntry(&cloud.coeff(0, i), i));
+			nodes.push_back(Node(createDimChildBucketSize(this->dim, indexedCount),uint32_t(0)));
+			updatePeakBuildMemory(0, 0);
 		}
-		
-		// build point vector and compute bounds
-		BuildPoints buildPoints;
-		buildPoints.reserve(cloud.cols());
-		for (int i = 0; i < cloud.cols(); ++i)
+		else
 		{
-			const Vector& v(cloud.block(0,i,this->dim,1));
-			buildPoints.push_back(i);
+			const uint64_t maxNodeCount((0x1ULL << (32-dimBitCount)) - 1);
+			const uint64_t estimatedNodeCount(indexedCount / (bucketSize / 2));
+			if (estimatedNodeCount > maxNodeCount)
+			{
+				throw runtime_error((boost::format("Cloud has a risk to have more nodes (%1%) than the kd-tree allows (%2%). The kd-tree has %3% bits for dimensions and %4% bits for node indices") % estimatedNodeCount % maxNodeCount % dimBitCount % (32-dimBitCount)).str());
+			}
+			
+			// build point vector and compute bounds
+			BuildPoints buildPoints;
+			buildPoints.reserve(indexedCount);
+			for (int i = 0; i < indexedCount; ++i)
+			{
+				const Vector& v(cloud.block(0,i,this->dim,1));
+				buildPoints.push_back(i);
 #ifdef EIGEN3_API
-			const_cast<Vector&>(minBound) = minBound.array().min(v.array());
-			const_cast<Vector&>(maxBound) = maxBound.array().max(v.array());
+				const_cast<Vector&>(minBound) = minBound.array().min(v.array());
+				const_cast<Vector&>(maxBound) = maxBound.array().max(v.array());
 #else // EIGEN3_API
-			const_cast<Vector&>(minBound) = minBound.cwise().min(v);
-			const_cast<Vector&>(maxBound) = maxBound.cwise().max(v);
+				const_cast<Vector&>(minBound) = minBound.cwise().min(v);
+				const_cast<Vector&>(maxBound) = maxBound.cwise().max(v);
 #endif // EIGEN3_API
+			}
+			buildPointsMemory = buildPoints.capacity() * sizeof(Index);
+			// every point ends in exactly one bucket
+			buckets.reserve(indexedCount);
+			updatePeakBuildMemory(0, 0);
+			const double boundsEndTime(getWallTime());
+			this->buildStatistics.boundsDuration = boundsEndTime - startTime;
+			
+			// create nodes
+			buildNodes(buildPoints.begin(), buildPoints.end(), minBound, maxBound);
+			
+			// nodes grew by doubling, release their unused capacity
+			if (nodes.capacity() > nodes.size())
+			{
+				Nodes shrunkNodes(nodes);
+				this->buildStatistics.peakBuildMemory = max(this->buildStatistics.peakBuildMemory, buildPointsMemory + (nodes.capacity() + shrunkNodes.capacity()) * sizeof(Node) + buckets.capacity() * sizeof(BucketEntry));
+				nodes.swap(shrunkNodes);
+			}
+			this->buildStatistics.treeDuration = getWallTime() - boundsEndTime;
+			buildPointsMemory = 0;
+		}
+		
+		if (leafStorage != LEAF_STORAGE_FULL)
+		{
+			const double reorderingStartTime(getWallTime());
+			buildLeafStorage();
+			this->buildStatistics.reorderingDuration = getWallTime() - reorderingStartTime;
 		}
 		
-		// create nodes
-		buildNodes(buildPoints.begin(), buildPoints.end(), minBound, maxBound);
-		buildPoints.clear();
+		const size_t leafStorageMemory(leafCoordinates.capacity() * sizeof(uint16_t) + leafErrors.capacity() * sizeof(float));
+		this->buildStatistics.memory = memoryUsage();
+		// leaf storage is built while nodes and buckets exist, together with a vector of dim floats
+		this->buildStatistics.peakBuildMemory = max(this->buildStatistics.peakBuildMemory, this->buildStatistics.memory + (leafStorageMemory != 0 ? dim * sizeof(float) : 0));
+		this->buildStatistics.totalDuration = getWallTime() - startTime;
+	}
+	
+	template<typename T, typename Heap>
+	size_t KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::memoryUsage() const
+	{
+		return nodes.capacity() * sizeof(Node) + buckets.capacity() * sizeof(BucketEntry) + leafCoordinates.capacity() * sizeof(uint16_t) + leafErrors.capacity() * sizeof(float) + periodicSizes.size() * sizeof(T);
+	}
+	
+	template<typename T, typename Heap>
+	typename NearestNeighbourSearch<T>::MemoryEstimate KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters)
+	{
+		const unsigned bucketSize(additionalParameters.get<unsigned>("bucketSize", 8));
+		const unsigned leafStorage(additionalParameters.get<unsigned>("leafStorage", LEAF_STORAGE_FULL));
+		const Vector periodicBox(additionalParameters.get<Vector>("periodicBox", Vector()));
+		if (bucketSize < 2)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
+		if (leafStorage >= LEAF_STORAGE_COUNT)
+			throw runtime_error((boost::format("Requested leaf storage %1%, but must be smaller than %2%") % leafStorage % LEAF_STORAGE_COUNT).str());
+		
+		// every split creates one leaf, and leaves are on average partially filled
+		const size_t leafCount(pointCount <= Index(bucketSize) ? 1 : size_t(ceil(double(pointCount) / (KDTREE_LEAF_FILL_RATIO * bucketSize))));
+		typename NearestNeighbourSearch<T>::MemoryEstimate estimate;
+		estimate.nodes = (2 * leafCount - 1) * sizeof(Node) + periodicBox.size() * sizeof(T);
+		estimate.buckets = size_t(pointCount) * sizeof(BucketEntry);
+		if (leafStorage != LEAF_STORAGE_FULL)
+			estimate.points = size_t(pointCount) * (size_t(dim) * sizeof(uint16_t) + sizeof(float));
+		return estimate;
 	}
 	
 	template<typename T, typename Heap>
@@ -295,11 +446,13 @@ namespace Nabo
 
 		Heap heap(k);
 		std::vector<T> off(dim, 0);
+		std::vector<T> periodicState(periodicSizes.size() * 3);
+		std::vector<float> leafBuffer(leafCoordinates.empty() ? 0 : bucketSize * dim);
 
 #pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
 		for (int i = 0; i < colCount; ++i)
 		{
-			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, periodicState, leafBuffer, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
 		}
 		}
 		return leafTouchedCount;
@@ -325,26 +478,82 @@ namespace Nabo
 
 		Heap heap(k);
 		std::vector<T> off(dim, 0);
+		std::vector<T> periodicState(periodicSizes.size() * 3);
+		std::vector<float> leafBuffer(leafCoordinates.empty() ? 0 : bucketSize * dim);
 		
 #pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
 		for (int i = 0; i < colCount; ++i)
 		{
 			const T maxRadius(maxRadii[i]);
 			const T maxRadius2(maxRadius * maxRadius);
-			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, periodicState, leafBuffer, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
 		}
 		}
 		return leafTouchedCount;
 	}
 	
 	template<typename T, typename Heap>
-	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, std::vector<T>& off, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const
+	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, std::vector<T>& off, std::vector<T>& periodicState, std::vector<float>& leafBuffer, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const
 	{
 		fill(off.begin(), off.end(), 0);
 		heap.reset();
 		unsigned long leafTouchedCount(0);
 		
-		if (allowSelfMatch)
+		if (periodicSizes.size() != 0)
+		{
+			// wrap the query into the domain, start from the whole domain as cell
+			T* wrappedQuery(&periodicState[0]);
+			T* minValues(&periodicState[dim]);
+			T* maxValues(&periodicState[2*dim]);
+			for (int d = 0; d < dim; ++d)
+			{
+				const T size(periodicSizes[d]);
+				if (size < numeric_limits<T>::infinity())
+				{
+					wrappedQuery[d] = wrapIntoDomain(query.coeff(d, i), size);
+					minValues[d] = 0;
+					maxValues[d] = size;
+				}
+				else
+				{
+					wrappedQuery[d] = query.coeff(d, i);
+					minValues[d] = -numeric_limits<T>::infinity();
+					maxValues[d] = numeric_limits<T>::infinity();
+				}
+			}
+			if (allowSelfMatch)
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnnPeriodic<true, true>(wrappedQuery, 0, 0, heap, off, minValues, maxValues, maxError2, maxRadius2);
+				else
+					recurseKnnPeriodic<true, false>(wrappedQuery, 0, 0, heap, off, minValues, maxValues, maxError2, maxRadius2);
+			}
+			else
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnnPeriodic<false, true>(wrappedQuery, 0, 0, heap, off, minValues, maxValues, maxError2, maxRadius2);
+				else
+					recurseKnnPeriodic<false, false>(wrappedQuery, 0, 0, heap, off, minValues, maxValues, maxError2, maxRadius2);
+			}
+		}
+		else if (!leafCoordinates.empty())
+		{
+			if (allowSelfMatch)
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnnCompact<true, true>(&query.coeff(0, i), 0, 0, heap, off, leafBuffer, maxError2, maxRadius2);
+				else
+					recurseKnnCompact<true, false>(&query.coeff(0, i), 0, 0, heap, off, leafBuffer, maxError2, maxRadius2);
+			}
+			else
+			{
+				if (collectStatistics)
+					leafTouchedCount += recurseKnnCompact<false, true>(&query.coeff(0, i), 0, 0, heap, off, leafBuffer, maxError2, maxRadius2);
+				else
+					recurseKnnCompact<false, false>(&query.coeff(0, i), 0, 0, heap, off, leafBuffer, maxError2, maxRadius2);
+			}
+		}
+		else if (allowSelfMatch)
 		{
 			if (collectStatistics)
 				leafTouchedCount += recurseKnn<true, true>(&query.coeff(0, i), 0, 0, heap, off, maxError2, maxRadius2);
@@ -383,13 +592,18 @@ namespace Nabo
 				//const T dist(dist2<T>(query, cloud.col(index)));
 				//const T dist((query - cloud.col(index)).squaredNorm());
 				T dist(0);
-				const T* qPtr(query);
-				const T* dPtr(bucket->pt);
-				for (int i = 0; i < this->dim; ++i)
+				if (this->dim >= DISTANCE_KERNEL_MIN_DIM)
+					dist = distanceKernels.dist2(query, bucket->pt, this->dim);
+				else
 				{
-					const T diff(*qPtr - *dPtr);
-					dist += diff*diff;
-					qPtr++; dPtr++;
+					const T* qPtr(query);
+					const T* dPtr(bucket->pt);
+					for (int i = 0; i < this->dim; ++i)
+					{
+						const T diff(*qPtr - *dPtr);
+						dist += diff*diff;
+						qPtr++; dPtr++;
+					}
 				}
 				if ((dist <= maxRadius2) &&
 					(dist < heap.headValue()) &&
@@ -448,6 +662,752 @@ namespace Nabo
 		}
 	}
 	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::recurseKnnCompact(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, std::vector<float>& leafBuffer, const T maxError2, const T maxRadius2) const
+	{
+		const Node& node(nodes[n]);
+		const uint32_t cd(getDim(node.dimChildBucketSize));
+		
+		if (cd == uint32_t(dim))
+		{
+			// decode the bucket, its coordinates are relative to its first point
+			const BucketEntry* bucket(&buckets[node.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			const T* origin(bucket->pt);
+			const float* decoded(&leafBuffer[0]);
+			const float* errors(&leafErrors[node.bucketIndex]);
+			(leafStorage == LEAF_STORAGE_HALF ? leafKernels.halfToFloat : leafKernels.bfloat16ToFloat)(&leafCoordinates[node.bucketIndex * dim], &leafBuffer[0], bucketSize * dim);
+			
+			// a point is discarded if its distance from the compact coordinates exceeds the current radius by more than
+			// its error, which includes the rounding errors due to its coordinates, plus those due to the query
+			const T roundingMargin(LEAF_ROUNDING_MARGIN * numeric_limits<T>::epsilon());
+			T queryError(0);
+			for (int d = 0; d < this->dim; ++d)
+				queryError += fabs(query[d] - origin[d]);
+			queryError *= roundingMargin;
+			const T radiusFactor((1 + roundingMargin) / (1 - roundingMargin * this->dim));
+			T radius(sqrt(min(heap.headValue(), maxRadius2)) * radiusFactor);
+			for (uint32_t i = 0; i < bucketSize; ++i)
+			{
+				T approxDist(0);
+				for (int d = 0; d < this->dim; ++d)
+				{
+					const T diff((query[d] - origin[d]) - T(*decoded));
+					approxDist += diff*diff;
+					++decoded;
+				}
+				const T discardRadius(radius + T(errors[i]) + queryError);
+				if (approxDist > discardRadius * discardRadius)
+				{
+					++bucket;
+					continue;
+				}
+				
+				// compare in full precision, the same way as without compact storage
+				T dist(0);
+				if (this->dim >= DISTANCE_KERNEL_MIN_DIM)
+					dist = distanceKernels.dist2(query, bucket->pt, this->dim);
+				else
+				{
+					const T* qPtr(query);
+					const T* dPtr(bucket->pt);
+					for (int d = 0; d < this->dim; ++d)
+					{
+						const T diff(*qPtr - *dPtr);
+						dist += diff*diff;
+						qPtr++; dPtr++;
+					}
+				}
+				if ((dist <= maxRadius2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > numeric_limits<T>::epsilon()))
+				)
+				{
+					heap.replaceHead(bucket->index, dist);
+					radius = sqrt(min(heap.headValue(), maxRadius2)) * radiusFactor;
+				}
+				++bucket;
+			}
+			return (unsigned long)(bucketSize);
+		}
+		else
+		{
+			const unsigned rightChild(getChildBucketSize(node.dimChildBucketSize));
+			unsigned long leafVisitedCount(0);
+			T& offcd(off[cd]);
+			//const T old_off(off.coeff(cd));
+			const T old_off(offcd);
+			const T new_off(query[cd] - node.cutVal);
+			if (new_off > 0)
+			{
+				if (collectStatistics)
+					leafVisitedCount += recurseKnnCompact<allowSelfMatch, true>(query, rightChild, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+				else
+					recurseKnnCompact<allowSelfMatch, false>(query, rightChild, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+				rd += - old_off*old_off + new_off*new_off;
+				if ((rd <= maxRadius2) &&
+					(rd * maxError2 < heap.headValue()))
+				{
+					offcd = new_off;
+					if (collectStatistics)
+						leafVisitedCount += recurseKnnCompact<allowSelfMatch, true>(query, n + 1, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+					else
+						recurseKnnCompact<allowSelfMatch, false>(query, n + 1, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+					offcd = old_off;
+				}
+			}
+			else
+			{
+				if (collectStatistics)
+					leafVisitedCount += recurseKnnCompact<allowSelfMatch, true>(query, n+1, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+				else
+					recurseKnnCompact<allowSelfMatch, false>(query, n+1, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+				rd += - old_off*old_off + new_off*new_off;
+				if ((rd <= maxRadius2) &&
+					(rd * maxError2 < heap.headValue()))
+				{
+					offcd = new_off;
+					if (collectStatistics)
+						leafVisitedCount += recurseKnnCompact<allowSelfMatch, true>(query, rightChild, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+					else
+						recurseKnnCompact<allowSelfMatch, false>(query, rightChild, rd, heap, off, leafBuffer, maxError2, maxRadius2);
+					offcd = old_off;
+				}
+			}
+			return leafVisitedCount;
+		}
+	}
+	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::recurseKnnPeriodic(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, T* minValues, T* maxValues, const T maxError2, const T maxRadius2) const
+	{
+		const Node& node(nodes[n]);
+		const uint32_t cd(getDim(node.dimChildBucketSize));
+		
+		if (cd == uint32_t(dim))
+		{
+			const BucketEntry* bucket(&buckets[node.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			const T* sizes(&periodicSizes.coeff(0));
+			for (uint32_t i = 0; i < bucketSize; ++i)
+			{
+				T dist(0);
+				const T* dPtr(bucket->pt);
+				for (int d = 0; d < this->dim; ++d)
+				{
+					// both coordinates are in the domain, so the shortest difference is either the direct or the wrapped one
+					T diff(fabs(query[d] - dPtr[d]));
+					diff = min(diff, sizes[d] - diff);
+					dist += diff*diff;
+				}
+				if ((dist <= maxRadius2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > numeric_limits<T>::epsilon()))
+				)
+					heap.replaceHead(bucket->index, dist);
+				++bucket;
+			}
+			return (unsigned long)(bucketSize);
+		}
+		else
+		{
+			const unsigned rightChild(getChildBucketSize(node.dimChildBucketSize));
+			const T size(periodicSizes[cd]);
+			T& offcd(off[cd]);
+			T& minValue(minValues[cd]);
+			T& maxValue(maxValues[cd]);
+			const T old_off(offcd);
+			const T old_min(minValue);
+			const T old_max(maxValue);
+			const T leftOff(periodicOffset(query[cd], old_min, node.cutVal, size));
+			const T rightOff(periodicOffset(query[cd], node.cutVal, old_max, size));
+			const bool leftFirst(leftOff <= rightOff);
+			unsigned long leafVisitedCount(0);
+			for (int c = 0; c < 2; ++c)
+			{
+				const bool left(leftFirst == (c == 0));
+				const T new_off(left ? leftOff : rightOff);
+				const T childRd(rd - old_off*old_off + new_off*new_off);
+				if ((childRd <= maxRadius2) &&
+					(childRd * maxError2 < heap.headValue()))
+				{
+					offcd = new_off;
+					if (left)
+						maxValue = node.cutVal;
+					else
+						minValue = node.cutVal;
+					if (collectStatistics)
+						leafVisitedCount += recurseKnnPeriodic<allowSelfMatch, true>(query, left ? n + 1 : rightChild, childRd, heap, off, minValues, maxValues, maxError2, maxRadius2);
+					else
+						recurseKnnPeriodic<allowSelfMatch, false>(query, left ? n + 1 : rightChild, childRd, heap, off, minValues, maxValues, maxError2, maxRadius2);
+					minValue = old_min;
+					maxValue = old_max;
+					offcd = old_off;
+				}
+			}
+			return leafVisitedCount;
+		}
+	}
+	
+	template<typename T, typename Heap>
+	struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::IncrementalCursor: public NearestNeighbourSearch<T>::Cursor
+	{
+		typedef KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap> Tree;
+		
+		//! node or point in the priority queue
+		struct Entry
+		{
+			T dist2; //!< squared distance from the query to the cell of the node, or to the point
+			Index id; //!< index of the node, or of the point
+			int cell; //!< for nodes, index of the bounds of their cell in cells; -1 for points
+			
+			//! Construct an entry
+			Entry(const T dist2, const Index id, const int cell): dist2(dist2), id(id), cell(cell) {}
+			//! return true if e0 is farther than e1
+			friend bool operator>(const Entry& e0, const Entry& e1) { return e0.dist2 > e1.dist2; }
+		};
+		
+		const Tree& tree; //!< tree to browse
+		const bool allowSelfMatch; //!< whether to yield points at distance 0
+		const T maxRadius2; //!< square of maximum radius
+		std::vector<T> sizes; //!< size of the domain along every dimension, infinity if not periodic
+		std::vector<T> query; //!< query, wrapped into the domain
+		std::vector<T> cells; //!< lower then upper bounds of cells, 2 x dim values per cell
+		std::vector<int> freeCells; //!< cells available for reuse
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue; //!< nodes and points to browse, closest first
+		
+		//! Create a cursor for query, with the root cell covering the whole domain
+		IncrementalCursor(const Tree& tree, const Vector& query, const bool allowSelfMatch, const T maxRadius):
+			tree(tree),
+			allowSelfMatch(allowSelfMatch),
+			maxRadius2(maxRadius * maxRadius),
+			sizes(tree.dim, numeric_limits<T>::infinity()),
+			query(tree.dim),
+			cells(2 * tree.dim)
+		{
+			const int dim(tree.dim);
+			for (int d = 0; d < dim; ++d)
+			{
+				if (tree.periodicSizes.size() != 0)
+					sizes[d] = tree.periodicSizes[d];
+				if (sizes[d] < numeric_limits<T>::infinity())
+				{
+					this->query[d] = wrapIntoDomain(query[d], sizes[d]);
+					cells[d] = 0;
+					cells[dim + d] = sizes[d];
+				}
+				else
+				{
+					this->query[d] = query[d];
+					cells[d] = -numeric_limits<T>::infinity();
+					cells[dim + d] = numeric_limits<T>::infinity();
+				}
+			}
+			queue.push(Entry(0, 0, 0));
+		}
+		
+		//! return the index of an unused cell, whose bounds are a copy of those of cell
+		int copyCell(const int cell)
+		{
+			const int dim(tree.dim);
+			int newCell;
+			if (freeCells.empty())
+			{
+				newCell = cells.size() / (2 * dim);
+				cells.resize(cells.size() + 2 * dim);
+			}
+			else
+			{
+				newCell = freeCells.back();
+				freeCells.pop_back();
+			}
+			copy(cells.begin() + cell * 2 * dim, cells.begin() + (cell + 1) * 2 * dim, cells.begin() + newCell * 2 * dim);
+			return newCell;
+		}
+		
+		//! push the children of a node, or the points of a leaf
+		void expand(const Entry& entry)
+		{
+			const int dim(tree.dim);
+			const Node& node(tree.nodes[entry.id]);
+			const uint32_t cd(tree.getDim(node.dimChildBucketSize));
+			if (cd == uint32_t(dim))
+			{
+				const BucketEntry* bucket(&tree.buckets[node.bucketIndex]);
+				const uint32_t bucketSize(tree.getChildBucketSize(node.dimChildBucketSize));
+				for (uint32_t i = 0; i < bucketSize; ++i, ++bucket)
+				{
+					T dist(0);
+					for (int d = 0; d < dim; ++d)
+					{
+						T diff(fabs(query[d] - bucket->pt[d]));
+						diff = min(diff, sizes[d] - diff);
+						dist += diff*diff;
+					}
+					if ((dist <= maxRadius2) &&
+						(allowSelfMatch || (dist > numeric_limits<T>::epsilon())))
+						queue.push(Entry(dist, bucket->index, -1));
+				}
+				freeCells.push_back(entry.cell);
+				return;
+			}
+			
+			// the left child keeps the cell of the node, the right child gets a copy
+			const int rightCell(copyCell(entry.cell));
+			T& leftMax(cells[entry.cell * 2 * dim + dim + cd]);
+			T& rightMin(cells[rightCell * 2 * dim + cd]);
+			const T parentOff(periodicOffset(query[cd], rightMin, leftMax, sizes[cd]));
+			leftMax = node.cutVal;
+			rightMin = node.cutVal;
+			const T leftOff(periodicOffset(query[cd], cells[entry.cell * 2 * dim + cd], leftMax, sizes[cd]));
+			const T rightOff(periodicOffset(query[cd], rightMin, cells[rightCell * 2 * dim + dim + cd], sizes[cd]));
+			const T leftDist2(max(entry.dist2, entry.dist2 - parentOff*parentOff + leftOff*leftOff));
+			const T rightDist2(max(entry.dist2, entry.dist2 - parentOff*parentOff + rightOff*rightOff));
+			if (leftDist2 <= maxRadius2)
+				queue.push(Entry(leftDist2, entry.id + 1, entry.cell));
+			else
+				freeCells.push_back(entry.cell);
+			if (rightDist2 <= maxRadius2)
+				queue.push(Entry(rightDist2, tree.getChildBucketSize(node.dimChildBucketSize), rightCell));
+			else
+				freeCells.push_back(rightCell);
+		}
+		
+		virtual bool next(Index& index, T& dist2)
+		{
+			while (!queue.empty())
+			{
+				const Entry entry(queue.top());
+				queue.pop();
+				if (entry.cell < 0)
+				{
+					index = entry.id;
+					dist2 = entry.dist2;
+					return true;
+				}
+				expand(entry);
+			}
+			return false;
+		}
+	};
+	
+	template<typename T, typename Heap>
+	typename NearestNeighbourSearch<T>::Cursor* KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::createCursor(const Vector& query, const unsigned optionFlags, const T maxRadius) const
+	{
+		if (query.size() < dim)
+			throw runtime_error((boost::format("Query has less dimensions (%1%) than requested for cloud (%2%)") % query.size() % dim).str());
+		return new IncrementalCursor(*this, query, optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH, maxRadius);
+	}
+	
+	template<typename T, typename Heap>
+	struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::SegmentMatch
+	{
+		T position; //!< position of the closest point of the segment
+		T dist2; //!< squared distance to the segment
+		Index index; //!< index of the point
+		
+		//! Construct a match
+		SegmentMatch(const T position, const T dist2, const Index index): position(position), dist2(dist2), index(index) {}
+		//! return true if m0 is before m1 along the segment
+		friend bool operator<(const SegmentMatch& m0, const SegmentMatch& m1)
+		{
+			if (m0.position != m1.position)
+				return m0.position < m1.position;
+			if (m0.dist2 != m1.dist2)
+				return m0.dist2 < m1.dist2;
+			return m0.index < m1.index;
+		}
+	};
+	
+	template<typename T, typename Heap>
+	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const
+	{
+		if (origins.rows() < dim)
+			throw runtime_error((boost::format("Origins have less dimensions (%1%) than requested for cloud (%2%)") % origins.rows() % dim).str());
+		if (ends.rows() != origins.rows() || ends.cols() != origins.cols())
+			throw runtime_error((boost::format("Ends matrix has a different size (%1% x %2%) than origins (%3% x %4%)") % ends.rows() % ends.cols() % origins.rows() % origins.cols()).str());
+		if (!(radius >= 0))
+			throw runtime_error((boost::format("Requesting segment search with a negative radius (%1%)") % radius).str());
+		if (periodicSizes.size() != 0)
+			throw runtime_error("Segment search does not support periodic domains");
+		
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const int segmentCount(origins.cols());
+		matches.resize(segmentCount);
+		unsigned long leafTouchedCount(0);
+		
+#pragma omp parallel
+		{
+		
+		std::vector<T> direction(dim);
+		SegmentMatches segmentMatches;
+		
+#pragma omp for reduction(+:leafTouchedCount) schedule(guided,32)
+		for (int i = 0; i < segmentCount; ++i)
+		{
+			T directionNorm2(0);
+			for (int d = 0; d < dim; ++d)
+			{
+				direction[d] = ends.coeff(d, i) - origins.coeff(d, i);
+				directionNorm2 += direction[d] * direction[d];
+			}
+			segmentMatches.clear();
+			const unsigned long touched(recurseSegment(&origins.coeff(0, i), &direction[0], directionNorm2, 0, 0, 1, radius, segmentMatches));
+			if (collectStatistics)
+				leafTouchedCount += touched;
+			sort(segmentMatches.begin(), segmentMatches.end());
+			
+			typename NearestNeighbourSearch<T>::SegmentMatches& result(matches[i]);
+			const int matchCount(segmentMatches.size());
+			result.indices.resize(matchCount);
+			result.positions.resize(matchCount);
+			result.dists2.resize(matchCount);
+			for (int j = 0; j < matchCount; ++j)
+			{
+				result.indices[j] = segmentMatches[j].index;
+				result.positions[j] = segmentMatches[j].position;
+				result.dists2[j] = segmentMatches[j].dist2;
+			}
+		}
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::recurseSegment(const T* origin, const T* direction, const T directionNorm2, const unsigned n, T t0, T t1, const T maxRadius, SegmentMatches& matches) const
+	{
+		const Node& node(nodes[n]);
+		const uint32_t cd(getDim(node.dimChildBucketSize));
+		
+		if (cd == uint32_t(dim))
+		{
+			const BucketEntry* bucket(&buckets[node.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			const T maxRadius2(maxRadius * maxRadius);
+			for (uint32_t i = 0; i < bucketSize; ++i, ++bucket)
+			{
+				// project the point on the segment
+				T dot(0);
+				for (int d = 0; d < dim; ++d)
+					dot += (bucket->pt[d] - origin[d]) * direction[d];
+				const T position(directionNorm2 > 0 ? max(T(0), min(T(1), dot / directionNorm2)) : T(0));
+				T dist(0);
+				for (int d = 0; d < dim; ++d)
+				{
+					const T diff(bucket->pt[d] - origin[d] - position * direction[d]);
+					dist += diff*diff;
+				}
+				if (dist <= maxRadius2)
+					matches.push_back(SegmentMatch(position, dist, bucket->index));
+			}
+			return (unsigned long)(bucketSize);
+		}
+		
+		// clip [t0..t1] to the slab of each child, grown by the radius: left has coordinates <= cutVal, right >= cutVal
+		const T o(origin[cd]);
+		const T dir(direction[cd]);
+		unsigned long leafVisitedCount(0);
+		T leftT0(t0), leftT1(t1);
+		T rightT0(t0), rightT1(t1);
+		const T leftLimit(node.cutVal + maxRadius);
+		const T rightLimit(node.cutVal - maxRadius);
+		if (dir > 0)
+		{
+			leftT1 = min(t1, (leftLimit - o) / dir);
+			rightT0 = max(t0, (rightLimit - o) / dir);
+		}
+		else if (dir < 0)
+		{
+			leftT0 = max(t0, (leftLimit - o) / dir);
+			rightT1 = min(t1, (rightLimit - o) / dir);
+		}
+		else
+		{
+			if (o > leftLimit)
+				leftT1 = -1;
+			if (o < rightLimit)
+				rightT1 = -1;
+		}
+		if (leftT0 <= leftT1)
+			leafVisitedCount += recurseSegment(origin, direction, directionNorm2, n + 1, leftT0, leftT1, maxRadius, matches);
+		if (rightT0 <= rightT1)
+			leafVisitedCount += recurseSegment(origin, direction, directionNorm2, getChildBucketSize(node.dimChildBucketSize), rightT0, rightT1, maxRadius, matches);
+		return leafVisitedCount;
+	}
+	
+	template<typename T, typename Heap> template<typename PairVisitor>
+	void KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::forEachPairWithin(const T maxRadius2, const PairVisitor& pairVisitor) const
+	{
+		const T maxRadius(sqrt(maxRadius2));
+		vector<unsigned> leaves;
+		vector<int> nodeLeaves(nodes.size(), -1);
+		for (unsigned n = 0; n < nodes.size(); ++n)
+		{
+			if (getDim(nodes[n].dimChildBucketSize) == uint32_t(dim))
+			{
+				nodeLeaves[n] = leaves.size();
+				leaves.push_back(n);
+			}
+		}
+		const int leafCount(leaves.size());
+		
+		// bounding boxes of leaves, minimum in the first dim rows, maximum in the last dim rows
+		Matrix leafBounds(2 * dim, leafCount);
+#pragma omp parallel for schedule(guided,256)
+		for (int l = 0; l < leafCount; ++l)
+		{
+			const Node& leaf(nodes[leaves[l]]);
+			const BucketEntry* bucket(&buckets[leaf.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(leaf.dimChildBucketSize));
+			for (int d = 0; d < dim; ++d)
+			{
+				T minVal(bucket[0].pt[d]);
+				T maxVal(minVal);
+				for (uint32_t i = 1; i < bucketSize; ++i)
+				{
+					minVal = min(minVal, bucket[i].pt[d]);
+					maxVal = max(maxVal, bucket[i].pt[d]);
+				}
+				leafBounds(d, l) = minVal;
+				leafBounds(dim + d, l) = maxVal;
+			}
+		}
+		
+#pragma omp parallel
+		{
+		
+		vector<unsigned> stack;
+		
+#pragma omp for schedule(dynamic,16)
+		for (int l = 0; l < leafCount; ++l)
+		{
+			const Node& leaf(nodes[leaves[l]]);
+			const BucketEntry* bucket(&buckets[leaf.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(leaf.dimChildBucketSize));
+			const T* minValues(&leafBounds(0, l));
+			const T* maxValues(&leafBounds(dim, l));
+			
+			// compare the points of the leaf with those of every leaf within radius of its box, at most once per pair of leaves
+			stack.assign(1, 0);
+			while (!stack.empty())
+			{
+				const unsigned n(stack.back());
+				stack.pop_back();
+				const Node& node(nodes[n]);
+				const uint32_t cd(getDim(node.dimChildBucketSize));
+				if (cd != uint32_t(dim))
+				{
+					if (maxValues[cd] + maxRadius >= node.cutVal)
+						stack.push_back(getChildBucketSize(node.dimChildBucketSize));
+					if (minValues[cd] - maxRadius <= node.cutVal)
+						stack.push_back(n + 1);
+					continue;
+				}
+				if (node.bucketIndex < leaf.bucketIndex)
+					continue;
+				
+				// bound distances between the points of the two leaves using their boxes
+				const int otherLeaf(nodeLeaves[n]);
+				const T* otherMinValues(&leafBounds(0, otherLeaf));
+				const T* otherMaxValues(&leafBounds(dim, otherLeaf));
+				T minDist2(0);
+				T maxDist2(0);
+				for (int d = 0; d < dim; ++d)
+				{
+					const T gap(max(T(0), max(otherMinValues[d] - maxValues[d], minValues[d] - otherMaxValues[d])));
+					const T span(max(otherMaxValues[d] - minValues[d], maxValues[d] - otherMinValues[d]));
+					minDist2 += gap*gap;
+					maxDist2 += span*span;
+				}
+				if (minDist2 > maxRadius2)
+					continue;
+				const bool allWithin(maxDist2 <= maxRadius2);
+				
+				const BucketEntry* otherBucket(&buckets[node.bucketIndex]);
+				const uint32_t otherBucketSize(getChildBucketSize(node.dimChildBucketSize));
+				const bool sameLeaf(node.bucketIndex == leaf.bucketIndex);
+				for (uint32_t i = 0; i < bucketSize; ++i)
+				{
+					for (uint32_t j = sameLeaf ? i + 1 : 0; j < otherBucketSize; ++j)
+					{
+						if (!allWithin)
+						{
+							T dist(0);
+							const T* aPtr(bucket[i].pt);
+							const T* bPtr(otherBucket[j].pt);
+							for (int d = 0; d < dim; ++d)
+							{
+								const T diff(aPtr[d] - bPtr[d]);
+								dist += diff*diff;
+							}
+							if (dist > maxRadius2)
+								continue;
+						}
+						pairVisitor(bucket[i].index, otherBucket[j].index);
+					}
+				}
+			}
+		}
+		}
+	}
+	
+	//! Atomically replace *value by newValue if it equals expected, return whether it did
+	inline bool compareAndSwap(int* value, const int expected, const int newValue)
+	{
+#ifdef HAVE_OPENMP
+		return __sync_bool_compare_and_swap(value, expected, newValue);
+#else // HAVE_OPENMP
+		if (*value != expected)
+			return false;
+		*value = newValue;
+		return true;
+#endif // HAVE_OPENMP
+	}
+	
+	//! Atomically read *value
+	inline int atomicRead(const int* value)
+	{
+		return *static_cast<const volatile int*>(value);
+	}
+	
+	//! Lock-free union-find over point indices, the root of a set is its smallest index
+	struct ConcurrentUnionFind
+	{
+		vector<int> parents; //!< parent of every point, itself for roots
+		
+		//! Create count singleton sets
+		ConcurrentUnionFind(const int count): parents(count)
+		{
+			for (int i = 0; i < count; ++i)
+				parents[i] = i;
+		}
+		//! return the root of the set of i, halving paths on the way
+		int find(int i)
+		{
+			while (true)
+			{
+				const int parent(atomicRead(&parents[i]));
+				if (parent == i)
+					return i;
+				const int grandParent(atomicRead(&parents[parent]));
+				if (parent != grandParent)
+					compareAndSwap(&parents[i], parent, grandParent);
+				i = grandParent;
+			}
+		}
+		//! merge the sets of a and b
+		void unite(int a, int b)
+		{
+			while (true)
+			{
+				a = find(a);
+				b = find(b);
+				if (a == b)
+					return;
+				if (a < b)
+					swap(a, b);
+				// link the larger root under the smaller one, retry if it is not a root anymore
+				if (compareAndSwap(&parents[a], a, b))
+					return;
+			}
+		}
+	};
+	
+	//! Pair visitor counting the neighbours of every point
+	struct ClusterNeighbourCounter
+	{
+		int* counts; //!< number of neighbours of every point
+		
+		//! Construct the visitor with the counts to increment
+		ClusterNeighbourCounter(int* counts): counts(counts) {}
+		//! count a and b as neighbours
+		void operator()(const int a, const int b) const
+		{
+#ifdef HAVE_OPENMP
+			__sync_fetch_and_add(&counts[a], 1);
+			__sync_fetch_and_add(&counts[b], 1);
+#else // HAVE_OPENMP
+			++counts[a];
+			++counts[b];
+#endif // HAVE_OPENMP
+		}
+	};
+	
+	//! Pair visitor joining core points and attaching border points to their core neighbour of smallest index
+	struct ClusterJoiner
+	{
+		const vector<int>& counts; //!< number of neighbours of every point
+		const int minPoints; //!< minimum number of neighbours of core points
+		ConcurrentUnionFind& sets; //!< clusters of core points
+		int* borderCores; //!< core neighbour of smallest index of every non-core point, or the number of points
+		
+		//! Construct the visitor
+		ClusterJoiner(const vector<int>& counts, const int minPoints, ConcurrentUnionFind& sets, int* borderCores):
+			counts(counts), minPoints(minPoints), sets(sets), borderCores(borderCores) {}
+		//! keep the smallest core of border point
+		void attach(const int border, const int core) const
+		{
+			int current(atomicRead(&borderCores[border]));
+			while (core < current && !compareAndSwap(&borderCores[border], current, core))
+				current = atomicRead(&borderCores[border]);
+		}
+		//! join a and b
+		void operator()(const int a, const int b) const
+		{
+			const bool aIsCore(counts[a] >= minPoints);
+			const bool bIsCore(counts[b] >= minPoints);
+			if (aIsCore && bIsCore)
+				sets.unite(a, b);
+			else if (aIsCore)
+				attach(b, a);
+			else if (bIsCore)
+				attach(a, b);
+		}
+	};
+	
+	template<typename T, typename Heap>
+	typename KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::Index KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, Heap>::cluster(IndexVector& labels, const T radius, const Index minPoints) const
+	{
+		if (periodicSizes.size() != 0)
+			throw runtime_error("Clustering does not support periodic domains");
+		
+		const int pointCount(cloud.cols());
+		const T radius2(radius * radius);
+		
+		// count neighbours, every point being its own neighbour, only if needed to find core points
+		vector<int> counts(pointCount, 1);
+		if (minPoints > 1)
+			forEachPairWithin(radius2, ClusterNeighbourCounter(&counts[0]));
+		
+		// join core points and attach border points
+		ConcurrentUnionFind sets(pointCount);
+		vector<int> borderCores(pointCount, pointCount);
+		forEachPairWithin(radius2, ClusterJoiner(counts, minPoints, sets, &borderCores[0]));
+		
+		// number clusters in order of their smallest core point, which is their root
+		vector<int> rootLabels(pointCount, -1);
+		Index clusterCount(0);
+		for (int i = 0; i < pointCount; ++i)
+		{
+			if (counts[i] < minPoints)
+				continue;
+			const int root(sets.find(i));
+			if (rootLabels[root] < 0)
+				rootLabels[root] = clusterCount++;
+			labels[i] = rootLabels[root];
+		}
+		for (int i = 0; i < pointCount; ++i)
+		{
+			if (counts[i] >= minPoints)
+				continue;
+			if (borderCores[i] < pointCount)
+				labels[i] = rootLabels[sets.find(borderCores[i])];
+			else
+				labels[i] = -1;
+		}
+		return clusterCount;
+	}
+	
 	template struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<float,IndexHeapSTL<int,float> >;
 	template struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<float,IndexHeapBruteForceVector<int,float> >;
 	template struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<double,IndexHeapSTL<int,double> >;
@@ -40,7 +40,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <limits>
 #include <queue>
 #include <algorithm>
-// #include <map>
+#include <map>
+#include <iterator>
+#include <cstring>
+#include <cstdlib>
 #include <boost/numeric/conversion/bounds.hpp>
 #include <boost/limits.hpp>
 #include <boost/format.hpp>
@@ -48,7 +51,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 /*!	\file kdtree_opencl.cpp
- \ *brief kd-tree search, opencl implementation
+ \brief kd-tree and brute-force search, opencl implementation
  \ingroup private
  */
 
@@ -72,6 +75,30 @@ namespace Nabo
 	
 	using namespace std;
 	
+	//! Default maximum number of queries per kernel launch
+	const unsigned DEFAULT_OPENCL_CHUNK_SIZE = 16384;
+	
+	//! Return the type of device selected by the openclDevice parameter, or else by the NABO_OPENCL_DEVICE environment variable
+	static cl_device_type getDeviceType(const Parameters& additionalParameters)
+	{
+		string name(additionalParameters.get<string>("openclDevice", ""));
+		if (name.empty())
+		{
+			const char* envName(getenv("NABO_OPENCL_DEVICE"));
+			if (envName)
+				name = envName;
+		}
+		if (name.empty() || name == "gpu")
+			return CL_DEVICE_TYPE_GPU;
+		if (name == "cpu")
+			return CL_DEVICE_TYPE_CPU;
+		if (name == "accelerator")
+			return CL_DEVICE_TYPE_ACCELERATOR;
+		if (name == "all")
+			return CL_DEVICE_TYPE_ALL;
+		throw runtime_error((boost::format("Unknown OpenCL device type %1%, must be one of gpu, cpu, accelerator and all") % name).str());
+	}
+	
 	//! Template to retrieve type-specific code for CL support
 	template<typename T>
 	struct EnableCLTypeSupport {};
@@ -119,6 +146,7 @@ namespace Nabo
 		cl::Context context; //!< context in which programs are cached
 		Devices devices; //!< devices linked to the context
 		ProgramCache cachedPrograms; //!< cached programs
+		boost::mutex mutex; //!< mutex to protect concurrent compilations
 		
 		//! Create a source cacher for a given device type, retrieves a list of devices
 		SourceCacher(const cl_device_type deviceType)
@@ -155,12 +183,6 @@ namespace Nabo
 				throw runtime_error("No devices on OpenCL platform");
 		}
 		
-		//! Destroy the cache, programs will be released automatically
-		~SourceCacher()
-		{
-			cerr << "Destroying source cacher containing " << cachedPrograms.size() << " cached programs" << endl;
-		}
-		
 		//! Return whether program source is cached
 		bool contains(const std::string& source)
 		{
@@ -178,7 +200,6 @@ namespace Nabo
 		//! Destroy the manager and all caches
 		~ContextManager()
 		{
-			cerr << "Destroying CL context manager, used " << devices.size() << " contexts" << endl;
 			for (Devices::iterator it(devices.begin()); it != devices.end(); ++it)
 				delete it->second;
 		}
@@ -189,9 +210,16 @@ namespace Nabo
 			Devices::iterator it(devices.find(deviceType));
 			if (it == devices.end())
 			{
-				it = devices.insert(
-					pair<cl_device_type, SourceCacher*>(deviceType, new SourceCacher(deviceType))
-					).first;
+				SourceCacher* sourceCacher;
+				try
+				{
+					sourceCacher = new SourceCacher(deviceType);
+				}
+				catch (const cl::Error& e)
+				{
+					throw runtime_error((boost::format("Cannot create OpenCL context: error %1% in %2%") % e.err() % e.what()).str());
+				}
+				it = devices.insert(pair<cl_device_type, SourceCacher*>(deviceType, sourceCacher)).first;
 			}
 			return it->second->context;
 		}
@@ -214,11 +242,14 @@ namespace Nabo
 	static ContextManager contextManager;
 	
 	template<typename T>
-	OpenCLSearch<T>::OpenCLSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType):
+	OpenCLSearch<T>::OpenCLSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
 		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
-		deviceType(deviceType),
-		context(contextManager.createContext(deviceType))
+		deviceType(getDeviceType(additionalParameters)),
+		context(contextManager.createContext(deviceType)),
+		chunkSize(additionalParameters.get<unsigned>("openclChunkSize", DEFAULT_OPENCL_CHUNK_SIZE))
 	{
+		if (chunkSize == 0)
+			throw runtime_error("OpenCL chunk size must be at least 1");
 	}
 	
 	template<typename T>
@@ -236,157 +267,216 @@ namespace Nabo
 		oss << EnableCLTypeSupport<T>::code(devices.back());
 		oss << "#define EPSILON " << numeric_limits<T>::epsilon() << "\n";
 		oss << "#define DIM_COUNT " << dim << "\n";
-		//oss << "#define CLOUD_POINT_COUNT " << cloud.cols() << "\n";
-		oss << "#define POINT_STRIDE " << cloud.stride() << "\n";
+		oss << "#define POINT_STRIDE " << cloud.rows() << "\n";
 		oss << "#define MAX_K " << MAX_K << "\n";
 		if (collectStatistics)
 			oss << "#define TOUCH_STATISTICS\n";
 		oss << additionalDefines;
-		//cerr << "params:\n" << oss.str() << endl;
 		
 		const std::string& source(oss.str());
-		if (!sourceCacher->contains(source))
+		try
 		{
-			const size_t defLen(source.length());
-			char *defContent(new char[defLen+1]);
-			strcpy(defContent, source.c_str());
-			sources.push_back(std::make_pair(defContent, defLen));
-			string sourceFileName(OPENCL_SOURCE_DIR);
-			sourceFileName += clFileName;
-			// load files
-			const char* files[] = {
-				OPENCL_SOURCE_DIR "structure.cl",
-				OPENCL_SOURCE_DIR "heap.cl",
-				sourceFileName.c_str(),
-				NULL 
-			};
-			for (const char** file = files; *file != NULL; ++file)
+			boost::mutex::scoped_lock lock(sourceCacher->mutex);
+			if (!sourceCacher->contains(source))
 			{
-				std::ifstream stream(*file);
-				if (!stream.good())
-					throw runtime_error((string("cannot open file: ") + *file));
+				const size_t defLen(source.length());
+				char *defContent(new char[defLen+1]);
+				strcpy(defContent, source.c_str());
+				sources.push_back(std::make_pair(defContent, defLen));
+				string sourceFileName(OPENCL_SOURCE_DIR);
+				sourceFileName += clFileName;
+				// load files
+				const char* files[] = {
+					OPENCL_SOURCE_DIR "structure.cl",
+					OPENCL_SOURCE_DIR "heap.cl",
+					sourceFileName.c_str(),
+					NULL 
+				};
+				for (const char** file = files; *file != NULL; ++file)
+				{
+					std::ifstream stream(*file);
+					if (!stream.good())
+					{
+						for (cl::Program::Sources::iterator it = sources.begin(); it != sources.end(); ++it)
+							delete[] it->first;
+						throw runtime_error((string("cannot open file: ") + *file));
+					}
+					
+					stream.seekg(0, std::ios_base::end);
+					size_t size(stream.tellg());
+					stream.seekg(0, std::ios_base::beg);
+					
+					char* content(new char[size + 1]);
+					std::copy(std::istreambuf_iterator<char>(stream),
+								std::istreambuf_iterator<char>(), content);
+					content[size] = '\0';
+					
+					sources.push_back(std::make_pair(content, size));
+				}
+				cl::Program program(context, sources);
 				
-				stream.seekg(0, std::ios_base::end);
-				size_t size(stream.tellg());
-				stream.seekg(0, std::ios_base::beg);
+				// cleanup sources
+				for (cl::Program::Sources::iterator it = sources.begin(); it != sources.end(); ++it)
+				{
+					delete[] it->first;
+				}
+				sources.clear();
 				
-				char* content(new char[size + 1]);
-				std::copy(std::istreambuf_iterator<char>(stream),
-							std::istreambuf_iterator<char>(), content);
-				content[size] = '\0';
-				
-				sources.push_back(std::make_pair(content, size));
+				// build, and report the compilation log if it fails
+				try {
+					program.build(devices);
+				} catch (const cl::Error& e) {
+					ostringstream log;
+					for (cl::Devices::const_iterator it = devices.begin(); it != devices.end(); ++it)
+						log << "device " << it->getInfo<CL_DEVICE_NAME>() << ":\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(*it) << "\n";
+					throw runtime_error((boost::format("Cannot compile OpenCL code of %1%: error %2% in %3%, compilation log:\n%4%") % clFileName % e.err() % e.what() % log.str()).str());
+				}
+				sourceCacher->cachedPrograms[source] = program;
 			}
-			sourceCacher->cachedPrograms[source] = cl::Program(context, sources);
 			cl::Program& program = sourceCacher->cachedPrograms[source];
 			
-			// build
-			cl::Error error(CL_SUCCESS);
-			try {
-				program.build(devices);
-			} catch (cl::Error e) {
-				error = e;
-			}
-			
-			// dump
-			for (cl::Devices::const_iterator it = devices.begin(); it != devices.end(); ++it)
-			{
-				cerr << "device : " << it->getInfo<CL_DEVICE_NAME>() << "\n";
-				cerr << "compilation log:\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(*it) << endl;
-			}
-			// cleanup sources
-			for (cl::Program::Sources::iterator it = sources.begin(); it != sources.end(); ++it)
-			{
-				delete[] it->first;
-			}
-			sources.clear();
+			// build kernel and command queues
+			knnKernel = cl::Kernel(program, kernelName); 
+			queue = cl::CommandQueue(context, devices.back());
+			transferQueue = cl::CommandQueue(context, devices.back());
 			
-			// make sure to stop if compilation failed
-			if (error.err() != CL_SUCCESS)
-				throw error;
+			// copy cloud once, the device keeps it for the lifetime of the search
+			const size_t cloudCLSize(cloud.cols() * cloud.rows() * sizeof(T));
+			cloudCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cloudCLSize, const_cast<T*>(&cloud.coeff(0,0)));
+			knnKernel.setArg(0, sizeof(cl_mem), &cloudCL);
 		}
-		cl::Program& program = sourceCacher->cachedPrograms[source];
-		
-		// build kernel and command queue
-		knnKernel = cl::Kernel(program, kernelName); 
-		queue = cl::CommandQueue(context, devices.back());
-		
-		// map cloud
-		if (!(cloud.Flags & Eigen::DirectAccessBit) || (cloud.Flags & Eigen::RowMajorBit))
-			throw runtime_error("wrong memory mapping in point cloud");
-		const size_t cloudCLSize(cloud.cols() * cloud.stride() * sizeof(T));
-		cloudCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, cloudCLSize, const_cast<T*>(&cloud.coeff(0,0)));
-		knnKernel.setArg(0, sizeof(cl_mem), &cloudCL);
+		catch (const cl::Error& e)
+		{
+			throw runtime_error((boost::format("OpenCL error %1% in %2%") % e.err() % e.what()).str());
+		}
+	}
+	
+	template<typename T>
+	void OpenCLSearch<T>::reserveChunkBuffers(ChunkBuffers& buffers, const size_t queryCount, const size_t queryRows) const
+	{
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		
+		if (buffers.queryCapacity >= queryCount && buffers.queryRows >= queryRows)
+			return;
+		const size_t capacity(max(buffers.queryCapacity, queryCount));
+		const size_t rows(max(buffers.queryRows, queryRows));
+		buffers.query = cl::Buffer(context, CL_MEM_READ_ONLY, capacity * rows * sizeof(T));
+		buffers.maxRadii2 = cl::Buffer(context, CL_MEM_READ_ONLY, capacity * sizeof(T));
+		buffers.indices = cl::Buffer(context, CL_MEM_WRITE_ONLY, capacity * MAX_K * sizeof(int));
+		buffers.dists2 = cl::Buffer(context, CL_MEM_WRITE_ONLY, capacity * MAX_K * sizeof(T));
+		if (collectStatistics)
+			buffers.touchStatistics = cl::Buffer(context, CL_MEM_WRITE_ONLY, capacity * sizeof(cl_uint));
+		buffers.queryCapacity = capacity;
+		buffers.queryRows = rows;
+	}
+	
+	template<typename T>
+	unsigned OpenCLSearch<T>::getFirstSpecificArg() const
+	{
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		// cloud, query, indices, dists2, maxRadii2, K, maxError, optionFlags, queryStride, pointCount and optionally touchStatistics
+		return collectStatistics ? 11 : 10;
 	}
 	
 	template<typename T>
 	unsigned long OpenCLSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
 	{
-		checkSizesKnn(query, indices, dists2, k);
+		const Vector maxRadii(Vector::Constant(query.cols(), maxRadius));
+		return knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags);
+	}
+	
+	template<typename T>
+	unsigned long OpenCLSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
 		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
 		
 		// check K
 		if (k > MAX_K)
-			throw runtime_error("number of neighbors too large for OpenCL");
-		
-		// check consistency of query wrt cloud
-		if (query.stride() != cloud.stride() ||
-			query.rows() != cloud.rows())
-			throw runtime_error("query is not of the same dimensionality as the point cloud");
-		
-		// map query
-		if (!(query.Flags & Eigen::DirectAccessBit) || (query.Flags & Eigen::RowMajorBit))
-			throw runtime_error("wrong memory mapping in query data");
-		const size_t queryCLSize(query.cols() * query.stride() * sizeof(T));
-		cl::Buffer queryCL(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, queryCLSize, const_cast<T*>(&query.coeff(0,0)));
-		knnKernel.setArg(1, sizeof(cl_mem), &queryCL);
-		// map indices
-		assert((indices.Flags & Eigen::DirectAccessBit) && (!(indices.Flags & Eigen::RowMajorBit)));
-		const int indexStride(indices.stride());
-		const size_t indicesCLSize(indices.cols() * indexStride * sizeof(int));
-		cl::Buffer indicesCL(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, indicesCLSize, &indices.coeffRef(0,0));
-		knnKernel.setArg(2, sizeof(cl_mem), &indicesCL);
-		// map dists2
-		assert((dists2.Flags & Eigen::DirectAccessBit) && (!(dists2.Flags & Eigen::RowMajorBit)));
-		const int dists2Stride(dists2.stride());
-		const size_t dists2CLSize(dists2.cols() * dists2Stride * sizeof(T));
-		cl::Buffer dists2CL(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, dists2CLSize, &dists2.coeffRef(0,0));
-		knnKernel.setArg(3, sizeof(cl_mem), &dists2CL);
-		
-		// set resulting parameters
-		knnKernel.setArg(4, k);
-		knnKernel.setArg(5, (1 + epsilon)*(1 + epsilon));
-		knnKernel.setArg(6, maxRadius*maxRadius);
-		knnKernel.setArg(7, optionFlags);
-		knnKernel.setArg(8, indexStride);
-		knnKernel.setArg(9, dists2Stride);
-		knnKernel.setArg(10, cl_uint(cloud.cols()));
-		
-		// if required, map visit count
-		vector<cl_uint> visitCounts;
-		const size_t visitCountCLSize(query.cols() * sizeof(cl_uint));
-		cl::Buffer visitCountCL;
-		if (collectStatistics)
+			throw runtime_error((boost::format("Requesting more points (%1%) than OpenCL supports (%2%)") % k % MAX_K).str());
+		const size_t queryCount(query.cols());
+		if (queryCount == 0 || k == 0)
+			return 0;
+		
+		// kernels compare squared distances
+		vector<T> maxRadii2(queryCount);
+		for (size_t i = 0; i < queryCount; ++i)
+			maxRadii2[i] = maxRadii[i] * maxRadii[i];
+		vector<cl_uint> touchStatistics(collectStatistics ? queryCount : 0);
+		
+		boost::mutex::scoped_lock lock(knnMutex);
+		try
 		{
-			visitCounts.resize(query.cols());
-			visitCountCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, visitCountCLSize, &visitCounts[0]);
-			knnKernel.setArg(11, sizeof(cl_mem), &visitCountCL);
+			const size_t chunkCount((queryCount + chunkSize - 1) / chunkSize);
+			for (size_t i = 0; i < 2; ++i)
+				reserveChunkBuffers(chunkBuffers[i], min(chunkSize, queryCount), query.rows());
+			
+			// set arguments common to all chunks
+			knnKernel.setArg(5, cl_uint(k));
+			knnKernel.setArg(6, (1 + epsilon)*(1 + epsilon));
+			knnKernel.setArg(7, cl_uint(optionFlags));
+			knnKernel.setArg(8, cl_uint(query.rows()));
+			knnKernel.setArg(9, cl_uint(cloud.cols()));
+			
+			// chunk c uses the buffers c % 2: while the kernel processes it, the transfer queue
+			// uploads chunk c + 1 and downloads the results of chunk c - 1
+			vector<cl::Event> kernelEvents(chunkCount);
+			for (size_t c = 0; c <= chunkCount; ++c)
+			{
+				// upload and process chunk c
+				if (c < chunkCount)
+				{
+					ChunkBuffers& buffers(chunkBuffers[c % 2]);
+					const size_t first(c * chunkSize);
+					const size_t count(min(chunkSize, queryCount - first));
+					// the kernel of chunk c - 2 must be done with the query buffers
+					vector<cl::Event> uploadWaits;
+					if (c >= 2)
+						uploadWaits.push_back(kernelEvents[c - 2]);
+					// the download of chunk c - 2 is before this upload in the in-order transfer queue
+					vector<cl::Event> kernelWaits(1);
+					transferQueue.enqueueWriteBuffer(buffers.query, CL_FALSE, 0, count * query.rows() * sizeof(T), &query.coeff(0, first), uploadWaits.empty() ? 0 : &uploadWaits);
+					transferQueue.enqueueWriteBuffer(buffers.maxRadii2, CL_FALSE, 0, count * sizeof(T), &maxRadii2[first], 0, &kernelWaits[0]);
+					transferQueue.flush();
+					
+					knnKernel.setArg(1, sizeof(cl_mem), &buffers.query);
+					knnKernel.setArg(2, sizeof(cl_mem), &buffers.indices);
+					knnKernel.setArg(3, sizeof(cl_mem), &buffers.dists2);
+					knnKernel.setArg(4, sizeof(cl_mem), &buffers.maxRadii2);
+					if (collectStatistics)
+						knnKernel.setArg(10, sizeof(cl_mem), &buffers.touchStatistics);
+					queue.enqueueNDRangeKernel(knnKernel, cl::NullRange, cl::NDRange(count), cl::NullRange, &kernelWaits, &kernelEvents[c]);
+					queue.flush();
+				}
+				
+				// download results of chunk c - 1 directly into the output matrices
+				if (c >= 1)
+				{
+					const size_t d(c - 1);
+					ChunkBuffers& buffers(chunkBuffers[d % 2]);
+					const size_t first(d * chunkSize);
+					const size_t count(min(chunkSize, queryCount - first));
+					vector<cl::Event> downloadWaits(1, kernelEvents[d]);
+					transferQueue.enqueueReadBuffer(buffers.indices, CL_FALSE, 0, count * k * sizeof(int), &indices.coeffRef(0, first), &downloadWaits);
+					transferQueue.enqueueReadBuffer(buffers.dists2, CL_FALSE, 0, count * k * sizeof(T), &dists2.coeffRef(0, first), &downloadWaits);
+					if (collectStatistics)
+						transferQueue.enqueueReadBuffer(buffers.touchStatistics, CL_FALSE, 0, count * sizeof(cl_uint), &touchStatistics[first], &downloadWaits);
+					transferQueue.flush();
+				}
+			}
+			transferQueue.finish();
+		}
+		catch (const cl::Error& e)
+		{
+			throw runtime_error((boost::format("OpenCL error %1% in %2%") % e.err() % e.what()).str());
 		}
-		
-		// execute query
-		queue.enqueueNDRangeKernel(knnKernel, cl::NullRange, cl::NDRange(query.cols()), cl::NullRange);
-		queue.enqueueMapBuffer(indicesCL, true, CL_MAP_READ, 0, indicesCLSize, 0, 0);
-		queue.enqueueMapBuffer(dists2CL, true, CL_MAP_READ, 0, dists2CLSize, 0, 0);
-		if (collectStatistics)
-			queue.enqueueMapBuffer(visitCountCL, true, CL_MAP_READ, 0, visitCountCLSize, 0, 0);
-		queue.finish();
 		
 		// if required, collect statistics
 		if (collectStatistics)
 		{
 			unsigned long totalVisitCounts(0);
-			for (size_t i = 0; i < visitCounts.size(); ++i)
-				totalVisitCounts += (unsigned long)visitCounts[i];
+			for (size_t i = 0; i < touchStatistics.size(); ++i)
+				totalVisitCounts += (unsigned long)touchStatistics[i];
 			return totalVisitCounts;
 		}
 		else
@@ -394,8 +484,8 @@ namespace Nabo
 	}
 	
 	template<typename T>
-	BruteForceSearchOpenCL<T>::BruteForceSearchOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType):
-	OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, deviceType)
+	BruteForceSearchOpenCL<T>::BruteForceSearchOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+	OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, additionalParameters)
 	{
 #ifdef EIGEN3_API
 		const_cast<Vector&>(this->minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
@@ -444,7 +534,7 @@ namespace Nabo
 		if (elCount <= 1)
 			return 0;
 		elCount --;
-		size_t i = 31;
+		int i = 31;
 		for (; i >= 0; --i)
 		{
 			if (elCount & (1 << i))
@@ -496,11 +586,9 @@ namespace Nabo
 	}
 	
 	template<typename T>
-	KDTreeBalancedPtInLeavesStackOpenCL<T>::KDTreeBalancedPtInLeavesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType):
-		OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, deviceType)
+	KDTreeBalancedPtInLeavesStackOpenCL<T>::KDTreeBalancedPtInLeavesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, additionalParameters)
 	{
-		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
-		
 		// build point vector and compute bounds
 		BuildPoints buildPoints;
 		buildPoints.reserve(cloud.cols());
@@ -525,13 +613,17 @@ namespace Nabo
 		// init openCL
 		initOpenCL("knn_kdtree_pt_in_leaves.cl", "knnKDTree", (boost::format("#define MAX_STACK_DEPTH %1%\n") % maxStackDepth).str());
 		
-		// map nodes, for info about alignment, see sect 6.1.5 
+		// copy nodes once, for info about alignment, see sect 6.1.5 
 		const size_t nodesCLSize(nodes.size() * sizeof(Node));
-		nodesCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, nodesCLSize, &nodes[0]);
-		if (collectStatistics)
-			knnKernel.setArg(12, sizeof(cl_mem), &nodesCL);
-		else
-			knnKernel.setArg(11, sizeof(cl_mem), &nodesCL);
+		try
+		{
+			nodesCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nodesCLSize, &nodes[0]);
+			knnKernel.setArg(getFirstSpecificArg(), sizeof(cl_mem), &nodesCL);
+		}
+		catch (const cl::Error& e)
+		{
+			throw runtime_error((boost::format("OpenCL error %1% in %2%") % e.err() % e.what()).str());
+		}
 	}
 
 	template struct KDTreeBalancedPtInLeavesStackOpenCL<float>;
@@ -619,11 +711,9 @@ namespace Nabo
 	}
 	
 	template<typename T>
-	KDTreeBalancedPtInNodesStackOpenCL<T>::KDTreeBalancedPtInNodesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType):
-	OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, deviceType)
+	KDTreeBalancedPtInNodesStackOpenCL<T>::KDTreeBalancedPtInNodesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+	OpenCLSearch<T>::OpenCLSearch(cloud, dim, creationOptionFlags, additionalParameters)
 	{
-		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
-		
 		// build point vector and compute bounds
 		BuildPoints buildPoints;
 		buildPoints.reserve(cloud.cols());
@@ -648,13 +738,17 @@ namespace Nabo
 		// init openCL
 		initOpenCL("knn_kdtree_pt_in_nodes.cl", "knnKDTree", (boost::format("#define MAX_STACK_DEPTH %1%\n") % maxStackDepth).str());
 		
-		// map nodes, for info about alignment, see sect 6.1.5 
+		// copy nodes once, for info about alignment, see sect 6.1.5 
 		const size_t nodesCLSize(nodes.size() * sizeof(Node));
-		nodesCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, nodesCLSize, &nodes[0]);
-		if (collectStatistics)
-			knnKernel.setArg(12, sizeof(cl_mem), &nodesCL);
-		else
-			knnKernel.setArg(11, sizeof(cl_mem), &nodesCL);
+		try
+		{
+			nodesCL = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nodesCLSize, &nodes[0]);
+			knnKernel.setArg(getFirstSpecificArg(), sizeof(cl_mem), &nodesCL);
+		}
+		catch (const cl::Error& e)
+		{
+			throw runtime_error((boost::format("OpenCL error %1% in %2%") % e.err() % e.what()).str());
+		}
 	}
 	
 	template struct KDTreeBalancedPtInNodesStackOpenCL<float>;
@@ -0,0 +1,481 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <boost/format.hpp>
+
+/*!	\file kdtree_set_cpu.cpp
+	\brief set of small kd-trees sharing one arena, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	template<typename T>
+	KDTreeSet<T>::BuildContext::BuildContext(const Matrix& cloud, const int dim, const unsigned bucketSize, Nodes& nodes, Indices& buckets):
+		cloud(cloud),
+		dim(dim),
+		dimBitCount(getStorageBitCount<uint32_t>(dim)),
+		bucketSize(bucketSize),
+		nodeOffset(nodes.size()),
+		bucketOffset(buckets.size()),
+		nodes(nodes),
+		buckets(buckets),
+		minValues(dim, numeric_limits<T>::max()),
+		maxValues(dim, -numeric_limits<T>::max())
+	{
+		for (int i = 0; i < cloud.cols(); ++i)
+		{
+			for (int d = 0; d < dim; ++d)
+			{
+				const T val(cloud.coeff(d, i));
+				minValues[d] = min(minValues[d], val);
+				maxValues[d] = max(maxValues[d], val);
+			}
+		}
+	}
+	
+	template<typename T>
+	uint32_t KDTreeSet<T>::buildNodes(BuildContext& context, const typename Indices::iterator first, const typename Indices::iterator last)
+	{
+		const int count(last - first);
+		assert(count >= 1);
+		const uint32_t pos(context.nodes.size() - context.nodeOffset);
+		
+		if (count <= int(context.bucketSize))
+		{
+			const uint32_t bucketIndex(context.buckets.size() - context.bucketOffset);
+			context.buckets.insert(context.buckets.end(), first, last);
+			context.nodes.push_back(Node(uint32_t(context.dim) | (uint32_t(count) << context.dimBitCount), bucketIndex));
+			return pos;
+		}
+		
+		// find the largest dimension of the cell
+		int cutDim(0);
+		T maxExtent(0);
+		for (int d = 0; d < context.dim; ++d)
+		{
+			const T extent(context.maxValues[d] - context.minValues[d]);
+			if (extent > maxExtent)
+			{
+				maxExtent = extent;
+				cutDim = d;
+			}
+		}
+		const T idealCutVal((context.maxValues[cutDim] + context.minValues[cutDim])/2);
+		
+		// get bounds from actual points
+		T minVal(numeric_limits<T>::max());
+		T maxVal(-numeric_limits<T>::max());
+		for (typename Indices::const_iterator it(first); it != last; ++it)
+		{
+			const T val(context.cloud.coeff(cutDim, *it));
+			minVal = min(val, minVal);
+			maxVal = max(val, maxVal);
+		}
+		
+		// correct cut following bounds
+		T cutVal;
+		if (idealCutVal < minVal)
+			cutVal = minVal;
+		else if (idealCutVal > maxVal)
+			cutVal = maxVal;
+		else
+			cutVal = idealCutVal;
+		
+		int l(0);
+		int r(count-1);
+		// partition points around cutVal
+		while (1)
+		{
+			while (l < count && context.cloud.coeff(cutDim, *(first+l)) < cutVal)
+				++l;
+			while (r >= 0 && context.cloud.coeff(cutDim, *(first+r)) >= cutVal)
+				--r;
+			if (l > r)
+				break;
+			swap(*(first+l), *(first+r));
+			++l; --r;
+		}
+		const int br1 = l;	// now: points[0..br1-1] < cutVal <= points[br1..count-1]
+		r = count-1;
+		// partition points[br1..count-1] around cutVal
+		while (1)
+		{
+			while (l < count && context.cloud.coeff(cutDim, *(first+l)) <= cutVal)
+				++l;
+			while (r >= br1 && context.cloud.coeff(cutDim, *(first+r)) > cutVal)
+				--r;
+			if (l > r)
+				break;
+			swap(*(first+l), *(first+r));
+			++l; --r;
+		}
+		const int br2 = l; // now: points[br1..br2-1] == cutVal < points[br2..count-1]
+		
+		// find best split index
+		int leftCount;
+		if (idealCutVal < minVal)
+			leftCount = 1;
+		else if (idealCutVal > maxVal)
+			leftCount = count-1;
+		else if (br1 > count / 2)
+			leftCount = br1;
+		else if (br2 < count / 2)
+			leftCount = br2;
+		else
+			leftCount = count / 2;
+		assert(leftCount > 0);
+		assert(leftCount < count);
+		
+		// add this
+		context.nodes.push_back(Node(0, cutVal));
+		
+		// recurse, restricting the cell along cutDim in place
+		const T oldMaxValue(context.maxValues[cutDim]);
+		context.maxValues[cutDim] = cutVal;
+		const uint32_t _UNUSED leftChild = buildNodes(context, first, first + leftCount);
+		assert(leftChild == pos + 1);
+		context.maxValues[cutDim] = oldMaxValue;
+		const T oldMinValue(context.minValues[cutDim]);
+		context.minValues[cutDim] = cutVal;
+		const uint32_t rightChild = buildNodes(context, first + leftCount, last);
+		context.minValues[cutDim] = oldMinValue;
+		
+		// write right child index and return
+		context.nodes[context.nodeOffset + pos].dimChildBucketSize = uint32_t(cutDim) | (rightChild << context.dimBitCount);
+		return pos;
+	}
+	
+	template<typename T>
+	KDTreeSet<T>::KDTreeSet(const std::vector<Matrix>& clouds, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearchSet<T>(dim, creationOptionFlags),
+		bucketSize(additionalParameters.get<unsigned>("bucketSize", 8))
+	{
+		if (bucketSize < 2)
+			throw runtime_error((boost::format("Requested bucket size %1%, but must be larger than 2") % bucketSize).str());
+		const int cloudCount(clouds.size());
+		for (int i = 0; i < cloudCount; ++i)
+		{
+			if (clouds[i].cols() == 0)
+				throw runtime_error((boost::format("Cloud %1% has no points") % i).str());
+			if (clouds[i].rows() == 0)
+				throw runtime_error((boost::format("Cloud %1% has 0 dimensions") % i).str());
+			// node indices are relative to each tree, check them here as exceptions cannot leave the parallel build
+			if (clouds[i].cols() > Index(bucketSize))
+			{
+				const uint32_t dimBitCount(getStorageBitCount<uint32_t>(min(dim, Index(clouds[i].rows()))));
+				const uint64_t maxNodeCount((0x1ULL << (32-dimBitCount)) - 1);
+				const uint64_t estimatedNodeCount(clouds[i].cols() / (bucketSize / 2));
+				if (estimatedNodeCount > maxNodeCount)
+					throw runtime_error((boost::format("Cloud %1% has a risk to have more nodes (%2%) than the kd-tree allows (%3%). The kd-tree has %4% bits for dimensions and %5% bits for node indices") % i % estimatedNodeCount % maxNodeCount % dimBitCount % (32-dimBitCount)).str());
+			}
+		}
+		
+		// sizes of the trees, then their positions in the arena
+		std::vector<TreeLayout> layouts(cloudCount);
+		size_t nodeCount(0);
+		size_t bucketCount(0);
+		
+#pragma omp parallel
+		{
+		
+		// build trees into buffers local to the thread, remembering where they are
+		Nodes threadNodes;
+		Indices threadBuckets;
+		std::vector<Index> builtClouds;
+		std::vector<TreeLayout> builtLayouts;
+		Indices buildPoints;
+		
+#pragma omp for schedule(dynamic,16)
+		for (int i = 0; i < cloudCount; ++i)
+		{
+			const Matrix& cloud(clouds[i]);
+			BuildContext context(cloud, min(dim, Index(cloud.rows())), bucketSize, threadNodes, threadBuckets);
+			buildPoints.resize(cloud.cols());
+			for (int j = 0; j < cloud.cols(); ++j)
+				buildPoints[j] = j;
+			buildNodes(context, buildPoints.begin(), buildPoints.end());
+			
+			TreeLayout layout;
+			layout.nodeOffset = context.nodeOffset;
+			layout.nodeCount = threadNodes.size() - context.nodeOffset;
+			layout.bucketOffset = context.bucketOffset;
+			layout.bucketCount = threadBuckets.size() - context.bucketOffset;
+			layouts[i] = layout;
+			builtClouds.push_back(i);
+			builtLayouts.push_back(layout);
+		}
+		
+		// the omp for above ends with a barrier, so all sizes are known: allocate the arena
+#pragma omp single
+		{
+			for (int i = 0; i < cloudCount; ++i)
+			{
+				layouts[i].nodeOffset = nodeCount;
+				nodeCount += layouts[i].nodeCount;
+			}
+			for (int i = 0; i < cloudCount; ++i)
+			{
+				layouts[i].bucketOffset = bucketCount;
+				bucketCount += layouts[i].bucketCount;
+			}
+			arena.resize(nodeCount * sizeof(Node) + bucketCount * sizeof(Index));
+		}
+		
+		// copy the trees of this thread to the arena, the buffers of the thread being freed at the end of the block
+		if (!arena.empty())
+		{
+			Node* arenaNodes(reinterpret_cast<Node*>(&arena[0]));
+			Index* arenaBuckets(reinterpret_cast<Index*>(&arena[nodeCount * sizeof(Node)]));
+			for (size_t j = 0; j < builtClouds.size(); ++j)
+			{
+				const TreeLayout& from(builtLayouts[j]);
+				const TreeLayout& to(layouts[builtClouds[j]]);
+				memcpy(arenaNodes + to.nodeOffset, &threadNodes[from.nodeOffset], from.nodeCount * sizeof(Node));
+				memcpy(arenaBuckets + to.bucketOffset, &threadBuckets[from.bucketOffset], from.bucketCount * sizeof(Index));
+			}
+		}
+		}
+		
+		// create the searches, pointing into the arena
+		searches.reserve(cloudCount);
+		for (int i = 0; i < cloudCount; ++i)
+		{
+			const Node* nodes(reinterpret_cast<const Node*>(&arena[0]) + layouts[i].nodeOffset);
+			const Index* buckets(reinterpret_cast<const Index*>(&arena[nodeCount * sizeof(Node)]) + layouts[i].bucketOffset);
+			const size_t memory(layouts[i].nodeCount * sizeof(Node) + layouts[i].bucketCount * sizeof(Index));
+			searches.push_back(new KDTreeSetView<T, IndexHeapBruteForceVector<int,T> >(clouds[i], dim, creationOptionFlags, nodes, buckets, memory));
+		}
+	}
+	
+	template<typename T>
+	KDTreeSet<T>::~KDTreeSet()
+	{
+		for (size_t i = 0; i < searches.size(); ++i)
+			delete searches[i];
+	}
+	
+	template<typename T>
+	typename KDTreeSet<T>::Index KDTreeSet<T>::getSearchCount() const
+	{
+		return searches.size();
+	}
+	
+	template<typename T>
+	const NearestNeighbourSearch<T>& KDTreeSet<T>::getSearch(const Index i) const
+	{
+		if (i < 0 || i >= Index(searches.size()))
+			throw runtime_error((boost::format("Requesting search %1%, but the set has %2% searches") % i % searches.size()).str());
+		return *searches[i];
+	}
+	
+	template<typename T>
+	size_t KDTreeSet<T>::getArenaSize() const
+	{
+		return arena.size();
+	}
+	
+	template struct KDTreeSet<float>;
+	template struct KDTreeSet<double>;
+	
+	template<typename T, typename Heap>
+	KDTreeSetView<T, Heap>::KDTreeSetView(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Node* nodes, const Index* buckets, const size_t memory):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		nodes(nodes),
+		buckets(buckets),
+		dimBitCount(getStorageBitCount<uint32_t>(this->dim)),
+		dimMask((1<<dimBitCount)-1),
+		memory(memory)
+	{
+		Vector& minBound(const_cast<Vector&>(this->minBound));
+		Vector& maxBound(const_cast<Vector&>(this->maxBound));
+		for (int i = 0; i < cloud.cols(); ++i)
+		{
+			for (int d = 0; d < this->dim; ++d)
+			{
+				const T val(cloud.coeff(d, i));
+				minBound(d) = min(minBound(d), val);
+				maxBound(d) = max(maxBound(d), val);
+			}
+		}
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long KDTreeSetView<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const T maxRadius2(maxRadius * maxRadius);
+		const T maxError2((1+epsilon)*(1+epsilon));
+		
+		Heap heap(k);
+		std::vector<T> off(dim, 0);
+		unsigned long leafTouchedCount(0);
+		for (int i = 0; i < query.cols(); ++i)
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long KDTreeSetView<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const T maxError2((1+epsilon)*(1+epsilon));
+		
+		Heap heap(k);
+		std::vector<T> off(dim, 0);
+		unsigned long leafTouchedCount(0);
+		for (int i = 0; i < query.cols(); ++i)
+		{
+			const T maxRadius(maxRadii[i]);
+			const T maxRadius2(maxRadius * maxRadius);
+			leafTouchedCount += onePointKnn(query, indices, dists2, i, heap, off, maxError2, maxRadius2, allowSelfMatch, collectStatistics, sortResults);
+		}
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap>
+	size_t KDTreeSetView<T, Heap>::memoryUsage() const
+	{
+		return memory;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long KDTreeSetView<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const int i, Heap& heap, std::vector<T>& off, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const
+	{
+		fill(off.begin(), off.end(), 0);
+		heap.reset();
+		unsigned long leafTouchedCount(0);
+		
+		if (allowSelfMatch)
+		{
+			if (collectStatistics)
+				leafTouchedCount += recurseKnn<true, true>(&query.coeff(0, i), 0, 0, heap, off, maxError2, maxRadius2);
+			else
+				recurseKnn<true, false>(&query.coeff(0, i), 0, 0, heap, off, maxError2, maxRadius2);
+		}
+		else
+		{
+			if (collectStatistics)
+				leafTouchedCount += recurseKnn<false, true>(&query.coeff(0, i), 0, 0, heap, off, maxError2, maxRadius2);
+			else
+				recurseKnn<false, false>(&query.coeff(0, i), 0, 0, heap, off, maxError2, maxRadius2);
+		}
+		
+		if (sortResults)
+			heap.sort();
+		
+		heap.getData(indices.col(i), dists2.col(i));
+		return leafTouchedCount;
+	}
+	
+	template<typename T, typename Heap> template<bool allowSelfMatch, bool collectStatistics>
+	unsigned long KDTreeSetView<T, Heap>::recurseKnn(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, const T maxError2, const T maxRadius2) const
+	{
+		const Node& node(nodes[n]);
+		const uint32_t cd(getDim(node.dimChildBucketSize));
+		
+		if (cd == uint32_t(dim))
+		{
+			const Index* bucket(&buckets[node.bucketIndex]);
+			const uint32_t bucketSize(getChildBucketSize(node.dimChildBucketSize));
+			for (uint32_t j = 0; j < bucketSize; ++j)
+			{
+				const T* qPtr(query);
+				const T* dPtr(&cloud.coeff(0, *bucket));
+				T dist(0);
+				for (int d = 0; d < dim; ++d)
+				{
+					const T diff(*qPtr - *dPtr);
+					dist += diff*diff;
+					qPtr++; dPtr++;
+				}
+				if ((dist <= maxRadius2) &&
+					(dist < heap.headValue()) &&
+					(allowSelfMatch || (dist > numeric_limits<T>::epsilon()))
+				)
+					heap.replaceHead(*bucket, dist);
+				++bucket;
+			}
+			return (unsigned long)(bucketSize);
+		}
+		else
+		{
+			const unsigned rightChild(getChildBucketSize(node.dimChildBucketSize));
+			unsigned long leafVisitedCount(0);
+			T& offcd(off[cd]);
+			const T old_off(offcd);
+			const T new_off(query[cd] - node.cutVal);
+			// visit the child containing the query first
+			const unsigned firstChild(new_off > 0 ? rightChild : n + 1);
+			const unsigned secondChild(new_off > 0 ? n + 1 : rightChild);
+			if (collectStatistics)
+				leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, firstChild, rd, heap, off, maxError2, maxRadius2);
+			else
+				recurseKnn<allowSelfMatch, false>(query, firstChild, rd, heap, off, maxError2, maxRadius2);
+			rd += - old_off*old_off + new_off*new_off;
+			if ((rd <= maxRadius2) &&
+				(rd * maxError2 < heap.headValue()))
+			{
+				offcd = new_off;
+				if (collectStatistics)
+					leafVisitedCount += recurseKnn<allowSelfMatch, true>(query, secondChild, rd, heap, off, maxError2, maxRadius2);
+				else
+					recurseKnn<allowSelfMatch, false>(query, secondChild, rd, heap, off, maxError2, maxRadius2);
+				offcd = old_off;
+			}
+			return leafVisitedCount;
+		}
+	}
+	
+	template struct KDTreeSetView<float, IndexHeapBruteForceVector<int,float> >;
+	template struct KDTreeSetView<double, IndexHeapBruteForceVector<int,double> >;
+	
+	//@}
+}
@@ -0,0 +1,424 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <cmath>
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file lsh_cpu.cpp
+	\brief locality-sensitive hashing search, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! number of points projected at once when building the tables
+	const int LSH_BUILD_BLOCK_SIZE = 4096;
+	//! maximal number of points in the sample used to estimate the default bucket width
+	const int LSH_SAMPLE_SIZE = 4096;
+	//! number of points whose nearest neighbour in the sample is used to estimate the default bucket width
+	const int LSH_SAMPLE_QUERY_COUNT = 64;
+	
+	//! A set of hash values to move to a neighbouring bucket, for multi-probe querying
+	template<typename T>
+	struct LSHPerturbationSet
+	{
+		T score; //!< sum of squared distances to the crossed bucket boundaries
+		uint64_t positions; //!< bit i is set if the set contains the i-th boundary in the sorted list of bucket boundaries
+		int last; //!< largest position in the set
+		
+		//! Construct a set of a single position
+		LSHPerturbationSet(const T score, const int position): score(score), positions(uint64_t(1) << position), last(position) {}
+		//! return true if s0 has a larger score than s1
+		friend bool operator>(const LSHPerturbationSet& s0, const LSHPerturbationSet& s1) { return s0.score > s1.score; }
+	};
+	
+	//! search state of locality-sensitive hashing, one per thread
+	template<typename T, typename Heap>
+	struct LSHSearch<T, Heap>::SearchState
+	{
+		//! heap of nearest neighbours
+		Heap heap;
+		//! points found as candidates by the current query, sized to their number rather than to the cloud
+		VisitedSet visited;
+		//! candidates of the current query
+		vector<Index> candidates;
+		//! hash values of the query in the current table
+		vector<int> values;
+		//! hash values of the probed neighbouring bucket
+		vector<int> perturbedValues;
+		//! distances to bucket boundaries, with 2 * hash function index + 1 if the boundary is above
+		vector<pair<T, int> > boundaries;
+		
+		//! construct a state for k neighbours, with hashCount hash functions per table
+		SearchState(const Index k, const unsigned hashCount):
+			heap(k),
+			values(hashCount),
+			perturbedValues(hashCount),
+			boundaries(2 * hashCount)
+		{}
+		
+		//! prepare for a new query
+		void reset()
+		{
+			heap.reset();
+			candidates.clear();
+			visited.clear();
+		}
+	};
+	
+	template<typename T, typename Heap>
+	LSHSearch<T, Heap>::LSHSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		tableCount(additionalParameters.get<unsigned>("tableCount", 8)),
+		hashCount(additionalParameters.get<unsigned>("hashCount", 12)),
+		probeCount(additionalParameters.get<unsigned>("probeCount", 32)),
+		bucketWidth(additionalParameters.get<T>("bucketWidth", T(0)))
+	{
+		if (tableCount == 0)
+			throw runtime_error("Table count must be at least 1");
+		if (hashCount == 0 || hashCount > 32)
+			throw runtime_error((boost::format("Hash count (%1%) must be between 1 and 32") % hashCount).str());
+		
+		const int pointCount(cloud.cols());
+#ifdef EIGEN3_API
+		const_cast<Vector&>(this->minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
+		const_cast<Vector&>(this->maxBound) = cloud.topRows(this->dim).rowwise().maxCoeff();
+#else // EIGEN3_API
+		// compute bounds
+		for (int i = 0; i < pointCount; ++i)
+		{
+			const Vector& v(cloud.block(0,i,this->dim,1));
+			const_cast<Vector&>(this->minBound) = this->minBound.cwise().min(v);
+			const_cast<Vector&>(this->maxBound) = this->maxBound.cwise().max(v);
+		}
+#endif // EIGEN3_API
+		
+		if (bucketWidth <= 0)
+			bucketWidth = 4 * estimateNeighbourDist();
+		if (bucketWidth <= 0)
+			bucketWidth = 1;
+		
+		// draw projections and shifts, scaled by the bucket width
+		const int hashFunctionCount(tableCount * hashCount);
+		boost::mt19937 rng(additionalParameters.get<unsigned>("seed", 0));
+		boost::variate_generator<boost::mt19937&, boost::normal_distribution<T> > gaussian(rng, boost::normal_distribution<T>());
+		boost::variate_generator<boost::mt19937&, boost::uniform_real<T> > uniform(rng, boost::uniform_real<T>(0, 1));
+		projections.resize(hashFunctionCount, this->dim);
+		for (int j = 0; j < this->dim; ++j)
+			for (int i = 0; i < hashFunctionCount; ++i)
+				projections(i, j) = gaussian() / bucketWidth;
+		shifts.resize(hashFunctionCount);
+		for (int i = 0; i < hashFunctionCount; ++i)
+			shifts(i) = uniform();
+		
+		// fill tables
+		tables.resize(tableCount);
+#pragma omp parallel for schedule(dynamic)
+		for (int t = 0; t < int(tableCount); ++t)
+		{
+			vector<pair<HashKey, Index> > entries(pointCount);
+			vector<int> values(hashCount);
+			for (int first = 0; first < pointCount; first += LSH_BUILD_BLOCK_SIZE)
+			{
+				const int count(min(LSH_BUILD_BLOCK_SIZE, pointCount - first));
+				const Matrix projected(projections.block(t * hashCount, 0, hashCount, this->dim) * cloud.block(0, first, this->dim, count));
+				for (int c = 0; c < count; ++c)
+				{
+					for (unsigned j = 0; j < hashCount; ++j)
+						values[j] = int(floor(projected(j, c) + shifts(t * hashCount + j)));
+					entries[first + c] = make_pair(hashKey(&values[0]), first + c);
+				}
+			}
+			sort(entries.begin(), entries.end());
+			Table& table(tables[t]);
+			table.indices.reserve(pointCount);
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				if (table.keys.empty() || table.keys.back() != entries[i].first)
+				{
+					table.keys.push_back(entries[i].first);
+					table.offsets.push_back(i);
+				}
+				table.indices.push_back(entries[i].second);
+			}
+			table.offsets.push_back(entries.size());
+			// release the capacity left by the growth of keys and offsets
+			vector<HashKey>(table.keys).swap(table.keys);
+			vector<uint32_t>(table.offsets).swap(table.offsets);
+		}
+	}
+	
+	template<typename T, typename Heap>
+	T LSHSearch<T, Heap>::estimateNeighbourDist() const
+	{
+		// evenly-spaced sample, the first points of which look for their nearest neighbour in it
+		const int pointCount(cloud.cols());
+		const int sampleCount(min(pointCount, LSH_SAMPLE_SIZE));
+		const int queryCount(min(sampleCount, LSH_SAMPLE_QUERY_COUNT));
+		T distSum(0);
+		int distCount(0);
+		for (int q = 0; q < queryCount; ++q)
+		{
+			const int qi(int((long long)(q) * pointCount / sampleCount));
+			T minDist2(numeric_limits<T>::infinity());
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				const int si(int((long long)(s) * pointCount / sampleCount));
+				const T dist2((cloud.block(0, qi, dim, 1) - cloud.block(0, si, dim, 1)).squaredNorm());
+				if (dist2 > 0)
+					minDist2 = min(minDist2, dist2);
+			}
+			if (minDist2 != numeric_limits<T>::infinity())
+			{
+				distSum += sqrt(minDist2);
+				++distCount;
+			}
+		}
+		return distCount > 0 ? distSum / T(distCount) : T(0);
+	}
+	
+	template<typename T, typename Heap>
+	typename LSHSearch<T, Heap>::HashKey LSHSearch<T, Heap>::hashKey(const int* values) const
+	{
+		// FNV-1a on hash values
+		HashKey key(14695981039346656037ULL);
+		for (unsigned j = 0; j < hashCount; ++j)
+			key = (key ^ HashKey(uint32_t(values[j]))) * HashKey(1099511628211ULL);
+		return key;
+	}
+	
+	template<typename T, typename Heap>
+	size_t LSHSearch<T, Heap>::memoryUsage() const
+	{
+		size_t memory((projections.size() + shifts.size()) * sizeof(T) + tables.capacity() * sizeof(Table));
+		for (size_t t = 0; t < tables.size(); ++t)
+			memory += tables[t].keys.capacity() * sizeof(HashKey) + tables[t].offsets.capacity() * sizeof(uint32_t) + tables[t].indices.capacity() * sizeof(Index);
+		return memory;
+	}
+	
+	template<typename T, typename Heap>
+	typename NearestNeighbourSearch<T>::MemoryEstimate LSHSearch<T, Heap>::estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters)
+	{
+		const size_t tableCount(additionalParameters.get<unsigned>("tableCount", 8));
+		const size_t hashCount(additionalParameters.get<unsigned>("hashCount", 12));
+		if (tableCount == 0)
+			throw runtime_error("Table count must be at least 1");
+		if (hashCount == 0 || hashCount > 32)
+			throw runtime_error((boost::format("Hash count (%1%) must be between 1 and 32") % hashCount).str());
+		
+		// at most one key per point in every table
+		typename NearestNeighbourSearch<T>::MemoryEstimate estimate;
+		estimate.nodes = tableCount * hashCount * (size_t(dim) + 1) * sizeof(T) + tableCount * sizeof(Table);
+		estimate.buckets = tableCount * (size_t(pointCount) * (sizeof(HashKey) + sizeof(uint32_t) + sizeof(Index)) + sizeof(uint32_t));
+		return estimate;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long LSHSearch<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		const Vector maxRadii(Vector::Constant(query.cols(), maxRadius));
+		return knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags);
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long LSHSearch<T, Heap>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T /*epsilon*/, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		const bool collectStatistics(creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS);
+		const int colCount(query.cols());
+		
+		// project all queries at once
+		Matrix projected(projections * query.block(0, 0, dim, colCount));
+		for (int i = 0; i < colCount; ++i)
+			projected.col(i) += shifts;
+		
+		unsigned long candidateCount(0);
+		
+#pragma omp parallel
+		{
+		
+		SearchState state(k, hashCount);
+		
+#pragma omp for reduction(+:candidateCount) schedule(guided,32)
+		for (int i = 0; i < colCount; ++i)
+		{
+			const T maxRadius(maxRadii[i]);
+			const T maxRadius2(maxRadius * maxRadius);
+			candidateCount += onePointKnn(query, indices, dists2, i, &projected.coeff(0, i), state, maxRadius2, allowSelfMatch, sortResults);
+		}
+		}
+		if (collectStatistics)
+			return candidateCount;
+		else
+			return 0;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long LSHSearch<T, Heap>::probe(const Table& table, const HashKey key, SearchState& state) const
+	{
+		const typename vector<HashKey>::const_iterator it(lower_bound(table.keys.begin(), table.keys.end(), key));
+		if (it == table.keys.end() || *it != key)
+			return 0;
+		const size_t keyIndex(it - table.keys.begin());
+		unsigned long newCount(0);
+		for (uint32_t j = table.offsets[keyIndex]; j < table.offsets[keyIndex + 1]; ++j)
+		{
+			const Index index(table.indices[j]);
+			if (!state.visited.insert(index))
+				continue;
+			state.candidates.push_back(index);
+			++newCount;
+		}
+		return newCount;
+	}
+	
+	template<typename T, typename Heap>
+	unsigned long LSHSearch<T, Heap>::onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const int i, const T* projected, SearchState& state, const T maxRadius2, const bool allowSelfMatch, const bool sortResults) const
+	{
+		typedef LSHPerturbationSet<T> PerturbationSet;
+		typedef priority_queue<PerturbationSet, vector<PerturbationSet>, greater<PerturbationSet> > PerturbationSets;
+		
+		state.reset();
+		vector<int>& values(state.values);
+		vector<int>& perturbedValues(state.perturbedValues);
+		vector<pair<T, int> >& boundaries(state.boundaries);
+		const int boundaryCount(2 * hashCount);
+		
+		for (unsigned t = 0; t < tableCount; ++t)
+		{
+			const Table& table(tables[t]);
+			const T* p(projected + t * hashCount);
+			for (unsigned j = 0; j < hashCount; ++j)
+			{
+				const T bucket(floor(p[j]));
+				const T offset(p[j] - bucket);
+				values[j] = int(bucket);
+				boundaries[2 * j] = make_pair(offset, 2 * j);
+				boundaries[2 * j + 1] = make_pair(T(1) - offset, 2 * j + 1);
+			}
+			probe(table, hashKey(&values[0]), state);
+			if (probeCount == 0)
+				continue;
+			
+			// generate perturbation sets by increasing score, using shift and expand operations
+			sort(boundaries.begin(), boundaries.end());
+			PerturbationSets sets;
+			sets.push(PerturbationSet(boundaries[0].first * boundaries[0].first, 0));
+			unsigned probedCount(0);
+			while (probedCount < probeCount && !sets.empty())
+			{
+				const PerturbationSet set(sets.top());
+				sets.pop();
+				const int last(set.last);
+				if (last + 1 < boundaryCount)
+				{
+					const T lastDist(boundaries[last].first);
+					const T nextDist(boundaries[last + 1].first);
+					PerturbationSet shifted(set);
+					shifted.positions ^= (uint64_t(3) << last);
+					shifted.last = last + 1;
+					shifted.score += nextDist * nextDist - lastDist * lastDist;
+					sets.push(shifted);
+					PerturbationSet expanded(set);
+					expanded.positions |= (uint64_t(1) << (last + 1));
+					expanded.last = last + 1;
+					expanded.score += nextDist * nextDist;
+					sets.push(expanded);
+				}
+				
+				// a set is valid if it moves every hash value at most once
+				perturbedValues = values;
+				uint32_t moved(0);
+				bool valid(true);
+				for (int position = 0; position <= last && valid; ++position)
+				{
+					if (!((set.positions >> position) & 1))
+						continue;
+					const int boundary(boundaries[position].second);
+					if ((moved >> (boundary / 2)) & 1)
+						valid = false;
+					moved |= uint32_t(1) << (boundary / 2);
+					perturbedValues[boundary / 2] += (boundary % 2) ? 1 : -1;
+				}
+				if (valid)
+				{
+					probe(table, hashKey(&perturbedValues[0]), state);
+					++probedCount;
+				}
+			}
+		}
+		
+		// verify candidates with exact distances, vectorized along dimensions by Eigen
+		typedef Eigen::Map<const Vector> ConstVectorMap;
+		const ConstVectorMap q(&query.coeff(0, i), dim);
+		Heap& heap(state.heap);
+		for (size_t c = 0; c < state.candidates.size(); ++c)
+		{
+			const Index index(state.candidates[c]);
+			const T dist((ConstVectorMap(&cloud.coeff(0, index), dim) - q).squaredNorm());
+			if ((dist <= maxRadius2) &&
+				(dist < heap.headValue()) &&
+				(allowSelfMatch || (dist > numeric_limits<T>::epsilon())))
+				heap.replaceHead(index, dist);
+		}
+		if (sortResults)
+			heap.sort();
+		heap.getData(indices.col(i), dists2.col(i));
+		return state.candidates.size();
+	}
+	
+	template struct LSHSearch<float,IndexHeapBruteForceVector<int,float> >;
+	template struct LSHSearch<double,IndexHeapBruteForceVector<int,double> >;
+	
+	//@}
+}
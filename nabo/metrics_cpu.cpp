@@ -0,0 +1,252 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+/*!	\file metrics_cpu.cpp
+	\brief metrics on the calls to knn() of a search
+	\ingroup private
+*/
+
+// Thread-local storage, add support for your favorite compiler
+#if defined(__GNUC__)
+	#define _THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+	#define _THREAD_LOCAL __declspec(thread)
+#endif
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! number of slots of counters, threads beyond it share slots
+	const int METRICS_SLOT_COUNT = 64;
+	
+	//! Atomically add 1 to *value
+	inline void atomicIncrement(uint64_t* value)
+	{
+#if defined(__GNUC__)
+		__sync_fetch_and_add(value, uint64_t(1));
+#else
+		++*value;
+#endif
+	}
+	
+	//! Atomically add increment to *value
+	inline void atomicAdd(uint64_t* value, const uint64_t increment)
+	{
+#if defined(__GNUC__)
+		__sync_fetch_and_add(value, increment);
+#else
+		*value += increment;
+#endif
+	}
+	
+	//! Return the slot of the calling thread, assigning slots to threads in turn on their first call
+	inline int getMetricsSlot()
+	{
+#ifdef _THREAD_LOCAL
+		static int nextSlot(0);
+		static _THREAD_LOCAL int slot(-1);
+		if (slot < 0)
+		{
+	#if defined(__GNUC__)
+			slot = __sync_fetch_and_add(&nextSlot, 1) % METRICS_SLOT_COUNT;
+	#else
+			slot = (nextSlot++) % METRICS_SLOT_COUNT;
+	#endif
+		}
+		return slot;
+#else // _THREAD_LOCAL
+		return 0;
+#endif // _THREAD_LOCAL
+	}
+	
+	//! Return the bucket of counts for value, the binary logarithm of value multiplied by subBucketCount, clamped to [0, bucketCount - 1]
+	inline int getLogBucket(const double value, const int subBucketCount, const int bucketCount)
+	{
+		if (!(value >= 1))
+			return 0;
+		const int bucket(int(floor(log(value) * (subBucketCount / log(2.)))));
+		return min(bucket, bucketCount - 1);
+	}
+	
+	template<typename T>
+	NearestNeighbourSearch<T>::Metrics::Metrics():
+		duration(0),
+		callCount(0),
+		queryCount(0),
+		touchedCount(0)
+	{
+		fill(kCounts, kCounts + K_BUCKET_COUNT, 0);
+		fill(latencyCounts, latencyCounts + LATENCY_BUCKET_COUNT, 0);
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Metrics NearestNeighbourSearch<T>::Metrics::operator -(const Metrics& that) const
+	{
+		Metrics result;
+		result.duration = duration - that.duration;
+		result.callCount = callCount - that.callCount;
+		result.queryCount = queryCount - that.queryCount;
+		result.touchedCount = touchedCount - that.touchedCount;
+		for (int i = 0; i < K_BUCKET_COUNT; ++i)
+			result.kCounts[i] = kCounts[i] - that.kCounts[i];
+		for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+			result.latencyCounts[i] = latencyCounts[i] - that.latencyCounts[i];
+		return result;
+	}
+	
+	template<typename T>
+	double NearestNeighbourSearch<T>::Metrics::getQueriesPerSecond() const
+	{
+		return duration > 0 ? double(queryCount) / duration : 0;
+	}
+	
+	template<typename T>
+	double NearestNeighbourSearch<T>::Metrics::getLatencyPercentile(const double p) const
+	{
+		uint64_t totalCount(0);
+		for (int i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+			totalCount += latencyCounts[i];
+		if (totalCount == 0)
+			return 0;
+		const uint64_t rank(max(uint64_t(1), uint64_t(ceil(p * double(totalCount)))));
+		uint64_t count(0);
+		int i(0);
+		for (; i < LATENCY_BUCKET_COUNT - 1; ++i)
+		{
+			count += latencyCounts[i];
+			if (count >= rank)
+				break;
+		}
+		return pow(2., double(i + 1) / 4) * 1e-6;
+	}
+	
+	template<typename T>
+	MeasuredSearch<T>::MeasuredSearch(NearestNeighbourSearch<T>* search):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(search->cloud, search->dim, search->creationOptionFlags),
+		search(search),
+		creationTime(getWallTime()),
+		slots(METRICS_SLOT_COUNT)
+	{
+		const_cast<Vector&>(minBound) = search->minBound;
+		const_cast<Vector&>(maxBound) = search->maxBound;
+		this->buildStatistics = search->getBuildStatistics();
+		memset(&slots[0], 0, slots.size() * sizeof(Slot));
+	}
+	
+	template<typename T>
+	MeasuredSearch<T>::~MeasuredSearch()
+	{
+		delete search;
+	}
+	
+	template<typename T>
+	void MeasuredSearch<T>::record(const Index k, const Index queryCount, const unsigned long touchedCount, const double duration) const
+	{
+		Slot& slot(slots[getMetricsSlot()]);
+		atomicIncrement(&slot.callCount);
+		atomicAdd(&slot.queryCount, uint64_t(queryCount));
+		atomicAdd(&slot.touchedCount, uint64_t(touchedCount));
+		atomicIncrement(&slot.kCounts[getLogBucket(double(k), 1, Metrics::K_BUCKET_COUNT)]);
+		atomicIncrement(&slot.latencyCounts[getLogBucket(duration * 1e6, 4, Metrics::LATENCY_BUCKET_COUNT)]);
+	}
+	
+	template<typename T>
+	unsigned long MeasuredSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		const double startTime(getWallTime());
+		const unsigned long touchedCount(search->knn(query, indices, dists2, k, epsilon, optionFlags, maxRadius));
+		record(k, query.cols(), touchedCount, getWallTime() - startTime);
+		return touchedCount;
+	}
+	
+	template<typename T>
+	unsigned long MeasuredSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		const double startTime(getWallTime());
+		const unsigned long touchedCount(search->knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags));
+		record(k, query.cols(), touchedCount, getWallTime() - startTime);
+		return touchedCount;
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Cursor* MeasuredSearch<T>::createCursor(const Vector& query, const unsigned optionFlags, const T maxRadius) const
+	{
+		return search->createCursor(query, optionFlags, maxRadius);
+	}
+	
+	template<typename T>
+	unsigned long MeasuredSearch<T>::findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const
+	{
+		return search->findNearSegments(origins, ends, matches, radius);
+	}
+	
+	template<typename T>
+	typename MeasuredSearch<T>::Metrics MeasuredSearch<T>::getMetrics() const
+	{
+		Metrics metrics;
+		metrics.duration = getWallTime() - creationTime;
+		for (size_t s = 0; s < slots.size(); ++s)
+		{
+			const Slot& slot(slots[s]);
+			metrics.callCount += slot.callCount;
+			metrics.queryCount += slot.queryCount;
+			metrics.touchedCount += slot.touchedCount;
+			for (int i = 0; i < Metrics::K_BUCKET_COUNT; ++i)
+				metrics.kCounts[i] += slot.kCounts[i];
+			for (int i = 0; i < Metrics::LATENCY_BUCKET_COUNT; ++i)
+				metrics.latencyCounts[i] += slot.latencyCounts[i];
+		}
+		return metrics;
+	}
+	
+	template<typename T>
+	size_t MeasuredSearch<T>::memoryUsage() const
+	{
+		return search->memoryUsage() + slots.capacity() * sizeof(Slot);
+	}
+	
+	template struct NearestNeighbourSearch<float>::Metrics;
+	template struct NearestNeighbourSearch<double>::Metrics;
+	template struct MeasuredSearch<float>;
+	template struct MeasuredSearch<double>;
+	
+	//@}
+}
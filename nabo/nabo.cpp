@@ -36,6 +36,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 #include <stdexcept>
 #include <boost/format.hpp>
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else // _WIN32
+	#include <sys/time.h>
+	#include <time.h>
+#endif // _WIN32
 
 /*!	\file nabo.cpp
 	\brief implementation of public interface
@@ -46,6 +53,24 @@ namespace Nabo
 {
 	using namespace std;
 	
+	double getWallTime()
+	{
+		#if defined(_WIN32)
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return double(counter.QuadPart) / double(frequency.QuadPart);
+		#elif defined(CLOCK_MONOTONIC)
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+		#else
+		struct timeval tv;
+		gettimeofday(&tv, 0);
+		return double(tv.tv_sec) + double(tv.tv_usec) * 1e-6;
+		#endif
+	}
+	
 	template<typename T>
 	NearestNeighbourSearch<T>::NearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags):
 		cloud(cloud),
@@ -80,6 +105,98 @@ namespace Nabo
 		return stats;
 	}
 	
+	//! number of queries of another scalar type converted at once
+	const int QUERY_CONVERSION_BLOCK_SIZE = 1024;
+	
+	//! Search the queries of scalar type U by blocks converted to T, with the scalar maxRadius if maxRadii is 0, or else with maxRadii
+	template<typename T, typename U>
+	static unsigned long knnConvertedQuery(const NearestNeighbourSearch<T>& nns, const Eigen::Matrix<U, Eigen::Dynamic, Eigen::Dynamic>& query, typename NearestNeighbourSearch<T>::IndexMatrix& indices, typename NearestNeighbourSearch<T>::Matrix& dists2, const typename NearestNeighbourSearch<T>::Vector* maxRadii, const T maxRadius, const typename NearestNeighbourSearch<T>::Index k, const T epsilon, const unsigned optionFlags)
+	{
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		
+		// other sizes are checked by knn() on every block
+		if (indices.rows() != k || indices.cols() != query.cols())
+			throw runtime_error((boost::format("Index matrix has a different size (%1% x %2%) than k x query columns (%3% x %4%)") % indices.rows() % indices.cols() % k % query.cols()).str());
+		if (dists2.rows() != k || dists2.cols() != query.cols())
+			throw runtime_error((boost::format("Distance matrix has a different size (%1% x %2%) than k x query columns (%3% x %4%)") % dists2.rows() % dists2.cols() % k % query.cols()).str());
+		if (maxRadii && maxRadii->size() != query.cols())
+			throw runtime_error((boost::format("Maximum radii vector has not the same length (%1%) than query has columns (%2%)") % maxRadii->size() % query.cols()).str());
+		
+		// only convert the dimensions that are searched
+		const int rowCount(min(int(query.rows()), int(nns.dim)));
+		if (query.cols() <= QUERY_CONVERSION_BLOCK_SIZE)
+		{
+			// a single block, whose results are written in place
+			const Matrix convertedQuery(query.block(0, 0, rowCount, query.cols()).template cast<T>());
+			if (maxRadii)
+				return nns.knn(convertedQuery, indices, dists2, *maxRadii, k, epsilon, optionFlags);
+			else
+				return nns.knn(convertedQuery, indices, dists2, k, epsilon, optionFlags, maxRadius);
+		}
+		
+		// knn() takes whole result matrices, so blocks are searched into buffers reused from block to block
+		Matrix blockQuery(rowCount, QUERY_CONVERSION_BLOCK_SIZE);
+		IndexMatrix blockIndices(k, QUERY_CONVERSION_BLOCK_SIZE);
+		Matrix blockDists2(k, QUERY_CONVERSION_BLOCK_SIZE);
+		Vector blockMaxRadii(maxRadii ? QUERY_CONVERSION_BLOCK_SIZE : 0);
+		unsigned long touchedCount(0);
+		for (int first = 0; first < query.cols(); first += QUERY_CONVERSION_BLOCK_SIZE)
+		{
+			const int blockSize(min(QUERY_CONVERSION_BLOCK_SIZE, int(query.cols()) - first));
+			if (blockSize != QUERY_CONVERSION_BLOCK_SIZE)
+			{
+				blockQuery.resize(rowCount, blockSize);
+				blockIndices.resize(k, blockSize);
+				blockDists2.resize(k, blockSize);
+				if (maxRadii)
+					blockMaxRadii.resize(blockSize);
+			}
+			blockQuery = query.block(0, first, rowCount, blockSize).template cast<T>();
+			if (maxRadii)
+			{
+				blockMaxRadii = maxRadii->segment(first, blockSize);
+				touchedCount += nns.knn(blockQuery, blockIndices, blockDists2, blockMaxRadii, k, epsilon, optionFlags);
+			}
+			else
+				touchedCount += nns.knn(blockQuery, blockIndices, blockDists2, k, epsilon, optionFlags, maxRadius);
+			indices.block(0, first, k, blockSize) = blockIndices;
+			dists2.block(0, first, k, blockSize) = blockDists2;
+		}
+		return touchedCount;
+	}
+	
+	template<typename T> template<typename U>
+	unsigned long NearestNeighbourSearch<T>::knn(const Eigen::Matrix<U, Eigen::Dynamic, Eigen::Dynamic>& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		return knnConvertedQuery<T, U>(*this, query, indices, dists2, 0, maxRadius, k, epsilon, optionFlags);
+	}
+	
+	template<typename T> template<typename U>
+	unsigned long NearestNeighbourSearch<T>::knn(const Eigen::Matrix<U, Eigen::Dynamic, Eigen::Dynamic>& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		return knnConvertedQuery<T, U>(*this, query, indices, dists2, &maxRadii, T(0), k, epsilon, optionFlags);
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Cursor* NearestNeighbourSearch<T>::createCursor(const Vector& /*query*/, const unsigned /*optionFlags*/, const T /*maxRadius*/) const
+	{
+		throw runtime_error("This search type does not support cursors, use a kd-tree");
+	}
+	
+	template<typename T>
+	unsigned long NearestNeighbourSearch<T>::findNearSegments(const Matrix& /*origins*/, const Matrix& /*ends*/, SegmentMatchesVector& /*matches*/, const T /*radius*/) const
+	{
+		throw runtime_error("This search type does not support segment search, use a kd-tree");
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Metrics NearestNeighbourSearch<T>::getMetrics() const
+	{
+		throw runtime_error("This search does not collect metrics, create it with the metrics parameter");
+	}
+	
 	template<typename T>
 	void NearestNeighbourSearch<T>::checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const Matrix& dists2, const Index k, const unsigned optionFlags, const Vector* maxRadii) const
 	{
@@ -117,15 +234,25 @@ namespace Nabo
 	{
 		if (dim <= 0)
 			throw runtime_error("Your space must have at least one dimension");
+		if (additionalParameters.get<unsigned>("metrics", 0))
+		{
+			Parameters measuredParameters(additionalParameters);
+			measuredParameters.erase("metrics");
+			return new MeasuredSearch<T>(create(cloud, dim, preferedType, creationOptionFlags, measuredParameters));
+		}
+		if (additionalParameters.get<string>("rotation", string("none")) != "none")
+			return new RotatedSearch<T>(cloud, dim, preferedType, creationOptionFlags, additionalParameters);
+		if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+			return new SimilaritySearch<T>(cloud, dim, preferedType, creationOptionFlags, additionalParameters);
 		switch (preferedType)
 		{
-			case BRUTE_FORCE: return new BruteForceSearch<T>(cloud, dim, creationOptionFlags);
+			case BRUTE_FORCE: return new BruteForceSearch<T>(cloud, dim, creationOptionFlags, additionalParameters);
 			case KDTREE_LINEAR_HEAP: return new KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapBruteForceVector<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
 			case KDTREE_TREE_HEAP: return new KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapSTL<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
 			#ifdef HAVE_OPENCL
-			case KDTREE_CL_PT_IN_NODES: return new KDTreeBalancedPtInNodesStackOpenCL<T>(cloud, dim, creationOptionFlags, CL_DEVICE_TYPE_GPU);
-			case KDTREE_CL_PT_IN_LEAVES: return new KDTreeBalancedPtInLeavesStackOpenCL<T>(cloud, dim, creationOptionFlags, CL_DEVICE_TYPE_GPU);
-			case BRUTE_FORCE_CL: return new BruteForceSearchOpenCL<T>(cloud, dim, creationOptionFlags, CL_DEVICE_TYPE_GPU);
+			case KDTREE_CL_PT_IN_NODES: return new KDTreeBalancedPtInNodesStackOpenCL<T>(cloud, dim, creationOptionFlags, additionalParameters);
+			case KDTREE_CL_PT_IN_LEAVES: return new KDTreeBalancedPtInLeavesStackOpenCL<T>(cloud, dim, creationOptionFlags, additionalParameters);
+			case BRUTE_FORCE_CL: return new BruteForceSearchOpenCL<T>(cloud, dim, creationOptionFlags, additionalParameters);
 			#else // HAVE_OPENCL
 			case KDTREE_CL_PT_IN_NODES: throw runtime_error("OpenCL not found during compilation");
 			case KDTREE_CL_PT_IN_LEAVES: throw runtime_error("OpenCL not found during compilation");
@@ -136,6 +263,59 @@ namespace Nabo
 			#else // HAVE_CUDA
 			case KDTREE_CUDA_CLUSTERED: throw runtime_error("CUDA not found during compilation");
 			#endif
+			case BALL_TREE: return new BallTree<T, IndexHeapBruteForceVector<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
+			case COVER_TREE: return new CoverTree<T, IndexHeapBruteForceVector<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
+			case LSH: return new LSHSearch<T, IndexHeapBruteForceVector<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
+			default: throw runtime_error("Unknown search type");
+		}
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::MemoryEstimate NearestNeighbourSearch<T>::estimateMemory(const SearchType type, const Index pointCount, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters)
+	{
+		if (pointCount <= 0)
+			throw runtime_error("Cloud has no points");
+		if (dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		if (additionalParameters.get<string>("rotation", string("none")) != "none")
+		{
+			// reject what create() would, as it checks the rotation first
+			if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+				throw runtime_error("Rotation is not supported in inner-product or cosine similarity search");
+			if (additionalParameters.get<Vector>("periodicBox", Vector()).size() != 0)
+				throw runtime_error("Rotation is not supported in periodic domains, whose boundaries are aligned with the axes");
+			// the rotated cloud is searched by a search of type, which does not see the rotation parameters
+			Parameters rotatedParameters(additionalParameters);
+			rotatedParameters.erase("rotation");
+			rotatedParameters.erase("rotationSeed");
+			MemoryEstimate estimate(estimateMemory(type, pointCount, dim, creationOptionFlags, rotatedParameters));
+			estimate.points += size_t(pointCount) * dim * sizeof(T);
+			return estimate;
+		}
+		if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+		{
+			if ((creationOptionFlags & INNER_PRODUCT) && (creationOptionFlags & COSINE))
+				throw runtime_error("INNER_PRODUCT and COSINE creation options are mutually exclusive");
+			// the cloud is copied, with an additional coordinate for inner product, and searched by the Euclidean search of type
+			const Index storeDim(creationOptionFlags & COSINE ? dim : dim + 1);
+			MemoryEstimate estimate;
+			if (type != BRUTE_FORCE)
+				estimate = estimateMemory(type, pointCount, storeDim, creationOptionFlags & ~unsigned(INNER_PRODUCT|COSINE), additionalParameters);
+			estimate.points += size_t(pointCount) * storeDim * sizeof(T);
+			return estimate;
+		}
+		switch (type)
+		{
+			case BRUTE_FORCE: return MemoryEstimate();
+			case KDTREE_LINEAR_HEAP: return KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapBruteForceVector<int,T> >::estimateMemory(pointCount, dim, additionalParameters);
+			case KDTREE_TREE_HEAP: return KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapSTL<int,T> >::estimateMemory(pointCount, dim, additionalParameters);
+			case KDTREE_CL_PT_IN_NODES:
+			case KDTREE_CL_PT_IN_LEAVES:
+			case BRUTE_FORCE_CL:
+			case KDTREE_CUDA_CLUSTERED: throw runtime_error((boost::format("Memory estimation is not available for search type %1%, whose structures are on the device") % type).str());
+			case BALL_TREE: return BallTree<T, IndexHeapBruteForceVector<int,T> >::estimateMemory(pointCount, dim, additionalParameters);
+			case COVER_TREE: return CoverTree<T, IndexHeapBruteForceVector<int,T> >::estimateMemory(pointCount, dim, additionalParameters);
+			case LSH: return LSHSearch<T, IndexHeapBruteForceVector<int,T> >::estimateMemory(pointCount, dim, additionalParameters);
 			default: throw runtime_error("Unknown search type");
 		}
 	}
@@ -145,6 +325,8 @@ namespace Nabo
 	{
 		if (dim <= 0)
 			throw runtime_error("Your space must have at least one dimension");
+		if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+			return new SimilaritySearch<T>(cloud, dim, BRUTE_FORCE, creationOptionFlags, Parameters());
 		return new BruteForceSearch<T>(cloud, dim, creationOptionFlags);
 	}
 	
@@ -153,6 +335,12 @@ namespace Nabo
 	{
 		if (dim <= 0)
 			throw runtime_error("Your space must have at least one dimension");
+		if (additionalParameters.get<unsigned>("metrics", 0))
+			return create(cloud, dim, KDTREE_LINEAR_HEAP, creationOptionFlags, additionalParameters);
+		if (additionalParameters.get<string>("rotation", string("none")) != "none")
+			return new RotatedSearch<T>(cloud, dim, KDTREE_LINEAR_HEAP, creationOptionFlags, additionalParameters);
+		if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+			return new SimilaritySearch<T>(cloud, dim, KDTREE_LINEAR_HEAP, creationOptionFlags, additionalParameters);
 		return new KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapBruteForceVector<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
 	}
 	
@@ -161,9 +349,244 @@ namespace Nabo
 	{
 		if (dim <= 0)
 			throw runtime_error("Your space must have at least one dimension");
+		if (additionalParameters.get<unsigned>("metrics", 0))
+			return create(cloud, dim, KDTREE_TREE_HEAP, creationOptionFlags, additionalParameters);
+		if (additionalParameters.get<string>("rotation", string("none")) != "none")
+			return new RotatedSearch<T>(cloud, dim, KDTREE_TREE_HEAP, creationOptionFlags, additionalParameters);
+		if (creationOptionFlags & (INNER_PRODUCT|COSINE))
+			return new SimilaritySearch<T>(cloud, dim, KDTREE_TREE_HEAP, creationOptionFlags, additionalParameters);
 		return new KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapSTL<int,T> >(cloud, dim, creationOptionFlags, additionalParameters);
 	}
 	
+	template<typename T>
+	unsigned long NearestNeighbourSearch<T>::buildKnnGraph(const Matrix& cloud, IndexMatrix& indices, Matrix& dists2, const Index k, const Index dim, const Parameters& additionalParameters)
+	{
+		if (cloud.cols() == 0)
+			throw runtime_error("Cloud has no points");
+		if (cloud.rows() == 0 || dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		if (k <= 0)
+			throw runtime_error((boost::format("Requesting a graph with %1% neighbours per point") % k).str());
+		if (k >= cloud.cols())
+			throw runtime_error((boost::format("Requesting more neighbours (%1%) than available in cloud minus 1 (%2%) (as self match is forbidden)") % k % (cloud.cols()-1)).str());
+		if (indices.rows() != k)
+			throw runtime_error((boost::format("Index matrix has a different number of rows (%1%) than k (%2%)") % indices.rows() % k).str());
+		if (indices.cols() != cloud.cols())
+			throw runtime_error((boost::format("Index matrix has a different number of columns (%1%) than cloud (%2%)") % indices.cols() % cloud.cols()).str());
+		if (dists2.rows() != k)
+			throw runtime_error((boost::format("Distance matrix has a different number of rows (%1%) than k (%2%)") % dists2.rows() % k).str());
+		if (dists2.cols() != cloud.cols())
+			throw runtime_error((boost::format("Distance matrix has a different number of columns (%1%) than cloud (%2%)") % dists2.cols() % cloud.cols()).str());
+		NNDescent<T> builder(cloud, min(dim, Index(cloud.rows())), k, additionalParameters);
+		return builder.build(indices, dists2);
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Index NearestNeighbourSearch<T>::cluster(const Matrix& cloud, IndexVector& labels, const T radius, const Index minPoints, const Index dim, const Parameters& additionalParameters)
+	{
+		if (dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		if (labels.size() != cloud.cols())
+			throw runtime_error((boost::format("Label vector has a different size (%1%) than cloud has columns (%2%)") % labels.size() % cloud.cols()).str());
+		if (!(radius >= 0))
+			throw runtime_error((boost::format("Requesting clusters with a negative radius (%1%)") % radius).str());
+		const KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapBruteForceVector<int,T> > tree(cloud, dim, 0, additionalParameters);
+		return tree.cluster(labels, radius, minPoints);
+	}
+	
 	template struct NearestNeighbourSearch<float>;
 	template struct NearestNeighbourSearch<double>;
+	template unsigned long NearestNeighbourSearch<float>::knn<double>(const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>&, IndexMatrix&, Matrix&, const Index, const float, const unsigned, const float) const;
+	template unsigned long NearestNeighbourSearch<float>::knn<double>(const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>&, IndexMatrix&, Matrix&, const Vector&, const Index, const float, const unsigned) const;
+	template unsigned long NearestNeighbourSearch<double>::knn<float>(const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>&, IndexMatrix&, Matrix&, const Index, const double, const unsigned, const double) const;
+	template unsigned long NearestNeighbourSearch<double>::knn<float>(const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>&, IndexMatrix&, Matrix&, const Vector&, const Index, const double, const unsigned) const;
+	
+	template<typename T>
+	IntegerNearestNeighbourSearch<T>::IntegerNearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags):
+		cloud(cloud),
+		dim(min(dim, int(cloud.rows()))),
+		creationOptionFlags(creationOptionFlags)
+	{
+		if (cloud.cols() == 0)
+			throw runtime_error("Cloud has no points");
+		if (cloud.rows() == 0)
+			throw runtime_error("Cloud has 0 dimensions");
+	}
+	
+	template<typename T>
+	void IntegerNearestNeighbourSearch<T>::checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const DistanceVector* maxDists2) const
+	{
+		const bool allowSelfMatch(optionFlags & ALLOW_SELF_MATCH);
+		if (allowSelfMatch)
+		{
+			if (k > cloud.cols())
+				throw runtime_error((boost::format("Requesting more points (%1%) than available in cloud (%2%)") % k % cloud.cols()).str());
+		}
+		else
+		{
+			if (k > cloud.cols()-1)
+				throw runtime_error((boost::format("Requesting more points (%1%) than available in cloud minus 1 (%2%) (as self match is forbidden)") % k % (cloud.cols()-1)).str());
+		}
+		if (query.rows() < dim)
+			throw runtime_error((boost::format("Query has less dimensions (%1%) than requested for cloud (%2%)") % query.rows() % dim).str());
+		if (indices.rows() != k)
+			throw runtime_error((boost::format("Index matrix has a different number of rows (%1%) than k (%2%)") % indices.rows() % k).str());
+		if (indices.cols() != query.cols())
+			throw runtime_error((boost::format("Index matrix has a different number of columns (%1%) than query (%2%)") % indices.cols() % query.cols()).str());
+		if (dists2.rows() != k)
+			throw runtime_error((boost::format("Distance matrix has a different number of rows (%1%) than k (%2%)") % dists2.rows() % k).str());
+		if (dists2.cols() != query.cols())
+			throw runtime_error((boost::format("Distance matrix has a different number of columns (%1%) than query (%2%)") % dists2.cols() % query.cols()).str());
+		if (maxDists2 && (maxDists2->size() != query.cols()))
+			throw runtime_error((boost::format("Maximum distances vector has not the same length (%1%) than query has columns (%2%)") % maxDists2->size() % query.cols()).str());
+		const unsigned maxOptionFlagsValue(ALLOW_SELF_MATCH|SORT_RESULTS);
+		if (optionFlags > maxOptionFlagsValue)
+			throw runtime_error((boost::format("OR-ed value of option flags (%1%) is larger than maximal valid value (%2%)") % optionFlags % maxOptionFlagsValue).str());
+	}
+	
+	template<typename T>
+	IntegerNearestNeighbourSearch<T>* IntegerNearestNeighbourSearch<T>::create(const Matrix& cloud, const Index dim, const SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters)
+	{
+		if (dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		switch (preferedType)
+		{
+			case BRUTE_FORCE: return new IntegerBruteForceSearch<T>(cloud, dim, creationOptionFlags);
+			case KDTREE: return new IntegerKDTree<T, IndexHeapBruteForceVector<int, Distance> >(cloud, dim, creationOptionFlags, additionalParameters);
+			default: throw runtime_error("Unknown search type");
+		}
+	}
+	
+	template struct IntegerNearestNeighbourSearch<boost::int16_t>;
+	template struct IntegerNearestNeighbourSearch<boost::int32_t>;
+	
+	template<typename T>
+	PyramidNearestNeighbourSearch<T>::PyramidNearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Index levelCount):
+		cloud(cloud),
+		dim(min(dim, int(cloud.rows()))),
+		creationOptionFlags(creationOptionFlags),
+		levelCount(levelCount)
+	{
+		if (cloud.cols() == 0)
+			throw runtime_error("Cloud has no points");
+		if (cloud.rows() == 0)
+			throw runtime_error("Cloud has 0 dimensions");
+		if (levelCount <= 0)
+			throw runtime_error((boost::format("Requesting a pyramid with %1% levels") % levelCount).str());
+	}
+	
+	template<typename T>
+	void PyramidNearestNeighbourSearch<T>::checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const Matrix& dists2, const Index level, const Index k, const unsigned optionFlags) const
+	{
+		if (level < 0 || level >= levelCount)
+			throw runtime_error((boost::format("Requesting level %1%, but the pyramid has %2% levels") % level % levelCount).str());
+		const Index levelSize(getLevelSize(level));
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH);
+		if (allowSelfMatch)
+		{
+			if (k > levelSize)
+				throw runtime_error((boost::format("Requesting more points (%1%) than available in level %2% (%3%)") % k % level % levelSize).str());
+		}
+		else
+		{
+			if (k > levelSize-1)
+				throw runtime_error((boost::format("Requesting more points (%1%) than available in level %2% minus 1 (%3%) (as self match is forbidden)") % k % level % (levelSize-1)).str());
+		}
+		if (query.rows() < dim)
+			throw runtime_error((boost::format("Query has less dimensions (%1%) than requested for cloud (%2%)") % query.rows() % dim).str());
+		if (indices.rows() != k)
+			throw runtime_error((boost::format("Index matrix has a different number of rows (%1%) than k (%2%)") % indices.rows() % k).str());
+		if (indices.cols() != query.cols())
+			throw runtime_error((boost::format("Index matrix has a different number of columns (%1%) than query (%2%)") % indices.cols() % query.cols()).str());
+		if (dists2.rows() != k)
+			throw runtime_error((boost::format("Distance matrix has a different number of rows (%1%) than k (%2%)") % dists2.rows() % k).str());
+		if (dists2.cols() != query.cols())
+			throw runtime_error((boost::format("Distance matrix has a different number of columns (%1%) than query (%2%)") % dists2.cols() % query.cols()).str());
+		const unsigned maxOptionFlagsValue(NearestNeighbourSearch<T>::ALLOW_SELF_MATCH|NearestNeighbourSearch<T>::SORT_RESULTS);
+		if (optionFlags > maxOptionFlagsValue)
+			throw runtime_error((boost::format("OR-ed value of option flags (%1%) is larger than maximal valid value (%2%)") % optionFlags % maxOptionFlagsValue).str());
+	}
+	
+	template<typename T>
+	PyramidNearestNeighbourSearch<T>* PyramidNearestNeighbourSearch<T>::create(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters)
+	{
+		if (dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		if (creationOptionFlags & ~unsigned(NearestNeighbourSearch<T>::TOUCH_STATISTICS))
+			throw runtime_error("Multi-resolution indices only support the TOUCH_STATISTICS creation option");
+		return new KDTreePyramid<T>(cloud, dim, creationOptionFlags, additionalParameters);
+	}
+	
+	template struct PyramidNearestNeighbourSearch<float>;
+	template struct PyramidNearestNeighbourSearch<double>;
+	
+	template<typename T>
+	NearestNeighbourSearchSet<T>::NearestNeighbourSearchSet(const Index dim, const unsigned creationOptionFlags):
+		dim(dim),
+		creationOptionFlags(creationOptionFlags)
+	{}
+	
+	template<typename T>
+	NearestNeighbourSearchSet<T>* NearestNeighbourSearchSet<T>::create(const std::vector<Matrix>& clouds, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters)
+	{
+		if (dim <= 0)
+			throw runtime_error("Your space must have at least one dimension");
+		if (creationOptionFlags & ~unsigned(NearestNeighbourSearch<T>::TOUCH_STATISTICS))
+			throw runtime_error("Search sets only support the TOUCH_STATISTICS creation option");
+		return new KDTreeSet<T>(clouds, dim, creationOptionFlags, additionalParameters);
+	}
+	
+	template struct NearestNeighbourSearchSet<float>;
+	template struct NearestNeighbourSearchSet<double>;
+	
+	BinaryNearestNeighbourSearch::BinaryNearestNeighbourSearch(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags):
+		descriptors(descriptors),
+		wordCount(descriptors.rows()),
+		creationOptionFlags(creationOptionFlags)
+	{
+		if (descriptors.cols() == 0)
+			throw runtime_error("Descriptor matrix has no descriptors");
+		if (descriptors.rows() == 0)
+			throw runtime_error("Descriptors have 0 words");
+	}
+	
+	void BinaryNearestNeighbourSearch::checkSizesKnn(const DescriptorMatrix& query, const IndexMatrix& indices, const DistanceMatrix& dists, const Index k, const unsigned optionFlags, const DistanceVector* maxDists) const
+	{
+		const bool allowSelfMatch(optionFlags & ALLOW_SELF_MATCH);
+		if (allowSelfMatch)
+		{
+			if (k > descriptors.cols())
+				throw runtime_error((boost::format("Requesting more descriptors (%1%) than available (%2%)") % k % descriptors.cols()).str());
+		}
+		else
+		{
+			if (k > descriptors.cols()-1)
+				throw runtime_error((boost::format("Requesting more descriptors (%1%) than available minus 1 (%2%) (as self match is forbidden)") % k % (descriptors.cols()-1)).str());
+		}
+		if (query.rows() != wordCount)
+			throw runtime_error((boost::format("Query has a different number of words (%1%) than descriptors (%2%)") % query.rows() % wordCount).str());
+		if (indices.rows() != k)
+			throw runtime_error((boost::format("Index matrix has a different number of rows (%1%) than k (%2%)") % indices.rows() % k).str());
+		if (indices.cols() != query.cols())
+			throw runtime_error((boost::format("Index matrix has a different number of columns (%1%) than query (%2%)") % indices.cols() % query.cols()).str());
+		if (dists.rows() != k)
+			throw runtime_error((boost::format("Distance matrix has a different number of rows (%1%) than k (%2%)") % dists.rows() % k).str());
+		if (dists.cols() != query.cols())
+			throw runtime_error((boost::format("Distance matrix has a different number of columns (%1%) than query (%2%)") % dists.cols() % query.cols()).str());
+		if (maxDists && (maxDists->size() != query.cols()))
+			throw runtime_error((boost::format("Maximum distances vector has not the same length (%1%) than query has columns (%2%)") % maxDists->size() % query.cols()).str());
+		const unsigned maxOptionFlagsValue(ALLOW_SELF_MATCH|SORT_RESULTS);
+		if (optionFlags > maxOptionFlagsValue)
+			throw runtime_error((boost::format("OR-ed value of option flags (%1%) is larger than maximal valid value (%2%)") % optionFlags % maxOptionFlagsValue).str());
+	}
+	
+	BinaryNearestNeighbourSearch* BinaryNearestNeighbourSearch::create(const DescriptorMatrix& descriptors, const SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters)
+	{
+		switch (preferedType)
+		{
+			case BRUTE_FORCE: return new BinaryBruteForceSearch(descriptors, creationOptionFlags);
+			case MULTI_INDEX_HASHING: return new BinaryMultiIndexHashing(descriptors, creationOptionFlags, additionalParameters);
+			default: throw runtime_error("Unknown search type");
+		}
+	}
 }
@@ -42,6 +42,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <map>
 #include <boost/any.hpp>
+#include <boost/cstdint.hpp>
 
 /*! 
 	\file nabo.h
@@ -125,9 +126,70 @@ Note that the matrix-based interface for query is more efficient than the vector
 
 \section ConstructionParameters Construction parameters
 
+The following additional construction parameters are available in KDTREE_, BALL_TREE and COVER_TREE algorithms:
+- \c bucketSize (\c unsigned): bucket size, defaults to 8; for COVER_TREE, number of remaining points below which they all become leaves of a node
+
 The following additional construction parameters are available in KDTREE_ algorithms:
+- \c periodicBox (\c Vector): for periodic domains, size of the domain along every dimension, 0 for non-periodic dimensions. Points must lie in [0, size[ along periodic dimensions, queries are wrapped into it, and distances are the shortest ones across domain boundaries. Defaults to an empty vector, which means no periodicity.
+- \c leafStorage (\c unsigned): format of a compact copy of the coordinates in the leaves, 0 for none, 1 for IEEE half precision, 2 for bfloat16; defaults to 0. Coordinates are stored relative to the first point of their leaf and converted with F16C or AVX-512 instructions when the CPU supports them. They only discard points that cannot be among the neighbours, the others are compared using the cloud, so that results are identical to those without compact storage. The compact copy is contiguous in leaf order and thus reduces memory traffic in higher dimensions, while in low dimensions the additional test usually costs more than it saves. Not available in periodic domains.
+
+The following additional construction parameter is available in BRUTE_FORCE and KDTREE_ algorithms:
+- \c cpuKernels (\c std::string): set of vectorized kernels computing distances, one of \c auto, \c scalar, \c sse4.2, \c avx2, \c avx512 and \c neon; defaults to the \c NABO_CPU_KERNELS environment variable if it is set, and to \c auto otherwise. \c auto selects the widest set supported by the running CPU, so that a generic build uses AVX-512 where available. Requesting a set that the CPU or the build does not support throws an exception. BRUTE_FORCE computes distances to tiles of points with these kernels and filters them before inserting into the heap; KDTREE_ algorithms use them in leaves from 16 dimensions, below which the inlined loop is faster.
+
+The following additional construction parameters are available in the OpenCL algorithms (\c BRUTE_FORCE_CL and \c KDTREE_CL_):
+- \c openclDevice (\c std::string): type of OpenCL device, one of \c gpu, \c cpu, \c accelerator and \c all; defaults to the \c NABO_OPENCL_DEVICE environment variable if it is set, and to \c gpu otherwise. If the platform has no device of this type, any device is used. The platform is the first one, or the one whose index is in the \c NABO_OPENCL_USE_PLATFORM environment variable. A CPU implementation such as PoCL allows to run these algorithms without GPU.
+- \c openclChunkSize (\c unsigned): maximum number of queries per kernel launch, defaults to 16384. The queries of a call to \c knn() are processed by chunks, the upload of a chunk and the download of the results of the previous one overlapping with the kernel of the current one. The cloud and the tree are copied to the device once at construction, and the buffers of the chunks are kept across calls.
+
+The following additional construction parameter is available in all algorithms, through NearestNeighbourSearch::create(), \c createKDTreeLinearHeap() and \c createKDTreeTreeHeap():
+- \c metrics (\c unsigned): if 1, collect metrics on the calls to \c knn(), see NearestNeighbourSearch::getMetrics(); defaults to 0. Every call then costs two clock readings and a few increments of counters private to the calling thread.
+
+The following additional construction parameters are available in all Euclidean algorithms, through NearestNeighbourSearch::create(), \c createKDTreeLinearHeap() and \c createKDTreeTreeHeap():
+- \c rotation (\c std::string): rotation of the cloud before indexing it, one of \c none, \c pca and \c random; defaults to \c none. With \c pca, the centered cloud is expressed in the eigenvectors of its covariance, so that kd-tree cuts follow its principal axes; this reduces the number of visited leaves for planar structures at arbitrary orientations, such as walls in building scans. With \c random, it is rotated by a random orthonormal matrix. Queries are rotated on the fly, and rotations preserve distances, so results equal those without rotation up to rounding. The search keeps a rotated copy of the cloud. Not available in periodic domains and in similarity search.
+- \c rotationSeed (\c unsigned): seed of the \c random rotation, defaults to 0
+
+The following additional construction parameters are available in the LSH algorithm, whose searches are approximate by construction and ignore the \c epsilon argument of knn():
+- \c tableCount (\c unsigned): number of hash tables, defaults to 8
+- \c hashCount (\c unsigned): number of random projections per table, at most 32, defaults to 12
+- \c probeCount (\c unsigned): number of neighbouring buckets probed per table in addition to the bucket of the query, defaults to 32
+- \c bucketWidth (\c T, the scalar type): width of the buckets along each projection, defaults to 4 times the average distance between a few points and their nearest neighbour in a sample of the cloud
+- \c seed (\c unsigned): seed of the random projections, defaults to 0
+
+The following additional construction parameter is available in the KDTREE algorithm of IntegerNearestNeighbourSearch:
 - \c bucketSize (\c unsigned): bucket size, defaults to 8
 
+The following additional construction parameter is available in the MULTI_INDEX_HASHING algorithm of BinaryNearestNeighbourSearch:
+- \c substringCount (\c unsigned): number of substrings the descriptors are split into, each indexed by its own hash table, defaults to the number of bits divided by the binary logarithm of the number of descriptors
+
+\section KnnGraphParameters k-nearest-neighbour graph parameters
+
+The following additional parameters are available in NearestNeighbourSearch::buildKnnGraph():
+- \c iterationCount (\c unsigned): maximum number of NN-descent iterations, defaults to 10
+- \c sampleRate (\c double): fraction of the k neighbours of a point sampled for joins at each iteration, defaults to 0.5
+- \c terminationRate (\c double): stop when fewer than this fraction of the k x N neighbours changed during an iteration, defaults to 0.001
+- \c treeCount (\c unsigned): number of randomized kd-trees used to initialize neighbours, 0 for random initialization, defaults to 0
+- \c seed (\c unsigned): seed of the random number generators, defaults to 0
+
+\section PyramidParameters Multi-resolution index parameters
+
+The following additional parameters are available in PyramidNearestNeighbourSearch::create():
+- \c levelCount (\c unsigned): number of levels including the full-resolution one, defaults to 4
+- \c voxelSize (\c T, the scalar type): size of the voxels of level 1, defaults to 1/256 of the largest extent of the cloud
+- \c levelScale (\c T, the scalar type): ratio between the voxel sizes of consecutive levels, must be larger than 1, defaults to 2
+- \c bucketSize (\c unsigned): bucket size of the kd-trees, defaults to 8
+
+\section SearchSetParameters Search set parameters
+
+The following additional parameter is available in NearestNeighbourSearchSet::create():
+- \c bucketSize (\c unsigned): bucket size of the kd-trees, defaults to 8
+
+\section SimilaritySearch Similarity search
+
+If \c creationOptionFlags contains \c INNER_PRODUCT or \c COSINE, knn() returns the \c k points of largest inner product or cosine similarity with the query, and \c dists2 holds these similarities instead of squared distances, from the largest to the smallest when \c SORT_RESULTS is set; missing entries are filled with minus infinity.
+With \c BRUTE_FORCE, similarities are computed by blocks of matrix products.
+With the other search types, the search is reduced to a Euclidean one at construction: for \c COSINE the cloud is normalized, for \c INNER_PRODUCT each point \f$x\f$ is augmented with the coordinate \f$\sqrt{M^2 - |x|^2}\f$, where \f$M\f$ is the largest norm in the cloud, and queries with 0.
+The similarities of the returned points are then recomputed exactly.
+In these modes, \c maxRadius must be infinite and \c epsilon applies to the reduced Euclidean search; with \c INNER_PRODUCT, a point of the cloud cannot be identified with the query, so \c ALLOW_SELF_MATCH is implied.
+
 \section UnitTesting Unit testing
 
 The distribution of libnabo integrates a unit test module, based on CTest.
@@ -180,7 +242,7 @@ libnabo differs from \ref ANN on the following points:
 - reentrant
 
 * limitations
-- only euclidean distance
+- only euclidean distance, and Hamming distance for binary descriptors
 - only KD-tree, no BD-tree
 - only ANN_KD_SL_MIDPT splitting rules
 
@@ -272,17 +334,22 @@ namespace Nabo
 			BRUTE_FORCE = 0, //!< brute force, check distance to every point in the data
 			KDTREE_LINEAR_HEAP, //!< kd-tree with linear heap, good for small k (~up to 30)
 			KDTREE_TREE_HEAP, //!< kd-tree with tree heap, good for large k (~from 30)
-			KDTREE_CL_PT_IN_NODES, //!< kd-tree using openCL, pt in nodes, only available if OpenCL enabled, UNSTABLE API
-			KDTREE_CL_PT_IN_LEAVES, //!< kd-tree using openCL, pt in leaves, only available if OpenCL enabled, UNSTABLE API
-			BRUTE_FORCE_CL, //!< brute-force using openCL, only available if OpenCL enabled, UNSTABLE API
+			KDTREE_CL_PT_IN_NODES, //!< kd-tree using openCL, pt in nodes, only available if OpenCL enabled, k up to 32
+			KDTREE_CL_PT_IN_LEAVES, //!< kd-tree using openCL, pt in leaves, only available if OpenCL enabled, k up to 32
+			BRUTE_FORCE_CL, //!< brute-force using openCL, only available if OpenCL enabled, k up to 32
 			KDTREE_CUDA_CLUSTERED, //!< cuda clustered search using recursive warp search
+			BALL_TREE, //!< ball tree with linear heap, good for medium-dimensional spaces (~10 to 30)
+			COVER_TREE, //!< cover tree with linear heap, good for high-dimensional spaces of low intrinsic dimension
+			LSH, //!< locality-sensitive hashing with random projections and multi-probe querying, approximate, good for very high-dimensional spaces (~from 100)
 			SEARCH_TYPE_COUNT //!< number of search types
 		};
 		
 		//! creation option
 		enum CreationOptionFlags
 		{
-			TOUCH_STATISTICS = 1 //!< perform statistics on the number of points touched
+			TOUCH_STATISTICS = 1, //!< perform statistics on the number of points touched, and time the partitioning and node emission of kd-tree construction, see getBuildStatistics()
+			INNER_PRODUCT = 2, //!< rank points by decreasing inner product with the query, see \ref SimilaritySearch
+			COSINE = 4 //!< rank points by decreasing cosine similarity with the query, see \ref SimilaritySearch
 		};
 		
 		//! search option
@@ -331,12 +398,167 @@ namespace Nabo
 		 */
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const = 0;
 		
+		//! Find the k nearest neighbours for each point of query, whose scalar type U differs from the one of the cloud
+		/*!	This allows for instance to query a search on doubles with points in floats, without converting the whole query matrix first.
+		 *	Queries are converted by blocks of 1024 that stay in cache, and these blocks are searched with knn(), whose results are copied into place if the batch has several blocks; U must be float or double.
+		 *	\param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols() 
+		 *	\param k number of nearest neighbour requested
+		 *	\param epsilon maximal ratio of error for approximate search, 0 for exact search; has no effect if the number of neighbour found is smaller than the number requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\param maxRadius maximum radius in which to search, can be used to prune search, is not affected by epsilon
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		template<typename U>
+		unsigned long knn(const Eigen::Matrix<U, Eigen::Dynamic, Eigen::Dynamic>& query, IndexMatrix& indices, Matrix& dists2, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const;
+		
+		//! Find the k nearest neighbours for each point of query, whose scalar type U differs from the one of the cloud
+		/*!	Queries are converted by blocks of 1024 that stay in cache, and these blocks are searched with knn(), whose results are copied into place if the batch has several blocks; U must be float or double.
+		 *	\param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols() 
+		 *	\param maxRadii vector of maximum radii in which to search, used to prune search, is not affected by epsilon
+		 *	\param k number of nearest neighbour requested
+		 *	\param epsilon maximal ratio of error for approximate search, 0 for exact search; has no effect if the number of neighbour found is smaller than the number requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		template<typename U>
+		unsigned long knn(const Eigen::Matrix<U, Eigen::Dynamic, Eigen::Dynamic>& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		
+		//! Cursor over the neighbours of a query, by increasing distance, see createCursor()
+		struct Cursor
+		{
+			//! virtual destructor
+			virtual ~Cursor() {}
+			//! Get the next nearest neighbour
+			/*!	\param index index of the neighbour in the cloud
+			 *	\param dist2 squared distance to the neighbour
+			 *	\return false if no neighbour remains, in which case index and dist2 are unchanged
+			 */
+			virtual bool next(Index& index, T& dist2) = 0;
+		};
+		
+		//! Create a cursor yielding the neighbours of query one at a time, by increasing distance
+		/*!	This allows to consume neighbours until a condition holds, without knowing k in advance.
+		 *	The cursor browses the kd-tree with a priority queue over nodes and points, so its cost is proportional to the number of neighbours consumed [Hjaltason and Samet, Distance browsing in spatial databases, 1999].
+		 *	Only KDTREE_LINEAR_HEAP and KDTREE_TREE_HEAP support cursors, other search types throw a runtime_error.
+		 *	\param query query point
+		 *	\param optionFlags search options, only ALLOW_SELF_MATCH has an effect, neighbours are always sorted
+		 *	\param maxRadius maximum radius in which to search
+		 *	\return a cursor, to be deleted by the caller; it refers to this search and the query is copied
+		 */
+		virtual Cursor* createCursor(const Vector& query, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const;
+		
+		//! Points near a segment, sorted by increasing position along it, see findNearSegments()
+		struct SegmentMatches
+		{
+			IndexVector indices; //!< indices of the points
+			Vector positions; //!< positions of the closest points of the segment, from 0 at its origin to 1 at its end
+			Vector dists2; //!< squared distances from the points to the segment
+		};
+		//! vector of points near segments, one entry per segment
+		typedef std::vector<SegmentMatches> SegmentMatchesVector;
+		
+		//! Find all points within radius of every segment [origins.col(i)..ends.col(i)]
+		/*!	This allows to cast rays in point maps, for instance for visibility checks; rays are segments long enough to cross the map.
+		 *	Segments are searched in parallel, and subtrees are pruned by clipping the range of positions along the segment to the slab of every node, grown by radius.
+		 *	Only KDTREE_LINEAR_HEAP and KDTREE_TREE_HEAP support segment search, other search types throw a runtime_error.
+		 *	\param origins origins of segments, one per column
+		 *	\param ends ends of segments, one per column
+		 *	\param matches points near every segment, resized to origins.cols()
+		 *	\param radius maximum distance from points to segments
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		virtual unsigned long findNearSegments(const Matrix& origins, const Matrix& ends, SegmentMatchesVector& matches, const T radius) const;
+		
+		//! Durations and memory of the construction of a search, see getBuildStatistics()
+		struct BuildStatistics
+		{
+			double boundsDuration; //!< time to compute the bounding box and the vector of points to index, in seconds
+			double treeDuration; //!< time of the recursive construction of the tree, in seconds
+			double partitionDuration; //!< part of treeDuration spent choosing cuts and partitioning points, in seconds; measured only with TOUCH_STATISTICS
+			double nodeEmissionDuration; //!< part of treeDuration spent appending nodes and bucket entries, in seconds; measured only with TOUCH_STATISTICS
+			double reorderingDuration; //!< time to copy leaf coordinates to compact storage, in seconds
+			double totalDuration; //!< time of the whole construction, in seconds
+			size_t peakBuildMemory; //!< peak number of bytes allocated by the construction, including temporary vectors and the copies made while vectors grow
+			size_t memory; //!< number of bytes of the constructed index, excluding the cloud
+			
+			//! constructor, zeroes all fields
+			BuildStatistics(): boundsDuration(0), treeDuration(0), partitionDuration(0), nodeEmissionDuration(0), reorderingDuration(0), totalDuration(0), peakBuildMemory(0), memory(0) {}
+		};
+		
+		//! Return durations and memory of the construction of this search, to attribute build regressions to their phase
+		/*!	Only KDTREE_LINEAR_HEAP and KDTREE_TREE_HEAP record statistics, other search types return zeroes. */
+		const BuildStatistics& getBuildStatistics() const { return buildStatistics; }
+		
+		//! Return the number of bytes of the index, excluding the cloud
+		/*!	Brute-force search has no index and returns 0, as do the OpenCL and CUDA searches, whose structures are on the device.
+		 *	See estimateMemory() to know this size before creating the search. */
+		virtual size_t memoryUsage() const { return 0; }
+		
+		//! Expected number of bytes of an index, see estimateMemory()
+		struct MemoryEstimate
+		{
+			size_t nodes; //!< bytes of the nodes of trees, or of the random projections of LSH
+			size_t buckets; //!< bytes of the references to points in the leaves of trees, or in the hash tables of LSH
+			size_t points; //!< bytes of the copies of coordinates, such as the compact leaf storage of kd-trees or the transformed cloud of similarity search
+			
+			//! constructor, zeroes all fields
+			MemoryEstimate(): nodes(0), buckets(0), points(0) {}
+			//! return the total number of bytes
+			size_t total() const { return nodes + buckets + points; }
+		};
+		
+		//! Estimate the number of bytes of the index that create() would build, excluding the cloud, without building it
+		/*!	The sizes of kd-tree nodes depend on the distribution of the points and are estimated from their typical fill of the leaves, the number of distinct keys in the hash tables of LSH is bounded by the number of points; the other sizes are exact.
+		 *	The counters of the \c metrics parameter, of constant size, are not included.
+		 *	\param type type of search, one of SearchType; OpenCL and CUDA searches are not supported
+		 *	\param pointCount number of points in the cloud
+		 *	\param dim number of dimensions to consider
+		 *	\param creationOptionFlags creation options, a bitwise OR of elements of CreationOptionFlags
+		 *	\param additionalParameters additional parameters, as passed to create()
+		 *	\return expected number of bytes, compare its total() with memoryUsage() once built */
+		static MemoryEstimate estimateMemory(const SearchType type, const Index pointCount, const Index dim, const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
+		
+		//! Snapshot of cumulative metrics on the calls to knn() of a search created with the \c metrics parameter, see getMetrics()
+		/*!	Counters only grow; subtract an earlier snapshot to get the metrics of an interval, for instance to export rates. */
+		struct Metrics
+		{
+			//! number of buckets of kCounts
+			static const int K_BUCKET_COUNT = 32;
+			//! number of buckets of latencyCounts
+			static const int LATENCY_BUCKET_COUNT = 128;
+			
+			double duration; //!< time covered by the snapshot, in seconds, from the creation of the search
+			boost::uint64_t callCount; //!< number of calls to knn()
+			boost::uint64_t queryCount; //!< number of query points
+			boost::uint64_t touchedCount; //!< number of points touched, if creationOptionFlags contains TOUCH_STATISTICS, 0 otherwise
+			boost::uint64_t kCounts[K_BUCKET_COUNT]; //!< number of calls per k, bucket i counting k in [2^i, 2^(i+1)[
+			boost::uint64_t latencyCounts[LATENCY_BUCKET_COUNT]; //!< number of calls per duration, bucket i counting durations in [2^(i/4), 2^((i+1)/4)[ microseconds, the first and last buckets also counting shorter and longer ones
+			
+			//! constructor, zeroes all fields
+			Metrics();
+			//! Return the metrics of the interval between that, an earlier snapshot, and this one
+			Metrics operator -(const Metrics& that) const;
+			//! Return the number of query points per second
+			double getQueriesPerSecond() const;
+			//! Return the upper bound of the duration of a fraction p of the calls, in seconds, within 19 %
+			double getLatencyPercentile(const double p) const;
+		};
+		
+		//! Return a snapshot of the metrics of this search, merging the counters of all threads
+		/*!	Only searches created with the \c metrics parameter collect metrics, for others this function throws a runtime_error.
+		 *	It can be called while other threads search, the snapshot then includes part of the running calls. */
+		virtual Metrics getMetrics() const;
+		
 		//! Create a nearest-neighbour search
 		/*!	\param cloud data-point cloud in which to search
 		 *	\param dim number of dimensions to consider, must be lower or equal to cloud.rows()
 		 *	\param preferedType type of search, one of SearchType
 		 *	\param creationOptionFlags creation options, a bitwise OR of elements of CreationOptionFlags
-		 *	\param additionalParameters additional parameters, currently only useful for KDTREE_
+		 *	\param additionalParameters additional parameters, currently only useful for KDTREE_, BALL_TREE, COVER_TREE and LSH
 		 *	\return an object on which to run nearest neighbour queries */
 		static NearestNeighbourSearch* create(const Matrix& cloud, const Index dim = std::numeric_limits<Index>::max(), const SearchType preferedType = KDTREE_LINEAR_HEAP, const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
 		
@@ -366,10 +588,40 @@ namespace Nabo
 		 * 	\return an object on which to run nearest neighbour queries */
 		static NearestNeighbourSearch* createKDTreeTreeHeap(const Matrix& cloud, const Index dim = std::numeric_limits<Index>::max(), const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
 		
+		//! Build an approximate k-nearest-neighbour graph of cloud, using parallel NN-descent
+		/*!	Every point starts with random neighbours, or with neighbours found in the leaves of randomized kd-trees,
+		 *	and then repeatedly considers the neighbours of its neighbours [Dong et al., Efficient k-nearest neighbor graph construction for generic similarity measures, 2011].
+		 *	A point is never its own neighbour. Neighbours are sorted by increasing distance.
+		 *	\param cloud data-point cloud, the nodes of the graph
+		 *	\param indices indices of nearest neighbours of every point, must be of size k x cloud.cols()
+		 *	\param dists2 squared distances to nearest neighbours of every point, must be of size k x cloud.cols()
+		 *	\param k number of neighbours per point, must be smaller than cloud.cols()
+		 *	\param dim number of dimensions to consider, must be lower or equal to cloud.rows()
+		 *	\param additionalParameters additional parameters, see \ref KnnGraphParameters
+		 *	\return the number of distances computed */
+		static unsigned long buildKnnGraph(const Matrix& cloud, IndexMatrix& indices, Matrix& dists2, const Index k, const Index dim = std::numeric_limits<Index>::max(), const Parameters& additionalParameters = Parameters());
+		
+		//! Cluster cloud into connected components of points closer than radius, optionally with the DBSCAN rule
+		/*!	Two points are neighbours if their distance is at most radius. A point is a core point if it has at least minPoints neighbours, itself included.
+		 *	Clusters are the connected components of core points, plus the non-core points that are neighbours of a core point, which join the cluster of their core neighbour of smallest index [Ester et al., A density-based algorithm for discovering clusters in large spatial databases with noise, 1996].
+		 *	With minPoints at most 1, every point is a core point and clusters are the connected components of the neighbour graph (Euclidean cluster extraction).
+		 *	Neighbour pairs are found from a kd-tree, by batches of a leaf against all leaves within radius of its points, and joined in parallel with a lock-free union-find.
+		 *	\param cloud data-point cloud
+		 *	\param labels cluster of every point, clusters being numbered from 0 in order of their core point of smallest index, -1 for noise; must be of size cloud.cols()
+		 *	\param radius maximum distance between neighbours
+		 *	\param minPoints minimum number of neighbours of core points, including themselves
+		 *	\param dim number of dimensions to consider, must be lower or equal to cloud.rows()
+		 *	\param additionalParameters additional parameters of the kd-tree, see \ref ConstructionParameters
+		 *	\return the number of clusters */
+		static Index cluster(const Matrix& cloud, IndexVector& labels, const T radius, const Index minPoints = 1, const Index dim = std::numeric_limits<Index>::max(), const Parameters& additionalParameters = Parameters());
+		
 		//! virtual destructor
 		virtual ~NearestNeighbourSearch() {}
 		
 	protected:
+		//! statistics on the construction, filled by search types that record them
+		BuildStatistics buildStatistics;
+		
 		//! constructor
 		NearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags);
 		
@@ -383,12 +635,367 @@ namespace Nabo
 		void checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const Matrix& dists2, const Index k, const unsigned optionFlags, const Vector* maxRadii = 0) const;
 	};
 	
+	//! Nearest neighbour search for binary descriptors (such as ORB or BRIEF), using the Hamming distance
+	struct BinaryNearestNeighbourSearch
+	{
+		//! a 64-bit word holding 64 bits of a descriptor
+		typedef boost::uint64_t Word;
+		//! a column-major Eigen matrix in which each column is a descriptor, packed in 64-bit words; unused bits must be 0
+		typedef Eigen::Matrix<Word, Eigen::Dynamic, Eigen::Dynamic> DescriptorMatrix;
+		//! an index to a column of a DescriptorMatrix, for refering to descriptors
+		typedef int Index;
+		//! a Hamming distance, i.e. a number of differing bits
+		typedef int Distance;
+		//! a vector of Hamming distances
+		typedef Eigen::Matrix<Distance, Eigen::Dynamic, 1> DistanceVector;
+		//! a matrix of Hamming distances
+		typedef Eigen::Matrix<Distance, Eigen::Dynamic, Eigen::Dynamic> DistanceMatrix;
+		//! a matrix of indices to descriptors
+		typedef Eigen::Matrix<Index, Eigen::Dynamic, Eigen::Dynamic> IndexMatrix;
+		
+		//! the reference to the descriptors, which must remain valid during the lifetime of the BinaryNearestNeighbourSearch object
+		const DescriptorMatrix& descriptors;
+		//! the number of 64-bit words per descriptor
+		const Index wordCount;
+		//! creation options
+		const unsigned creationOptionFlags;
+		
+		//! type of search
+		enum SearchType
+		{
+			BRUTE_FORCE = 0, //!< brute force, use POPCNT or AVX-512 VPOPCNTDQ when the CPU supports them
+			MULTI_INDEX_HASHING, //!< exact multi-index hashing, sub-linear when neighbours are close compared to the descriptor length
+			SEARCH_TYPE_COUNT //!< number of search types
+		};
+		
+		//! creation option
+		enum CreationOptionFlags
+		{
+			TOUCH_STATISTICS = 1 //!< perform statistics on the number of descriptors touched
+		};
+		
+		//! search option
+		enum SearchOptionFlags
+		{
+			ALLOW_SELF_MATCH = 1, //!< allows the return of descriptors at distance 0 of the query; forbidden by default
+			SORT_RESULTS = 2 //!< sort descriptors by distances, when k > 1; do not sort by default
+		};
+		
+		//! Find the k nearest neighbours for each descriptor of query
+		/*!	If the search finds less than k descriptors, the empty entries in dists will be filled with std::numeric_limits<Distance>::max() and the indices with 0.
+		 *	\param query query descriptors, must have wordCount rows
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists Hamming distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\param maxDist maximum Hamming distance in which to search
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of descriptors touched, otherwise return 0
+		 */
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const Index k = 1, const unsigned optionFlags = 0, const Distance maxDist = std::numeric_limits<Distance>::max()) const = 0;
+		
+		//! Find the k nearest neighbours for each descriptor of query
+		/*!	If the search finds less than k descriptors, the empty entries in dists will be filled with std::numeric_limits<Distance>::max() and the indices with 0.
+		 *	\param query query descriptors, must have wordCount rows
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists Hamming distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param maxDists vector of maximum Hamming distances in which to search
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of descriptors touched, otherwise return 0
+		 */
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const DistanceVector& maxDists, const Index k = 1, const unsigned optionFlags = 0) const = 0;
+		
+		//! Create a nearest-neighbour search for binary descriptors
+		/*!	\param descriptors descriptors in which to search, one per column
+		 *	\param preferedType type of search, one of SearchType
+		 *	\param creationOptionFlags creation options, a bitwise OR of elements of CreationOptionFlags
+		 *	\param additionalParameters additional parameters, currently only useful for MULTI_INDEX_HASHING
+		 *	\return an object on which to run nearest neighbour queries */
+		static BinaryNearestNeighbourSearch* create(const DescriptorMatrix& descriptors, const SearchType preferedType = BRUTE_FORCE, const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
+		
+		//! virtual destructor
+		virtual ~BinaryNearestNeighbourSearch() {}
+		
+	protected:
+		//! constructor
+		BinaryNearestNeighbourSearch(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags);
+		
+		//! Make sure that the output matrices have the right sizes. Throw an exception otherwise.
+		/*!	\param query query descriptors
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists Hamming distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags the options passed to knn()
+		 *	\param maxDists if non 0, maximum distances, must be of size query.cols() */
+		void checkSizesKnn(const DescriptorMatrix& query, const IndexMatrix& indices, const DistanceMatrix& dists, const Index k, const unsigned optionFlags, const DistanceVector* maxDists = 0) const;
+	};
+	
+	//! Nearest neighbour search for points with integer coordinates, templatized on coordinate type
+	/*!	Points are searched in place, without conversion, and squared distances are accumulated in unsigned 64-bit integers.
+	 *	They are exact below 2^64, which always holds for boost::int16_t coordinates, and for boost::int32_t coordinates in one dimension or when differences along every dimension are below 2^32 / sqrt(dim), for instance 2^31 in 3D.
+	 *	Larger squared distances saturate at std::numeric_limits<Distance>::max() - 1: such points are still found, farther than all others, but they compare equal among themselves.
+	 *	Instantiated for boost::int16_t and boost::int32_t.
+	 */
+	template<typename T>
+	struct IntegerNearestNeighbourSearch
+	{
+		//! an Eigen vector of type T, to hold the coordinates of a point
+		typedef typename Eigen::Matrix<T, Eigen::Dynamic, 1> Vector;
+		//! a column-major Eigen matrix in which each column is a point; this matrix has dim rows
+		typedef typename Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		//! an index to a Vector or a Matrix, for refering to data points
+		typedef int Index;
+		//! a vector of indices to data points
+		typedef typename Eigen::Matrix<Index, Eigen::Dynamic, 1> IndexVector;
+		//! a matrix of indices to data points
+		typedef typename Eigen::Matrix<Index, Eigen::Dynamic, Eigen::Dynamic> IndexMatrix;
+		//! a squared distance
+		typedef boost::uint64_t Distance;
+		//! a vector of squared distances
+		typedef Eigen::Matrix<Distance, Eigen::Dynamic, 1> DistanceVector;
+		//! a matrix of squared distances
+		typedef Eigen::Matrix<Distance, Eigen::Dynamic, Eigen::Dynamic> DistanceMatrix;
+		
+		//! the reference to the data-point cloud, which must remain valid during the lifetime of the IntegerNearestNeighbourSearch object
+		const Matrix& cloud;
+		//! the dimensionality of the data-point cloud
+		const Index dim;
+		//! creation options
+		const unsigned creationOptionFlags;
+		
+		//! type of search
+		enum SearchType
+		{
+			BRUTE_FORCE = 0, //!< brute force, check distance to every point in the data
+			KDTREE, //!< kd-tree splitting at the median of the dimension of largest spread, with a linear heap
+			SEARCH_TYPE_COUNT //!< number of search types
+		};
+		
+		//! creation option
+		enum CreationOptionFlags
+		{
+			TOUCH_STATISTICS = 1 //!< perform statistics on the number of points touched
+		};
+		
+		//! search option
+		enum SearchOptionFlags
+		{
+			ALLOW_SELF_MATCH = 1, //!< allows the return of the same point as the query, if this point is in the data cloud; forbidden by default
+			SORT_RESULTS = 2 //!< sort points by distances, when k > 1; do not sort by default
+		};
+		
+		//! Find the k nearest neighbours for each point of query
+		/*!	If the search finds less than k points, the empty entries in dists2 will be filled with std::numeric_limits<Distance>::max() and the indices with 0.
+		 *	\param query query points, each column is a point
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\param maxDist2 maximum squared distance in which to search
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const Index k = 1, const unsigned optionFlags = 0, const Distance maxDist2 = std::numeric_limits<Distance>::max()) const = 0;
+		
+		//! Find the k nearest neighbours for each point of query
+		/*!	If the search finds less than k points, the empty entries in dists2 will be filled with std::numeric_limits<Distance>::max() and the indices with 0.
+		 *	\param query query points, each column is a point
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param maxDists2 vector of maximum squared distances in which to search
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags search options, a bitwise OR of elements of SearchOptionFlags
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const DistanceVector& maxDists2, const Index k = 1, const unsigned optionFlags = 0) const = 0;
+		
+		//! Create a nearest-neighbour search for points with integer coordinates
+		/*!	\param cloud data-point cloud in which to search
+		 *	\param dim number of dimensions to consider, must be lower or equal to cloud.rows()
+		 *	\param preferedType type of search, one of SearchType
+		 *	\param creationOptionFlags creation options, a bitwise OR of elements of CreationOptionFlags
+		 *	\param additionalParameters additional parameters, currently only useful for KDTREE
+		 *	\return an object on which to run nearest neighbour queries */
+		static IntegerNearestNeighbourSearch* create(const Matrix& cloud, const Index dim = std::numeric_limits<Index>::max(), const SearchType preferedType = KDTREE, const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
+		
+		//! virtual destructor
+		virtual ~IntegerNearestNeighbourSearch() {}
+		
+	protected:
+		//! constructor
+		IntegerNearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags);
+		
+		//! Make sure that the output matrices have the right sizes. Throw an exception otherwise.
+		/*!	\param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags the options passed to knn()
+		 *	\param maxDists2 if non 0, maximum squared distances, must be of size query.cols() */
+		void checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const DistanceVector* maxDists2 = 0) const;
+	};
+	
+	//! Multi-resolution index over voxel-downsampled levels of a point cloud, for coarse-to-fine registration
+	/*!	Level 0 holds all the points of the cloud; every following level keeps, in every voxel, the point of the previous level closest to the voxel center, voxels growing by a constant factor from one level to the next.
+	 *	Coarser levels are thus subsets of finer ones.
+	 *	All levels are built in one pass and share a single copy of the cloud, reordered such that every level is a prefix of it, each level being searched by its own kd-tree.
+	 *	Returned indices always refer to columns of the original cloud.
+	 *	Construction parameters are described in \ref PyramidParameters.
+	 */
+	template<typename T>
+	struct PyramidNearestNeighbourSearch
+	{
+		//! an Eigen vector of type T, to hold the coordinates of a point
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		//! a column-major Eigen matrix in which each column is a point; this matrix has dim rows
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		//! an index to a Vector or a Matrix, for refering to data points
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		//! a vector of indices to data points
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		//! a matrix of indices to data points
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		//! the reference to the data-point cloud, which must remain valid during the lifetime of the PyramidNearestNeighbourSearch object
+		const Matrix& cloud;
+		//! the dimensionality of the data-point cloud
+		const Index dim;
+		//! creation options, a bitwise OR of elements of NearestNeighbourSearch::CreationOptionFlags; only TOUCH_STATISTICS is supported
+		const unsigned creationOptionFlags;
+		//! number of levels, level 0 being the full-resolution cloud
+		const Index levelCount;
+		
+		//! Return the number of points in a level
+		/*!	\param level level, between 0 (finest) and levelCount-1 (coarsest)
+		 *	\return number of points in level */
+		virtual Index getLevelSize(const Index level) const = 0;
+		
+		//! Find the k nearest neighbours of each point of query among the points of a level
+		/*!	If the search finds less than k points, the empty entries in dists2 will be filled with infinity and the indices with 0.
+		 *	\param query query points, each column is a point
+		 *	\param indices indices of nearest neighbours in cloud, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param level level in which to search, between 0 (finest) and levelCount-1 (coarsest)
+		 *	\param k number of nearest neighbour requested
+		 *	\param epsilon maximal ratio of error for approximate search, 0 for exact search
+		 *	\param optionFlags search options, a bitwise OR of elements of NearestNeighbourSearch::SearchOptionFlags
+		 *	\param maxRadius maximum radius in which to search
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched, otherwise return 0
+		 */
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const = 0;
+		
+		//! Find the k nearest neighbours of each point of query among the points of a level, bounding the search by the result in a coarser level
+		/*!	The k nearest neighbours are first searched in coarseLevel, and the distance to the k-th one is used as maximum radius of the search in level.
+		 *	As coarser levels are subsets of finer ones, this bound does not change the result with respect to knn(), but prunes the search from its start.
+		 *	\param query query points, each column is a point
+		 *	\param indices indices of nearest neighbours in cloud, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param level level in which to search, between 0 (finest) and levelCount-1 (coarsest)
+		 *	\param coarseLevel level providing the bound, between level and levelCount-1
+		 *	\param k number of nearest neighbour requested
+		 *	\param epsilon maximal ratio of error for approximate search, 0 for exact search
+		 *	\param optionFlags search options, a bitwise OR of elements of NearestNeighbourSearch::SearchOptionFlags
+		 *	\return if creationOptionFlags contains TOUCH_STATISTICS, return the number of point touched in both levels, otherwise return 0
+		 */
+		virtual unsigned long knnCoarseToFine(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index coarseLevel, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const = 0;
+		
+		//! Create a multi-resolution index over a point cloud
+		/*!	\param cloud data-point cloud in which to search
+		 *	\param dim number of dimensions to consider, must be lower or equal to cloud.rows()
+		 *	\param creationOptionFlags creation options, a bitwise OR of elements of NearestNeighbourSearch::CreationOptionFlags
+		 *	\param additionalParameters additional parameters, see \ref PyramidParameters
+		 *	\return an object on which to run nearest neighbour queries */
+		static PyramidNearestNeighbourSearch* create(const Matrix& cloud, const Index dim = std::numeric_limits<Index>::max(), const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
+		
+		//! virtual destructor
+		virtual ~PyramidNearestNeighbourSearch() {}
+		
+	protected:
+		//! constructor
+		PyramidNearestNeighbourSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Index levelCount);
+		
+		//! Make sure that the level and the output matrices have the right sizes. Throw an exception otherwise.
+		/*!	\param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param level level in which to search
+		 *	\param k number of nearest neighbour requested
+		 *	\param optionFlags the options passed to knn() */
+		void checkSizesKnn(const Matrix& query, const IndexMatrix& indices, const Matrix& dists2, const Index level, const Index k, const unsigned optionFlags) const;
+	};
+	
+	//! Set of small kd-trees built together, each indexing its own point cloud
+	/*!	All trees are built in parallel, and their nodes and buckets are then stored in a single arena, which is freed in one operation when the set is deleted.
+	 *	Every tree is accessed through a lightweight NearestNeighbourSearch object, on which knn() is called as usual.
+	 *	These objects search on the calling thread, so that many of them can be searched in parallel.
+	 *	Construction parameters are described in \ref SearchSetParameters.
+	 */
+	template<typename T>
+	struct NearestNeighbourSearchSet
+	{
+		//! an Eigen vector of type T, to hold the coordinates of a point
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		//! a column-major Eigen matrix in which each column is a point; this matrix has dim rows
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		//! an index to a Vector or a Matrix, for refering to data points
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		//! a vector of indices to data points
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		//! a matrix of indices to data points
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		//! the maximum number of dimensions to consider, each search using min(dim, cloud.rows()) dimensions of its cloud
+		const Index dim;
+		//! creation options, a bitwise OR of elements of NearestNeighbourSearch::CreationOptionFlags; only TOUCH_STATISTICS is supported
+		const unsigned creationOptionFlags;
+		
+		//! Return the number of searches in the set, which is the number of clouds passed to create()
+		virtual Index getSearchCount() const = 0;
+		
+		//! Return the search in the i-th cloud
+		/*!	The returned object remains valid during the lifetime of the set.
+		 *	\param i index of the cloud, between 0 and getSearchCount()-1
+		 *	\return the search whose returned indices refer to columns of the i-th cloud */
+		virtual const NearestNeighbourSearch<T>& getSearch(const Index i) const = 0;
+		
+		//! Return the size of the arena holding the nodes and buckets of all trees, in bytes
+		virtual size_t getArenaSize() const = 0;
+		
+		//! Create a set of kd-trees, one per point cloud
+		/*!	\param clouds data-point clouds in which to search, which, as the vector holding them, must remain valid during the lifetime of the set
+		 *	\param dim maximum number of dimensions to consider
+		 *	\param creationOptionFlags creation options, a bitwise OR of elements of NearestNeighbourSearch::CreationOptionFlags
+		 *	\param additionalParameters additional parameters, see \ref SearchSetParameters
+		 *	\return an object holding the searches */
+		static NearestNeighbourSearchSet* create(const std::vector<Matrix>& clouds, const Index dim = std::numeric_limits<Index>::max(), const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters());
+		
+		//! virtual destructor
+		virtual ~NearestNeighbourSearchSet() {}
+		
+	protected:
+		//! constructor
+		NearestNeighbourSearchSet(const Index dim, const unsigned creationOptionFlags);
+	};
+	
 	// Convenience typedefs
 	
 	//! nearest neighbour search with scalars of type float
 	typedef NearestNeighbourSearch<float> NNSearchF;
 	//! nearest neighbour search with scalars of type double
 	typedef NearestNeighbourSearch<double> NNSearchD;
+	//! nearest neighbour search for binary descriptors
+	typedef BinaryNearestNeighbourSearch BinaryNNSearch;
+	//! nearest neighbour search with coordinates of type boost::int16_t
+	typedef IntegerNearestNeighbourSearch<boost::int16_t> NNSearchI16;
+	//! nearest neighbour search with coordinates of type boost::int32_t
+	typedef IntegerNearestNeighbourSearch<boost::int32_t> NNSearchI32;
+	//! multi-resolution nearest neighbour search with scalars of type float
+	typedef PyramidNearestNeighbourSearch<float> PyramidNNSearchF;
+	//! multi-resolution nearest neighbour search with scalars of type double
+	typedef PyramidNearestNeighbourSearch<double> PyramidNNSearchD;
+	//! set of nearest neighbour searches with scalars of type float
+	typedef NearestNeighbourSearchSet<float> NNSearchSetF;
+	//! set of nearest neighbour searches with scalars of type double
+	typedef NearestNeighbourSearchSet<double> NNSearchSetD;
 	
 	//@}
 }
@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef BOOST_STDINT
 	#include <boost/cstdint.hpp>
 	using boost::uint32_t;
+	using boost::uint64_t;
 #else // BOOST_STDINT
 	#include <stdint.h>
 #endif // BOOST_STDINT
@@ -44,7 +45,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // OpenCL
 #ifdef HAVE_OPENCL
 	#define __CL_ENABLE_EXCEPTIONS
+	#ifndef CL_TARGET_OPENCL_VERSION
+		#define CL_TARGET_OPENCL_VERSION 120
+	#endif // CL_TARGET_OPENCL_VERSION
 	#include "CL/cl.hpp"
+	#include <boost/thread/mutex.hpp>
 #endif // HAVE_OPENCL
 
 // CUDA
@@ -78,6 +83,173 @@ namespace Nabo
 		return (v0 - v1).squaredNorm();
 	}
 
+	//! Return the index of the maximum value of a vector of positive values
+	/** \param v vector of positive values
+	 * \return index of maximum value, 0 if the vector is empty
+	 */
+	template<typename T>
+	inline size_t argMax(const typename NearestNeighbourSearch<T>::Vector& v)
+	{
+		T maxVal(0);
+		size_t maxIdx(0);
+		for (int i = 0; i < v.size(); ++i)
+		{
+			if (v[i] > maxVal)
+			{
+				maxVal = v[i];
+				maxIdx = i;
+			}
+		}
+		return maxIdx;
+	}
+
+	//! Return the number of bit required to store a value
+	/** \param v value to store
+	 * \return number of bits required
+	 */
+	template<typename T>
+	inline T getStorageBitCount(T v)
+	{
+		for (T i = 0; i < 64; ++i)
+		{
+			if (v == 0)
+				return i;
+			v >>= 1;
+		}
+		return 64;
+	}
+
+	//! Set of the point indices already seen by a query, whose size follows the number of indices seen rather than the number of points
+	/** Open addressing with linear probing, kept at most half full. Every slot
+	 *	holds the stamp of the query that filled it, so that clear() is O(1)
+	 *	and the set can be reused from query to query and call to call. */
+	class VisitedSet
+	{
+	public:
+		//! construct an empty set
+		VisitedSet():
+			stamp(1),
+			count(0),
+			bitCount(0)
+		{
+			rehash(6);
+		}
+
+		//! remove all indices
+		void clear()
+		{
+			count = 0;
+			++stamp;
+			if (stamp == 0)
+			{
+				for (size_t i = 0; i < slots.size(); ++i)
+					slots[i].stamp = 0;
+				stamp = 1;
+			}
+		}
+
+		//! add index, return false if it was already in the set
+		bool insert(const int index)
+		{
+			if (2 * (count + 1) > slots.size())
+				rehash(bitCount + 1);
+			const size_t mask(slots.size() - 1);
+			for (size_t i = hash(index); ; i = (i + 1) & mask)
+			{
+				Slot& slot(slots[i]);
+				if (slot.stamp != stamp)
+				{
+					slot.index = index;
+					slot.stamp = stamp;
+					++count;
+					return true;
+				}
+				if (slot.index == index)
+					return false;
+			}
+		}
+
+	protected:
+		//! an index and the stamp of the query that added it
+		struct Slot
+		{
+			int index; //!< index of the point
+			uint32_t stamp; //!< the slot is in the set if this is the current stamp
+		};
+
+		std::vector<Slot> slots; //!< slots, a power of two of them
+		uint32_t stamp; //!< stamp of the current query
+		size_t count; //!< number of indices in the set
+		int bitCount; //!< log2 of the number of slots
+
+		//! return the first slot to probe for index, Fibonacci hashing keeps the high bits of the product
+		size_t hash(const int index) const
+		{
+			return size_t((uint32_t(index) * 2654435769U) >> (32 - bitCount));
+		}
+
+		//! resize to 2^newBitCount slots, keeping the indices of the set
+		void rehash(const int newBitCount)
+		{
+			std::vector<Slot> oldSlots(size_t(1) << newBitCount);
+			oldSlots.swap(slots);
+			for (size_t i = 0; i < slots.size(); ++i)
+				slots[i].stamp = 0;
+			const uint32_t oldStamp(stamp);
+			bitCount = newBitCount;
+			count = 0;
+			stamp = 1;
+			for (size_t i = 0; i < oldSlots.size(); ++i)
+				if (oldSlots[i].stamp == oldStamp)
+					insert(oldSlots[i].index);
+		}
+	};
+
+	//! Return a monotonic wall-clock time in seconds, for timing phases of construction
+	double getWallTime();
+	
+	//! Sets of vectorized cpu kernels built into the library
+	enum CpuKernelSet
+	{
+		CPU_KERNELS_SCALAR = 0, //!< portable code
+		CPU_KERNELS_SSE42, //!< x86 SSE4.2
+		CPU_KERNELS_AVX2, //!< x86 AVX2
+		CPU_KERNELS_AVX512, //!< x86 AVX-512F
+		CPU_KERNELS_NEON, //!< 64-bit ARM NEON
+		CPU_KERNELS_COUNT //!< number of kernel sets
+	};
+	
+	//! Return the name of kernelSet, as accepted by the cpuKernels parameter
+	const char* getCpuKernelSetName(const CpuKernelSet kernelSet);
+	//! Return whether both this build and the running CPU support kernelSet
+	bool isCpuKernelSetSupported(const CpuKernelSet kernelSet);
+	//! Return the kernel set named by the cpuKernels parameter, or else by the NABO_CPU_KERNELS environment variable, or else the widest one supported; throw if the requested set is unknown or unsupported
+	CpuKernelSet selectCpuKernelSet(const Parameters& additionalParameters);
+	
+	//! Kernels computing squared Euclidean distances, selected for a given kernel set at construction
+	template<typename T>
+	struct DistanceKernels
+	{
+		//! return the squared distance between the dim coordinates at a and b
+		typedef T (*Dist2Function)(const T* a, const T* b, const int dim);
+		//! compute into dists2 the squared distances between query and count points, whose dim coordinates start every stride values from points
+		typedef void (*TileDist2Function)(const T* query, const T* points, const int dim, const int stride, const int count, T* dists2);
+		//! write into selected the indices of the count values lower or equal to threshold, and return their number
+		typedef int (*SelectBelowFunction)(const T* values, const int count, const T threshold, int* selected);
+		
+		//! distance between two points
+		Dist2Function dist2;
+		//! distances between a query and a tile of points
+		TileDist2Function tileDist2;
+		//! filter of candidates before heap insertion
+		SelectBelowFunction selectBelow;
+		//! set of the selected kernels, scalar if the requested one is not built
+		CpuKernelSet kernelSet;
+		
+		//! select kernels of kernelSet
+		DistanceKernels(const CpuKernelSet kernelSet);
+	};
+	
 	//! Brute-force nearest neighbour
 	template<typename T>
 	struct BruteForceSearch: public NearestNeighbourSearch<T>
@@ -94,12 +266,37 @@ namespace Nabo
 		using NearestNeighbourSearch<T>::minBound;
 		using NearestNeighbourSearch<T>::maxBound;
 
+		//! selected distance kernels
+		const DistanceKernels<T> kernels;
+		
 		//! constructor, calls NearestNeighbourSearch<T>(cloud)
-		BruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags);
+		BruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters = Parameters());
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
 	};
 	
+	//! Return the IEEE 754 half-precision value nearest to v, rounding ties to even
+	uint16_t floatToHalf(const float v);
+	//! Return the bfloat16 value nearest to v, rounding ties to even
+	uint16_t floatToBfloat16(const float v);
+	
+	//! Kernels converting 16-bit floating-point values to float, the fastest ones supported by the running CPU are selected at construction
+	struct HalfFloatKernels
+	{
+		//! convert count 16-bit values from src to float into dst
+		typedef void (*ToFloatFunction)(const uint16_t* src, float* dst, const int count);
+		
+		//! kernel for IEEE 754 half-precision values
+		ToFloatFunction halfToFloat;
+		//! kernel for bfloat16 values
+		ToFloatFunction bfloat16ToFloat;
+		//! name of the selected kernels, for information
+		const char* name;
+		
+		//! select the kernels of kernelSet, or the portable ones if kernelSet has none
+		HalfFloatKernels(const CpuKernelSet kernelSet);
+	};
+	
 	//! KDTree, unbalanced, points in leaves, stack, implicit bounds, ANN_KD_SL_MIDPT, optimised implementation
 	template<typename T, typename Heap>
 	struct KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt: public NearestNeighbourSearch<T>
@@ -127,6 +324,27 @@ namespace Nabo
 		
 		//! size of bucket
 		const unsigned bucketSize;
+		//! for periodic domains, size of the domain along every dimension, infinity for non-periodic dimensions; empty otherwise
+		Vector periodicSizes;
+		
+		//! format of the compact copy of leaf coordinates
+		enum LeafStorage
+		{
+			LEAF_STORAGE_FULL = 0, //!< no compact copy, leaves read the cloud
+			LEAF_STORAGE_HALF, //!< IEEE 754 half precision
+			LEAF_STORAGE_BFLOAT16, //!< bfloat16
+			LEAF_STORAGE_COUNT //!< number of formats
+		};
+		//! format of the compact copy of leaf coordinates, one of LeafStorage
+		const unsigned leafStorage;
+		//! for compact leaf storage, coordinates of every bucket entry relative to the first entry of its bucket, dim 16-bit values per entry; empty otherwise
+		std::vector<uint16_t> leafCoordinates;
+		//! for compact leaf storage, upper bound of the distance between every bucket entry and its compact coordinates
+		std::vector<float> leafErrors;
+		//! selected conversion kernels
+		const HalfFloatKernels leafKernels;
+		//! selected distance kernels, used in leaves of higher-dimensional trees
+		const DistanceKernels<T> distanceKernels;
 		
 		//! number of bits required to store dimension index + number of dimensions
 		const uint32_t dimBitCount;
@@ -191,6 +409,12 @@ namespace Nabo
 		std::pair<T,T> getBounds(const BuildPointsIt first, const BuildPointsIt last, const unsigned dim);
 		//! construct nodes for points [first..last[ inside the hyperrectangle [minValues..maxValues]
 		unsigned buildNodes(const BuildPointsIt first, const BuildPointsIt last, const Vector minValues, const Vector maxValues);
+		//! fill leafCoordinates and leafErrors from buckets
+		void buildLeafStorage();
+		//! number of bytes of temporary vectors during construction, to which the sizes of nodes and buckets are added to track peak memory
+		size_t buildPointsMemory;
+		//! after appending to nodes and buckets, update buildStatistics.peakBuildMemory, counting both old and new storage of vectors that grew
+		void updatePeakBuildMemory(const size_t oldNodesCapacity, const size_t oldBucketsCapacity);
 		
 		//! search one point, call recurseKnn with the correct template parameters
 		/** \param query pointer to query coordinates 
@@ -199,13 +423,15 @@ namespace Nabo
 		 *	\param i index of point to search
 		 * 	\param heap reference to heap
 		 * 	\param off reference to array of offsets
+		 * 	\param periodicState for periodic domains, reference to array of 3 x dim values: wrapped query, lower and upper bounds of the current cell
+		 * 	\param leafBuffer for compact leaf storage, reference to array of bucketSize x dim values receiving the coordinates of a bucket
 		 *	\param maxError error factor (1 + epsilon) 
 		 *	\param maxRadius2 square of maximum radius
 		 *	\param allowSelfMatch whether to allow self match
 		 *	\param collectStatistics whether to collect statistics
 		 *	\param sortResults wether to sort results
 		 */
-		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, std::vector<T>& off, const T maxError, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const;
+		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, std::vector<T>& off, std::vector<T>& periodicState, std::vector<float>& leafBuffer, const T maxError, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const;
 		
 		//! recursive search, strongly inspired by ANN and [Arya & Mount, Algorithms for fast vector quantization, 1993]
 		/**	\param query pointer to query coordinates 
@@ -219,16 +445,990 @@ namespace Nabo
 		template<bool allowSelfMatch, bool collectStatistics>
 		unsigned long recurseKnn(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, const T maxError, const T maxRadius2) const;
 		
+		//! recursive search in a periodic domain, distances to cells and between points are the shortest ones across domain boundaries
+		/**	\param query pointer to query coordinates, wrapped into the domain
+		 * 	\param n index of node to visit
+		 * 	\param rd squared dist to this rect
+		 * 	\param heap reference to heap
+		 * 	\param off reference to array of offsets
+		 * 	\param minValues lower bounds of the cell of node n
+		 * 	\param maxValues upper bounds of the cell of node n
+		 * 	\param maxError error factor (1 + epsilon) 
+		 *	\param maxRadius2 square of maximum radius
+		 */
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnnPeriodic(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, T* minValues, T* maxValues, const T maxError, const T maxRadius2) const;
+		
+		//! recursive search reading compact leaf coordinates, points that may enter the heap are re-ranked with the coordinates of the cloud
+		/**	\param query pointer to query coordinates
+		 * 	\param n index of node to visit
+		 * 	\param rd squared dist to this rect
+		 * 	\param heap reference to heap
+		 * 	\param off reference to array of offsets
+		 * 	\param leafBuffer reference to array of bucketSize x dim values receiving the coordinates of a bucket
+		 * 	\param maxError error factor (1 + epsilon)
+		 *	\param maxRadius2 square of maximum radius
+		 */
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnnCompact(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, std::vector<float>& leafBuffer, const T maxError, const T maxRadius2) const;
+		
+		//! call pairVisitor(a, b) once for every pair of distinct points a and b closer than sqrt(maxRadius2)
+		/**	Leaves are processed in parallel, each against the leaves of higher bucket index intersecting its bounding box grown by the radius
+		 *	\param maxRadius2 square of maximum radius
+		 *	\param pairVisitor functor called with the indices of the two points, possibly concurrently */
+		template<typename PairVisitor>
+		void forEachPairWithin(const T maxRadius2, const PairVisitor& pairVisitor) const;
+		
+		//! cursor browsing the tree by increasing distance to a query
+		struct IncrementalCursor;
+		//! point found near a segment
+		struct SegmentMatch;
+		//! vector of points found near a segment
+		typedef std::vector<SegmentMatch> SegmentMatches;
+		//! add the points of the subtree of node n within sqrt(maxRadius2) of segment [origin..origin+direction] to matches, considering only positions in [t0..t1], return the number of points touched
+		unsigned long recurseSegment(const T* origin, const T* direction, const T directionNorm2, const unsigned n, T t0, T t1, const T maxRadius, SegmentMatches& matches) const;
+		
+	public:
+		//! constructor, calls NearestNeighbourSearch<T>(cloud); if pointCount is non-negative, only the first pointCount points of cloud are indexed
+		KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters, const Index pointCount = -1);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual unsigned long findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const;
+		virtual typename NearestNeighbourSearch<T>::Cursor* createCursor(const Vector& query, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const;
+		//! cluster the cloud, see NearestNeighbourSearch<T>::cluster(); labels must be of size cloud.cols()
+		Index cluster(IndexVector& labels, const T radius, const Index minPoints) const;
+		virtual size_t memoryUsage() const;
+		//! estimate the memory of a search of pointCount points in dim dimensions, see NearestNeighbourSearch<T>::estimateMemory()
+		static typename NearestNeighbourSearch<T>::MemoryEstimate estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters);
+	};
+
+	//! Ball tree, balanced, points in leaves, stack, hypersphere bounds
+	template<typename T, typename Heap>
+	struct BallTree: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+
+	protected:
+		//! indices of points during ball-tree construction
+		typedef std::vector<Index> BuildPoints;
+		//! iterator to indices of points during ball-tree construction
+		typedef typename BuildPoints::iterator BuildPointsIt;
+
+		//! size of bucket
+		const unsigned bucketSize;
+
+		//! search node, its ball is stored in centroids and radii at the same position
+		struct Node
+		{
+			uint32_t rightChildBucketIndex; //!< for split node, index of right node (left index is current+1), for leaf node, index of first bucket entry
+			uint32_t bucketSize; //!< for leaf node, number of points in bucket, 0 for split node
+
+			//! construct a node
+			Node(const uint32_t rightChildBucketIndex = 0, const uint32_t bucketSize = 0):
+				rightChildBucketIndex(rightChildBucketIndex), bucketSize(bucketSize) {}
+		};
+		//! dense vector of search nodes
+		typedef std::vector<Node> Nodes;
+
+		//! entry in a bucket
+		struct BucketEntry
+		{
+			const T* pt; //!< pointer to first value of point data
+			Index index; //!< index of point
+
+			//! create a new bucket entry for a point in the data
+			/** \param pt pointer to first component of the point, components must be continuous
+			 * \param index index of the point in the data
+			 */
+			BucketEntry(const T* pt = 0, const Index index = 0): pt(pt), index(index) {}
+		};
+		//! bucket data
+		typedef std::vector<BucketEntry> Buckets;
+
+		//! search nodes
+		Nodes nodes;
+		//! centers of the balls of the nodes, dim values per node
+		std::vector<T> centroids;
+		//! radii of the balls of the nodes
+		std::vector<T> radii;
+		//! buckets, a leaf refers to a continuous range
+		Buckets buckets;
+
+		//! return the number of nodes required to store count points in buckets of at most bucketSize points
+		static unsigned getNodeCount(const unsigned count, const unsigned bucketSize);
+		//! construct nodes for points [first..last[ at position pos, first is the first point of the cloud
+		void buildNodes(const BuildPointsIt begin, const BuildPointsIt first, const BuildPointsIt last, const unsigned pos);
+
+		//! search one point, call recurseKnn with the correct template parameters
+		/** \param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param i index of point to search
+		 * 	\param heap reference to heap
+		 *	\param maxError2 squared error factor (1 + epsilon)^2
+		 *	\param maxRadius2 square of maximum radius
+		 *	\param allowSelfMatch whether to allow self match
+		 *	\param collectStatistics whether to collect statistics
+		 *	\param sortResults wether to sort results
+		 */
+		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const;
+
+		//! return the squared distance from query to the ball of node n, 0 if query is inside
+		inline T ballDist2(const T* query, const unsigned n) const;
+
+		//! recursive search, visiting the closest child ball first
+		/**	\param query pointer to query coordinates
+		 * 	\param n index of node to visit
+		 * 	\param heap reference to heap
+		 *	\param maxError2 squared error factor (1 + epsilon)^2
+		 *	\param maxRadius2 square of maximum radius
+		 */
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnn(const T* query, const unsigned n, Heap& heap, const T maxError2, const T maxRadius2) const;
+
+	public:
+		//! constructor, calls NearestNeighbourSearch<T>(cloud)
+		BallTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual size_t memoryUsage() const;
+		//! estimate the memory of a search of pointCount points in dim dimensions, see NearestNeighbourSearch<T>::estimateMemory()
+		static typename NearestNeighbourSearch<T>::MemoryEstimate estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters);
+	};
+
+	//! Cover tree, batch construction, explicit maximum descendant distances
+	/** Every point of the cloud is a node of the tree. The children of a node are
+	 *	chosen by halving a covering radius, as in [Beygelzimer et al., Cover trees
+	 *	for nearest neighbor, 2006], until at most bucketSize points are left.
+	 *	Each node stores the maximum distance to its descendants, so pruning
+	 *	is exact regardless of the level structure. */
+	template<typename T, typename Heap>
+	struct CoverTree: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+
+	protected:
+		//! point during cover-tree construction, with its distance to the current center
+		struct BuildPoint
+		{
+			Index index; //!< index of point in cloud
+			T dist; //!< distance to the current center
+			//! Construct a build point
+			BuildPoint(const Index index = 0, const T dist = 0): index(index), dist(dist) {}
+		};
+		//! points during cover-tree construction
+		typedef std::vector<BuildPoint> BuildPoints;
+		//! iterator to points during cover-tree construction
+		typedef typename BuildPoints::iterator BuildPointsIt;
+
+		//! maximum number of remaining descendants that become leaf children directly
+		const unsigned bucketSize;
+
+		//! search node
+		struct Node
+		{
+			Index index; //!< index of the point of this node
+			T maxDist; //!< maximum distance from the point of this node to any of its descendants
+			uint32_t firstChild; //!< index of the first child, children are contiguous
+			uint32_t childCount; //!< number of children, 0 for a leaf
+
+			//! construct a node
+			Node(const Index index = 0):
+				index(index), maxDist(0), firstChild(0), childCount(0) {}
+		};
+		//! dense vector of search nodes
+		typedef std::vector<Node> Nodes;
+
+		//! child considered during search
+		struct Candidate
+		{
+			T lowerBound; //!< lower bound of the distance from query to the subtree
+			T dist; //!< distance from query to the point of the child
+			uint32_t node; //!< index of the child
+			//! Construct a candidate
+			Candidate(const T lowerBound, const T dist, const uint32_t node): lowerBound(lowerBound), dist(dist), node(node) {}
+			//! return true if c0 has a smaller lower bound than c1
+			friend bool operator<(const Candidate& c0, const Candidate& c1) { return c0.lowerBound < c1.lowerBound; }
+		};
+		//! stack of candidates, shared by all recursion levels of a search
+		typedef std::vector<Candidate> Candidates;
+
+		//! search nodes
+		Nodes nodes;
+
+		//! return the distance between the points of indices i0 and i1 in cloud
+		inline T pointDist(const Index i0, const Index i1) const;
+		//! return the distance between query and the point of index i in cloud
+		inline T queryDist(const T* query, const Index i) const;
+		//! construct the children of node n from points [first..last[, whose dist are relative to the point of n
+		void buildChildren(const unsigned n, const BuildPointsIt first, const BuildPointsIt last);
+
+		//! search one point, call recurseKnn with the correct template parameters
+		/** \param query query points
+		 *	\param indices indices of nearest neighbours, must be of size k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, must be of size k x query.cols()
+		 *	\param i index of point to search
+		 * 	\param heap reference to heap
+		 * 	\param candidates reference to candidate stack
+		 *	\param maxError2 squared error factor (1 + epsilon)^2
+		 *	\param maxRadius2 square of maximum radius
+		 *	\param allowSelfMatch whether to allow self match
+		 *	\param collectStatistics whether to collect statistics
+		 *	\param sortResults wether to sort results
+		 */
+		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, int i, Heap& heap, Candidates& candidates, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const;
+
+		//! recursive search, visiting children by increasing lower bound
+		/**	\param query pointer to query coordinates
+		 * 	\param n index of node to visit, its point must already have been considered
+		 * 	\param heap reference to heap
+		 * 	\param candidates reference to candidate stack
+		 *	\param maxError2 squared error factor (1 + epsilon)^2
+		 *	\param maxRadius2 square of maximum radius
+		 */
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnn(const T* query, const unsigned n, Heap& heap, Candidates& candidates, const T maxError2, const T maxRadius2) const;
+
+	public:
+		//! constructor, calls NearestNeighbourSearch<T>(cloud)
+		CoverTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual size_t memoryUsage() const;
+		//! estimate the memory of a search of pointCount points in dim dimensions, see NearestNeighbourSearch<T>::estimateMemory()
+		static typename NearestNeighbourSearch<T>::MemoryEstimate estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters);
+	};
+
+	//! Locality-sensitive hashing with p-stable random projections and multi-probe querying
+	/** Each of tableCount tables hashes a point x with hashCount functions
+	 *	floor((a.x + b) / bucketWidth), a having gaussian coordinates and b being
+	 *	uniform in [0, bucketWidth[ [Datar et al., Locality-sensitive hashing scheme
+	 *	based on p-stable distributions, 2004]. A query probes its bucket and the
+	 *	probeCount most likely neighbouring buckets in every table [Lv et al.,
+	 *	Multi-probe LSH: efficient indexing for high-dimensional similarity search,
+	 *	2007], and the candidates are verified with exact distances. The search is
+	 *	approximate and ignores epsilon. */
+	template<typename T, typename Heap>
+	struct LSHSearch: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! combination of the hash values of a table
+		typedef uint64_t HashKey;
+		//! hash table, as sorted unique keys with ranges in a vector of point indices
+		struct Table
+		{
+			std::vector<HashKey> keys; //!< sorted unique keys
+			std::vector<uint32_t> offsets; //!< points with keys[i] are indices[offsets[i]..offsets[i+1][
+			std::vector<Index> indices; //!< point indices, grouped by key
+		};
+		//! vector of hash tables
+		typedef std::vector<Table> Tables;
+		//! per-query search state
+		struct SearchState;
+		
+		//! number of hash tables
+		const unsigned tableCount;
+		//! number of random projections per table
+		const unsigned hashCount;
+		//! number of neighbouring buckets probed per table
+		const unsigned probeCount;
+		//! width of buckets along projections
+		T bucketWidth;
+		//! random projections, divided by bucketWidth, hashCount rows per table
+		Matrix projections;
+		//! random shifts, divided by bucketWidth
+		Vector shifts;
+		//! hash tables
+		Tables tables;
+		
+		//! return the average distance between a few points and their nearest neighbour in a sample of the cloud
+		T estimateNeighbourDist() const;
+		//! return the key of hashCount hash values
+		inline HashKey hashKey(const int* values) const;
+		//! add the points of table whose key is key to the candidates of state, return the number of new candidates
+		unsigned long probe(const Table& table, const HashKey key, SearchState& state) const;
+		//! search one point, projected is its scaled and shifted projection
+		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const int i, const T* projected, SearchState& state, const T maxRadius2, const bool allowSelfMatch, const bool sortResults) const;
+		
 	public:
 		//! constructor, calls NearestNeighbourSearch<T>(cloud)
-		KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		LSHSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual size_t memoryUsage() const;
+		//! estimate the memory of a search of pointCount points in dim dimensions, see NearestNeighbourSearch<T>::estimateMemory()
+		static typename NearestNeighbourSearch<T>::MemoryEstimate estimateMemory(const Index pointCount, const Index dim, const Parameters& additionalParameters);
+	};
+	
+	//! Inner-product or cosine similarity search
+	/** Brute-force search computes similarities by blocks of matrix products.
+	 *	Other search types run on a reduced Euclidean problem: for cosine, the
+	 *	normalized cloud; for inner product, the cloud augmented with the
+	 *	coordinate sqrt(M^2 - |x|^2), M being the largest norm, and queries
+	 *	augmented with 0 [Bachrach et al., Speeding up the Xbox recommender
+	 *	system using a Euclidean transformation for inner-product spaces, 2014]. */
+	template<typename T>
+	struct SimilaritySearch: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! whether similarity is cosine, otherwise inner product
+		const bool cosine;
+		//! for cosine, the normalized cloud; for inner product, the augmented cloud
+		Matrix store;
+		//! Euclidean search on store, 0 for brute-force search
+		NearestNeighbourSearch<T>* reducedSearch;
+		
+		//! return query in the space of store, normalized for cosine, augmented for inner product if augment is true
+		Matrix transformQuery(const Matrix& query, const bool augment) const;
+		//! brute-force search by blocks of matrix products, return the number of points touched
+		unsigned long bruteForceKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const bool allowSelfMatch, const bool sortResults) const;
+		
+	public:
+		//! constructor, calls NearestNeighbourSearch<T>(cloud) and creates the reduced search of type preferedType
+		SimilaritySearch(const Matrix& cloud, const Index dim, const typename NearestNeighbourSearch<T>::SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		//! destructor, deletes the reduced search
+		virtual ~SimilaritySearch();
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual size_t memoryUsage() const;
+	};
+	
+	//! Search in a rotated copy of the cloud, so that kd-tree cuts follow its principal axes
+	/** The cloud is centered and rotated either into the eigenvectors of its
+	 *	covariance, from the largest to the smallest eigenvalue, or by a random
+	 *	orthonormal matrix. Planar structures at arbitrary orientations, such
+	 *	as walls in building scans, then lie along the axes of the inner search
+	 *	instead of cutting its cells diagonally. Rotations preserve distances,
+	 *	so queries are rotated by the same function as the cloud and forwarded;
+	 *	a query equal to a point thus has the same rotated coordinates, and
+	 *	self-match exclusion is unaffected. */
+	template<typename T>
+	struct RotatedSearch: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! mean of the cloud, subtracted before rotating
+		Vector center;
+		//! orthonormal matrix, whose rows are the axes of the rotated frame in the frame of the cloud
+		Matrix rotation;
+		//! rotated cloud, of dim rows
+		Matrix store;
+		//! search on store, owned
+		NearestNeighbourSearch<T>* rotatedSearch;
+		
+		//! compute rotation from the eigenvectors of the covariance of the cloud, by cyclic Jacobi sweeps
+		void computePrincipalRotation();
+		//! compute rotation by orthonormalizing a matrix of Gaussian samples
+		void computeRandomRotation(const unsigned seed);
+		//! return the first dim coordinates of points, centered and rotated
+		Matrix rotate(const Matrix& points) const;
+		
+	public:
+		//! constructor, calls NearestNeighbourSearch<T>(cloud) and creates the search of type preferedType on the rotated cloud
+		RotatedSearch(const Matrix& cloud, const Index dim, const typename NearestNeighbourSearch<T>::SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		//! destructor, deletes the rotated search
+		virtual ~RotatedSearch();
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual typename NearestNeighbourSearch<T>::Cursor* createCursor(const Vector& query, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const;
+		virtual unsigned long findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const;
+		virtual size_t memoryUsage() const;
+	};
+	
+	//! Search forwarding to another one and collecting metrics on its calls to knn()
+	/** Every thread records into its own slot, chosen once per thread, so
+	 *	that recording only touches a cache line private to the thread.
+	 *	Threads beyond the number of slots share them, which counters
+	 *	support as they are incremented atomically. getMetrics() sums all
+	 *	slots. */
+	template<typename T>
+	struct MeasuredSearch: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		typedef typename NearestNeighbourSearch<T>::Metrics Metrics;
+		
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		
+	protected:
+		//! counters of the threads using a slot, aligned on cache lines
+		struct Slot
+		{
+			uint64_t callCount; //!< number of calls to knn()
+			uint64_t queryCount; //!< number of query points
+			uint64_t touchedCount; //!< number of points touched
+			uint64_t kCounts[Metrics::K_BUCKET_COUNT]; //!< number of calls per k
+			uint64_t latencyCounts[Metrics::LATENCY_BUCKET_COUNT]; //!< number of calls per duration
+			char padding[64]; //!< keeps the counters of neighbouring slots on different cache lines
+		};
+		
+		//! measured search, owned
+		NearestNeighbourSearch<T>* search;
+		//! time of creation, start of the duration of metrics
+		const double creationTime;
+		//! counters, one slot per thread up to their number
+		mutable std::vector<Slot> slots;
+		
+		//! add a call to the counters of the calling thread
+		void record(const Index k, const Index queryCount, const unsigned long touchedCount, const double duration) const;
+		
+	public:
+		//! constructor, takes ownership of search
+		MeasuredSearch(NearestNeighbourSearch<T>* search);
+		//! destructor, deletes the measured search
+		virtual ~MeasuredSearch();
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual typename NearestNeighbourSearch<T>::Cursor* createCursor(const Vector& query, const unsigned optionFlags = 0, const T maxRadius = std::numeric_limits<T>::infinity()) const;
+		virtual unsigned long findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const;
+		virtual Metrics getMetrics() const;
+		virtual size_t memoryUsage() const;
+	};
+	
+	//! Multi-resolution index, one kd-tree per level over a prefix of a shared reordered copy of the cloud
+	/** Levels are computed from the finest to the coarsest, every level
+	 *	keeping, in every voxel, the point of the previous level closest to
+	 *	the voxel center. Points are then sorted by decreasing coarsest level
+	 *	they belong to, so that every level is a prefix of the store. */
+	template<typename T>
+	struct KDTreePyramid: public PyramidNearestNeighbourSearch<T>
+	{
+		typedef typename PyramidNearestNeighbourSearch<T>::Vector Vector;
+		typedef typename PyramidNearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename PyramidNearestNeighbourSearch<T>::Index Index;
+		typedef typename PyramidNearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename PyramidNearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		
+		using PyramidNearestNeighbourSearch<T>::dim;
+		using PyramidNearestNeighbourSearch<T>::cloud;
+		using PyramidNearestNeighbourSearch<T>::creationOptionFlags;
+		using PyramidNearestNeighbourSearch<T>::levelCount;
+		using PyramidNearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! vector of point indices
+		typedef std::vector<Index> Indices;
+		
+		//! copy of the cloud, sorted such that every level is a prefix of it
+		Matrix store;
+		//! for every column of store, index of the point in cloud
+		IndexVector storeIndices;
+		//! number of points in every level
+		Indices levelSizes;
+		//! kd-tree of every level, indexing the corresponding prefix of store
+		std::vector<NearestNeighbourSearch<T>*> trees;
+		
+		//! return the points of candidates, a subset of cloud, that are kept in a grid of voxels of size voxelSize starting at minValues
+		Indices downsample(const Indices& candidates, const Vector& minValues, const T voxelSize) const;
+		//! replace indices in store by indices in cloud, for the entries that were found
+		void mapIndices(IndexMatrix& indices, const Matrix& dists2) const;
+		
+	public:
+		//! constructor, builds all levels
+		KDTreePyramid(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		//! destructor, deletes the kd-trees
+		virtual ~KDTreePyramid();
+		virtual Index getLevelSize(const Index level) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knnCoarseToFine(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index coarseLevel, const Index k, const T epsilon, const unsigned optionFlags) const;
+	};
+	
+	//! Set of small kd-trees built in parallel, whose nodes and buckets are stored in one arena
+	/** Every thread first builds its trees into its own growing buffers,
+	 *	then, once the sizes of all trees are known, a single arena is
+	 *	allocated and every thread copies its trees into it. Trees use the
+	 *	node encoding of KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt,
+	 *	with child and bucket indices relative to the start of their tree. */
+	template<typename T>
+	struct KDTreeSet: public NearestNeighbourSearchSet<T>
+	{
+		typedef typename NearestNeighbourSearchSet<T>::Vector Vector;
+		typedef typename NearestNeighbourSearchSet<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearchSet<T>::Index Index;
+		
+		using NearestNeighbourSearchSet<T>::dim;
+		using NearestNeighbourSearchSet<T>::creationOptionFlags;
+		
+		//! search node, either a split or a leaf
+		struct Node
+		{
+			uint32_t dimChildBucketSize; //!< cut dimension for split nodes (dimBitCount lsb), index of right node or number of points in bucket (rest)
+			union
+			{
+				T cutVal; //!< for split node, split value
+				uint32_t bucketIndex; //!< for leaf node, index of the first point of the bucket, relative to the buckets of the tree
+			};
+			
+			//! construct a split node
+			Node(const uint32_t dimChild, const T cutVal):
+				dimChildBucketSize(dimChild), cutVal(cutVal) {}
+			//! construct a leaf node
+			Node(const uint32_t bucketSize, const uint32_t bucketIndex):
+				dimChildBucketSize(bucketSize), bucketIndex(bucketIndex) {}
+		};
+		//! vector of nodes
+		typedef std::vector<Node> Nodes;
+		//! vector of point indices
+		typedef std::vector<Index> Indices;
+		
+	protected:
+		//! position and size of a tree, in a thread buffer and then in the arena
+		struct TreeLayout
+		{
+			size_t nodeOffset; //!< index of the first node of the tree
+			size_t nodeCount; //!< number of nodes of the tree
+			size_t bucketOffset; //!< index of the first bucket entry of the tree
+			size_t bucketCount; //!< number of bucket entries of the tree
+		};
+		
+		//! state of the construction of one tree by one thread
+		struct BuildContext
+		{
+			const Matrix& cloud; //!< cloud of the tree
+			const int dim; //!< number of dimensions of the tree
+			const uint32_t dimBitCount; //!< number of bits used to store the cut dimension
+			const unsigned bucketSize; //!< maximum number of points in a leaf
+			const size_t nodeOffset; //!< index of the first node of the tree in nodes
+			const size_t bucketOffset; //!< index of the first bucket entry of the tree in buckets
+			Nodes& nodes; //!< nodes of all trees built by the thread
+			Indices& buckets; //!< bucket entries of all trees built by the thread
+			std::vector<T> minValues; //!< lower corner of the cell being built
+			std::vector<T> maxValues; //!< upper corner of the cell being built
+			
+			//! constructor
+			BuildContext(const Matrix& cloud, const int dim, const unsigned bucketSize, Nodes& nodes, Indices& buckets);
+		};
+		
+		//! maximum number of points in a leaf
+		const unsigned bucketSize;
+		//! arena holding the nodes of all trees followed by their bucket entries
+		std::vector<char> arena;
+		//! searches of the set, one per cloud
+		std::vector<NearestNeighbourSearch<T>*> searches;
+		
+		//! recursively build the nodes of the points [first, last[, return the index of the created node relative to the tree
+		static uint32_t buildNodes(BuildContext& context, const typename Indices::iterator first, const typename Indices::iterator last);
+		
+	public:
+		//! constructor, builds all trees
+		KDTreeSet(const std::vector<Matrix>& clouds, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		//! destructor, deletes the searches and the arena
+		virtual ~KDTreeSet();
+		virtual Index getSearchCount() const;
+		virtual const NearestNeighbourSearch<T>& getSearch(const Index i) const;
+		virtual size_t getArenaSize() const;
+	};
+	
+	//! Search in one tree of a KDTreeSet, the tree being stored in the arena of the set
+	template<typename T, typename Heap>
+	struct KDTreeSetView: public NearestNeighbourSearch<T>
+	{
+		typedef typename NearestNeighbourSearch<T>::Vector Vector;
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexVector IndexVector;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		typedef typename KDTreeSet<T>::Node Node;
+		
+		using NearestNeighbourSearch<T>::dim;
+		using NearestNeighbourSearch<T>::cloud;
+		using NearestNeighbourSearch<T>::creationOptionFlags;
+		using NearestNeighbourSearch<T>::minBound;
+		using NearestNeighbourSearch<T>::maxBound;
+		using NearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! nodes of the tree, in the arena
+		const Node* nodes;
+		//! bucket entries of the tree, indices in cloud, in the arena
+		const Index* buckets;
+		//! number of bits required to store dim
+		const uint32_t dimBitCount;
+		//! mask to access dim
+		const uint32_t dimMask;
+		//! number of bytes of the nodes and bucket entries of the tree
+		const size_t memory;
+		
+		//! get cut dimension of node from compound dimChildBucketSize
+		inline uint32_t getDim(const uint32_t dimChildBucketSize) const
+		{
+			return dimChildBucketSize & dimMask;
+		}
+		//! get child of node or size of bucket from compound dimChildBucketSize
+		inline uint32_t getChildBucketSize(const uint32_t dimChildBucketSize) const
+		{
+			return dimChildBucketSize >> dimBitCount;
+		}
+		
+		//! search one point, call recurseKnn with the correct template parameters
+		unsigned long onePointKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const int i, Heap& heap, std::vector<T>& off, const T maxError2, const T maxRadius2, const bool allowSelfMatch, const bool collectStatistics, const bool sortResults) const;
+		//! recursive search, strongly inspired by ANN and [Arya & Mount, Algorithms for fast vector quantization, 1993]
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnn(const T* query, const unsigned n, T rd, Heap& heap, std::vector<T>& off, const T maxError2, const T maxRadius2) const;
+		
+	public:
+		//! constructor, computes the bounds of cloud
+		KDTreeSetView(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Node* nodes, const Index* buckets, const size_t memory);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
+		virtual size_t memoryUsage() const;
+	};
+	
+	//! Approximate k-nearest-neighbour graph construction by NN-descent
+	/** Every point keeps a list of its k best neighbours so far. At each
+	 *	iteration, a sample of the neighbours and reverse neighbours of every
+	 *	point is joined: all pairs are compared and may improve each other's
+	 *	lists. Only pairs involving a neighbour inserted since the previous
+	 *	iteration are compared [Dong et al., Efficient k-nearest neighbor
+	 *	graph construction for generic similarity measures, 2011]. Lists can be
+	 *	initialized from the leaves of randomized kd-trees, splitting at the
+	 *	median of a random dimension among those of largest spread. */
+	template<typename T>
+	struct NNDescent
+	{
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+	
+	protected:
+		//! vector of point indices
+		typedef std::vector<Index> Indices;
+		//! per-thread state during joins
+		struct ThreadState;
+		
+		//! data-point cloud
+		const Matrix& cloud;
+		//! number of dimensions to consider
+		const Index dim;
+		//! number of neighbours per point
+		const Index k;
+		//! maximum number of iterations
+		const unsigned iterationCount;
+		//! maximum number of new and of old neighbours, and of reverse ones, sampled per point and iteration
+		const Index sampleCount;
+		//! stop when fewer list updates than this happened during an iteration
+		const double terminationCount;
+		//! number of randomized kd-trees used to initialize the lists
+		const unsigned treeCount;
+		//! seed of the random number generators
+		const unsigned seed;
+		
+		//! neighbours of point i are neighbours[i*k..(i+1)*k[, sorted by increasing distance, -1 if not found yet
+		Indices neighbours;
+		//! squared distances corresponding to neighbours
+		std::vector<T> neighbourDists2;
+		//! 1 if the corresponding neighbour was inserted since it was last sampled
+		std::vector<unsigned char> neighbourIsNew;
+		//! per-point spin locks protecting the lists and the reverse samples
+		std::vector<int> locks;
+		//! candidates of every point, sampleCount per list: new, old, reverse new, reverse old
+		Indices candidates[4];
+		//! number of candidates of every point in the corresponding list
+		Indices candidateCounts[4];
+		//! number of points seen by the reservoir sampling of reverse candidates
+		Indices reverseSeenCounts[2];
+		
+		//! return the squared distance between points a and b
+		inline T dist2(const Index a, const Index b) const;
+		//! insert neighbour at squared distance d2 in the list of point, return true if the list changed
+		bool tryInsert(const Index point, const Index neighbour, const T d2);
+		//! initialize the lists from the leaves of a randomized kd-tree, return the number of distances computed
+		unsigned long initFromTree(const unsigned tree);
+		//! complete the lists with random neighbours, return the number of distances computed
+		unsigned long initRandom();
+		//! sample the candidates of all points for iteration
+		void sampleCandidates(const unsigned iteration);
+		//! join the candidates of point, add the number of list updates to updateCount, return the number of distances computed
+		unsigned long localJoin(const Index point, ThreadState& state, unsigned long& updateCount);
+	
+	public:
+		//! constructor, reads the parameters
+		NNDescent(const Matrix& cloud, const Index dim, const Index k, const Parameters& additionalParameters);
+		//! build the graph into indices and dists2, return the number of distances computed
+		unsigned long build(IndexMatrix& indices, Matrix& dists2);
+	};
+	
+	//! Hamming distance kernels, the fastest ones supported by the running CPU are selected at construction
+	struct HammingKernels
+	{
+		typedef BinaryNearestNeighbourSearch::Word Word;
+		typedef BinaryNearestNeighbourSearch::Index Index;
+		typedef BinaryNearestNeighbourSearch::Distance Distance;
+		
+		//! compute the Hamming distances between query and count consecutive descriptors starting at data
+		typedef void (*DistancesFunction)(const Word* query, const Word* data, const Index count, const Index wordCount, Distance* dists);
+		//! return the Hamming distance between two descriptors
+		typedef Distance (*DistanceFunction)(const Word* d0, const Word* d1, const Index wordCount);
+		
+		//! kernel for many consecutive descriptors, used by brute-force search
+		DistancesFunction distances;
+		//! kernel for a single descriptor, used to verify candidates
+		DistanceFunction distance;
+		//! name of the selected kernels, for information
+		const char* name;
+		
+		//! select kernels for the running CPU
+		HammingKernels();
+	};
+	
+	//! Brute-force search for binary descriptors
+	struct BinaryBruteForceSearch: public BinaryNearestNeighbourSearch
+	{
+		//! selected distance kernels
+		const HammingKernels kernels;
+		
+		//! constructor, calls BinaryNearestNeighbourSearch(descriptors)
+		BinaryBruteForceSearch(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags);
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const Index k, const unsigned optionFlags, const Distance maxDist) const;
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const DistanceVector& maxDists, const Index k = 1, const unsigned optionFlags = 0) const;
+	};
+	
+	//! Exact multi-index hashing for binary descriptors
+	/** The descriptors are split into substringCount disjoint substrings, each
+	 *	indexed by its own hash table [Norouzi et al., Fast Exact Search in Hamming
+	 *	Space with Multi-Index Hashing, 2014]. If two descriptors are within
+	 *	distance d, at least one of their substrings are within distance
+	 *	d / substringCount, so the search probes the tables at increasing
+	 *	substring radii and verifies candidates with the full distance, until
+	 *	no unseen descriptor can enter the heap. */
+	struct BinaryMultiIndexHashing: public BinaryNearestNeighbourSearch
+	{
+	protected:
+		//! hash table of one substring, as ranges in a vector of descriptor indices
+		/** If the substring has few enough bits, offsets is directly addressed by
+		 *	substring values and keys is empty; otherwise keys holds the sorted unique
+		 *	substring values and offsets is addressed by their position in keys. */
+		struct Table
+		{
+			int firstBit; //!< position of the first bit of the substring
+			int bitCount; //!< number of bits of the substring, at most 64
+			std::vector<Word> keys; //!< sorted unique substring values, empty if the table is directly addressed
+			std::vector<uint32_t> offsets; //!< descriptors with the i-th key are indices[offsets[i]..offsets[i+1][
+			std::vector<Index> indices; //!< descriptor indices, grouped by key
+		};
+		//! vector of hash tables
+		typedef std::vector<Table> Tables;
+		//! per-query search state
+		struct SearchState;
+		
+		//! selected distance kernels
+		const HammingKernels kernels;
+		//! hash tables, one per substring
+		Tables tables;
+		//! smallest number of bits of a substring
+		int minBitCount;
+		
+		//! return the substring of table t for descriptor d
+		inline Word substring(const Word* d, const Table& t) const;
+		//! verify the descriptors of table whose substring is key, return the number of descriptors touched
+		unsigned long probe(const Word* query, const Table& table, const Word key, SearchState& state, const bool allowSelfMatch, const Distance maxDist) const;
+		//! search the neighbours of query, return the number of descriptors touched
+		unsigned long onePointKnn(const Word* query, SearchState& state, const unsigned optionFlags, const Distance maxDist) const;
+		
+	public:
+		//! constructor, calls BinaryNearestNeighbourSearch(descriptors)
+		BinaryMultiIndexHashing(const DescriptorMatrix& descriptors, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const Index k, const unsigned optionFlags, const Distance maxDist) const;
+		virtual unsigned long knn(const DescriptorMatrix& query, IndexMatrix& indices, DistanceMatrix& dists, const DistanceVector& maxDists, const Index k = 1, const unsigned optionFlags = 0) const;
+	};
+	
+	//! Brute-force search for points with integer coordinates
+	template<typename T>
+	struct IntegerBruteForceSearch: public IntegerNearestNeighbourSearch<T>
+	{
+		typedef typename IntegerNearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename IntegerNearestNeighbourSearch<T>::Index Index;
+		typedef typename IntegerNearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		typedef typename IntegerNearestNeighbourSearch<T>::Distance Distance;
+		typedef typename IntegerNearestNeighbourSearch<T>::DistanceVector DistanceVector;
+		typedef typename IntegerNearestNeighbourSearch<T>::DistanceMatrix DistanceMatrix;
+		
+		using IntegerNearestNeighbourSearch<T>::dim;
+		using IntegerNearestNeighbourSearch<T>::cloud;
+		using IntegerNearestNeighbourSearch<T>::creationOptionFlags;
+		using IntegerNearestNeighbourSearch<T>::checkSizesKnn;
+		
+		//! constructor, calls IntegerNearestNeighbourSearch<T>(cloud)
+		IntegerBruteForceSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const Distance maxDist2) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const DistanceVector& maxDists2, const Index k = 1, const unsigned optionFlags = 0) const;
+	};
+	
+	//! KDTree for points with integer coordinates, balanced, points in leaves, stack, implicit bounds
+	/** Nodes split at the median of the dimension of largest spread, such that
+	 *	points of the left child are lower or equal and points of the right
+	 *	child larger or equal to the cut value. Offsets to cells are exact
+	 *	signed 64-bit integers, squared distances saturating unsigned ones. */
+	template<typename T, typename Heap>
+	struct IntegerKDTree: public IntegerNearestNeighbourSearch<T>
+	{
+		typedef typename IntegerNearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename IntegerNearestNeighbourSearch<T>::Index Index;
+		typedef typename IntegerNearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
+		typedef typename IntegerNearestNeighbourSearch<T>::Distance Distance;
+		typedef typename IntegerNearestNeighbourSearch<T>::DistanceVector DistanceVector;
+		typedef typename IntegerNearestNeighbourSearch<T>::DistanceMatrix DistanceMatrix;
+		
+		using IntegerNearestNeighbourSearch<T>::dim;
+		using IntegerNearestNeighbourSearch<T>::cloud;
+		using IntegerNearestNeighbourSearch<T>::creationOptionFlags;
+		using IntegerNearestNeighbourSearch<T>::checkSizesKnn;
+		
+	protected:
+		//! indices of points during kd-tree construction
+		typedef std::vector<Index> BuildPoints;
+		//! iterator to indices of points during kd-tree construction
+		typedef typename BuildPoints::iterator BuildPointsIt;
+		//! functor comparing points along one dimension
+		struct CompareDim;
+		
+		//! size of bucket
+		const unsigned bucketSize;
+		//! number of bits required to store dimension index + number of dimensions
+		const uint32_t dimBitCount;
+		//! mask to access dim
+		const uint32_t dimMask;
+		
+		//! create the compound index containing the dimension and the index of the child or the bucket size
+		inline uint32_t createDimChildBucketSize(const uint32_t dim, const uint32_t childIndex) const
+		{ return dim | (childIndex << dimBitCount); }
+		//! get the dimension out of the compound index
+		inline uint32_t getDim(const uint32_t dimChildBucketSize) const
+		{ return dimChildBucketSize & dimMask; }
+		//! get the child index or the bucket size out of the compound index
+		inline uint32_t getChildBucketSize(const uint32_t dimChildBucketSize) const
+		{ return dimChildBucketSize >> dimBitCount; }
+		
+		//! search node
+		struct Node
+		{
+			uint32_t dimChildBucketSize; //!< cut dimension for split nodes (dimBitCount lsb), index of right node or number of bucket(rest). Note that left index is current+1
+			union
+			{
+				T cutVal; //!< for split node, split value
+				uint32_t bucketIndex; //!< for leaf node, pointer to bucket
+			};
+			
+			//! construct a split node
+			Node(const uint32_t dimChild, const T cutVal):
+				dimChildBucketSize(dimChild), cutVal(cutVal) {}
+			//! construct a leaf node
+			Node(const uint32_t bucketSize, const uint32_t bucketIndex):
+				dimChildBucketSize(bucketSize), bucketIndex(bucketIndex) {}
+		};
+		//! dense vector of search nodes
+		typedef std::vector<Node> Nodes;
+		
+		//! entry in a bucket
+		struct BucketEntry
+		{
+			const T* pt; //!< pointer to first value of point data
+			Index index; //!< index of point
+			
+			//! create a new bucket entry for a point in the data
+			BucketEntry(const T* pt = 0, const Index index = 0): pt(pt), index(index) {}
+		};
+		//! bucket data
+		typedef std::vector<BucketEntry> Buckets;
+		
+		//! search nodes
+		Nodes nodes;
+		//! buckets
+		Buckets buckets;
+		
+		//! construct nodes for points [first..last[
+		unsigned buildNodes(const BuildPointsIt first, const BuildPointsIt last);
+		
+		//! recursive search
+		/**	\param query pointer to query coordinates
+		 * 	\param n index of node to visit
+		 * 	\param rd squared dist to this rect
+		 * 	\param heap reference to heap
+		 * 	\param off reference to array of offsets
+		 *	\param maxDist2 maximum squared distance
+		 */
+		template<bool allowSelfMatch, bool collectStatistics>
+		unsigned long recurseKnn(const T* query, const unsigned n, Distance rd, Heap& heap, std::vector<boost::int64_t>& off, const Distance maxDist2) const;
+		
+	public:
+		//! constructor, calls IntegerNearestNeighbourSearch<T>(cloud)
+		IntegerKDTree(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const Index k, const unsigned optionFlags, const Distance maxDist2) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, DistanceMatrix& dists2, const DistanceVector& maxDists2, const Index k = 1, const unsigned optionFlags = 0) const;
 	};
 	
 	#ifdef HAVE_OPENCL
 	
-	//! OpenCL support for nearest neighbour search	
+	//! OpenCL support for nearest neighbour search
+	/*!	Queries are processed by chunks, whose upload and download on a transfer queue overlap with the kernel of the previous or next chunk.
+	 *	The cloud and the tree are copied to the device once at construction, and the buffers for two chunks persist across calls to knn(). */
 	template<typename T>
 	struct OpenCLSearch: public NearestNeighbourSearch<T>
 	{
@@ -244,26 +1444,50 @@ namespace Nabo
 		using NearestNeighbourSearch<T>::checkSizesKnn;
 		
 	protected:
+		//! Device buffers for a chunk of queries and its results
+		struct ChunkBuffers
+		{
+			cl::Buffer query; //!< coordinates of the queries
+			cl::Buffer maxRadii2; //!< squared maximum radii of the queries
+			cl::Buffer indices; //!< indices of the neighbours, room for MAX_K per query
+			cl::Buffer dists2; //!< squared distances to the neighbours, room for MAX_K per query
+			cl::Buffer touchStatistics; //!< number of points visited per query, if TOUCH_STATISTICS is set
+			size_t queryCapacity; //!< number of queries the buffers can hold
+			size_t queryRows; //!< number of coordinates per query the query buffer holds
+			
+			//! Create empty buffers
+			ChunkBuffers(): queryCapacity(0), queryRows(0) {}
+		};
+		
 		const cl_device_type deviceType; //!< the type of device to run CL code on (CL_DEVICE_TYPE_CPU or CL_DEVICE_TYPE_GPU)
 		cl::Context& context; //!< the CL context
 		mutable cl::Kernel knnKernel; //!< the kernel to perform knnSearch, mutable because it is stateful, but conceptually const
-		cl::CommandQueue queue; //!< the command queue
+		mutable cl::CommandQueue queue; //!< the command queue for kernels
+		mutable cl::CommandQueue transferQueue; //!< the command queue for transfers of queries and results
 		cl::Buffer cloudCL; //!< the buffer for the input data
+		const size_t chunkSize; //!< maximum number of queries per kernel launch
+		mutable ChunkBuffers chunkBuffers[2]; //!< buffers of the chunks being transferred and processed
+		mutable boost::mutex knnMutex; //!< serializes calls to knn(), which share the kernel and the buffers
 		
 		//! constructor, calls NearestNeighbourSearch<T>(cloud)
-		OpenCLSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType);
+		OpenCLSearch(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
 		//! Initialize CL support
 		/** \param clFileName name of file containing CL code
 		 * \param kernelName name of the CL kernel function
 		 * \param additionalDefines additional CL code to pass to compiler
 		 */
 		void initOpenCL(const char* clFileName, const char* kernelName, const std::string& additionalDefines = "");
+		//! Make sure that the buffers of chunk can hold queryCount queries of queryRows coordinates
+		void reserveChunkBuffers(ChunkBuffers& buffers, const size_t queryCount, const size_t queryRows) const;
+		//! Return the index of the first kernel argument that follows the common ones, the subclasses pass their data from there
+		unsigned getFirstSpecificArg() const;
 	
 	public:
 		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const;
+		virtual unsigned long knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k = 1, const T epsilon = 0, const unsigned optionFlags = 0) const;
 	};
 	
-	//! KDTree, balanced, points in leaves, stack, implicit bounds, balance aspect ratio
+	//! Brute-force search using OpenCL
 	template<typename T>
 	struct BruteForceSearchOpenCL: public OpenCLSearch<T>
 	{
@@ -274,7 +1498,7 @@ namespace Nabo
 		using OpenCLSearch<T>::initOpenCL;
 		
 		//! constructor, calls OpenCLSearch<T>(cloud, ...)
-		BruteForceSearchOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType);
+		BruteForceSearchOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
 	};
 	
 	//! KDTree, balanced, points in leaves, stack, implicit bounds, balance aspect ratio
@@ -297,6 +1521,7 @@ namespace Nabo
 		using OpenCLSearch<T>::knnKernel;
 		
 		using OpenCLSearch<T>::initOpenCL;
+		using OpenCLSearch<T>::getFirstSpecificArg;
 		
 	protected:
 		//! Point during kd-tree construction
@@ -350,7 +1575,7 @@ namespace Nabo
 		
 	public:
 		//! constructor, calls OpenCLSearch<T>(cloud, ...)
-		KDTreeBalancedPtInLeavesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType);
+		KDTreeBalancedPtInLeavesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
 	};
 	
 	//! KDTree, balanced, points in nodes, stack, implicit bounds, balance aspect ratio
@@ -373,6 +1598,7 @@ namespace Nabo
 		using OpenCLSearch<T>::knnKernel;
 		
 		using OpenCLSearch<T>::initOpenCL;
+		using OpenCLSearch<T>::getFirstSpecificArg;
 		
 	protected:
 		//! a point during kd-tree construction is just its index
@@ -421,7 +1647,7 @@ namespace Nabo
 		
 	public:
 		//! constructor, calls OpenCLSearch<T>(cloud, ...)
-		KDTreeBalancedPtInNodesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const cl_device_type deviceType);
+		KDTreeBalancedPtInNodesStackOpenCL(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters);
 	};
 	
 	#endif // HAVE_OPENCL
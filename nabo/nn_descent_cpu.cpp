@@ -0,0 +1,422 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file nn_descent_cpu.cpp
+	\brief approximate k-nearest-neighbour graph construction by NN-descent, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! minimal number of points in the leaves of the randomized kd-trees
+	const int NN_DESCENT_MIN_LEAF_SIZE = 16;
+	//! number of dimensions of largest spread among which the randomized kd-trees pick their split dimension
+	const int NN_DESCENT_SPLIT_DIM_CANDIDATES = 5;
+	//! maximal number of points used to estimate the spread of the dimensions in a randomized kd-tree node
+	const int NN_DESCENT_SPREAD_SAMPLE_SIZE = 128;
+	
+	//! Lock the spin lock lock
+	inline void lockSpin(int& lock)
+	{
+		#ifdef HAVE_OPENMP
+		while (__sync_lock_test_and_set(&lock, 1))
+			while (*static_cast<volatile int*>(&lock)) {}
+		#endif
+	}
+	
+	//! Unlock the spin lock lock
+	inline void unlockSpin(int& lock)
+	{
+		#ifdef HAVE_OPENMP
+		__sync_lock_release(&lock);
+		#endif
+	}
+	
+	//! Return the index of the running thread, 0 without OpenMP
+	inline int threadIndex()
+	{
+		#ifdef HAVE_OPENMP
+		return omp_get_thread_num();
+		#else
+		return 0;
+		#endif
+	}
+	
+	//! Functor to compare point indices on a given dimension of a cloud
+	template<typename T>
+	struct NNDescentCompareDim
+	{
+		typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+		typedef typename NearestNeighbourSearch<T>::Index Index;
+		
+		const Matrix& cloud; //!< data-point cloud
+		const Index dim; //!< dimension to compare
+		
+		//! Construct a comparator on dimension dim
+		NNDescentCompareDim(const Matrix& cloud, const Index dim): cloud(cloud), dim(dim) {}
+		//! return true if point a is before point b along dim
+		bool operator()(const Index a, const Index b) const { return cloud.coeff(dim, a) < cloud.coeff(dim, b); }
+	};
+	
+	template<typename T>
+	struct NNDescent<T>::ThreadState
+	{
+		Indices newCandidates; //!< new and reverse new candidates of the current point
+		Indices oldCandidates; //!< old and reverse old candidates of the current point
+	};
+	
+	template<typename T>
+	NNDescent<T>::NNDescent(const Matrix& cloud, const Index dim, const Index k, const Parameters& additionalParameters):
+		cloud(cloud),
+		dim(dim),
+		k(k),
+		iterationCount(additionalParameters.get<unsigned>("iterationCount", 10)),
+		sampleCount(max<Index>(1, Index(ceil(additionalParameters.get<double>("sampleRate", 0.5) * k)))),
+		terminationCount(additionalParameters.get<double>("terminationRate", 0.001) * double(k) * double(cloud.cols())),
+		treeCount(additionalParameters.get<unsigned>("treeCount", 0)),
+		seed(additionalParameters.get<unsigned>("seed", 0))
+	{
+		const double sampleRate(additionalParameters.get<double>("sampleRate", 0.5));
+		if (!(sampleRate > 0 && sampleRate <= 1))
+			throw runtime_error((boost::format("Sample rate (%1%) must be in ]0, 1]") % sampleRate).str());
+	}
+	
+	template<typename T>
+	T NNDescent<T>::dist2(const Index a, const Index b) const
+	{
+		return Nabo::dist2<T>(cloud.block(0, a, dim, 1), cloud.block(0, b, dim, 1));
+	}
+	
+	template<typename T>
+	bool NNDescent<T>::tryInsert(const Index point, const Index neighbour, const T d2)
+	{
+		if (point == neighbour)
+			return false;
+		T* ds(&neighbourDists2[point * k]);
+		// unlocked early rejection, the list only improves so a stale worst distance is conservative
+		if (d2 >= *static_cast<volatile T*>(&ds[k - 1]))
+			return false;
+		Index* ns(&neighbours[point * k]);
+		unsigned char* isNew(&neighbourIsNew[point * k]);
+		lockSpin(locks[point]);
+		if (d2 >= ds[k - 1])
+		{
+			unlockSpin(locks[point]);
+			return false;
+		}
+		for (Index j = 0; j < k; ++j)
+		{
+			if (ns[j] == neighbour)
+			{
+				unlockSpin(locks[point]);
+				return false;
+			}
+		}
+		Index j(k - 1);
+		for (; j > 0 && ds[j - 1] > d2; --j)
+		{
+			ds[j] = ds[j - 1];
+			ns[j] = ns[j - 1];
+			isNew[j] = isNew[j - 1];
+		}
+		ds[j] = d2;
+		ns[j] = neighbour;
+		isNew[j] = 1;
+		unlockSpin(locks[point]);
+		return true;
+	}
+	
+	template<typename T>
+	unsigned long NNDescent<T>::initFromTree(const unsigned tree)
+	{
+		const Index pointCount(cloud.cols());
+		const Index leafSize(max<Index>(2 * k + 2, NN_DESCENT_MIN_LEAF_SIZE));
+		boost::mt19937 rng(seed + tree);
+		
+		// shuffle so that the first points of every range are a random sample of it
+		Indices order(pointCount);
+		for (Index i = 0; i < pointCount; ++i)
+			order[i] = i;
+		for (Index i = pointCount - 1; i > 0; --i)
+			swap(order[i], order[rng() % (i + 1)]);
+		
+		// split ranges at the median of a random dimension among those of largest spread
+		typedef pair<Index, Index> Range;
+		vector<Range> stack(1, Range(0, pointCount));
+		vector<Range> leaves;
+		vector<pair<T, Index> > spreads(dim);
+		while (!stack.empty())
+		{
+			const Range range(stack.back());
+			stack.pop_back();
+			const Index count(range.second - range.first);
+			if (count <= leafSize)
+			{
+				leaves.push_back(range);
+				continue;
+			}
+			const Index sampleSize(min<Index>(count, NN_DESCENT_SPREAD_SAMPLE_SIZE));
+			for (Index d = 0; d < dim; ++d)
+			{
+				T minVal(cloud.coeff(d, order[range.first]));
+				T maxVal(minVal);
+				for (Index i = 1; i < sampleSize; ++i)
+				{
+					const T v(cloud.coeff(d, order[range.first + i]));
+					minVal = min(minVal, v);
+					maxVal = max(maxVal, v);
+				}
+				spreads[d] = make_pair(maxVal - minVal, d);
+			}
+			const Index candidateCount(min<Index>(dim, NN_DESCENT_SPLIT_DIM_CANDIDATES));
+			partial_sort(spreads.begin(), spreads.begin() + candidateCount, spreads.end(), greater<pair<T, Index> >());
+			const Index splitDim(spreads[rng() % candidateCount].second);
+			const Index mid(range.first + count / 2);
+			nth_element(order.begin() + range.first, order.begin() + mid, order.begin() + range.second, NNDescentCompareDim<T>(cloud, splitDim));
+			stack.push_back(Range(range.first, mid));
+			stack.push_back(Range(mid, range.second));
+		}
+		
+		// compare all pairs in every leaf
+		const int leafCount(leaves.size());
+		unsigned long distCount(0);
+		#pragma omp parallel for reduction(+:distCount) schedule(guided,32)
+		for (int l = 0; l < leafCount; ++l)
+		{
+			for (Index i = leaves[l].first; i < leaves[l].second; ++i)
+			{
+				for (Index j = i + 1; j < leaves[l].second; ++j)
+				{
+					const T d2(dist2(order[i], order[j]));
+					tryInsert(order[i], order[j], d2);
+					tryInsert(order[j], order[i], d2);
+					++distCount;
+				}
+			}
+		}
+		return distCount;
+	}
+	
+	template<typename T>
+	unsigned long NNDescent<T>::initRandom()
+	{
+		const Index pointCount(cloud.cols());
+		unsigned long distCount(0);
+		#pragma omp parallel reduction(+:distCount)
+		{
+			boost::mt19937 rng(seed ^ (0x9e3779b9u * unsigned(threadIndex() + 1)));
+			#pragma omp for schedule(guided,256)
+			for (Index i = 0; i < pointCount; ++i)
+			{
+				while (neighbours[i * k + k - 1] < 0)
+				{
+					const Index j(rng() % pointCount);
+					if (j == i)
+						continue;
+					tryInsert(i, j, dist2(i, j));
+					++distCount;
+				}
+			}
+		}
+		return distCount;
+	}
+	
+	template<typename T>
+	void NNDescent<T>::sampleCandidates(const unsigned iteration)
+	{
+		const Index pointCount(cloud.cols());
+		for (int l = 0; l < 4; ++l)
+			fill(candidateCounts[l].begin(), candidateCounts[l].end(), 0);
+		for (int l = 0; l < 2; ++l)
+			fill(reverseSeenCounts[l].begin(), reverseSeenCounts[l].end(), 0);
+		
+		#pragma omp parallel
+		{
+			boost::mt19937 rng(seed ^ (0x9e3779b9u * unsigned(threadIndex() + 1)) ^ (0x85ebca6bu * (iteration + 1)));
+			Indices positions[2];
+			#pragma omp for schedule(guided,256)
+			for (Index i = 0; i < pointCount; ++i)
+			{
+				positions[0].clear();
+				positions[1].clear();
+				for (Index j = 0; j < k; ++j)
+					if (neighbours[i * k + j] >= 0)
+						positions[neighbourIsNew[i * k + j] ? 0 : 1].push_back(j);
+				
+				// l = 0: new neighbours, marked old once sampled; l = 1: old neighbours
+				for (int l = 0; l < 2; ++l)
+				{
+					Indices& pos(positions[l]);
+					const Index count(min<Index>(pos.size(), sampleCount));
+					for (Index c = 0; c < count; ++c)
+					{
+						swap(pos[c], pos[c + rng() % (pos.size() - c)]);
+						const Index neighbour(neighbours[i * k + pos[c]]);
+						if (l == 0)
+							neighbourIsNew[i * k + pos[c]] = 0;
+						candidates[l][i * sampleCount + c] = neighbour;
+						
+						// reservoir sampling of the reverse candidates of neighbour
+						lockSpin(locks[neighbour]);
+						const Index seen(reverseSeenCounts[l][neighbour]++);
+						if (seen < sampleCount)
+						{
+							candidates[l + 2][neighbour * sampleCount + seen] = i;
+							++candidateCounts[l + 2][neighbour];
+						}
+						else
+						{
+							const Index r(rng() % (seen + 1));
+							if (r < sampleCount)
+								candidates[l + 2][neighbour * sampleCount + r] = i;
+						}
+						unlockSpin(locks[neighbour]);
+					}
+					candidateCounts[l][i] = count;
+				}
+			}
+		}
+	}
+	
+	template<typename T>
+	unsigned long NNDescent<T>::localJoin(const Index point, ThreadState& state, unsigned long& updateCount)
+	{
+		Indices* merged[2] = { &state.newCandidates, &state.oldCandidates };
+		for (int l = 0; l < 2; ++l)
+		{
+			Indices& m(*merged[l]);
+			m.clear();
+			for (int s = l; s < 4; s += 2)
+			{
+				const Index* c(&candidates[s][point * sampleCount]);
+				m.insert(m.end(), c, c + candidateCounts[s][point]);
+			}
+			sort(m.begin(), m.end());
+			m.erase(unique(m.begin(), m.end()), m.end());
+		}
+		
+		const Indices& newCandidates(state.newCandidates);
+		const Indices& oldCandidates(state.oldCandidates);
+		unsigned long distCount(0);
+		for (size_t i = 0; i < newCandidates.size(); ++i)
+		{
+			const Index a(newCandidates[i]);
+			for (size_t j = i + 1; j < newCandidates.size(); ++j)
+			{
+				const Index b(newCandidates[j]);
+				const T d2(dist2(a, b));
+				updateCount += tryInsert(a, b, d2);
+				updateCount += tryInsert(b, a, d2);
+				++distCount;
+			}
+			for (size_t j = 0; j < oldCandidates.size(); ++j)
+			{
+				const Index b(oldCandidates[j]);
+				if (a == b)
+					continue;
+				const T d2(dist2(a, b));
+				updateCount += tryInsert(a, b, d2);
+				updateCount += tryInsert(b, a, d2);
+				++distCount;
+			}
+		}
+		return distCount;
+	}
+	
+	template<typename T>
+	unsigned long NNDescent<T>::build(IndexMatrix& indices, Matrix& dists2)
+	{
+		const Index pointCount(cloud.cols());
+		neighbours.assign(pointCount * k, -1);
+		neighbourDists2.assign(pointCount * k, numeric_limits<T>::infinity());
+		neighbourIsNew.assign(pointCount * k, 1);
+		locks.assign(pointCount, 0);
+		for (int l = 0; l < 4; ++l)
+		{
+			candidates[l].resize(pointCount * sampleCount);
+			candidateCounts[l].resize(pointCount);
+		}
+		for (int l = 0; l < 2; ++l)
+			reverseSeenCounts[l].resize(pointCount);
+		
+		unsigned long distCount(0);
+		for (unsigned tree = 0; tree < treeCount; ++tree)
+			distCount += initFromTree(tree);
+		distCount += initRandom();
+		
+		for (unsigned iteration = 0; iteration < iterationCount; ++iteration)
+		{
+			sampleCandidates(iteration);
+			unsigned long updateCount(0);
+			#pragma omp parallel reduction(+:distCount,updateCount)
+			{
+				ThreadState state;
+				#pragma omp for schedule(guided,32)
+				for (Index i = 0; i < pointCount; ++i)
+					distCount += localJoin(i, state, updateCount);
+			}
+			if (double(updateCount) < terminationCount)
+				break;
+		}
+		
+		for (Index i = 0; i < pointCount; ++i)
+		{
+			for (Index j = 0; j < k; ++j)
+			{
+				indices.coeffRef(j, i) = neighbours[i * k + j];
+				dists2.coeffRef(j, i) = neighbourDists2[i * k + j];
+			}
+		}
+		return distCount;
+	}
+	
+	template struct NNDescent<float>;
+	template struct NNDescent<double>;
+	
+	//@}
+}
@@ -20,9 +20,13 @@ void heapHeadReplace(HeapEntry* heap, const int index, const T value, const uint
 void heapInit(HeapEntry* heap, const uint K)
 {
 	for (uint i = 0; i < K; ++i)
-		heap[i].value = HUGE_VALF;
+	{
+		heap[i].value = INFINITY;
+		heap[i].index = 0;
+	}
 }
 
+// the heap is kept sorted from the farthest to the closest entry, copy it in increasing distance
 void heapCopy(global int* indices, global T* dists2, const HeapEntry* heap, const uint K)
 {
 	for (uint i = 0; i < K; ++i)
@@ -32,6 +36,3 @@ void heapCopy(global int* indices, global T* dists2, const HeapEntry* heap, cons
 	}
 }
 
-void heapSort(const HeapEntry* heap)
-{
-}
@@ -2,12 +2,11 @@ kernel void knnBruteForce(const global T* cloud,
 						const global T* query,
 						global int* indices,
 						global T* dists2,
+						const global T* maxRadii2,
 						const uint K,
 						const T maxError,
-						const T maxRadius2,
 						const uint optionFlags,
-						const uint indexStride,
-						const uint dists2Stride,
+						const uint queryStride,
 						const uint pointCount
 #ifdef TOUCH_STATISTICS
 						,
@@ -20,8 +19,8 @@ kernel void knnBruteForce(const global T* cloud,
 	
 	const size_t queryId = get_global_id(0);
 	const bool allowSelfMatch = optionFlags & ALLOW_SELF_MATCH;
-	const bool doSort = optionFlags & SORT_RESULTS;
-	const global T* q = &query[queryId * POINT_STRIDE];
+	const T maxRadius2 = maxRadii2[queryId];
+	const global T* q = &query[queryId * queryStride];
 	
 	for (uint index = 0; index < pointCount; ++index)
 	{
@@ -34,13 +33,11 @@ kernel void knnBruteForce(const global T* cloud,
 		}
 		if ((dist <= maxRadius2) &&
 			(dist < heapHeadValue(heap) &&
-			(allowSelfMatch || (dist > 0)))
+			(allowSelfMatch || (dist > (T)EPSILON))))
 			heapHeadReplace(heap, index, dist, K);
 	}
 	
-	if (doSort)
-		heapSort(heap);
-	heapCopy(&indices[queryId * indexStride], &dists2[queryId * dists2Stride], heap, K);
+	heapCopy(&indices[queryId * K], &dists2[queryId * K], heap, K);
 	#ifdef TOUCH_STATISTICS
 	touchStatistics[queryId] = pointCount;
 	#endif
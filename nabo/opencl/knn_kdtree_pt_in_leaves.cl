@@ -35,12 +35,11 @@ kernel void knnKDTree(	const global T* cloud,
 						const global T* query,
 						global int* indices,
 						global T* dists2,
+						const global T* maxRadii2,
 						const uint K,
 						const T maxError,
-						const T maxRadius2,
 						const uint optionFlags,
-						const uint indexStride,
-						const uint dists2Stride,
+						const uint queryStride,
 						const uint pointCount,
 #ifdef TOUCH_STATISTICS
 						global uint* touchStatistics,
@@ -58,8 +57,8 @@ kernel void knnKDTree(	const global T* cloud,
 
 	const size_t queryId = get_global_id(0);
 	const bool allowSelfMatch = optionFlags & ALLOW_SELF_MATCH;
-	const bool doSort = optionFlags & SORT_RESULTS;
-	const global T* q = &query[queryId * POINT_STRIDE];
+	const T maxRadius2 = maxRadii2[queryId];
+	const global T* q = &query[queryId * queryStride];
 	
 	heapInit(heap, K);
 	offInit(off);
@@ -123,7 +122,6 @@ kernel void knnKDTree(	const global T* cloud,
 			
 			case OP_REC1:
 			{
-				T rdE;
 				s->rd += - (s->old_off*s->old_off) + (s->new_off*s->new_off);
 				if ((s->rd <= maxRadius2) &&
 					(s->rd * maxError < heapHeadValue(heap)))
@@ -144,9 +142,7 @@ kernel void knnKDTree(	const global T* cloud,
 		}
 	}
 	
-	if (doSort)
-		heapSort(heap);
-	heapCopy(&indices[queryId * indexStride], &dists2[queryId * dists2Stride], heap, K);
+	heapCopy(&indices[queryId * K], &dists2[queryId * K], heap, K);
 #ifdef TOUCH_STATISTICS
 	touchStatistics[queryId] = visitCount;
 #endif
@@ -22,12 +22,11 @@ kernel void knnKDTree(	const global T* cloud,
 						const global T* query,
 						global int* indices,
 						global T* dists2,
+						const global T* maxRadii2,
 						const uint K,
 						const T maxError,
-						const T maxRadius2,
 						const uint optionFlags,
-						const uint indexStride,
-						const uint dists2Stride,
+						const uint queryStride,
 						const uint pointCount,
 #ifdef TOUCH_STATISTICS
 						global uint* touchStatistics,
@@ -44,8 +43,8 @@ kernel void knnKDTree(	const global T* cloud,
 	
 	const size_t queryId = get_global_id(0);
 	const bool allowSelfMatch = optionFlags & ALLOW_SELF_MATCH;
-	const bool doSort = optionFlags & SORT_RESULTS;
-	const global T* q = &query[queryId * POINT_STRIDE];
+	const T maxRadius2 = maxRadii2[queryId];
+	const global T* q = &query[queryId * queryStride];
 	
 	heapInit(heap, K);
 	
@@ -106,9 +105,7 @@ kernel void knnKDTree(	const global T* cloud,
 		}
 	}
 	
-	if (doSort)
-		heapSort(heap);
-	heapCopy(&indices[queryId * indexStride], &dists2[queryId * dists2Stride], heap, K);
+	heapCopy(&indices[queryId * K], &dists2[queryId * K], heap, K);
 #ifdef TOUCH_STATISTICS
 	touchStatistics[queryId] = visitCount;
 #endif
@@ -0,0 +1,251 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <boost/format.hpp>
+
+/*!	\file pyramid_cpu.cpp
+	\brief multi-resolution index over voxel-downsampled levels, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! default number of voxels along the largest extent of the cloud, in level 1
+	const int PYRAMID_DEFAULT_VOXEL_COUNT = 256;
+	
+	//! compare points by their voxel coordinates, in lexicographic order
+	struct VoxelCompare
+	{
+		const uint64_t* voxels; //!< voxel coordinates, dim values per point
+		const int dim; //!< number of dimensions
+		
+		//! constructor
+		VoxelCompare(const uint64_t* voxels, const int dim): voxels(voxels), dim(dim) {}
+		//! compare the voxels of points a and b, given by their positions in voxels
+		bool operator()(const int a, const int b) const
+		{
+			return lexicographical_compare(voxels + a * dim, voxels + (a + 1) * dim, voxels + b * dim, voxels + (b + 1) * dim);
+		}
+	};
+	
+	template<typename T>
+	KDTreePyramid<T>::KDTreePyramid(const Matrix& cloud, const Index dim, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		PyramidNearestNeighbourSearch<T>(cloud, dim, creationOptionFlags, additionalParameters.get<unsigned>("levelCount", 4))
+	{
+		const T levelScale(additionalParameters.get<T>("levelScale", T(2)));
+		if (!(levelScale > 1))
+			throw runtime_error((boost::format("Level scale (%1%) must be larger than 1") % levelScale).str());
+		T voxelSize(additionalParameters.get<T>("voxelSize", T(0)));
+		if (voxelSize < 0)
+			throw runtime_error((boost::format("Requesting a negative voxel size (%1%)") % voxelSize).str());
+		const int pointCount(cloud.cols());
+		
+		// compute bounds
+		Vector minValues(Vector::Constant(this->dim, numeric_limits<T>::infinity()));
+		Vector maxValues(Vector::Constant(this->dim, -numeric_limits<T>::infinity()));
+		for (int i = 0; i < pointCount; ++i)
+			for (int d = 0; d < this->dim; ++d)
+			{
+				minValues[d] = min(minValues[d], cloud.coeff(d, i));
+				maxValues[d] = max(maxValues[d], cloud.coeff(d, i));
+			}
+		if (voxelSize == 0)
+		{
+			T extent(0);
+			for (int d = 0; d < this->dim; ++d)
+				extent = max(extent, maxValues[d] - minValues[d]);
+			voxelSize = extent / PYRAMID_DEFAULT_VOXEL_COUNT;
+			if (voxelSize <= 0)
+				voxelSize = 1;
+		}
+		
+		// compute levels from the finest to the coarsest, every level being a subset of the previous one
+		Indices coarsestLevels(pointCount, 0);
+		Indices candidates(pointCount);
+		for (int i = 0; i < pointCount; ++i)
+			candidates[i] = i;
+		levelSizes.push_back(pointCount);
+		for (Index level = 1; level < levelCount; ++level)
+		{
+			candidates = downsample(candidates, minValues, voxelSize);
+			for (size_t j = 0; j < candidates.size(); ++j)
+				coarsestLevels[candidates[j]] = level;
+			levelSizes.push_back(candidates.size());
+			voxelSize *= levelScale;
+		}
+		
+		// sort points by decreasing coarsest level, points of level l then start at levelSizes[l+1]
+		Indices nextPositions(levelCount, 0);
+		for (Index level = 0; level + 1 < levelCount; ++level)
+			nextPositions[level] = levelSizes[level + 1];
+		store.resize(this->dim, pointCount);
+		storeIndices.resize(pointCount);
+		for (int i = 0; i < pointCount; ++i)
+		{
+			const Index position(nextPositions[coarsestLevels[i]]++);
+			store.col(position) = cloud.block(0, i, this->dim, 1);
+			storeIndices[position] = i;
+		}
+		
+		// build one kd-tree per level, on the prefix of the store holding its points
+		try
+		{
+			for (Index level = 0; level < levelCount; ++level)
+				trees.push_back(new KDTreeUnbalancedPtInLeavesImplicitBoundsStackOpt<T, IndexHeapBruteForceVector<int,T> >(store, this->dim, creationOptionFlags, additionalParameters, levelSizes[level]));
+		}
+		catch (...)
+		{
+			for (size_t level = 0; level < trees.size(); ++level)
+				delete trees[level];
+			throw;
+		}
+	}
+	
+	template<typename T>
+	KDTreePyramid<T>::~KDTreePyramid()
+	{
+		for (size_t level = 0; level < trees.size(); ++level)
+			delete trees[level];
+	}
+	
+	template<typename T>
+	typename KDTreePyramid<T>::Indices KDTreePyramid<T>::downsample(const Indices& candidates, const Vector& minValues, const T voxelSize) const
+	{
+		// compute the voxel of every candidate, relative to the lowest corner of the cloud
+		const int candidateCount(candidates.size());
+		vector<uint64_t> voxels(candidateCount * this->dim);
+#pragma omp parallel for schedule(static)
+		for (int j = 0; j < candidateCount; ++j)
+			for (int d = 0; d < this->dim; ++d)
+				voxels[j * this->dim + d] = uint64_t(floor((cloud.coeff(d, candidates[j]) - minValues[d]) / voxelSize));
+		
+		// group candidates by voxel, and keep the one closest to the voxel center in every group
+		Indices order(candidateCount);
+		for (int j = 0; j < candidateCount; ++j)
+			order[j] = j;
+		const VoxelCompare compare(&voxels[0], this->dim);
+		sort(order.begin(), order.end(), compare);
+		Indices kept;
+		int groupStart(0);
+		while (groupStart < candidateCount)
+		{
+			int best(-1);
+			T bestDist2(numeric_limits<T>::infinity());
+			int j(groupStart);
+			for (; j < candidateCount && !compare(order[groupStart], order[j]); ++j)
+			{
+				T dist2(0);
+				for (int d = 0; d < this->dim; ++d)
+				{
+					const T center(minValues[d] + (T(voxels[order[j] * this->dim + d]) + T(0.5)) * voxelSize);
+					const T diff(cloud.coeff(d, candidates[order[j]]) - center);
+					dist2 += diff * diff;
+				}
+				if (best < 0 || dist2 < bestDist2)
+				{
+					best = order[j];
+					bestDist2 = dist2;
+				}
+			}
+			kept.push_back(candidates[best]);
+			groupStart = j;
+		}
+		sort(kept.begin(), kept.end());
+		return kept;
+	}
+	
+	template<typename T>
+	void KDTreePyramid<T>::mapIndices(IndexMatrix& indices, const Matrix& dists2) const
+	{
+		const int colCount(indices.cols());
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < colCount; ++i)
+			for (int j = 0; j < indices.rows(); ++j)
+				if (dists2.coeff(j, i) != numeric_limits<T>::infinity())
+					indices.coeffRef(j, i) = storeIndices[indices.coeff(j, i)];
+	}
+	
+	template<typename T>
+	typename KDTreePyramid<T>::Index KDTreePyramid<T>::getLevelSize(const Index level) const
+	{
+		if (level < 0 || level >= levelCount)
+			throw runtime_error((boost::format("Requesting level %1%, but the pyramid has %2% levels") % level % levelCount).str());
+		return levelSizes[level];
+	}
+	
+	template<typename T>
+	unsigned long KDTreePyramid<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		checkSizesKnn(query, indices, dists2, level, k, optionFlags);
+		const unsigned long touchedCount(trees[level]->knn(query, indices, dists2, k, epsilon, optionFlags, maxRadius));
+		mapIndices(indices, dists2);
+		return touchedCount;
+	}
+	
+	template<typename T>
+	unsigned long KDTreePyramid<T>::knnCoarseToFine(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index level, const Index coarseLevel, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, level, k, optionFlags);
+		if (coarseLevel < level)
+			throw runtime_error((boost::format("Coarse level (%1%) is finer than searched level (%2%)") % coarseLevel % level).str());
+		checkSizesKnn(query, indices, dists2, coarseLevel, k, optionFlags);
+		
+		// search the coarse level, its k-th neighbour is a point of level too, so its distance bounds the search;
+		// the bound is slightly enlarged such that rounding errors in its square do not exclude this neighbour
+		const unsigned searchOptionFlags(optionFlags & ~unsigned(NearestNeighbourSearch<T>::SORT_RESULTS));
+		unsigned long touchedCount(trees[coarseLevel]->knn(query, indices, dists2, k, epsilon, searchOptionFlags, numeric_limits<T>::infinity()));
+		const int colCount(query.cols());
+		Vector maxRadii(colCount);
+		for (int i = 0; i < colCount; ++i)
+			maxRadii[i] = sqrt(dists2.col(i).maxCoeff()) * (1 + 4 * numeric_limits<T>::epsilon());
+		
+		// search level within these bounds
+		touchedCount += trees[level]->knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags);
+		mapIndices(indices, dists2);
+		return touchedCount;
+	}
+	
+	template struct KDTreePyramid<float>;
+	template struct KDTreePyramid<double>;
+	
+	//@}
+}
@@ -0,0 +1,259 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+
+/*!	\file rotation_cpu.cpp
+	\brief search in a cloud rotated into its principal axes or randomly, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! maximum number of Jacobi sweeps when diagonalizing the covariance, convergence is quadratic and usually takes less than 10
+	const int ROTATION_MAX_JACOBI_SWEEPS = 50;
+	
+	template<typename T>
+	RotatedSearch<T>::RotatedSearch(const Matrix& cloud, const Index dim, const typename NearestNeighbourSearch<T>::SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		rotatedSearch(0)
+	{
+		if (creationOptionFlags & (NearestNeighbourSearch<T>::INNER_PRODUCT | NearestNeighbourSearch<T>::COSINE))
+			throw runtime_error("Rotation is not supported in inner-product or cosine similarity search");
+		if (additionalParameters.get<Vector>("periodicBox", Vector()).size() != 0)
+			throw runtime_error("Rotation is not supported in periodic domains, whose boundaries are aligned with the axes");
+		
+		const Index pointCount(cloud.cols());
+#ifdef EIGEN3_API
+		const_cast<Vector&>(this->minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
+		const_cast<Vector&>(this->maxBound) = cloud.topRows(this->dim).rowwise().maxCoeff();
+#else // EIGEN3_API
+		// compute bounds
+		for (int i = 0; i < pointCount; ++i)
+		{
+			const Vector& v(cloud.block(0,i,this->dim,1));
+			const_cast<Vector&>(this->minBound) = this->minBound.cwise().min(v);
+			const_cast<Vector&>(this->maxBound) = this->maxBound.cwise().max(v);
+		}
+#endif // EIGEN3_API
+		
+		center = Vector::Zero(this->dim);
+		for (int i = 0; i < pointCount; ++i)
+			center += cloud.block(0, i, this->dim, 1);
+		center /= T(pointCount);
+		
+		const string rotationType(additionalParameters.get<string>("rotation", string("none")));
+		if (rotationType == "pca")
+			computePrincipalRotation();
+		else if (rotationType == "random")
+			computeRandomRotation(additionalParameters.get<unsigned>("rotationSeed", 0));
+		else
+			throw runtime_error((boost::format("Unknown rotation %1%, valid values are none, pca and random") % rotationType).str());
+		
+		store = rotate(cloud);
+		Parameters rotatedParameters(additionalParameters);
+		rotatedParameters.erase("rotation");
+		rotatedParameters.erase("rotationSeed");
+		rotatedSearch = NearestNeighbourSearch<T>::create(store, this->dim, preferedType, creationOptionFlags, rotatedParameters);
+		this->buildStatistics = rotatedSearch->getBuildStatistics();
+	}
+	
+	template<typename T>
+	RotatedSearch<T>::~RotatedSearch()
+	{
+		delete rotatedSearch;
+	}
+	
+	template<typename T>
+	void RotatedSearch<T>::computePrincipalRotation()
+	{
+		// covariance of the centered cloud, the scale is irrelevant for eigenvectors
+		Matrix a(Matrix::Zero(dim, dim));
+		for (int i = 0; i < cloud.cols(); ++i)
+		{
+			const Vector v(cloud.block(0, i, dim, 1) - center);
+			a += v * v.transpose();
+		}
+		
+		// cyclic Jacobi sweeps, every plane rotation zeroes one off-diagonal entry and accumulates into eigenvectors
+		Matrix eigenvectors(Matrix::Identity(dim, dim));
+		for (int sweep = 0; sweep < ROTATION_MAX_JACOBI_SWEEPS; ++sweep)
+		{
+			T offDiagonal(0);
+			T diagonal(0);
+			for (int p = 0; p < dim; ++p)
+			{
+				diagonal += a(p, p) * a(p, p);
+				for (int q = p + 1; q < dim; ++q)
+					offDiagonal += a(p, q) * a(p, q);
+			}
+			if (offDiagonal <= numeric_limits<T>::epsilon() * numeric_limits<T>::epsilon() * diagonal)
+				break;
+			
+			for (int p = 0; p < dim; ++p)
+			{
+				for (int q = p + 1; q < dim; ++q)
+				{
+					if (a(p, q) == 0)
+						continue;
+					const T theta((a(q, q) - a(p, p)) / (T(2) * a(p, q)));
+					const T t((theta >= 0 ? T(1) : T(-1)) / (fabs(theta) + sqrt(theta * theta + T(1))));
+					const T c(T(1) / sqrt(t * t + T(1)));
+					const T s(t * c);
+					for (int k = 0; k < dim; ++k)
+					{
+						const T akp(a(k, p)), akq(a(k, q));
+						a(k, p) = c * akp - s * akq;
+						a(k, q) = s * akp + c * akq;
+					}
+					for (int k = 0; k < dim; ++k)
+					{
+						const T apk(a(p, k)), aqk(a(q, k));
+						a(p, k) = c * apk - s * aqk;
+						a(q, k) = s * apk + c * aqk;
+					}
+					for (int k = 0; k < dim; ++k)
+					{
+						const T vkp(eigenvectors(k, p)), vkq(eigenvectors(k, q));
+						eigenvectors(k, p) = c * vkp - s * vkq;
+						eigenvectors(k, q) = s * vkp + c * vkq;
+					}
+				}
+			}
+		}
+		
+		// rows of the rotation are the eigenvectors, by decreasing eigenvalue
+		vector<pair<T, int> > order(dim);
+		for (int i = 0; i < dim; ++i)
+			order[i] = make_pair(-a(i, i), i);
+		sort(order.begin(), order.end());
+		rotation.resize(dim, dim);
+		for (int i = 0; i < dim; ++i)
+			rotation.row(i) = eigenvectors.col(order[i].second).transpose();
+	}
+	
+	template<typename T>
+	void RotatedSearch<T>::computeRandomRotation(const unsigned seed)
+	{
+		// Gram-Schmidt orthonormalization of Gaussian rows gives a rotation uniformly distributed up to reflections
+		boost::mt19937 rng(seed);
+		boost::variate_generator<boost::mt19937&, boost::normal_distribution<T> > gaussian(rng, boost::normal_distribution<T>());
+		rotation.resize(dim, dim);
+		for (int i = 0; i < dim; ++i)
+		{
+			for (int j = 0; j < dim; ++j)
+				rotation(i, j) = gaussian();
+			for (int j = 0; j < i; ++j)
+				rotation.row(i) -= rotation.row(i).dot(rotation.row(j)) * rotation.row(j);
+			rotation.row(i) /= rotation.row(i).norm();
+		}
+	}
+	
+	template<typename T>
+	typename RotatedSearch<T>::Matrix RotatedSearch<T>::rotate(const Matrix& points) const
+	{
+		// a plain loop rather than a matrix product, whose rounding could depend on the number of columns
+		const int colCount(points.cols());
+		Matrix rotated(dim, colCount);
+#pragma omp parallel for
+		for (int i = 0; i < colCount; ++i)
+		{
+			for (int r = 0; r < dim; ++r)
+			{
+				T value(0);
+				for (int c = 0; c < dim; ++c)
+					value += rotation(r, c) * (points(c, i) - center(c));
+				rotated(r, i) = value;
+			}
+		}
+		return rotated;
+	}
+	
+	template<typename T>
+	size_t RotatedSearch<T>::memoryUsage() const
+	{
+		return store.size() * sizeof(T) + rotatedSearch->memoryUsage();
+	}
+	
+	template<typename T>
+	unsigned long RotatedSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags);
+		return rotatedSearch->knn(rotate(query), indices, dists2, k, epsilon, optionFlags, maxRadius);
+	}
+	
+	template<typename T>
+	unsigned long RotatedSearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		return rotatedSearch->knn(rotate(query), indices, dists2, maxRadii, k, epsilon, optionFlags);
+	}
+	
+	template<typename T>
+	typename NearestNeighbourSearch<T>::Cursor* RotatedSearch<T>::createCursor(const Vector& query, const unsigned optionFlags, const T maxRadius) const
+	{
+		if (query.size() < dim)
+			throw runtime_error((boost::format("Query has less dimensions (%1%) than requested for cloud (%2%)") % query.size() % dim).str());
+		const Vector rotatedQuery(rotate(query).col(0));
+		return rotatedSearch->createCursor(rotatedQuery, optionFlags, maxRadius);
+	}
+	
+	template<typename T>
+	unsigned long RotatedSearch<T>::findNearSegments(const Matrix& origins, const Matrix& ends, typename NearestNeighbourSearch<T>::SegmentMatchesVector& matches, const T radius) const
+	{
+		if (origins.rows() < dim)
+			throw runtime_error((boost::format("Origins have less dimensions (%1%) than requested for cloud (%2%)") % origins.rows() % dim).str());
+		if (ends.rows() != origins.rows() || ends.cols() != origins.cols())
+			throw runtime_error((boost::format("Ends matrix has a different size (%1% x %2%) than origins (%3% x %4%)") % ends.rows() % ends.cols() % origins.rows() % origins.cols()).str());
+		// positions along segments and distances are preserved by rotation
+		return rotatedSearch->findNearSegments(rotate(origins), rotate(ends), matches, radius);
+	}
+	
+	template struct RotatedSearch<float>;
+	template struct RotatedSearch<double>;
+	
+	//@}
+}
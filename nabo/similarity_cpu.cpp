@@ -0,0 +1,248 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo_private.h"
+#include "index_heap.h"
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/*!	\file similarity_cpu.cpp
+	\brief inner-product and cosine similarity search, cpu implementation
+	\ingroup private
+*/
+
+namespace Nabo
+{
+	//! \ingroup private
+	//@{
+	
+	using namespace std;
+	
+	//! number of queries whose similarities brute-force search computes in one matrix product
+	const int SIMILARITY_QUERY_BLOCK_SIZE = 64;
+	//! number of points whose similarities brute-force search computes in one matrix product
+	const int SIMILARITY_POINT_BLOCK_SIZE = 1024;
+	
+	template<typename T>
+	SimilaritySearch<T>::SimilaritySearch(const Matrix& cloud, const Index dim, const typename NearestNeighbourSearch<T>::SearchType preferedType, const unsigned creationOptionFlags, const Parameters& additionalParameters):
+		NearestNeighbourSearch<T>::NearestNeighbourSearch(cloud, dim, creationOptionFlags),
+		cosine(creationOptionFlags & NearestNeighbourSearch<T>::COSINE),
+		reducedSearch(0)
+	{
+		if ((creationOptionFlags & NearestNeighbourSearch<T>::INNER_PRODUCT) && cosine)
+			throw runtime_error("INNER_PRODUCT and COSINE creation options are mutually exclusive");
+		
+		const Index pointCount(cloud.cols());
+#ifdef EIGEN3_API
+		const_cast<Vector&>(this->minBound) = cloud.topRows(this->dim).rowwise().minCoeff();
+		const_cast<Vector&>(this->maxBound) = cloud.topRows(this->dim).rowwise().maxCoeff();
+#else // EIGEN3_API
+		// compute bounds
+		for (int i = 0; i < pointCount; ++i)
+		{
+			const Vector& v(cloud.block(0,i,this->dim,1));
+			const_cast<Vector&>(this->minBound) = this->minBound.cwise().min(v);
+			const_cast<Vector&>(this->maxBound) = this->maxBound.cwise().max(v);
+		}
+#endif // EIGEN3_API
+		
+		if (cosine)
+		{
+			// normalize once, zero points stay zero
+			store = cloud.block(0, 0, this->dim, pointCount);
+			for (int i = 0; i < pointCount; ++i)
+			{
+				const T norm(store.col(i).norm());
+				if (norm > 0)
+					store.col(i) /= norm;
+			}
+		}
+		else
+		{
+			// augment every point to the norm of the largest one
+			store.resize(this->dim + 1, pointCount);
+			store.block(0, 0, this->dim, pointCount) = cloud.block(0, 0, this->dim, pointCount);
+			Vector norms2(pointCount);
+			for (int i = 0; i < pointCount; ++i)
+				norms2(i) = store.block(0, i, this->dim, 1).squaredNorm();
+			const T maxNorm2(norms2.maxCoeff());
+			for (int i = 0; i < pointCount; ++i)
+				store(this->dim, i) = sqrt(max(maxNorm2 - norms2(i), T(0)));
+		}
+		
+		if (preferedType != NearestNeighbourSearch<T>::BRUTE_FORCE)
+		{
+			const unsigned reducedFlags(creationOptionFlags & ~(NearestNeighbourSearch<T>::INNER_PRODUCT | NearestNeighbourSearch<T>::COSINE));
+			reducedSearch = NearestNeighbourSearch<T>::create(store, store.rows(), preferedType, reducedFlags, additionalParameters);
+		}
+	}
+	
+	template<typename T>
+	SimilaritySearch<T>::~SimilaritySearch()
+	{
+		delete reducedSearch;
+	}
+	
+	template<typename T>
+	size_t SimilaritySearch<T>::memoryUsage() const
+	{
+		return store.size() * sizeof(T) + (reducedSearch ? reducedSearch->memoryUsage() : 0);
+	}
+	
+	template<typename T>
+	typename SimilaritySearch<T>::Matrix SimilaritySearch<T>::transformQuery(const Matrix& query, const bool augment) const
+	{
+		const int colCount(query.cols());
+		Matrix transformed((augment && !cosine) ? dim + 1 : dim, colCount);
+		transformed.block(0, 0, dim, colCount) = query.block(0, 0, dim, colCount);
+		if (cosine)
+		{
+			for (int i = 0; i < colCount; ++i)
+			{
+				const T norm(transformed.col(i).norm());
+				if (norm > 0)
+					transformed.col(i) /= norm;
+			}
+		}
+		else if (augment)
+			transformed.row(dim).setZero();
+		return transformed;
+	}
+	
+	template<typename T>
+	unsigned long SimilaritySearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const T epsilon, const unsigned optionFlags, const T maxRadius) const
+	{
+		const Vector maxRadii(Vector::Constant(query.cols(), maxRadius));
+		return knn(query, indices, dists2, maxRadii, k, epsilon, optionFlags);
+	}
+	
+	template<typename T>
+	unsigned long SimilaritySearch<T>::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Vector& maxRadii, const Index k, const T epsilon, const unsigned optionFlags) const
+	{
+		checkSizesKnn(query, indices, dists2, k, optionFlags, &maxRadii);
+		for (int i = 0; i < maxRadii.size(); ++i)
+			if (maxRadii[i] != numeric_limits<T>::infinity())
+				throw runtime_error("Maximum radius is not supported in inner-product or cosine similarity search");
+		
+		// with inner product, a point of the cloud cannot be identified with the query
+		const bool allowSelfMatch((optionFlags & NearestNeighbourSearch<T>::ALLOW_SELF_MATCH) || !cosine);
+		const bool sortResults(optionFlags & NearestNeighbourSearch<T>::SORT_RESULTS);
+		
+		if (!reducedSearch)
+			return bruteForceKnn(query, indices, dists2, k, allowSelfMatch, sortResults);
+		
+		// search in reduced Euclidean space, then recompute the similarities of the results
+		const Matrix reducedQuery(transformQuery(query, true));
+		const unsigned reducedOptionFlags(optionFlags | (allowSelfMatch ? NearestNeighbourSearch<T>::ALLOW_SELF_MATCH : 0));
+		const unsigned long stats(reducedSearch->knn(reducedQuery, indices, dists2, k, epsilon, reducedOptionFlags));
+		for (int i = 0; i < query.cols(); ++i)
+		{
+			for (int j = 0; j < k; ++j)
+			{
+				if (dists2(j, i) == numeric_limits<T>::infinity())
+					dists2(j, i) = -numeric_limits<T>::infinity();
+				else
+					dists2(j, i) = store.col(indices(j, i)).segment(0, dim).dot(reducedQuery.col(i).segment(0, dim));
+			}
+		}
+		return stats;
+	}
+	
+	template<typename T>
+	unsigned long SimilaritySearch<T>::bruteForceKnn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const bool allowSelfMatch, const bool sortResults) const
+	{
+		typedef IndexHeapSTL<Index, T> Heap;
+		
+		const Matrix q(transformQuery(query, false));
+		const int colCount(q.cols());
+		const int pointCount(store.cols());
+		const int blockCount((colCount + SIMILARITY_QUERY_BLOCK_SIZE - 1) / SIMILARITY_QUERY_BLOCK_SIZE);
+		
+#pragma omp parallel
+		{
+		
+		// heaps hold negated similarities, so that the largest similarities are kept
+		vector<Heap> heaps(SIMILARITY_QUERY_BLOCK_SIZE, Heap(k));
+		Matrix scores;
+		
+#pragma omp for schedule(dynamic)
+		for (int b = 0; b < blockCount; ++b)
+		{
+			const int first(b * SIMILARITY_QUERY_BLOCK_SIZE);
+			const int count(min(SIMILARITY_QUERY_BLOCK_SIZE, colCount - first));
+			for (int j = 0; j < count; ++j)
+				heaps[j].reset();
+			for (int pointFirst = 0; pointFirst < pointCount; pointFirst += SIMILARITY_POINT_BLOCK_SIZE)
+			{
+				const int pointBlockCount(min(SIMILARITY_POINT_BLOCK_SIZE, pointCount - pointFirst));
+#ifdef EIGEN3_API
+				scores.noalias() = store.block(0, pointFirst, dim, pointBlockCount).transpose() * q.block(0, first, dim, count);
+#else // EIGEN3_API
+				scores = store.block(0, pointFirst, dim, pointBlockCount).transpose() * q.block(0, first, dim, count);
+#endif // EIGEN3_API
+				for (int j = 0; j < count; ++j)
+				{
+					Heap& heap(heaps[j]);
+					for (int i = 0; i < pointBlockCount; ++i)
+					{
+						const T value(-scores(i, j));
+						// for cosine, 2 + 2 * value is the squared distance between normalized points
+						if ((value < heap.headValue()) &&
+							(allowSelfMatch || (T(2) + T(2) * value > numeric_limits<T>::epsilon())))
+							heap.replaceHead(pointFirst + i, value);
+					}
+				}
+			}
+			for (int j = 0; j < count; ++j)
+			{
+				if (sortResults)
+					heaps[j].sort();
+				heaps[j].getData(indices.col(first + j), dists2.col(first + j));
+				dists2.col(first + j) = -dists2.col(first + j);
+			}
+		}
+		}
+		if (creationOptionFlags & NearestNeighbourSearch<T>::TOUCH_STATISTICS)
+			return (unsigned long)colCount * (unsigned long)pointCount;
+		else
+			return 0;
+	}
+	
+	template struct SimilaritySearch<float>;
+	template struct SimilaritySearch<double>;
+	
+	//@}
+}
@@ -0,0 +1,189 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "client.h"
+#include "protocol.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <boost/format.hpp>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// some systems do not have this flag, they must ignore SIGPIPE instead
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+/*!	\file client.cpp
+	\brief client of a SearchServer
+*/
+
+namespace Nabo
+{
+	using namespace std;
+	
+	SearchClient::SearchClient(const std::string& socketPath):
+		socket(-1),
+		dim(0),
+		pointCount(0)
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+			throw runtime_error((boost::format("Socket path %1% is longer than the maximum of %2% characters") % socketPath % (sizeof(address.sun_path) - 1)).str());
+		strcpy(address.sun_path, socketPath.c_str());
+		
+		socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (socket < 0)
+			throw runtime_error((boost::format("Cannot create socket: %1%") % strerror(errno)).str());
+		if (connect(socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+		{
+			const string error(strerror(errno));
+			close(socket);
+			throw runtime_error((boost::format("Cannot connect to %1%: %2%") % socketPath % error).str());
+		}
+		
+		Protocol::Hello hello;
+		try
+		{
+			receiveAll(&hello, sizeof(hello));
+		}
+		catch (const runtime_error&)
+		{
+			close(socket);
+			throw;
+		}
+		if (hello.magic != Protocol::MAGIC || hello.version != Protocol::VERSION)
+		{
+			close(socket);
+			throw runtime_error((boost::format("Server at %1% speaks protocol version %2% instead of %3%") % socketPath % hello.version % Protocol::VERSION).str());
+		}
+		dim = hello.dim;
+		pointCount = hello.pointCount;
+	}
+	
+	SearchClient::~SearchClient()
+	{
+		close(socket);
+	}
+	
+	void SearchClient::knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k, const float epsilon, const unsigned optionFlags, const float maxRadius)
+	{
+		if (query.rows() < dim)
+			throw runtime_error((boost::format("Query has less dimensions (%1%) than the cloud of the server (%2%)") % query.rows() % dim).str());
+		if (k < 0)
+			throw runtime_error((boost::format("Requesting a negative number of points (%1%)") % k).str());
+		if (uint32_t(k) > Protocol::MAX_K)
+			throw runtime_error((boost::format("Requesting more points (%1%) than a request allows (%2%)") % k % Protocol::MAX_K).str());
+		const bool allowSelfMatch(optionFlags & NearestNeighbourSearch<float>::ALLOW_SELF_MATCH);
+		const Index availableCount(allowSelfMatch ? pointCount : pointCount - 1);
+		if (k > availableCount)
+			throw runtime_error((boost::format("Requesting more points (%1%) than available in the cloud of the server%2% (%3%)") % k % (allowSelfMatch ? "" : " minus 1") % availableCount).str());
+		if (uint64_t(k) * uint64_t(query.cols()) > Protocol::MAX_RESULT_COUNT)
+			throw runtime_error((boost::format("Requesting more results (%1% points for %2% queries) than a request allows (%3%)") % k % query.cols() % Protocol::MAX_RESULT_COUNT).str());
+		
+		// send the header and the coordinates, without copy if they are contiguous
+		Protocol::RequestHeader header;
+		header.magic = Protocol::MAGIC;
+		header.queryCount = query.cols();
+		header.k = k;
+		header.optionFlags = optionFlags;
+		header.epsilon = epsilon;
+		header.maxRadius = maxRadius;
+		if (header.queryCount > Protocol::MAX_QUERY_COUNT)
+			throw runtime_error((boost::format("Query has more points (%1%) than a request can hold (%2%)") % header.queryCount % Protocol::MAX_QUERY_COUNT).str());
+		sendAll(&header, sizeof(header));
+		if (query.rows() == dim)
+			sendAll(query.data(), query.size() * sizeof(float));
+		else
+		{
+			const Matrix coordinates(query.block(0, 0, dim, query.cols()));
+			sendAll(coordinates.data(), coordinates.size() * sizeof(float));
+		}
+		
+		Protocol::ResponseHeader response;
+		receiveAll(&response, sizeof(response));
+		if (response.magic != Protocol::MAGIC)
+			throw runtime_error("Invalid response from server");
+		if (response.errorLength)
+		{
+			string message(response.errorLength, ' ');
+			receiveAll(&message[0], response.errorLength);
+			throw runtime_error((boost::format("Server error: %1%") % message).str());
+		}
+		indices.resize(k, query.cols());
+		dists2.resize(k, query.cols());
+		if (indices.size())
+		{
+			receiveAll(indices.data(), indices.size() * sizeof(Index));
+			receiveAll(dists2.data(), dists2.size() * sizeof(float));
+		}
+	}
+	
+	//! Send size bytes of data, throw if the connection fails
+	void SearchClient::sendAll(const void* data, const size_t size)
+	{
+		const char* bytes(reinterpret_cast<const char*>(data));
+		size_t sentSize(0);
+		while (sentSize < size)
+		{
+			const ssize_t result(send(socket, bytes + sentSize, size - sentSize, MSG_NOSIGNAL));
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+				throw runtime_error((boost::format("Cannot send to server: %1%") % strerror(errno)).str());
+			sentSize += result;
+		}
+	}
+	
+	//! Receive size bytes into data, throw if the connection fails
+	void SearchClient::receiveAll(void* data, const size_t size)
+	{
+		char* bytes(reinterpret_cast<char*>(data));
+		size_t receivedSize(0);
+		while (receivedSize < size)
+		{
+			const ssize_t result(recv(socket, bytes + receivedSize, size - receivedSize, 0));
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result == 0)
+				throw runtime_error("Connection closed by server");
+			if (result < 0)
+				throw runtime_error((boost::format("Cannot receive from server: %1%") % strerror(errno)).str());
+			receivedSize += result;
+		}
+	}
+}
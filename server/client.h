@@ -0,0 +1,91 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __NABO_CLIENT_H
+#define __NABO_CLIENT_H
+
+#include "nabo/nabo.h"
+#include <string>
+
+/*!	\file client.h
+	\brief client of a SearchServer
+*/
+
+namespace Nabo
+{
+	//! Connection to a SearchServer, to query a nearest-neighbour search shared with other processes
+	/*!	Calls are blocking, and a client must not be used by several threads at once; use one client per thread instead.
+	 *	Errors, including those reported by the server, throw a runtime_error.
+	 */
+	struct SearchClient
+	{
+		typedef NearestNeighbourSearch<float>::Matrix Matrix; //!< a column-major matrix of floats, in which each column is a point
+		typedef NearestNeighbourSearch<float>::Index Index; //!< an index to a data point
+		typedef NearestNeighbourSearch<float>::IndexMatrix IndexMatrix; //!< a matrix of indices to data points
+		
+		//! Connect to the server listening at socketPath
+		SearchClient(const std::string& socketPath);
+		//! Close the connection
+		~SearchClient();
+		
+		//! Return the number of dimensions of the cloud of the server
+		Index getDim() const { return dim; }
+		//! Return the number of points of the cloud of the server
+		Index getPointCount() const { return pointCount; }
+		
+		//! Find the k nearest neighbours for each point of query, see NearestNeighbourSearch::knn()
+		/*!	For radius searches, set maxRadius and a k bounding the number of neighbours.
+		 *	\param query query points, only the first getDim() rows are used
+		 *	\param indices indices of nearest neighbours, resized to k x query.cols()
+		 *	\param dists2 squared distances to nearest neighbours, resized to k x query.cols()
+		 *	\param k number of nearest neighbour requested
+		 *	\param epsilon maximal ratio of error for approximate search, 0 for exact search
+		 *	\param optionFlags search options, a bitwise OR of elements of NearestNeighbourSearch::SearchOptionFlags
+		 *	\param maxRadius maximum radius in which to search
+		 */
+		void knn(const Matrix& query, IndexMatrix& indices, Matrix& dists2, const Index k = 1, const float epsilon = 0, const unsigned optionFlags = 0, const float maxRadius = std::numeric_limits<float>::infinity());
+		
+	protected:
+		void sendAll(const void* data, const size_t size);
+		void receiveAll(void* data, const size_t size);
+		
+		int socket; //!< connected socket
+		Index dim; //!< number of dimensions of the cloud of the server
+		Index pointCount; //!< number of points of the cloud of the server
+	
+	private:
+		//! clients cannot be copied, as they own their connection
+		SearchClient(const SearchClient&);
+		SearchClient& operator=(const SearchClient&);
+	};
+}
+
+#endif // __NABO_CLIENT_H
@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "server.h"
+#include "load.h"
+#include <iostream>
+#include <cstdlib>
+#include <signal.h>
+
+/*!	\file knnserver.cpp
+	\brief executable serving nearest-neighbour requests of local processes
+*/
+
+using namespace std;
+using namespace Nabo;
+
+//! server to stop on signals
+static SearchServer* server(0);
+
+//! Stop the server on SIGINT and SIGTERM
+static void stopServer(int)
+{
+	if (server)
+		server->stop();
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		cerr << "Usage " << argv[0] << " DATA SOCKET_PATH [SEARCH_TYPE] [MAX_BATCH_SIZE] [MAX_DELAY_US]" << endl;
+		cerr << "  DATA: text file with one point per line" << endl;
+		cerr << "  SEARCH_TYPE: index of NearestNeighbourSearch::SearchType, defaults to " << SearchServer::NNS::KDTREE_LINEAR_HEAP << endl;
+		cerr << "  MAX_BATCH_SIZE: number of pending query points searched without waiting further, defaults to 1024" << endl;
+		cerr << "  MAX_DELAY_US: maximum time a request waits to be coalesced with others, in microseconds, defaults to 200" << endl;
+		return 1;
+	}
+	
+	SearchServer::Matrix cloud;
+	if (!loadCloud(argv[1], cloud))
+	{
+		cerr << "Cannot load cloud from " << argv[1] << endl;
+		return 2;
+	}
+	const SearchServer::NNS::SearchType searchType(argc >= 4 ? SearchServer::NNS::SearchType(atoi(argv[3])) : SearchServer::NNS::KDTREE_LINEAR_HEAP);
+	const unsigned maxBatchSize(argc >= 5 ? atoi(argv[4]) : 1024);
+	const unsigned maxDelay(argc >= 6 ? atoi(argv[5]) : 200);
+	
+	try
+	{
+		SearchServer searchServer(cloud, argv[2], searchType, 0, Parameters(), maxBatchSize, maxDelay);
+		server = &searchServer;
+		signal(SIGINT, stopServer);
+		signal(SIGTERM, stopServer);
+		signal(SIGPIPE, SIG_IGN);
+		cerr << "Serving " << cloud.cols() << " points of " << cloud.rows() << " dimensions on " << argv[2] << endl;
+		searchServer.serve();
+		server = 0;
+		const SearchServer::Statistics& statistics(searchServer.getStatistics());
+		cerr << "Served " << statistics.requestCount << " requests of " << statistics.queryCount << " query points in " << statistics.batchCount << " batches" << endl;
+	}
+	catch (const exception& e)
+	{
+		cerr << "Error: " << e.what() << endl;
+		return 3;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "client.h"
+#include "load.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*!	\file knnserverbench.cpp
+	\brief latency and throughput benchmark of a running knnserver
+*/
+
+using namespace std;
+using namespace Nabo;
+
+typedef NearestNeighbourSearch<float> NNS;
+
+//! Return the current time, in seconds
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return double(tv.tv_sec) + double(tv.tv_usec) * 1e-6;
+}
+
+//! Return requestCount queries of queryCount points of cloud, displaced by a small random offset
+static vector<NNS::Matrix> createRequests(const NNS::Matrix& cloud, const int requestCount, const int queryCount)
+{
+	vector<NNS::Matrix> requests(requestCount);
+	for (int r = 0; r < requestCount; ++r)
+	{
+		requests[r].resize(cloud.rows(), queryCount);
+		for (int i = 0; i < queryCount; ++i)
+			for (int d = 0; d < cloud.rows(); ++d)
+				requests[r](d, i) = cloud(d, rand() % cloud.cols()) + 0.01f * (float(rand()) / RAND_MAX - 0.5f);
+	}
+	return requests;
+}
+
+//! Print the number of queries per second and latency percentiles of requests of queryCount points
+static void printResults(const char* name, vector<double>& latencies, const int queryCount, const double duration)
+{
+	sort(latencies.begin(), latencies.end());
+	const size_t n(latencies.size());
+	cout << name << ": " << double(n) * queryCount / duration << " queries/s, request latency in us: p50 " << latencies[n / 2] * 1e6 << ", p90 " << latencies[(n * 9) / 10] * 1e6 << ", p99 " << latencies[(n * 99) / 100] * 1e6 << ", max " << latencies[n - 1] * 1e6 << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 7)
+	{
+		cerr << "Usage " << argv[0] << " DATA SOCKET_PATH CLIENT_COUNT QUERIES_PER_REQUEST REQUEST_COUNT K" << endl;
+		cerr << "  DATA: cloud served by knnserver on SOCKET_PATH, queries are drawn from it" << endl;
+		cerr << "  CLIENT_COUNT: number of client processes sending requests concurrently" << endl;
+		return 1;
+	}
+	
+	NNS::Matrix cloud;
+	if (!loadCloud(argv[1], cloud))
+	{
+		cerr << "Cannot load cloud from " << argv[1] << endl;
+		return 2;
+	}
+	const char* socketPath(argv[2]);
+	const int clientCount(atoi(argv[3]));
+	const int queryCount(atoi(argv[4]));
+	const int requestCount(atoi(argv[5]));
+	const int K(atoi(argv[6]));
+	if (clientCount < 1 || queryCount < 1 || requestCount < 1 || K < 1)
+	{
+		cerr << "Client count, queries per request, request count and K must be positive" << endl;
+		return 1;
+	}
+	
+	// reference: the index every process would have to build, queried in-process
+	{
+		srand(0);
+		const vector<NNS::Matrix> requests(createRequests(cloud, requestCount, queryCount));
+		double t(now());
+		NNS* nns(NNS::create(cloud, cloud.rows(), NNS::KDTREE_LINEAR_HEAP));
+		cout << "In-process build: " << (now() - t) * 1e3 << " ms" << endl;
+		NNS::IndexMatrix indices(K, queryCount);
+		NNS::Matrix dists2(K, queryCount);
+		vector<double> latencies(requestCount);
+		const double start(now());
+		for (int r = 0; r < requestCount; ++r)
+		{
+			t = now();
+			nns->knn(requests[r], indices, dists2, K);
+			latencies[r] = now() - t;
+		}
+		printResults("In-process, one client", latencies, queryCount, now() - start);
+		delete nns;
+	}
+	
+	// clients in separate processes, each reporting its start time, end time and latencies through a pipe
+	vector<int> pipes(clientCount);
+	vector<pid_t> pids(clientCount);
+	for (int c = 0; c < clientCount; ++c)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+		{
+			perror("Cannot create pipe");
+			return 3;
+		}
+		pids[c] = fork();
+		if (pids[c] == 0)
+		{
+			close(fds[0]);
+			srand(c + 1);
+			const vector<NNS::Matrix> requests(createRequests(cloud, requestCount, queryCount));
+			vector<double> results(requestCount + 2);
+			try
+			{
+				SearchClient client(socketPath);
+				NNS::IndexMatrix indices;
+				NNS::Matrix dists2;
+				client.knn(requests[0], indices, dists2, K);
+				results[0] = now();
+				for (int r = 0; r < requestCount; ++r)
+				{
+					const double t(now());
+					client.knn(requests[r], indices, dists2, K);
+					results[r + 2] = now() - t;
+				}
+				results[1] = now();
+			}
+			catch (const exception& e)
+			{
+				cerr << "Client " << c << " error: " << e.what() << endl;
+				_exit(1);
+			}
+			const char* data(reinterpret_cast<const char*>(&results[0]));
+			size_t size(results.size() * sizeof(double));
+			while (size > 0)
+			{
+				const ssize_t written(write(fds[1], data, size));
+				if (written <= 0)
+					_exit(1);
+				data += written;
+				size -= written;
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pipes[c] = fds[0];
+	}
+	
+	vector<double> latencies;
+	double start(numeric_limits<double>::max());
+	double end(0);
+	bool ok(true);
+	for (int c = 0; c < clientCount; ++c)
+	{
+		vector<double> results(requestCount + 2);
+		char* data(reinterpret_cast<char*>(&results[0]));
+		size_t size(results.size() * sizeof(double));
+		while (size > 0)
+		{
+			const ssize_t readSize(read(pipes[c], data, size));
+			if (readSize <= 0)
+				break;
+			data += readSize;
+			size -= readSize;
+		}
+		close(pipes[c]);
+		int status;
+		waitpid(pids[c], &status, 0);
+		if (size > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			ok = false;
+			continue;
+		}
+		start = min(start, results[0]);
+		end = max(end, results[1]);
+		latencies.insert(latencies.end(), results.begin() + 2, results.end());
+	}
+	if (!ok)
+	{
+		cerr << "Some clients failed" << endl;
+		return 4;
+	}
+	cout << "Server, " << clientCount << " client" << (clientCount > 1 ? "s" : "");
+	printResults("", latencies, queryCount, end - start);
+	
+	return 0;
+}
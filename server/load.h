@@ -0,0 +1,78 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __NABO_SERVER_LOAD_H
+#define __NABO_SERVER_LOAD_H
+
+#include "nabo/nabo.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+/*!	\file load.h
+	\brief loading of clouds for the server executables
+*/
+
+//! Load a cloud from a text file with one point per line, return false if it cannot be read
+inline bool loadCloud(const char* fileName, Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>& cloud)
+{
+	std::ifstream ifs(fileName);
+	if (!ifs.good())
+		return false;
+	std::vector<float> data;
+	int dim(0);
+	std::string line;
+	while (getline(ifs, line))
+	{
+		std::vector<char> buffer(line.begin(), line.end());
+		buffer.push_back(0);
+		int lineDim(0);
+		for (char* token(strtok(&buffer[0], " \t,;")); token; token = strtok(0, " \t,;"))
+		{
+			data.push_back(float(atof(token)));
+			++lineDim;
+		}
+		if (lineDim == 0)
+			continue;
+		if (dim == 0)
+			dim = lineDim;
+		else if (lineDim != dim)
+			return false;
+	}
+	if (dim == 0)
+		return false;
+	cloud = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>::Map(&data[0], dim, data.size() / dim);
+	return true;
+}
+
+#endif // __NABO_SERVER_LOAD_H
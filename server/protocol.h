@@ -0,0 +1,99 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __NABO_SERVER_PROTOCOL_H
+#define __NABO_SERVER_PROTOCOL_H
+
+#ifdef BOOST_STDINT
+	#include <boost/cstdint.hpp>
+	using boost::uint32_t;
+	using boost::uint64_t;
+#else // BOOST_STDINT
+	#include <stdint.h>
+#endif // BOOST_STDINT
+
+/*!	\file protocol.h
+	\brief messages exchanged between SearchServer and SearchClient over a Unix domain socket
+	
+	Both ends run on the same machine, so values are sent in native byte order.
+	On connection, the server sends a Hello.
+	Then, the client sends requests, each made of a RequestHeader followed by queryCount x dim float coordinates, column by column.
+	The server answers every request, in order, with a ResponseHeader followed either by k x queryCount int32 indices and k x queryCount float squared distances, column-major, or by an error message of errorLength characters.
+	Requests whose k exceeds MAX_K, the number of available points or, multiplied by queryCount, MAX_RESULT_COUNT get an error response.
+*/
+
+namespace Nabo
+{
+	namespace Protocol
+	{
+		//! first field of every message, "NABO"
+		const uint32_t MAGIC = 0x4F42414E;
+		//! version of the protocol, incremented on incompatible changes
+		const uint32_t VERSION = 1;
+		//! maximum number of queries in a request
+		const uint32_t MAX_QUERY_COUNT = 1 << 20;
+		//! maximum number of nearest neighbours per query in a request
+		const uint32_t MAX_K = 1 << 16;
+		//! maximum number of results, k x queryCount, in a request
+		const uint32_t MAX_RESULT_COUNT = 1 << 24;
+		
+		//! message sent by the server to every new client
+		struct Hello
+		{
+			uint32_t magic; //!< MAGIC
+			uint32_t version; //!< VERSION
+			uint32_t dim; //!< number of dimensions of the queries
+			uint32_t pointCount; //!< number of points in the cloud
+		};
+		
+		//! header of a k-nearest-neighbour request
+		struct RequestHeader
+		{
+			uint32_t magic; //!< MAGIC
+			uint32_t queryCount; //!< number of query points following the header
+			uint32_t k; //!< number of nearest neighbours requested
+			uint32_t optionFlags; //!< search options, a bitwise OR of NearestNeighbourSearch::SearchOptionFlags
+			float epsilon; //!< maximal ratio of error for approximate search
+			float maxRadius; //!< maximum radius in which to search, infinity for none
+		};
+		
+		//! header of the response to a request
+		struct ResponseHeader
+		{
+			uint32_t magic; //!< MAGIC
+			uint32_t queryCount; //!< number of query points of the request
+			uint32_t k; //!< number of nearest neighbours per query
+			uint32_t errorLength; //!< if not 0, length of the error message following the header, in place of results
+		};
+	}
+}
+
+#endif // __NABO_SERVER_PROTOCOL_H
@@ -0,0 +1,409 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "server.h"
+#include "protocol.h"
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <cstring>
+#include <cerrno>
+#include <boost/format.hpp>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// some systems do not have this flag, they must ignore SIGPIPE instead
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+/*!	\file server.cpp
+	\brief server sharing one nearest-neighbour search between the processes of a machine
+*/
+
+namespace Nabo
+{
+	using namespace std;
+	
+	//! number of bytes read from a socket at once
+	const size_t RECEIVE_CHUNK_SIZE = 65536;
+	//! maximum time between two checks of stop(), in milliseconds
+	const int STOP_POLL_PERIOD = 100;
+	
+	//! Return the current time, in seconds
+	static double now()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, 0);
+		return double(tv.tv_sec) + double(tv.tv_usec) * 1e-6;
+	}
+	
+	//! Append size bytes from data to buffer
+	static void append(vector<char>& buffer, const void* data, const size_t size)
+	{
+		const char* bytes(reinterpret_cast<const char*>(data));
+		buffer.insert(buffer.end(), bytes, bytes + size);
+	}
+	
+	SearchServer::SearchServer(const Matrix& cloud, const std::string& socketPath, const NNS::SearchType searchType, const unsigned creationOptionFlags, const Parameters& additionalParameters, const unsigned maxBatchSize, const unsigned maxDelay):
+		cloud(cloud),
+		nns(NNS::create(cloud, cloud.rows(), searchType, creationOptionFlags, additionalParameters)),
+		socketPath(socketPath),
+		maxBatchSize(maxBatchSize),
+		maxDelay(maxDelay),
+		listeningSocket(-1),
+		pendingQueryCount(0),
+		oldestPendingTime(0),
+		stopRequested(0)
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path))
+		{
+			delete nns;
+			throw runtime_error((boost::format("Socket path %1% is longer than the maximum of %2% characters") % socketPath % (sizeof(address.sun_path) - 1)).str());
+		}
+		strcpy(address.sun_path, socketPath.c_str());
+		
+		listeningSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listeningSocket < 0)
+		{
+			delete nns;
+			throw runtime_error((boost::format("Cannot create socket: %1%") % strerror(errno)).str());
+		}
+		unlink(socketPath.c_str());
+		if (bind(listeningSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+			listen(listeningSocket, SOMAXCONN) != 0)
+		{
+			const string error(strerror(errno));
+			close(listeningSocket);
+			delete nns;
+			throw runtime_error((boost::format("Cannot listen on %1%: %2%") % socketPath % error).str());
+		}
+		fcntl(listeningSocket, F_SETFL, fcntl(listeningSocket, F_GETFL) | O_NONBLOCK);
+	}
+	
+	SearchServer::~SearchServer()
+	{
+		for (Connections::iterator it(connections.begin()); it != connections.end(); ++it)
+			close(it->first);
+		close(listeningSocket);
+		unlink(socketPath.c_str());
+		delete nns;
+	}
+	
+	void SearchServer::serve()
+	{
+		vector<struct pollfd> pollFds;
+		while (!stopRequested)
+		{
+			// listen to every socket, and wait until the oldest pending request must be searched
+			pollFds.clear();
+			struct pollfd listening = { listeningSocket, POLLIN, 0 };
+			pollFds.push_back(listening);
+			for (Connections::const_iterator it(connections.begin()); it != connections.end(); ++it)
+			{
+				struct pollfd connection = { it->first, short(POLLIN | (it->second.output.size() > it->second.outputOffset ? POLLOUT : 0)), 0 };
+				pollFds.push_back(connection);
+			}
+			int timeout(STOP_POLL_PERIOD);
+			if (!pending.empty())
+				timeout = max(0, min(timeout, int((oldestPendingTime + maxDelay * 1e-6 - now()) * 1e3)));
+			const int readyCount(poll(&pollFds[0], pollFds.size(), timeout));
+			if (readyCount < 0 && errno != EINTR)
+				throw runtime_error((boost::format("Cannot poll sockets: %1%") % strerror(errno)).str());
+			
+			// exchange data with clients, closing the connections that fail
+			for (size_t i = 1; readyCount > 0 && i < pollFds.size(); ++i)
+			{
+				const int socket(pollFds[i].fd);
+				Connection& connection(connections[socket]);
+				bool ok(true);
+				if (pollFds[i].revents & (POLLIN | POLLHUP | POLLERR))
+					ok = receive(socket, connection) && parseRequests(socket, connection);
+				if (ok && (pollFds[i].revents & POLLOUT))
+					ok = send(socket, connection);
+				if (!ok)
+					closeConnection(socket);
+			}
+			if (readyCount > 0 && (pollFds[0].revents & POLLIN))
+				acceptConnection();
+			
+			// search once enough queries are pending or the oldest request waited long enough
+			if (!pending.empty() && (pendingQueryCount >= maxBatchSize || now() >= oldestPendingTime + maxDelay * 1e-6))
+				searchPending();
+		}
+	}
+	
+	//! Accept all waiting connections and greet them
+	void SearchServer::acceptConnection()
+	{
+		while (true)
+		{
+			const int socket(accept(listeningSocket, 0, 0));
+			if (socket < 0)
+				return;
+			fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+			Connection& connection(connections[socket]);
+			Protocol::Hello hello;
+			hello.magic = Protocol::MAGIC;
+			hello.version = Protocol::VERSION;
+			hello.dim = nns->dim;
+			hello.pointCount = cloud.cols();
+			append(connection.output, &hello, sizeof(hello));
+			send(socket, connection);
+		}
+	}
+	
+	//! Close socket, forget its connection and drop its pending requests
+	void SearchServer::closeConnection(const int socket)
+	{
+		close(socket);
+		connections.erase(socket);
+		PendingRequests::iterator kept(pending.begin());
+		for (PendingRequests::iterator it(pending.begin()); it != pending.end(); ++it)
+		{
+			if (it->socket == socket)
+				pendingQueryCount -= it->queryCount;
+			else
+			{
+				if (kept != it)
+					swap(*kept, *it);
+				++kept;
+			}
+		}
+		pending.erase(kept, pending.end());
+	}
+	
+	//! Read available bytes from socket, return false if the connection is closed
+	bool SearchServer::receive(const int socket, Connection& connection)
+	{
+		while (true)
+		{
+			const size_t oldSize(connection.input.size());
+			connection.input.resize(oldSize + RECEIVE_CHUNK_SIZE);
+			const ssize_t receivedSize(recv(socket, &connection.input[oldSize], RECEIVE_CHUNK_SIZE, 0));
+			connection.input.resize(oldSize + max(receivedSize, ssize_t(0)));
+			if (receivedSize == 0)
+				return false;
+			if (receivedSize < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			if (size_t(receivedSize) < RECEIVE_CHUNK_SIZE)
+				return true;
+		}
+	}
+	
+	//! Return why the request of header cannot be searched, or an empty string if it can
+	std::string SearchServer::checkRequest(const Protocol::RequestHeader& header) const
+	{
+		const bool allowSelfMatch(header.optionFlags & NNS::ALLOW_SELF_MATCH);
+		const uint64_t availableCount(allowSelfMatch ? cloud.cols() : cloud.cols() - 1);
+		if (header.k > Protocol::MAX_K)
+			return (boost::format("Requesting more points (%1%) than a request allows (%2%)") % header.k % Protocol::MAX_K).str();
+		if (header.k > availableCount)
+			return (boost::format("Requesting more points (%1%) than available in cloud%2% (%3%)") % header.k % (allowSelfMatch ? "" : " minus 1") % availableCount).str();
+		if (uint64_t(header.k) * header.queryCount > Protocol::MAX_RESULT_COUNT)
+			return (boost::format("Requesting more results (%1% points for %2% queries) than a request allows (%3%)") % header.k % header.queryCount % Protocol::MAX_RESULT_COUNT).str();
+		return std::string();
+	}
+	
+	//! Move the complete requests in the input of connection to pending, return false if the input is not a valid request
+	bool SearchServer::parseRequests(const int socket, Connection& connection)
+	{
+		size_t offset(0);
+		while (connection.input.size() - offset >= sizeof(Protocol::RequestHeader))
+		{
+			Protocol::RequestHeader header;
+			memcpy(&header, &connection.input[offset], sizeof(header));
+			if (header.magic != Protocol::MAGIC || header.queryCount > Protocol::MAX_QUERY_COUNT)
+				return false;
+			const size_t queriesSize(size_t(header.queryCount) * nns->dim * sizeof(float));
+			if (connection.input.size() - offset < sizeof(header) + queriesSize)
+				break;
+			
+			PendingRequest request;
+			request.socket = socket;
+			request.queryCount = header.queryCount;
+			request.k = header.k;
+			request.optionFlags = header.optionFlags;
+			request.epsilon = header.epsilon;
+			request.maxRadius = header.maxRadius;
+			request.error = checkRequest(header);
+			request.queries.resize(size_t(header.queryCount) * nns->dim);
+			if (queriesSize)
+				memcpy(&request.queries[0], &connection.input[offset + sizeof(header)], queriesSize);
+			offset += sizeof(header) + queriesSize;
+			
+			if (pending.empty())
+				oldestPendingTime = now();
+			pending.push_back(request);
+			pendingQueryCount += request.queryCount;
+		}
+		connection.input.erase(connection.input.begin(), connection.input.begin() + offset);
+		return true;
+	}
+	
+	//! Send as much of the output of connection as possible, return false if the connection is closed
+	bool SearchServer::send(const int socket, Connection& connection)
+	{
+		while (connection.outputOffset < connection.output.size())
+		{
+			const ssize_t sentSize(::send(socket, &connection.output[connection.outputOffset], connection.output.size() - connection.outputOffset, MSG_NOSIGNAL));
+			if (sentSize < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			connection.outputOffset += sentSize;
+		}
+		connection.output.clear();
+		connection.outputOffset = 0;
+		return true;
+	}
+	
+	//! Queue an error response to a request of socket
+	void SearchServer::sendError(const int socket, const unsigned queryCount, const unsigned k, const std::string& message)
+	{
+		Connections::iterator it(connections.find(socket));
+		if (it == connections.end())
+			return;
+		Protocol::ResponseHeader header;
+		header.magic = Protocol::MAGIC;
+		header.queryCount = queryCount;
+		header.k = k;
+		header.errorLength = message.size();
+		append(it->second.output, &header, sizeof(header));
+		append(it->second.output, message.c_str(), message.size());
+	}
+	
+	//! Search all pending requests, in one knn() call per group of compatible requests, and queue the responses
+	void SearchServer::searchPending()
+	{
+		const int dim(nns->dim);
+		vector<bool> done(pending.size(), false);
+		for (size_t first = 0; first < pending.size(); ++first)
+		{
+			if (done[first])
+				continue;
+			
+			const PendingRequest& reference(pending[first]);
+			done[first] = true;
+			if (!reference.error.empty())
+			{
+				sendError(reference.socket, reference.queryCount, reference.k, reference.error);
+				continue;
+			}
+			
+			// gather the requests compatible with the first one not done, in order of arrival,
+			// but not past an incompatible request of the same client, whose responses must stay in order
+			vector<size_t> group(1, first);
+			set<int> blockedSockets;
+			int queryCount(reference.queryCount);
+			for (size_t i = first + 1; i < pending.size(); ++i)
+			{
+				if (done[i] || blockedSockets.count(pending[i].socket))
+					continue;
+				if (pending[i].isCompatible(reference))
+				{
+					group.push_back(i);
+					queryCount += pending[i].queryCount;
+					done[i] = true;
+				}
+				else
+					blockedSockets.insert(pending[i].socket);
+			}
+			
+			IndexMatrix indices;
+			Matrix dists2;
+			try
+			{
+				Matrix query(dim, queryCount);
+				Vector maxRadii(queryCount);
+				int col(0);
+				for (size_t g = 0; g < group.size(); ++g)
+				{
+					const PendingRequest& request(pending[group[g]]);
+					if (request.queryCount)
+						memcpy(&query.coeffRef(0, col), &request.queries[0], request.queries.size() * sizeof(float));
+					maxRadii.segment(col, request.queryCount).setConstant(request.maxRadius);
+					col += request.queryCount;
+				}
+				indices.resize(reference.k, queryCount);
+				dists2.resize(reference.k, queryCount);
+				nns->knn(query, indices, dists2, maxRadii, reference.k, reference.epsilon, reference.optionFlags);
+			}
+			catch (const exception& e)
+			{
+				for (size_t g = 0; g < group.size(); ++g)
+					sendError(pending[group[g]].socket, pending[group[g]].queryCount, reference.k, e.what());
+				continue;
+			}
+			++statistics.batchCount;
+			
+			// scatter results to the clients
+			int col(0);
+			for (size_t g = 0; g < group.size(); ++g)
+			{
+				const PendingRequest& request(pending[group[g]]);
+				Connection& connection(connections[request.socket]);
+				Protocol::ResponseHeader header;
+				header.magic = Protocol::MAGIC;
+				header.queryCount = request.queryCount;
+				header.k = reference.k;
+				header.errorLength = 0;
+				append(connection.output, &header, sizeof(header));
+				const size_t resultCount(size_t(reference.k) * request.queryCount);
+				if (resultCount)
+				{
+					append(connection.output, &indices.coeff(0, col), resultCount * sizeof(int));
+					append(connection.output, &dists2.coeff(0, col), resultCount * sizeof(float));
+				}
+				col += request.queryCount;
+				++statistics.requestCount;
+				statistics.queryCount += request.queryCount;
+			}
+		}
+		pending.clear();
+		pendingQueryCount = 0;
+		
+		// start sending right away, the rest is sent when sockets are writable
+		for (Connections::iterator it(connections.begin()); it != connections.end();)
+		{
+			const int socket(it->first);
+			++it;
+			if (!send(socket, connections[socket]))
+				closeConnection(socket);
+		}
+	}
+}
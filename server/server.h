@@ -0,0 +1,148 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __NABO_SERVER_H
+#define __NABO_SERVER_H
+
+#include "nabo/nabo.h"
+#include "protocol.h"
+#include <signal.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/*!	\file server.h
+	\brief server sharing one nearest-neighbour search between the processes of a machine
+*/
+
+namespace Nabo
+{
+	//! Server answering k-nearest-neighbour requests of local processes over a Unix domain socket
+	/*!	The server builds a single NearestNeighbourSearch on a cloud, so that processes querying the same map do not each build their own.
+	 *	Small requests from all clients are coalesced into a single batched knn() call, which amortizes the overhead per call and lets the search parallelize over the queries of all clients.
+	 *	Requests are coalesced when they share k, epsilon and option flags, maximum radii may differ.
+	 *	The server runs a single-threaded event loop, the search itself is parallelized by OpenMP.
+	 */
+	struct SearchServer
+	{
+		typedef NearestNeighbourSearch<float> NNS; //!< type of the shared search
+		typedef NNS::Matrix Matrix; //!< a column-major matrix of floats, in which each column is a point
+		typedef NNS::Vector Vector; //!< a vector of floats
+		typedef NNS::IndexMatrix IndexMatrix; //!< a matrix of indices to data points
+		
+		//! Statistics on the requests served
+		struct Statistics
+		{
+			unsigned long requestCount; //!< number of requests answered
+			unsigned long queryCount; //!< number of query points searched
+			unsigned long batchCount; //!< number of knn() calls
+			
+			//! constructor, zeroes all fields
+			Statistics(): requestCount(0), queryCount(0), batchCount(0) {}
+		};
+		
+		//! Build a search on cloud and listen on a Unix domain socket at socketPath, replacing any file there
+		/*!	\param cloud data-point cloud, must remain valid during the lifetime of the server
+		 *	\param socketPath path of the socket
+		 *	\param searchType type of search, see NearestNeighbourSearch::create()
+		 *	\param creationOptionFlags creation options, see NearestNeighbourSearch::create()
+		 *	\param additionalParameters additional parameters, see NearestNeighbourSearch::create()
+		 *	\param maxBatchSize number of pending query points from which a batch is searched without waiting further
+		 *	\param maxDelay maximum time in microseconds that a request waits for others to coalesce with, 0 to only coalesce requests that arrived together
+		 */
+		SearchServer(const Matrix& cloud, const std::string& socketPath, const NNS::SearchType searchType = NNS::KDTREE_LINEAR_HEAP, const unsigned creationOptionFlags = 0, const Parameters& additionalParameters = Parameters(), const unsigned maxBatchSize = 1024, const unsigned maxDelay = 200);
+		//! Close all connections and remove the socket
+		~SearchServer();
+		
+		//! Serve requests until stop() is called
+		void serve();
+		//! Make serve() return within a few milliseconds; can be called from a signal handler
+		void stop() { stopRequested = 1; }
+		//! Return statistics on the requests served so far
+		const Statistics& getStatistics() const { return statistics; }
+		
+	protected:
+		//! a connected client
+		struct Connection
+		{
+			std::vector<char> input; //!< received bytes not yet parsed
+			std::vector<char> output; //!< bytes to send
+			size_t outputOffset; //!< number of bytes of output already sent
+			
+			//! constructor
+			Connection(): outputOffset(0) {}
+		};
+		//! connections by socket; closing a connection drops its pending requests, so that a new connection reusing the socket does not get them
+		typedef std::map<int, Connection> Connections;
+		
+		//! a received request, waiting to be searched
+		struct PendingRequest
+		{
+			int socket; //!< socket of the client
+			unsigned queryCount; //!< number of query points
+			unsigned k; //!< number of nearest neighbours requested
+			unsigned optionFlags; //!< search options
+			float epsilon; //!< maximal ratio of error
+			float maxRadius; //!< maximum radius
+			std::vector<float> queries; //!< queryCount x dim coordinates
+			std::string error; //!< if not empty, the request is invalid and is answered with this error
+			
+			//! return whether this request can be searched in the same batch as that
+			bool isCompatible(const PendingRequest& that) const { return error.empty() && that.error.empty() && k == that.k && optionFlags == that.optionFlags && epsilon == that.epsilon; }
+		};
+		//! requests waiting to be searched, in order of arrival
+		typedef std::vector<PendingRequest> PendingRequests;
+		
+		void acceptConnection();
+		void closeConnection(const int socket);
+		std::string checkRequest(const Protocol::RequestHeader& header) const;
+		bool receive(const int socket, Connection& connection);
+		bool parseRequests(const int socket, Connection& connection);
+		bool send(const int socket, Connection& connection);
+		void sendError(const int socket, const unsigned queryCount, const unsigned k, const std::string& message);
+		void searchPending();
+		
+		const Matrix& cloud; //!< data-point cloud
+		NNS* nns; //!< shared search
+		const std::string socketPath; //!< path of the listening socket
+		const unsigned maxBatchSize; //!< number of pending query points from which a batch is searched
+		const unsigned maxDelay; //!< maximum waiting time of a request before being searched, in microseconds
+		int listeningSocket; //!< socket accepting connections
+		Connections connections; //!< connected clients
+		PendingRequests pending; //!< requests to search
+		unsigned pendingQueryCount; //!< number of query points in pending
+		double oldestPendingTime; //!< arrival time of the first request in pending, in seconds
+		volatile sig_atomic_t stopRequested; //!< whether stop() was called
+		Statistics statistics; //!< statistics on the requests served
+	};
+}
+
+#endif // __NABO_SERVER_H
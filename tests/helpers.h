@@ -179,5 +179,148 @@ namespace boost
 	#include <boost/timer.hpp>
 #endif // _POSIX_TIMERS
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif // __linux__
+
+/*
+	Hardware performance counters of the calling thread, using perf_event_open() on Linux.
+	Counters that the kernel or the processor does not provide read as 0 and are not available,
+	on other systems isAvailable() returns false and all counters read as 0.
+	Threads that already exist when the counters are created, such as those
+	of OpenMP, are not counted: set OMP_NUM_THREADS=1 to count all the work.
+*/
+struct PerfCounters
+{
+	enum Counter
+	{
+		INSTRUCTIONS = 0,
+		CYCLES,
+		CACHE_REFERENCES,
+		CACHE_MISSES,
+		BRANCH_MISSES,
+		DTLB_READ_MISSES,
+		PAGE_FAULTS,
+		COUNTER_COUNT
+	};
+	
+	// counts of an interval, scaled for the time each counter was multiplexed out
+	struct Values
+	{
+		double counts[COUNTER_COUNT];
+		
+		Values() { for (int i = 0; i < COUNTER_COUNT; ++i) counts[i] = 0; }
+		double operator[](const int i) const { return counts[i]; }
+		void operator +=(const Values& that) { for (int i = 0; i < COUNTER_COUNT; ++i) counts[i] += that.counts[i]; }
+		void operator /=(const double factor) { for (int i = 0; i < COUNTER_COUNT; ++i) counts[i] /= factor; }
+	};
+	
+	static const char* getName(const int counter)
+	{
+		static const char* names[COUNTER_COUNT] = { "instructions", "cycles", "cache references", "cache misses", "branch misses", "dTLB read misses", "page faults" };
+		return names[counter];
+	}
+	
+	PerfCounters()
+	{
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+			fds[i] = -1;
+		#ifdef __linux__
+		const uint32_t types[COUNTER_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_SOFTWARE };
+		const uint64_t configs[COUNTER_COUNT] = {
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_CACHE_REFERENCES,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES,
+			PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_SW_PAGE_FAULTS
+		};
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+		{
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[i];
+			attr.config = configs[i];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.inherit = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+		}
+		#endif // __linux__
+	}
+	
+	~PerfCounters()
+	{
+		#ifdef __linux__
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+			if (fds[i] >= 0)
+				close(fds[i]);
+		#endif // __linux__
+	}
+	
+	// whether counter could be opened
+	bool isAvailable(const int counter) const
+	{
+		return fds[counter] >= 0;
+	}
+	
+	// whether at least one counter could be opened
+	bool isAvailable() const
+	{
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+			if (isAvailable(i))
+				return true;
+		return false;
+	}
+	
+	// reset and start all counters
+	void start()
+	{
+		#ifdef __linux__
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+		{
+			if (fds[i] < 0)
+				continue;
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+		#endif // __linux__
+	}
+	
+	// stop all counters and return their counts since start()
+	Values stop()
+	{
+		Values values;
+		#ifdef __linux__
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+			if (fds[i] >= 0)
+				ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		for (int i = 0; i < COUNTER_COUNT; ++i)
+		{
+			// value, time enabled, time running
+			uint64_t data[3];
+			if (fds[i] < 0 || read(fds[i], data, sizeof(data)) != ssize_t(sizeof(data)) || data[2] == 0)
+				continue;
+			values.counts[i] = double(data[0]) * double(data[1]) / double(data[2]);
+		}
+		#endif // __linux__
+		return values;
+	}
+	
+private:
+	int fds[COUNTER_COUNT];
+	
+	PerfCounters(const PerfCounters&);
+	PerfCounters& operator=(const PerfCounters&);
+};
+
 #endif // __NABE_TEST_HELPERS_H
 
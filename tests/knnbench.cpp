@@ -87,20 +87,58 @@ struct BenchResult
 	double executionDuration;
 	double visitCount;
 	double totalCount;
+	PerfCounters::Values creationCounters;
+	PerfCounters::Values executionCounters;
+	// phases of creation, for methods reporting them
+	double boundsDuration;
+	double treeDuration;
+	double partitionDuration;
+	double nodeEmissionDuration;
+	double reorderingDuration;
+	double peakBuildMemory;
+	double memory;
 	
 	BenchResult():
 		creationDuration(0),
 		executionDuration(0),
 		visitCount(0),
-		totalCount(0)
+		totalCount(0),
+		boundsDuration(0),
+		treeDuration(0),
+		partitionDuration(0),
+		nodeEmissionDuration(0),
+		reorderingDuration(0),
+		peakBuildMemory(0),
+		memory(0)
 	{}
 	
+	template<typename T>
+	void setBuildStatistics(const typename NearestNeighbourSearch<T>::BuildStatistics& statistics)
+	{
+		boundsDuration = statistics.boundsDuration;
+		treeDuration = statistics.treeDuration;
+		partitionDuration = statistics.partitionDuration;
+		nodeEmissionDuration = statistics.nodeEmissionDuration;
+		reorderingDuration = statistics.reorderingDuration;
+		peakBuildMemory = double(statistics.peakBuildMemory);
+		memory = double(statistics.memory);
+	}
+	
 	void operator +=(const BenchResult& that)
 	{
 		creationDuration += that.creationDuration;
 		executionDuration += that.executionDuration;
 		visitCount += that.visitCount;
 		totalCount += that.totalCount;
+		creationCounters += that.creationCounters;
+		executionCounters += that.executionCounters;
+		boundsDuration += that.boundsDuration;
+		treeDuration += that.treeDuration;
+		partitionDuration += that.partitionDuration;
+		nodeEmissionDuration += that.nodeEmissionDuration;
+		reorderingDuration += that.reorderingDuration;
+		peakBuildMemory += that.peakBuildMemory;
+		memory += that.memory;
 	}
 	
 	void operator /=(const double factor)
@@ -109,8 +147,54 @@ struct BenchResult
 		executionDuration /= factor;
 		visitCount /= factor;
 		totalCount /= factor;
+		creationCounters /= factor;
+		executionCounters /= factor;
+		boundsDuration /= factor;
+		treeDuration /= factor;
+		partitionDuration /= factor;
+		nodeEmissionDuration /= factor;
+		reorderingDuration /= factor;
+		peakBuildMemory /= factor;
+		memory /= factor;
 	}
 };
+
+// hardware performance counters, 0 if disabled
+PerfCounters* perfCounters(0);
+
+void startCounters()
+{
+	if (perfCounters)
+		perfCounters->start();
+}
+
+PerfCounters::Values stopCounters()
+{
+	if (perfCounters)
+		return perfCounters->stop();
+	return PerfCounters::Values();
+}
+
+void printCounters(const char* phase, const PerfCounters::Values& values, const double divisor, const double duration)
+{
+	cout << "  " << phase << " counters:";
+	const char* separator(" ");
+	for (int c = 0; c < PerfCounters::COUNTER_COUNT; ++c)
+	{
+		if (!perfCounters->isAvailable(c))
+			continue;
+		cout << separator << values[c] / divisor << " " << PerfCounters::getName(c);
+		separator = ", ";
+	}
+	if (values[PerfCounters::CYCLES] != 0)
+		cout << ", IPC " << values[PerfCounters::INSTRUCTIONS] / values[PerfCounters::CYCLES];
+	if (values[PerfCounters::CACHE_REFERENCES] != 0)
+		cout << ", cache miss ratio " << values[PerfCounters::CACHE_MISSES] / values[PerfCounters::CACHE_REFERENCES];
+	// over the whole phase, each last-level cache miss transfers a 64-byte line from memory
+	if (perfCounters->isAvailable(PerfCounters::CACHE_MISSES) && duration > 0)
+		cout << ", memory bandwidth " << values[PerfCounters::CACHE_MISSES] * 64. / duration / 1e6 << " MB/s";
+	cout << "\n";
+}
 typedef vector<BenchResult> BenchResults;
 
 // template<typename T>
@@ -145,20 +229,26 @@ BenchResult doBenchType(const typename NearestNeighbourSearch<T>::SearchType typ
 	typedef typename NearestNeighbourSearch<T>::IndexMatrix IndexMatrix;
 	
 	BenchResult result;
+	startCounters();
 	boost::timer t;
 	nnsT* nns(nnsT::create(d, d.rows(), type, creationOptionFlags));
 	result.creationDuration = t.elapsed();
+	result.creationCounters = stopCounters();
+	result.template setBuildStatistics<T>(nns->getBuildStatistics());
 	
 	for (int s = 0; s < searchCount; ++s)
 	{
-		t.restart();
 		IndexMatrix indices(K, q.cols());
 		Matrix dists2(K, q.cols());
+		startCounters();
+		t.restart();
 		const unsigned long visitCount = nns->knn(q, indices, dists2, K, 0, 0);
 		result.executionDuration += t.elapsed();
+		result.executionCounters += stopCounters();
 		result.visitCount += double(visitCount);
 	}
 	result.executionDuration /= double(searchCount);
+	result.executionCounters /= double(searchCount);
 	result.visitCount /= double(searchCount);
 	
 	delete nns;
@@ -176,16 +266,19 @@ BenchResult doBenchANNStack(const MatrixD& d, const MatrixD& q, const int K, con
 	boost::timer t;
 	const int ptCount(d.cols());
 	const double **pa = new const double *[d.cols()];
+	startCounters();
 	for (int i = 0; i < ptCount; ++i)
 		pa[i] = &d.coeff(0, i);
 	ANNkd_tree* ann_kdt = new ANNkd_tree(const_cast<double**>(pa), ptCount, d.rows(), 8);
 	result.creationDuration = t.elapsed();
+	result.creationCounters = stopCounters();
 	
 	for (int s = 0; s < searchCount; ++s)
 	{
-		t.restart();
 		ANNidx nnIdx[K];
 		ANNdist dists[K];
+		startCounters();
+		t.restart();
 		for (int i = 0; i < itCount; ++i)
 		{
 			const VectorD& tq(q.col(i));
@@ -198,8 +291,10 @@ BenchResult doBenchANNStack(const MatrixD& d, const MatrixD& q, const int K, con
 							0);			// error bound
 		}
 		result.executionDuration += t.elapsed();
+		result.executionCounters += stopCounters();
 	}
 	result.executionDuration /= double(searchCount);
+	result.executionCounters /= double(searchCount);
 	
 	return result;
 }
@@ -286,9 +381,10 @@ BenchResult doBenchFLANN(const Matrix& d, const Matrix& q, const Index K, const
 
 int main(int argc, char* argv[])
 {
-	if (argc != 6)
+	if (argc != 6 && argc != 7)
 	{
-		cerr << "Usage " << argv[0] << " DATA K METHOD RUN_COUNT SEARCH_COUNT" << endl;
+		cerr << "Usage " << argv[0] << " DATA K METHOD RUN_COUNT SEARCH_COUNT [COUNTERS]" << endl;
+		cerr << "  COUNTERS: if 1, report hardware performance counters of creation and execution (Linux only)" << endl;
 		return 1;
 	}
 	
@@ -299,6 +395,16 @@ int main(int argc, char* argv[])
 	const int itCount(method >= 0 ? method : dD.cols() * 2);
 	const int runCount(atoi(argv[4]));
 	const int searchCount(atoi(argv[5]));
+	if (argc == 7 && atoi(argv[6]) != 0)
+	{
+		perfCounters = new PerfCounters();
+		if (!perfCounters->isAvailable())
+		{
+			cerr << "Hardware performance counters are not available, check /proc/sys/kernel/perf_event_paranoid" << endl;
+			delete perfCounters;
+			perfCounters = 0;
+		}
+	}
 	
 	// compare KDTree with brute force search
 	if (K >= dD.cols())
@@ -325,9 +431,9 @@ int main(int argc, char* argv[])
 		"Nabo, float, unbalanced, stack, pt in leaves only, implicit bounds, ANN_KD_SL_MIDPT, STL heap, opt",
 		"Nabo, float, unbalanced, stack, pt in leaves only, implicit bounds, ANN_KD_SL_MIDPT, STL heap, opt, stats",
 		#ifdef HAVE_OPENCL
-		"Nabo, float, OpenCL, GPU, balanced, points in nodes, stack, implicit bounds, balance aspect ratio, stats",
-		"Nabo, float, OpenCL, GPU, balanced, points in leaves, stack, implicit bounds, balance aspect ratio, stats",
-		//"Nabo, float, OpenCL, GPU, brute force",
+		"Nabo, float, OpenCL, balanced, points in nodes, stack, implicit bounds, balance aspect ratio, stats",
+		"Nabo, float, OpenCL, balanced, points in leaves, stack, implicit bounds, balance aspect ratio, stats",
+		//"Nabo, float, OpenCL, brute force",
 		#endif // HAVE_OPENCL
 		//"Nabo, unbalanced, points in leaves, stack, explicit bounds, ANN_KD_SL_MIDPT",
 		#ifdef HAVE_ANN
@@ -361,7 +467,7 @@ int main(int argc, char* argv[])
 		#ifdef HAVE_OPENCL
 		results.at(i++) += doBenchType<float>(NNSearchF::KDTREE_CL_PT_IN_NODES, NNSearchF::TOUCH_STATISTICS, dF, qF, K, itCount, searchCount);
 		results.at(i++) += doBenchType<float>(NNSearchF::KDTREE_CL_PT_IN_LEAVES, NNSearchF::TOUCH_STATISTICS, dF, qF, K, itCount, searchCount);
-		//results.at(i++) += doBenchType<float>(NNSearchF::BRUTE_FORCE_CL, dF, qF, K, itCount, searchCount);
+		//results.at(i++) += doBenchType<float>(NNSearchF::BRUTE_FORCE_CL, 0, dF, qF, K, itCount, searchCount);
 		#endif // HAVE_OPENCL
 		#ifdef HAVE_ANN
 		results.at(i++) += doBenchANNStack(dD, qD, K, itCount, searchCount);
@@ -380,6 +486,16 @@ int main(int argc, char* argv[])
 		results[i] /= double(runCount);
 		cout << "Method " << benchLabels[i] << ":\n";
 		cout << "  creation duration: " << results[i].creationDuration << "\n";
+		if (results[i].memory != 0)
+		{
+			cout << "  creation phases: bounds " << results[i].boundsDuration << ", tree " << results[i].treeDuration;
+			if (results[i].partitionDuration != 0)
+				cout << " (partition " << results[i].partitionDuration << ", node emission " << results[i].nodeEmissionDuration << ")";
+			if (results[i].reorderingDuration != 0)
+				cout << ", reordering " << results[i].reorderingDuration;
+			cout << "\n";
+			cout << "  creation memory: peak " << results[i].peakBuildMemory / 1048576. << " MB, index " << results[i].memory / 1048576. << " MB\n";
+		}
 		cout << "  execution duration: " << results[i].executionDuration << "\n";
 		if (results[i].totalCount != 0)
 		{
@@ -389,8 +505,14 @@ int main(int argc, char* argv[])
 		}
 		else
 			cout << "  no stats for visits\n";
+		if (perfCounters)
+		{
+			printCounters("creation", results[i].creationCounters, 1, results[i].creationDuration);
+			printCounters("execution per query", results[i].executionCounters, double(itCount), results[i].executionDuration);
+		}
 		cout << endl;
 	}
 	
+	delete perfCounters;
 	return 0;
 }
@@ -0,0 +1,171 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <limits>
+
+using namespace std;
+using namespace Nabo;
+
+typedef BinaryNNSearch::Word Word;
+typedef BinaryNNSearch::DescriptorMatrix DescriptorMatrix;
+typedef BinaryNNSearch::IndexMatrix IndexMatrix;
+typedef BinaryNNSearch::DistanceMatrix DistanceMatrix;
+typedef BinaryNNSearch::Distance Distance;
+
+//! Return a random 64-bit word
+Word randomWord()
+{
+	Word w(0);
+	for (int i = 0; i < 4; ++i)
+		w = (w << 16) ^ Word(rand() & 0xFFFF);
+	return w;
+}
+
+//! Copy descriptor i of source into column j of target, flipping each bit with probability flipProbability
+void perturb(const DescriptorMatrix& source, const int i, DescriptorMatrix& target, const int j, const double flipProbability)
+{
+	target.col(j) = source.col(i);
+	const int bitCount(source.rows() * 64);
+	for (int b = 0; b < bitCount; ++b)
+		if (double(rand()) / double(RAND_MAX) < flipProbability)
+			target(b / 64, j) ^= Word(1) << (b % 64);
+}
+
+//! Create descriptorCount descriptors in clusters around random prototypes
+DescriptorMatrix createDescriptors(const int wordCount, const int descriptorCount)
+{
+	const int prototypeCount(max(descriptorCount / 20, 1));
+	DescriptorMatrix prototypes(wordCount, prototypeCount);
+	for (int i = 0; i < prototypeCount; ++i)
+		for (int w = 0; w < wordCount; ++w)
+			prototypes(w, i) = randomWord();
+	DescriptorMatrix descriptors(wordCount, descriptorCount);
+	for (int i = 0; i < descriptorCount; ++i)
+		perturb(prototypes, rand() % prototypeCount, descriptors, i, 0.05);
+	return descriptors;
+}
+
+//! Return the Hamming distance between column i of d0 and column j of d1, bit by bit
+Distance referenceDist(const DescriptorMatrix& d0, const int i, const DescriptorMatrix& d1, const int j)
+{
+	Distance dist(0);
+	for (int w = 0; w < d0.rows(); ++w)
+		for (int b = 0; b < 64; ++b)
+			dist += ((d0(w, i) >> b) & 1) != ((d1(w, j) >> b) & 1);
+	return dist;
+}
+
+//! Validate the results of search type against a bit-by-bit brute-force search
+void validate(const DescriptorMatrix& descriptors, const DescriptorMatrix& query, const int K, const Distance maxDist, const unsigned optionFlags, const BinaryNNSearch::SearchType searchType)
+{
+	BinaryNNSearch* nns(BinaryNNSearch::create(descriptors, searchType, BinaryNNSearch::TOUCH_STATISTICS));
+	IndexMatrix indices(K, query.cols());
+	DistanceMatrix dists(K, query.cols());
+	const unsigned long touched(nns->knn(query, indices, dists, K, optionFlags | BinaryNNSearch::SORT_RESULTS, maxDist));
+	
+	const bool allowSelfMatch(optionFlags & BinaryNNSearch::ALLOW_SELF_MATCH);
+	vector<Distance> refDists(descriptors.cols());
+	for (int i = 0; i < query.cols(); ++i)
+	{
+		// reference: sorted distances of valid candidates
+		refDists.clear();
+		for (int j = 0; j < descriptors.cols(); ++j)
+		{
+			const Distance dist(referenceDist(query, i, descriptors, j));
+			if (dist <= maxDist && (allowSelfMatch || dist > 0))
+				refDists.push_back(dist);
+		}
+		sort(refDists.begin(), refDists.end());
+		for (int k = 0; k < K; ++k)
+		{
+			const Distance expected(k < int(refDists.size()) ? refDists[k] : numeric_limits<Distance>::max());
+			if (dists(k, i) != expected)
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has distance " << dists(k, i) << " instead of " << expected << endl;
+				exit(4);
+			}
+			if (expected == numeric_limits<Distance>::max())
+				continue;
+			const int index(indices(k, i));
+			if (index < 0 || index >= descriptors.cols())
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has invalid index " << index << " out of range [0:" << descriptors.cols() << "[" << endl;
+				exit(4);
+			}
+			if (referenceDist(query, i, descriptors, index) != expected)
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has index " << index << " whose distance is not " << expected << endl;
+				exit(4);
+			}
+		}
+	}
+	cout << "Search type " << searchType << ": touched " << double(touched) / double(query.cols()) << " descriptors per query on " << descriptors.cols() << endl;
+	delete nns;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cerr << "Usage " << argv[0] << " WORD_COUNT DESCRIPTOR_COUNT QUERY_COUNT K [MAX_DIST]" << endl;
+		return 1;
+	}
+	
+	const int wordCount(atoi(argv[1]));
+	const int descriptorCount(atoi(argv[2]));
+	const int queryCount(atoi(argv[3]));
+	const int K(atoi(argv[4]));
+	const Distance maxDist(argc >= 6 ? atoi(argv[5]) : numeric_limits<Distance>::max());
+	if (K >= descriptorCount)
+	{
+		cerr << "Requested more nearest neighbour than descriptors in the data set" << endl;
+		return 2;
+	}
+	
+	srand(0);
+	const DescriptorMatrix descriptors(createDescriptors(wordCount, descriptorCount));
+	// half of the queries are perturbed descriptors, the other half are exact copies
+	DescriptorMatrix query(wordCount, queryCount);
+	for (int i = 0; i < queryCount; ++i)
+		perturb(descriptors, rand() % descriptorCount, query, i, i % 2 ? 0.02 : 0.);
+	
+	for (int searchType = 0; searchType < BinaryNNSearch::SEARCH_TYPE_COUNT; ++searchType)
+	{
+		validate(descriptors, query, K, maxDist, 0, BinaryNNSearch::SearchType(searchType));
+		validate(descriptors, query, K, maxDist, BinaryNNSearch::ALLOW_SELF_MATCH, BinaryNNSearch::SearchType(searchType));
+	}
+	
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <deque>
+
+using namespace std;
+using namespace Nabo;
+
+// maximum number of points for which clusters are compared with the quadratic reference
+const int REFERENCE_MAX_POINT_COUNT = 20000;
+
+// return whether points a and b of d are closer than radius
+template<typename T>
+bool areNeighbours(const typename NearestNeighbourSearch<T>::Matrix& d, const int a, const int b, const T radius)
+{
+	T dist(0);
+	for (int i = 0; i < d.rows(); ++i)
+	{
+		const T diff(d(i, a) - d(i, b));
+		dist += diff*diff;
+	}
+	return dist <= radius * radius;
+}
+
+// cluster d by breadth-first search over a quadratic neighbour test, following the rules of NearestNeighbourSearch::cluster()
+template<typename T>
+int referenceCluster(const typename NearestNeighbourSearch<T>::Matrix& d, vector<int>& labels, const T radius, const int minPoints)
+{
+	const int pointCount(d.cols());
+	vector<bool> isCore(pointCount);
+	for (int i = 0; i < pointCount; ++i)
+	{
+		int count(0);
+		for (int j = 0; j < pointCount; ++j)
+			count += areNeighbours<T>(d, i, j, radius);
+		isCore[i] = count >= minPoints;
+	}
+	
+	labels.assign(pointCount, -1);
+	int clusterCount(0);
+	for (int i = 0; i < pointCount; ++i)
+	{
+		if (!isCore[i] || labels[i] >= 0)
+			continue;
+		deque<int> toVisit(1, i);
+		labels[i] = clusterCount;
+		while (!toVisit.empty())
+		{
+			const int a(toVisit.front());
+			toVisit.pop_front();
+			for (int b = 0; b < pointCount; ++b)
+			{
+				if (isCore[b] && labels[b] < 0 && areNeighbours<T>(d, a, b, radius))
+				{
+					labels[b] = clusterCount;
+					toVisit.push_back(b);
+				}
+			}
+		}
+		++clusterCount;
+	}
+	for (int i = 0; i < pointCount; ++i)
+	{
+		if (isCore[i])
+			continue;
+		for (int j = 0; j < pointCount; ++j)
+		{
+			if (isCore[j] && areNeighbours<T>(d, i, j, radius))
+			{
+				labels[i] = labels[j];
+				break;
+			}
+		}
+	}
+	return clusterCount;
+}
+
+template<typename T>
+bool testCluster(const char *fileName, const T radius, const int minPoints)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexVector IndexVector;
+	
+	const Matrix d(load<T>(fileName));
+	IndexVector labels(d.cols());
+	boost::timer t;
+	const int clusterCount(NNS::cluster(d, labels, radius, minPoints));
+	const double duration(t.elapsed());
+	int noiseCount(0);
+	for (int i = 0; i < d.cols(); ++i)
+		noiseCount += (labels[i] < 0);
+	cout << clusterCount << " clusters, " << noiseCount << " noise points, in " << duration << " s" << endl;
+	
+	if (d.cols() > REFERENCE_MAX_POINT_COUNT)
+		return true;
+	
+	vector<int> referenceLabels;
+	const int referenceClusterCount(referenceCluster<T>(d, referenceLabels, radius, minPoints));
+	if (referenceClusterCount != clusterCount)
+	{
+		cerr << "Found " << clusterCount << " clusters instead of " << referenceClusterCount << endl;
+		return false;
+	}
+	for (int i = 0; i < d.cols(); ++i)
+	{
+		if (labels[i] != referenceLabels[i])
+		{
+			cerr << "Point " << i << " has label " << labels[i] << " instead of " << referenceLabels[i] << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		cerr << "Usage " << argv[0] << " DATA RADIUS MIN_POINTS" << endl;
+		return 1;
+	}
+	
+	const double radius(atof(argv[2]));
+	const int minPoints(atoi(argv[3]));
+	
+	if (!testCluster<float>(argv[1], radius, minPoints))
+		return 1;
+	if (!testCluster<double>(argv[1], radius, minPoints))
+		return 1;
+	
+	return 0;
+}
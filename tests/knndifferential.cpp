@@ -0,0 +1,491 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+using namespace Nabo;
+
+// Randomized differential validation: every search type, heap, bucket size,
+// leaf storage and cpu kernel set is compared to a scalar brute-force search,
+// on generated clouds including degenerate ones, with random k, epsilon,
+// maximum radius and search options. Iterations run in parallel, each one
+// reproducible from the seed and its index.
+
+// xorshift generator, independent of the platform
+struct Random
+{
+	uint64_t state;
+	
+	Random(const uint64_t seed): state(seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL) {}
+	uint32_t next()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return uint32_t(state >> 32);
+	}
+	// uniform in [0, 1[
+	double uniform() { return double(next()) / 4294967296.; }
+	// uniform in [0, n[
+	int below(const int n) { return int(next() % uint32_t(n)); }
+	// standard normal
+	double gaussian() { return sqrt(-2 * log(1 - uniform())) * cos(2 * M_PI * uniform()); }
+};
+
+enum CloudKind
+{
+	CLOUD_UNIFORM = 0,
+	CLOUD_CLUSTERS,
+	CLOUD_DUPLICATES,
+	CLOUD_COLLINEAR,
+	CLOUD_CONSTANT_DIMS,
+	CLOUD_GRID,
+	CLOUD_IDENTICAL,
+	CLOUD_KIND_COUNT
+};
+
+const char* cloudKindNames[CLOUD_KIND_COUNT] = { "uniform", "gaussian clusters", "duplicates", "collinear", "constant dimensions", "integer grid", "identical points" };
+
+// Generate pointCount points in dim dimensions of the given kind
+template<typename T>
+typename NearestNeighbourSearch<T>::Matrix generateCloud(const int kind, const int pointCount, const int dim, Random& random)
+{
+	typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+	Matrix d(dim, pointCount);
+	switch (kind)
+	{
+		case CLOUD_UNIFORM:
+		for (int i = 0; i < pointCount; ++i)
+			for (int j = 0; j < dim; ++j)
+				d(j, i) = T(random.uniform() * 100);
+		break;
+		
+		case CLOUD_CLUSTERS:
+		{
+			Matrix centers(dim, 16);
+			for (int c = 0; c < centers.cols(); ++c)
+				for (int j = 0; j < dim; ++j)
+					centers(j, c) = T(random.uniform() * 100);
+			for (int i = 0; i < pointCount; ++i)
+			{
+				const int c(random.below(centers.cols()));
+				for (int j = 0; j < dim; ++j)
+					d(j, i) = centers(j, c) + T(random.gaussian());
+			}
+		}
+		break;
+		
+		case CLOUD_DUPLICATES:
+		{
+			// every distinct point is repeated about 8 times, at random positions
+			const int distinctCount(max(1, pointCount / 8));
+			for (int i = 0; i < distinctCount; ++i)
+				for (int j = 0; j < dim; ++j)
+					d(j, i) = T(random.uniform() * 100);
+			for (int i = distinctCount; i < pointCount; ++i)
+				d.col(i) = d.col(random.below(distinctCount));
+		}
+		break;
+		
+		case CLOUD_COLLINEAR:
+		{
+			Matrix origin(dim, 1), direction(dim, 1);
+			for (int j = 0; j < dim; ++j)
+			{
+				origin(j, 0) = T(random.uniform() * 100);
+				direction(j, 0) = T(random.gaussian());
+			}
+			for (int i = 0; i < pointCount; ++i)
+				d.col(i) = origin + direction * T(random.uniform() * 100);
+		}
+		break;
+		
+		case CLOUD_CONSTANT_DIMS:
+		for (int j = 0; j < dim; ++j)
+		{
+			const bool constant(j % 2 == 1 || dim == 1);
+			const T value(T(random.uniform() * 100));
+			for (int i = 0; i < pointCount; ++i)
+				d(j, i) = constant ? value : T(random.uniform() * 100);
+		}
+		break;
+		
+		case CLOUD_GRID:
+		{
+			// small integer coordinates, so that many distances are exactly equal
+			const int side(max(2, int(pow(double(pointCount), 1. / dim) / 2)));
+			for (int i = 0; i < pointCount; ++i)
+				for (int j = 0; j < dim; ++j)
+					d(j, i) = T(random.below(side));
+		}
+		break;
+		
+		case CLOUD_IDENTICAL:
+		{
+			for (int j = 0; j < dim; ++j)
+				d(j, 0) = T(random.uniform() * 100);
+			for (int i = 1; i < pointCount; ++i)
+				d.col(i) = d.col(0);
+		}
+		break;
+		
+		default:
+		throw runtime_error("Unknown cloud kind");
+	}
+	return d;
+}
+
+// How results of a configuration must relate to the exact ones
+enum Accuracy
+{
+	EXACT, // same distances, up to rounding
+	EPSILON_BOUNDED, // every i-th distance at most (1 + epsilon)^2 times the exact i-th one
+	APPROXIMATE // every i-th distance at least the exact i-th one
+};
+
+// A search type with its parameters
+struct Configuration
+{
+	int searchType;
+	Parameters parameters;
+	string label;
+	bool approximate;
+	bool optional; // may be unsupported by the build or the machine, such as cpu kernels or OpenCL devices
+	
+	Configuration(const int searchType, const Parameters& parameters, const string& label, const bool approximate = false, const bool optional = false):
+		searchType(searchType), parameters(parameters), label(label), approximate(approximate), optional(optional) {}
+};
+typedef vector<Configuration> Configurations;
+
+// Return all configurations to compare to the reference
+template<typename T>
+Configurations getConfigurations()
+{
+	typedef NearestNeighbourSearch<T> NNS;
+	Configurations configurations;
+	const char* kernelSets[] = { "scalar", "sse4.2", "avx2", "avx512", "neon" };
+	const int kernelSetCount(sizeof(kernelSets) / sizeof(kernelSets[0]));
+	const unsigned bucketSizes[] = { 2, 8, 33 };
+	const int bucketSizeCount(sizeof(bucketSizes) / sizeof(bucketSizes[0]));
+	
+	for (int s = 0; s < kernelSetCount; ++s)
+		configurations.push_back(Configuration(NNS::BRUTE_FORCE, Parameters("cpuKernels", string(kernelSets[s])), string("brute force, cpu kernels ") + kernelSets[s], false, true));
+	const int kdTreeTypes[] = { NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP };
+	const char* kdTreeNames[] = { "kd-tree linear heap", "kd-tree tree heap" };
+	for (int t = 0; t < 2; ++t)
+	{
+		for (int b = 0; b < bucketSizeCount; ++b)
+		{
+			for (unsigned leafStorage = 0; leafStorage <= 2; ++leafStorage)
+			{
+				Parameters parameters("bucketSize", bucketSizes[b]);
+				parameters["leafStorage"] = leafStorage;
+				ostringstream label;
+				label << kdTreeNames[t] << ", bucket size " << bucketSizes[b] << ", leaf storage " << leafStorage;
+				configurations.push_back(Configuration(kdTreeTypes[t], parameters, label.str()));
+			}
+		}
+		for (int s = 0; s < kernelSetCount; ++s)
+			configurations.push_back(Configuration(kdTreeTypes[t], Parameters("cpuKernels", string(kernelSets[s])), string(kdTreeNames[t]) + ", cpu kernels " + kernelSets[s], false, true));
+	}
+	for (int b = 0; b < bucketSizeCount; ++b)
+	{
+		ostringstream label;
+		label << ", bucket size " << bucketSizes[b];
+		configurations.push_back(Configuration(NNS::BALL_TREE, Parameters("bucketSize", bucketSizes[b]), "ball tree" + label.str()));
+		configurations.push_back(Configuration(NNS::COVER_TREE, Parameters("bucketSize", bucketSizes[b]), "cover tree" + label.str()));
+	}
+	configurations.push_back(Configuration(NNS::LSH, Parameters(), "LSH", true));
+	#ifdef HAVE_OPENCL
+	// small chunks, so that transfers of several chunks overlap with kernels
+	const Parameters openCLParameters("openclChunkSize", 64u);
+	configurations.push_back(Configuration(NNS::BRUTE_FORCE_CL, openCLParameters, "OpenCL brute force", false, true));
+	configurations.push_back(Configuration(NNS::KDTREE_CL_PT_IN_NODES, openCLParameters, "OpenCL kd-tree, points in nodes", false, true));
+	configurations.push_back(Configuration(NNS::KDTREE_CL_PT_IN_LEAVES, openCLParameters, "OpenCL kd-tree, points in leaves", false, true));
+	#endif // HAVE_OPENCL
+	return configurations;
+}
+
+// Check the results of one query against the exact ones, return an empty string if they are valid or else the error
+template<typename T>
+string checkQuery(const typename NearestNeighbourSearch<T>::Matrix& d, const T* query, const int* indices, const T* dists2, const T* exactDists2, const int K, const Accuracy accuracy, const T epsilon, const T maxRadius, const bool sorted)
+{
+	typedef pair<T, int> Neighbour;
+	const int dim(d.rows());
+	// distances are sums of dim squares, computed in various orders and possibly with fused multiply-adds
+	const T tolerance(2 * (dim + 4) * numeric_limits<T>::epsilon());
+	const T maxRadius2(maxRadius * maxRadius);
+	ostringstream error;
+	
+	vector<Neighbour> neighbours;
+	for (int k = 0; k < K; ++k)
+	{
+		if (dists2[k] == numeric_limits<T>::infinity())
+			continue;
+		if (sorted && k > 0 && dists2[k] < dists2[k - 1])
+		{
+			error << "neighbour " << k << " at squared distance " << dists2[k] << " is closer than the previous one at " << dists2[k - 1] << " with SORT_RESULTS";
+			return error.str();
+		}
+		if (indices[k] < 0 || indices[k] >= d.cols())
+		{
+			error << "neighbour " << k << " has invalid index " << indices[k];
+			return error.str();
+		}
+		double trueDist2(0);
+		for (int j = 0; j < dim; ++j)
+		{
+			const double diff(double(query[j]) - double(d(j, indices[k])));
+			trueDist2 += diff * diff;
+		}
+		if (fabs(double(dists2[k]) - trueDist2) > tolerance * trueDist2)
+		{
+			error << "neighbour " << k << ", point " << indices[k] << ", is reported at squared distance " << dists2[k] << " but is at " << trueDist2;
+			return error.str();
+		}
+		if (dists2[k] > maxRadius2 * (1 + tolerance))
+		{
+			error << "neighbour " << k << " at squared distance " << dists2[k] << " is beyond maximum radius " << maxRadius;
+			return error.str();
+		}
+		neighbours.push_back(Neighbour(dists2[k], indices[k]));
+	}
+	sort(neighbours.begin(), neighbours.end());
+	for (size_t k = 1; k < neighbours.size(); ++k)
+	{
+		if (neighbours[k].second == neighbours[k - 1].second)
+		{
+			error << "point " << neighbours[k].second << " is returned twice";
+			return error.str();
+		}
+	}
+	
+	vector<T> exact;
+	for (int k = 0; k < K; ++k)
+		if (exactDists2[k] != numeric_limits<T>::infinity())
+			exact.push_back(exactDists2[k]);
+	
+	const size_t count(neighbours.size());
+	if (accuracy == EXACT ? count != exact.size() : count > exact.size())
+	{
+		// with rounding, exact searches may disagree on points at the maximum radius
+		bool onBoundary(accuracy == EXACT);
+		for (size_t k = min(count, exact.size()); k < max(count, exact.size()); ++k)
+		{
+			const T dist2(k < count ? neighbours[k].first : exact[k]);
+			onBoundary = onBoundary && fabs(dist2 - maxRadius2) <= tolerance * maxRadius2;
+		}
+		if (!onBoundary)
+		{
+			error << count << " neighbours found instead of " << exact.size();
+			return error.str();
+		}
+	}
+	if (accuracy == EPSILON_BOUNDED && count < exact.size() && maxRadius == numeric_limits<T>::infinity())
+	{
+		error << count << " neighbours found instead of " << exact.size() << ", without maximum radius";
+		return error.str();
+	}
+	for (size_t k = 0; k < min(count, exact.size()); ++k)
+	{
+		const T dist2(neighbours[k].first);
+		const T exactDist2(exact[k]);
+		const bool closerThanExact(dist2 < exactDist2 - tolerance * exactDist2);
+		const T maxDist2(accuracy == EXACT ? exactDist2 : (1 + epsilon) * (1 + epsilon) * exactDist2);
+		const bool fartherThanAllowed(accuracy != APPROXIMATE && dist2 > maxDist2 + tolerance * maxDist2);
+		if (closerThanExact || fartherThanAllowed)
+		{
+			error << "neighbour " << k << " is at squared distance " << dist2 << " instead of " << exactDist2;
+			return error.str();
+		}
+	}
+	return string();
+}
+
+// Run one iteration of the validation in scalar type T, return the number of failed configurations
+template<typename T>
+int runIteration(const int iteration, const uint64_t seed, const int pointCount, const int maxDim, const int queryCount)
+{
+	typedef NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	Random random(seed + uint64_t(iteration));
+	const int kind(iteration % CLOUD_KIND_COUNT);
+	const int dim(1 + random.below(maxDim));
+	const Matrix d(generateCloud<T>(kind, pointCount, dim, random));
+	
+	// queries are half points of the cloud, to test self matches, and half random points around the cloud
+	Matrix q(dim, queryCount);
+	for (int i = 0; i < queryCount; ++i)
+	{
+		if (i % 2 == 0)
+			q.col(i) = d.col(random.below(pointCount));
+		else
+		{
+			for (int j = 0; j < dim; ++j)
+			{
+				const T v(d(j, random.below(pointCount)) + T(random.gaussian() * 10));
+				q(j, i) = (kind == CLOUD_GRID) ? T(floor(v)) : v;
+			}
+		}
+	}
+	
+	const int K(1 + random.below(min(24, pointCount - 1)));
+	const T epsilon(random.below(4) == 0 ? T(0.5) : T(0));
+	T maxRadius(numeric_limits<T>::infinity());
+	if (random.below(2) == 0)
+	{
+		// for the grid, an integer radius has points exactly on it
+		const T distance((d.col(random.below(pointCount)) - d.col(random.below(pointCount))).norm());
+		maxRadius = (kind == CLOUD_GRID) ? T(1 + random.below(3)) : distance * T(0.1);
+	}
+	const unsigned optionFlags(random.below(4) & (NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS));
+	const unsigned creationOptionFlags(random.below(2) == 0 ? unsigned(NNS::TOUCH_STATISTICS) : 0);
+	
+	ostringstream description;
+	description << "iteration " << iteration << " (" << (sizeof(T) == sizeof(float) ? "float" : "double") << ", " << cloudKindNames[kind] << ", " << pointCount << " points in " << dim << " dimensions, K " << K << ", epsilon " << epsilon << ", maximum radius " << maxRadius << ", options " << optionFlags << ")";
+	
+	// reference: scalar brute force
+	NNS* reference(NNS::create(d, dim, NNS::BRUTE_FORCE, 0, Parameters("cpuKernels", string("scalar"))));
+	IndexMatrix exactIndices(K, queryCount);
+	Matrix exactDists2(K, queryCount);
+	reference->knn(q, exactIndices, exactDists2, K, 0, optionFlags | NNS::SORT_RESULTS, maxRadius);
+	delete reference;
+	
+	const Configurations configurations(getConfigurations<T>());
+	int failedCount(0);
+	int testedCount(0);
+	for (size_t c = 0; c < configurations.size(); ++c)
+	{
+		const Configuration& configuration(configurations[c]);
+		NNS* nns;
+		try
+		{
+			nns = NNS::create(d, dim, typename NNS::SearchType(configuration.searchType), creationOptionFlags, configuration.parameters);
+		}
+		catch (const runtime_error& e)
+		{
+			// cpu kernels or OpenCL devices not supported by this build or machine
+			if (configuration.optional)
+				continue;
+			#pragma omp critical
+			cerr << "Seed " << seed << ", " << description.str() << ", " << configuration.label << ": creation failed: " << e.what() << endl;
+			++failedCount;
+			continue;
+		}
+		
+		IndexMatrix indices(K, queryCount);
+		Matrix dists2(K, queryCount);
+		string error;
+		try
+		{
+			nns->knn(q, indices, dists2, K, epsilon, optionFlags, maxRadius);
+		}
+		catch (const runtime_error& e)
+		{
+			error = string("search failed: ") + e.what();
+		}
+		delete nns;
+		++testedCount;
+		
+		const Accuracy accuracy(configuration.approximate ? APPROXIMATE : (epsilon > 0 ? EPSILON_BOUNDED : EXACT));
+		for (int i = 0; i < queryCount && error.empty(); ++i)
+		{
+			error = checkQuery<T>(d, &q.coeff(0, i), &indices.coeff(0, i), &dists2.coeff(0, i), &exactDists2.coeff(0, i), K, accuracy, epsilon, maxRadius, optionFlags & NNS::SORT_RESULTS);
+			if (!error.empty())
+			{
+				ostringstream position;
+				position << "query " << i << ": ";
+				error = position.str() + error;
+			}
+		}
+		if (!error.empty())
+		{
+			#pragma omp critical
+			cerr << "Seed " << seed << ", " << description.str() << ", " << configuration.label << ", " << error << endl;
+			++failedCount;
+		}
+	}
+	
+	#pragma omp critical
+	cout << "Seed " << seed << ", " << description.str() << ": " << testedCount - failedCount << " of " << testedCount << " configurations valid" << endl;
+	return failedCount;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cerr << "Usage " << argv[0] << " POINT_COUNT MAX_DIM QUERY_COUNT ITERATION_COUNT [SEED]" << endl;
+		cerr << "  Iterations cycle through cloud kinds and alternate float and double, each with random dimension, k, epsilon, radius and options" << endl;
+		return 1;
+	}
+	
+	const int pointCount(atoi(argv[1]));
+	const int maxDim(atoi(argv[2]));
+	const int queryCount(atoi(argv[3]));
+	const int iterationCount(atoi(argv[4]));
+	const uint64_t seed(argc >= 6 ? strtoull(argv[5], 0, 10) : 0);
+	if (pointCount < 2 || maxDim < 1 || queryCount < 1 || iterationCount < 1)
+	{
+		cerr << "Point count must be at least 2, maximum dimension, query count and iteration count at least 1" << endl;
+		return 1;
+	}
+	
+	int failedCount(0);
+	// iterations run in parallel, each search within them running on a single thread
+	#pragma omp parallel for schedule(dynamic, 1) reduction(+:failedCount)
+	for (int iteration = 0; iteration < iterationCount; ++iteration)
+	{
+		// cycling through kinds first, so that both scalar types meet every kind
+		if ((iteration / CLOUD_KIND_COUNT) % 2 == 0)
+			failedCount += runIteration<float>(iteration, seed, pointCount, maxDim, queryCount);
+		else
+			failedCount += runIteration<double>(iteration, seed, pointCount, maxDim, queryCount);
+	}
+	
+	if (failedCount > 0)
+	{
+		cerr << failedCount << " configurations failed" << endl;
+		return 2;
+	}
+	cout << "All configurations valid" << endl;
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+using namespace Nabo;
+
+//! Return a normally-distributed random value, using the Box-Muller transform
+template<typename T>
+T normalRand()
+{
+	const T u1((T(rand()) + 1) / (T(RAND_MAX) + 2));
+	const T u2(T(rand()) / T(RAND_MAX));
+	return sqrt(-2 * log(u1)) * cos(T(2 * M_PI) * u2);
+}
+
+//! Create a cloud of pointCount points in dim dimensions, drawn around clusterCount random centers
+template<typename T>
+typename NearestNeighbourSearch<T>::Matrix createClusteredCloud(const int dim, const int pointCount, const int clusterCount, const T sigma)
+{
+	typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+	
+	Matrix centers(dim, clusterCount);
+	for (int c = 0; c < clusterCount; ++c)
+		for (int j = 0; j < dim; ++j)
+			centers(j, c) = T(rand()) / T(RAND_MAX);
+	Matrix cloud(dim, pointCount);
+	for (int i = 0; i < pointCount; ++i)
+	{
+		const int c(rand() % clusterCount);
+		for (int j = 0; j < dim; ++j)
+			cloud(j, i) = centers(j, c) + sigma * normalRand<T>();
+	}
+	return cloud;
+}
+
+//! Create a cloud of pointCount points in dim dimensions, lying close to a random intrinsicDim-dimensional curved manifold
+template<typename T>
+typename NearestNeighbourSearch<T>::Matrix createManifoldCloud(const int dim, const int intrinsicDim, const int pointCount, const T noise)
+{
+	typedef typename NearestNeighbourSearch<T>::Matrix Matrix;
+	
+	// the manifold is the image of a random linear map of the latent coordinates and of their sines,
+	// all points share the same seed for the map, so that queries and data lie on the same manifold
+	const unsigned seed(rand());
+	srand(12345);
+	const Matrix linear(Matrix::Random(dim, intrinsicDim));
+	const Matrix curved(Matrix::Random(dim, intrinsicDim));
+	srand(seed);
+	Matrix cloud(dim, pointCount);
+	for (int i = 0; i < pointCount; ++i)
+	{
+		typename NearestNeighbourSearch<T>::Vector latent(intrinsicDim);
+		typename NearestNeighbourSearch<T>::Vector curvedLatent(intrinsicDim);
+		for (int j = 0; j < intrinsicDim; ++j)
+		{
+			latent(j) = T(rand()) / T(RAND_MAX);
+			curvedLatent(j) = sin(T(3) * latent(j));
+		}
+		cloud.col(i) = linear * latent + curved * curvedLatent;
+		for (int j = 0; j < dim; ++j)
+			cloud(j, i) += noise * normalRand<T>();
+	}
+	return cloud;
+}
+
+//! Return the average duration of searchCount searches of K neighbours, the number of points touched per query in visitCount, and the squared distances found in dists2
+template<typename T>
+double benchSearch(const typename NearestNeighbourSearch<T>::SearchType type, const typename NearestNeighbourSearch<T>::Matrix& d, const typename NearestNeighbourSearch<T>::Matrix& q, const int K, const int searchCount, double& creationDuration, double& visitCount, typename NearestNeighbourSearch<T>::Matrix& dists2)
+{
+	typedef NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	boost::timer t;
+	NNS* nns(NNS::create(d, d.rows(), type, NNS::TOUCH_STATISTICS));
+	creationDuration = t.elapsed();
+	
+	IndexMatrix indices(K, q.cols());
+	dists2.resize(K, q.cols());
+	double duration(0);
+	visitCount = 0;
+	for (int s = 0; s < searchCount; ++s)
+	{
+		t.restart();
+		visitCount += double(nns->knn(q, indices, dists2, K, 0, NNS::ALLOW_SELF_MATCH));
+		duration += t.elapsed();
+	}
+	visitCount /= double(searchCount) * double(q.cols());
+	
+	delete nns;
+	return duration / double(searchCount);
+}
+
+//! Return the average fraction of the exact K nearest neighbours, whose squared distances are in exactDists2, that are found in dists2
+template<typename T>
+double recall(const typename NearestNeighbourSearch<T>::Matrix& exactDists2, const typename NearestNeighbourSearch<T>::Matrix& dists2)
+{
+	const int K(exactDists2.rows());
+	double foundCount(0);
+	for (int i = 0; i < exactDists2.cols(); ++i)
+	{
+		// ties at the K-th distance are equally good neighbours
+		const T maxDist2(exactDists2.col(i).maxCoeff() * (1 + 16 * numeric_limits<T>::epsilon()));
+		for (int k = 0; k < K; ++k)
+			if (dists2(k, i) <= maxDist2)
+				foundCount += 1;
+	}
+	return foundCount / (double(K) * double(exactDists2.cols()));
+}
+
+template<typename T>
+void doBenchDimensions(const int pointCount, const int queryCount, const int K, const int maxDim, const int searchCount, const int intrinsicDim)
+{
+	typedef NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	
+	const typename NNS::SearchType types[] = { NNS::BRUTE_FORCE, NNS::KDTREE_LINEAR_HEAP, NNS::BALL_TREE, NNS::COVER_TREE, NNS::LSH };
+	const char* labels[] = { "brute_force", "kdtree_linear_heap", "ball_tree", "cover_tree", "lsh" };
+	const size_t typeCount(sizeof(types) / sizeof(types[0]));
+	
+	// for each tree, the first dimension from which brute force is faster
+	vector<int> crossovers(typeCount, -1);
+	
+	cout << "dim";
+	for (size_t i = 0; i < typeCount; ++i)
+		cout << " " << labels[i] << "_creation " << labels[i] << "_execution " << labels[i] << "_visit " << labels[i] << "_throughput " << labels[i] << "_recall";
+	cout << endl;
+	
+	for (int dim = max(2, intrinsicDim); dim <= maxDim; dim = (dim < 8 ? dim + 2 : (dim < 64 ? dim + 4 : dim * 2)))
+	{
+		// queries are drawn from the same distribution as the data
+		const Matrix all(intrinsicDim > 0 ? createManifoldCloud<T>(dim, intrinsicDim, pointCount + queryCount, T(0.001)) : createClusteredCloud<T>(dim, pointCount + queryCount, 16, T(0.05)));
+		const Matrix d(all.block(0, 0, dim, pointCount));
+		const Matrix q(all.block(0, pointCount, dim, queryCount));
+		
+		vector<double> durations(typeCount);
+		Matrix exactDists2;
+		cout << dim;
+		for (size_t i = 0; i < typeCount; ++i)
+		{
+			double creationDuration, visitCount;
+			Matrix dists2;
+			durations[i] = benchSearch<T>(types[i], d, q, K, searchCount, creationDuration, visitCount, dists2);
+			if (i == 0)
+				exactDists2 = dists2;
+			cout << " " << creationDuration << " " << durations[i] << " " << visitCount << " " << double(q.cols()) / durations[i] << " " << recall<T>(exactDists2, dists2);
+		}
+		cout << endl;
+		
+		for (size_t i = 1; i < typeCount; ++i)
+			if (crossovers[i] < 0 && durations[i] >= durations[0])
+				crossovers[i] = dim;
+	}
+	
+	cout << "\nCrossover with brute force:\n";
+	for (size_t i = 1; i < typeCount; ++i)
+	{
+		cout << "  " << labels[i] << ": ";
+		if (crossovers[i] < 0)
+			cout << "faster than brute force up to dimension " << maxDim << "\n";
+		else
+			cout << "slower than brute force from dimension " << crossovers[i] << "\n";
+	}
+	cout << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 6 && argc != 7)
+	{
+		cerr << "Usage " << argv[0] << " POINT_COUNT QUERY_COUNT K MAX_DIM SEARCH_COUNT [INTRINSIC_DIM]" << endl;
+		cerr << "  without INTRINSIC_DIM, points are drawn from gaussian clusters filling all dimensions" << endl;
+		cerr << "  with INTRINSIC_DIM, points lie close to a random curved manifold of that dimension" << endl;
+		return 1;
+	}
+	
+	const int pointCount(atoi(argv[1]));
+	const int queryCount(atoi(argv[2]));
+	const int K(atoi(argv[3]));
+	const int maxDim(atoi(argv[4]));
+	const int searchCount(atoi(argv[5]));
+	const int intrinsicDim(argc == 7 ? atoi(argv[6]) : 0);
+	
+	if (K >= pointCount)
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		return 2;
+	}
+	
+	doBenchDimensions<float>(pointCount, queryCount, K, maxDim, searchCount, intrinsicDim);
+	
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace Nabo;
+
+// Build the k-nearest-neighbour graph of a cloud by NN-descent, check it and compare it to the exact one
+template<typename T>
+bool testKnnGraph(const char *fileName, const int K, const double minRecall)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::Index Index;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	if (K >= d.cols())
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		exit(2);
+	}
+	
+	// exact graph, with self matches allowed to keep duplicated points
+	NNS* nns = NNS::createKDTreeLinearHeap(d);
+	IndexMatrix exactIndices(K+1, d.cols());
+	Matrix exactDists2(K+1, d.cols());
+	boost::timer t;
+	nns->knn(d, exactIndices, exactDists2, K+1, 0, NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS);
+	const double exactDuration(t.elapsed());
+	delete nns;
+	cout << "exact kd-tree: " << exactDuration << " s" << endl;
+	
+	bool ok(true);
+	for (unsigned treeCount = 0; treeCount < 3; treeCount += 2)
+	{
+		IndexMatrix indices(K, d.cols());
+		Matrix dists2(K, d.cols());
+		Parameters params("treeCount", treeCount);
+		boost::timer t;
+		const unsigned long distCount(NNS::buildKnnGraph(d, indices, dists2, K, std::numeric_limits<Index>::max(), params));
+		const double duration(t.elapsed());
+		
+		size_t found(0);
+		for (int i = 0; i < d.cols(); ++i)
+		{
+			// exact distance to the k-th neighbour other than i
+			const T kthDist2(exactDists2(K, i));
+			for (int j = 0; j < K; ++j)
+			{
+				const Index index(indices(j, i));
+				if (index < 0 || index >= d.cols() || index == i)
+				{
+					cerr << "Invalid neighbour " << index << " of point " << i << endl;
+					return false;
+				}
+				const T dist2((d.col(index) - d.col(i)).squaredNorm());
+				if (fabs(dist2 - dists2(j, i)) > numeric_limits<T>::epsilon() * (1 + dist2))
+				{
+					cerr << "Wrong distance " << dists2(j, i) << " instead of " << dist2 << " between " << i << " and " << index << endl;
+					return false;
+				}
+				if (j > 0 && (dists2(j, i) < dists2(j-1, i) || index == indices(j-1, i)))
+				{
+					cerr << "Neighbours of point " << i << " are not sorted or are duplicated" << endl;
+					return false;
+				}
+				if (dists2(j, i) <= kthDist2)
+					++found;
+			}
+		}
+		const double recall(double(found) / double(K * d.cols()));
+		cout << "NN-descent, " << treeCount << " trees: " << duration << " s, " << double(distCount) / double(d.cols()) << " distances per point, recall " << recall << endl;
+		if (recall < minRecall)
+		{
+			cerr << "Recall " << recall << " lower than " << minRecall << endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		cerr << "Usage " << argv[0] << " DATA K MIN_RECALL" << endl;
+		return 1;
+	}
+	
+	const int K(atoi(argv[2]));
+	const double minRecall(atof(argv[3]));
+	
+	if (!testKnnGraph<float>(argv[1], K, minRecall))
+		return 1;
+	if (!testKnnGraph<double>(argv[1], K, minRecall))
+		return 1;
+	
+	return 0;
+}
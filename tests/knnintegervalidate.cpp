@@ -0,0 +1,233 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+using namespace Nabo;
+
+//! Return a random coordinate in [minVal, maxVal], built from several calls to rand() to cover wide ranges
+template<typename T>
+T randomCoordinate(const boost::int64_t minVal, const boost::int64_t maxVal)
+{
+	boost::int64_t r(0);
+	for (int i = 0; i < 3; ++i)
+		r = (r << 16) ^ boost::int64_t(rand() & 0xFFFF);
+	return T(minVal + r % (maxVal - minVal + 1));
+}
+
+//! Create pointCount points in clusters of voxels spread over [minVal, maxVal] in each dimension
+template<typename T>
+typename IntegerNearestNeighbourSearch<T>::Matrix createCloud(const int dim, const int pointCount, const boost::int64_t minVal, const boost::int64_t maxVal)
+{
+	typedef typename IntegerNearestNeighbourSearch<T>::Matrix Matrix;
+	const int clusterCount(max(pointCount / 50, 1));
+	Matrix centers(dim, clusterCount);
+	for (int i = 0; i < clusterCount; ++i)
+		for (int d = 0; d < dim; ++d)
+			centers(d, i) = randomCoordinate<T>(minVal + 16, maxVal - 16);
+	Matrix cloud(dim, pointCount);
+	for (int i = 0; i < pointCount; ++i)
+	{
+		const int c(rand() % clusterCount);
+		for (int d = 0; d < dim; ++d)
+			cloud(d, i) = T(centers(d, c) + (rand() % 33) - 16);
+	}
+	// put some points in the corners of the range, to exercise the full width of the accumulation
+	for (int i = 0; i < min(pointCount, 4); ++i)
+		for (int d = 0; d < dim; ++d)
+			cloud(d, i) = T((i + d) % 2 ? maxVal : minVal);
+	return cloud;
+}
+
+//! Return the squared distance between column i of a and column j of b, in unsigned 64 bits, saturated to the largest value below the maximum
+template<typename T>
+boost::uint64_t referenceDist2(const typename IntegerNearestNeighbourSearch<T>::Matrix& a, const int i, const typename IntegerNearestNeighbourSearch<T>::Matrix& b, const int j)
+{
+	const boost::uint64_t saturated(numeric_limits<boost::uint64_t>::max() - 1);
+	boost::uint64_t dist(0);
+	for (int d = 0; d < a.rows(); ++d)
+	{
+		const boost::int64_t diff(boost::int64_t(a(d, i)) - boost::int64_t(b(d, j)));
+		const boost::uint64_t absDiff(diff < 0 ? -diff : diff);
+		const boost::uint64_t diff2(absDiff * absDiff);
+		if (diff2 > saturated - dist)
+			return saturated;
+		dist += diff2;
+	}
+	return dist;
+}
+
+//! Validate the results of search type against an exhaustive search
+template<typename T>
+void validate(const typename IntegerNearestNeighbourSearch<T>::Matrix& cloud, const typename IntegerNearestNeighbourSearch<T>::Matrix& query, const int K, const boost::uint64_t maxDist2, const unsigned optionFlags, const typename IntegerNearestNeighbourSearch<T>::SearchType searchType)
+{
+	typedef IntegerNearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Distance Distance;
+	NNS* nns(NNS::create(cloud, cloud.rows(), searchType, NNS::TOUCH_STATISTICS));
+	typename NNS::IndexMatrix indices(K, query.cols());
+	typename NNS::DistanceMatrix dists2(K, query.cols());
+	const unsigned long touched(nns->knn(query, indices, dists2, K, optionFlags | NNS::SORT_RESULTS, maxDist2));
+	
+	const bool allowSelfMatch(optionFlags & NNS::ALLOW_SELF_MATCH);
+	vector<Distance> refDists2;
+	for (int i = 0; i < query.cols(); ++i)
+	{
+		// reference: sorted distances of valid candidates
+		refDists2.clear();
+		for (int j = 0; j < cloud.cols(); ++j)
+		{
+			const Distance dist2(referenceDist2<T>(query, i, cloud, j));
+			if (dist2 <= maxDist2 && (allowSelfMatch || dist2 > 0))
+				refDists2.push_back(dist2);
+		}
+		sort(refDists2.begin(), refDists2.end());
+		for (int k = 0; k < K; ++k)
+		{
+			const Distance expected(k < int(refDists2.size()) ? refDists2[k] : numeric_limits<Distance>::max());
+			if (dists2(k, i) != expected)
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has squared distance " << dists2(k, i) << " instead of " << expected << endl;
+				exit(4);
+			}
+			if (expected == numeric_limits<Distance>::max())
+				continue;
+			const int index(indices(k, i));
+			if (index < 0 || index >= cloud.cols())
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has invalid index " << index << " out of range [0:" << cloud.cols() << "[" << endl;
+				exit(4);
+			}
+			if (referenceDist2<T>(query, i, cloud, index) != expected)
+			{
+				cerr << "Search type " << searchType << ", query " << i << ", neighbour " << k << " of " << K << " has index " << index << " whose squared distance is not " << expected << endl;
+				exit(4);
+			}
+		}
+	}
+	cout << sizeof(T) * 8 << "-bit coordinates, search type " << searchType << ": touched " << double(touched) / double(query.cols()) << " points per query on " << cloud.cols() << endl;
+	delete nns;
+}
+
+//! Validate all search types for coordinates of type T over [minVal, maxVal]
+template<typename T>
+void validateAll(const int dim, const int pointCount, const int queryCount, const int K, const boost::uint64_t maxDist2, const boost::int64_t minVal, const boost::int64_t maxVal)
+{
+	typedef IntegerNearestNeighbourSearch<T> NNS;
+	const typename NNS::Matrix cloud(createCloud<T>(dim, pointCount, minVal, maxVal));
+	// half of the queries are cloud points, the other half are shifted by one unit in a random dimension
+	typename NNS::Matrix query(dim, queryCount);
+	for (int i = 0; i < queryCount; ++i)
+	{
+		query.col(i) = cloud.col(rand() % pointCount);
+		if (i % 2)
+		{
+			const int d(rand() % dim);
+			query(d, i) = T(query(d, i) == maxVal ? query(d, i) - 1 : query(d, i) + 1);
+		}
+	}
+	
+	for (int searchType = 0; searchType < NNS::SEARCH_TYPE_COUNT; ++searchType)
+	{
+		validate<T>(cloud, query, K, maxDist2, 0, typename NNS::SearchType(searchType));
+		validate<T>(cloud, query, K, maxDist2, NNS::ALLOW_SELF_MATCH, typename NNS::SearchType(searchType));
+	}
+}
+
+//! Validate distances between the extreme coordinates of type T, in one dimension and in the corners of a 3D box
+template<typename T>
+void validateCorners()
+{
+	typedef IntegerNearestNeighbourSearch<T> NNS;
+	const T minVal(numeric_limits<T>::min());
+	const T maxVal(numeric_limits<T>::max());
+	const typename NNS::Distance range(typename NNS::Distance(boost::int64_t(maxVal) - boost::int64_t(minVal)));
+	
+	// from minVal, 0 is the nearest other point, and maxVal is at the square of the range
+	typename NNS::Matrix line(1, 3);
+	line << minVal, maxVal, 0;
+	const typename NNS::Matrix lineQuery(line.col(0));
+	for (int searchType = 0; searchType < NNS::SEARCH_TYPE_COUNT; ++searchType)
+	{
+		NNS* nns(NNS::create(line, 1, typename NNS::SearchType(searchType)));
+		typename NNS::IndexMatrix indices(2, 1);
+		typename NNS::DistanceMatrix dists2(2, 1);
+		nns->knn(lineQuery, indices, dists2, 2, NNS::SORT_RESULTS);
+		if (indices(0, 0) != 2 || indices(1, 0) != 1 || dists2(1, 0) != range * range)
+		{
+			cerr << sizeof(T) * 8 << "-bit coordinates, search type " << searchType << ": neighbours of the minimum are " << indices(0, 0) << ", " << indices(1, 0) << " at squared distances " << dists2(0, 0) << ", " << dists2(1, 0) << " instead of 2, 1 at " << range * range << endl;
+			exit(5);
+		}
+		delete nns;
+	}
+	
+	// all corners of the box, the farthest ones saturating with 32-bit coordinates
+	typename NNS::Matrix corners(3, 8);
+	for (int i = 0; i < 8; ++i)
+		for (int d = 0; d < 3; ++d)
+			corners(d, i) = (i >> d) & 1 ? maxVal : minVal;
+	validate<T>(corners, corners, 7, numeric_limits<typename NNS::Distance>::max(), 0, NNS::BRUTE_FORCE);
+	validate<T>(corners, corners, 7, numeric_limits<typename NNS::Distance>::max(), 0, NNS::KDTREE);
+	validate<T>(corners, corners, 8, numeric_limits<typename NNS::Distance>::max(), NNS::ALLOW_SELF_MATCH, NNS::KDTREE);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cerr << "Usage " << argv[0] << " DIM POINT_COUNT QUERY_COUNT K [MAX_DIST2]" << endl;
+		return 1;
+	}
+	
+	const int dim(atoi(argv[1]));
+	const int pointCount(atoi(argv[2]));
+	const int queryCount(atoi(argv[3]));
+	const int K(atoi(argv[4]));
+	const boost::uint64_t maxDist2(argc >= 6 ? strtoull(argv[5], 0, 10) : numeric_limits<boost::uint64_t>::max());
+	if (K >= pointCount)
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		return 2;
+	}
+	
+	srand(0);
+	validateAll<boost::int16_t>(dim, pointCount, queryCount, K, maxDist2, numeric_limits<boost::int16_t>::min(), numeric_limits<boost::int16_t>::max());
+	validateAll<boost::int32_t>(dim, pointCount, queryCount, K, maxDist2, numeric_limits<boost::int32_t>::min(), numeric_limits<boost::int32_t>::max());
+	validateCorners<boost::int16_t>();
+	validateCorners<boost::int32_t>();
+	
+	return 0;
+}
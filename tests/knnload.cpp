@@ -0,0 +1,269 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+#include <time.h>
+#ifdef HAVE_OPENMP
+	#include <omp.h>
+#endif // HAVE_OPENMP
+
+using namespace std;
+using namespace Nabo;
+
+typedef NearestNeighbourSearch<float> NNS;
+typedef NNS::Matrix Matrix;
+typedef NNS::IndexMatrix IndexMatrix;
+
+// Return the current wall-clock time in nanoseconds
+uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * uint64_t(1000000000) + uint64_t(ts.tv_nsec);
+}
+
+// Sleep until time t, in nanoseconds
+void sleepUntil(const uint64_t t)
+{
+	const uint64_t current(now());
+	if (t <= current)
+		return;
+	struct timespec ts;
+	ts.tv_sec = time_t((t - current) / 1000000000);
+	ts.tv_nsec = long((t - current) % 1000000000);
+	nanosleep(&ts, 0);
+}
+
+/*
+	Histogram of latencies in nanoseconds, with 32 logarithmically-spaced
+	buckets per power of two, so that percentiles are within 3 % of exact
+	ones while recording costs a few instructions and no allocation.
+*/
+struct LatencyHistogram
+{
+	enum { SUB_BUCKET_BITS = 5, SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS };
+	
+	vector<uint64_t> counts;
+	uint64_t totalCount;
+	uint64_t maxLatency;
+	
+	LatencyHistogram():
+		counts(SUB_BUCKET_COUNT * (64 - SUB_BUCKET_BITS + 1), 0),
+		totalCount(0),
+		maxLatency(0)
+	{}
+	
+	static size_t bucketIndex(const uint64_t latency)
+	{
+		if (latency < SUB_BUCKET_COUNT)
+			return size_t(latency);
+		int exponent(SUB_BUCKET_BITS);
+		while ((latency >> (exponent + 1)) != 0)
+			++exponent;
+		const uint64_t subBucket((latency >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT);
+		return size_t(SUB_BUCKET_COUNT * (exponent - SUB_BUCKET_BITS + 1) + subBucket);
+	}
+	
+	// return the middle of the range of latencies in bucket index
+	static double bucketLatency(const size_t index)
+	{
+		if (index < SUB_BUCKET_COUNT)
+			return double(index);
+		const int shift(int(index / SUB_BUCKET_COUNT) - 1);
+		const uint64_t subBucket(index % SUB_BUCKET_COUNT);
+		return (double(SUB_BUCKET_COUNT + subBucket) + 0.5) * double(uint64_t(1) << shift);
+	}
+	
+	void add(const uint64_t latency)
+	{
+		++counts[bucketIndex(latency)];
+		++totalCount;
+		maxLatency = max(maxLatency, latency);
+	}
+	
+	void operator +=(const LatencyHistogram& that)
+	{
+		for (size_t i = 0; i < counts.size(); ++i)
+			counts[i] += that.counts[i];
+		totalCount += that.totalCount;
+		maxLatency = max(maxLatency, that.maxLatency);
+	}
+	
+	// return the latency below which a fraction p of the recorded latencies are
+	double percentile(const double p) const
+	{
+		const uint64_t rank(max(uint64_t(1), uint64_t(ceil(p * double(totalCount)))));
+		uint64_t count(0);
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			count += counts[i];
+			if (count >= rank)
+				return min(bucketLatency(i), double(maxLatency));
+		}
+		return double(maxLatency);
+	}
+};
+
+// Result of running a number of clients during some time
+struct LoadResult
+{
+	LatencyHistogram latencies;
+	uint64_t batchCount;
+	double duration;
+	
+	LoadResult(): batchCount(0), duration(0) {}
+};
+
+// Run clientCount threads, each searching batches of batchSize queries at rate batches per second (or as fast as possible if 0) during duration seconds
+LoadResult runClients(const NNS& nns, const Matrix& queries, const int K, const int batchSize, const int clientCount, const double duration, const double rate)
+{
+	LoadResult result;
+	const uint64_t start(now());
+	const uint64_t end(start + uint64_t(duration * 1e9));
+	const int batchCountInPool(int(queries.cols()) / batchSize);
+	
+	#pragma omp parallel num_threads(clientCount)
+	{
+		#ifdef HAVE_OPENMP
+		// each client searches its batch in its own thread
+		omp_set_num_threads(1);
+		const int client(omp_get_thread_num());
+		#else // HAVE_OPENMP
+		const int client(0);
+		#endif // HAVE_OPENMP
+		
+		LatencyHistogram latencies;
+		IndexMatrix indices(K, batchSize);
+		Matrix dists2(K, batchSize);
+		// spread clients over the pool and their first requests over the first period
+		int batch((client * batchCountInPool) / clientCount);
+		uint64_t scheduled(start + (rate > 0 ? uint64_t(1e9 * client / (rate * clientCount)) : 0));
+		while (true)
+		{
+			if (rate > 0)
+				sleepUntil(scheduled);
+			const uint64_t sent(now());
+			if (sent >= end)
+				break;
+			nns.knn(queries.block(0, batch * batchSize, queries.rows(), batchSize), indices, dists2, K);
+			// with a target rate, measure from the scheduled time, so that batches delayed by slow ones count their waiting time
+			latencies.add(now() - (rate > 0 ? scheduled : sent));
+			batch = (batch + 1) % batchCountInPool;
+			if (rate > 0)
+				scheduled += uint64_t(1e9 / rate);
+		}
+		
+		#pragma omp critical
+		result.latencies += latencies;
+	}
+	
+	result.batchCount = result.latencies.totalCount;
+	result.duration = double(now() - start) * 1e-9;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 6 && argc != 7)
+	{
+		cerr << "Usage " << argv[0] << " DATA K BATCH_SIZE MAX_CLIENT_COUNT DURATION [RATE]" << endl;
+		cerr << "  BATCH_SIZE: number of query points per knn() call" << endl;
+		cerr << "  MAX_CLIENT_COUNT: clients are doubled from 1 up to this number, each in its own thread" << endl;
+		cerr << "  DURATION: time in seconds during which each number of clients is run" << endl;
+		cerr << "  RATE: target batches per second of each client, 0 (default) to send the next batch as soon as the previous one is answered" << endl;
+		return 1;
+	}
+	
+	const Matrix d(load<float>(argv[1]));
+	const int K(atoi(argv[2]));
+	const int batchSize(atoi(argv[3]));
+	int maxClientCount(atoi(argv[4]));
+	const double duration(atof(argv[5]));
+	const double rate(argc == 7 ? atof(argv[6]) : 0);
+	if (K >= d.cols())
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		return 2;
+	}
+	if (batchSize < 1 || maxClientCount < 1 || duration <= 0 || rate < 0)
+	{
+		cerr << "Batch size and client count must be positive, duration strictly positive and rate non-negative" << endl;
+		return 1;
+	}
+	#ifndef HAVE_OPENMP
+	if (maxClientCount > 1)
+	{
+		cerr << "Compiled without OpenMP, running a single client" << endl;
+		maxClientCount = 1;
+	}
+	#endif // HAVE_OPENMP
+	
+	// shared index and a pool of queries cycled through by clients
+	NNS* nns(NNS::createKDTreeLinearHeap(d));
+	const int poolSize(max(batchSize * maxClientCount * 16, 65536));
+	const Matrix queries(createQuery<float>(d, poolSize, 0));
+	
+	cout << "Searching batches of " << batchSize << " queries for " << K << " neighbours in " << d.cols() << " points, during " << duration << " s per client count";
+	if (rate > 0)
+		cout << ", at " << rate << " batches/s per client";
+	cout << "\n\n";
+	cout << "latencies in us\n";
+	cout << "clients  batches/s  queries/s       p50       p90       p99      p999       max\n";
+	
+	double saturationThroughput(0);
+	int saturationClientCount(0);
+	for (int clientCount = 1; ; clientCount = min(clientCount * 2, maxClientCount))
+	{
+		const LoadResult result(runClients(*nns, queries, K, batchSize, clientCount, duration, rate));
+		const double batchRate(double(result.batchCount) / result.duration);
+		const LatencyHistogram& l(result.latencies);
+		cout << setw(7) << clientCount << setw(11) << batchRate << setw(11) << batchRate * batchSize;
+		cout << setw(10) << l.percentile(0.5) * 1e-3 << setw(10) << l.percentile(0.9) * 1e-3 << setw(10) << l.percentile(0.99) * 1e-3 << setw(10) << l.percentile(0.999) * 1e-3 << setw(10) << double(l.maxLatency) * 1e-3 << endl;
+		
+		// throughput saturates once adding clients increases it by less than 10 %
+		if (batchRate > saturationThroughput * 1.1)
+		{
+			saturationThroughput = batchRate;
+			saturationClientCount = clientCount;
+		}
+		if (clientCount == maxClientCount)
+			break;
+	}
+	cout << "\nThroughput saturates at " << saturationThroughput * batchSize << " queries/s with " << saturationClientCount << " client" << (saturationClientCount > 1 ? "s" : "") << endl;
+	
+	delete nns;
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+using namespace Nabo;
+
+// number of random queries per level
+const int QUERY_COUNT = 1000;
+
+// return whether squared distances a and b are equal up to rounding errors
+template<typename T>
+bool sameDist2(const T a, const T b)
+{
+	if (a == b)
+		return true;
+	return fabs(a - b) <= 1e-5 * max(fabs(a), fabs(b));
+}
+
+template<typename T>
+bool testPyramid(const char *fileName, const int K, const unsigned levelCount)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef Nabo::PyramidNearestNeighbourSearch<T> Pyramid;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	boost::timer t;
+	Pyramid* pyramid(Pyramid::create(d, d.rows(), 0, Parameters("levelCount", levelCount)));
+	cout << "Pyramid of " << levelCount << " levels built in " << t.elapsed() << " s, level sizes:";
+	for (unsigned level = 0; level < levelCount; ++level)
+		cout << " " << pyramid->getLevelSize(level);
+	cout << endl;
+	if (pyramid->getLevelSize(0) != d.cols())
+	{
+		cerr << "Level 0 has " << pyramid->getLevelSize(0) << " points instead of " << d.cols() << endl;
+		return false;
+	}
+	
+	// find the points of every level by searching the cloud in it, and check that levels are nested
+	vector<vector<bool> > isInLevel(levelCount, vector<bool>(d.cols(), false));
+	IndexMatrix selfIndices(1, d.cols());
+	Matrix selfDists2(1, d.cols());
+	for (unsigned level = 0; level < levelCount; ++level)
+	{
+		pyramid->knn(d, selfIndices, selfDists2, level, 1, 0, NNS::ALLOW_SELF_MATCH);
+		for (int i = 0; i < d.cols(); ++i)
+			if (selfDists2(0, i) == 0)
+				isInLevel[level][selfIndices(0, i)] = true;
+		if (level == 0)
+			continue;
+		if (pyramid->getLevelSize(level) > pyramid->getLevelSize(level - 1))
+		{
+			cerr << "Level " << level << " has more points than level " << level - 1 << endl;
+			return false;
+		}
+		for (int i = 0; i < d.cols(); ++i)
+		{
+			if (isInLevel[level][i] && !isInLevel[level - 1][i])
+			{
+				cerr << "Point " << i << " is in level " << level << " but not in level " << level - 1 << endl;
+				return false;
+			}
+		}
+	}
+	
+	// compare every level with a brute-force search on its points, and with the coarse-to-fine search
+	const Matrix q(createQuery<T>(d, QUERY_COUNT, 1));
+	for (unsigned level = 0; level < levelCount; ++level)
+	{
+		vector<int> levelIndices;
+		for (int i = 0; i < d.cols(); ++i)
+			if (isInLevel[level][i])
+				levelIndices.push_back(i);
+		Matrix levelCloud(d.rows(), levelIndices.size());
+		for (size_t j = 0; j < levelIndices.size(); ++j)
+			levelCloud.col(j) = d.col(levelIndices[j]);
+		const int k(min(K, int(levelIndices.size())));
+		NNS* bruteForce(NNS::createBruteForce(levelCloud));
+		IndexMatrix bfIndices(k, q.cols()), indices(k, q.cols()), coarseToFineIndices(k, q.cols());
+		Matrix bfDists2(k, q.cols()), dists2(k, q.cols()), coarseToFineDists2(k, q.cols());
+		bruteForce->knn(q, bfIndices, bfDists2, k, 0, NNS::SORT_RESULTS | NNS::ALLOW_SELF_MATCH);
+		pyramid->knn(q, indices, dists2, level, k, 0, NNS::SORT_RESULTS | NNS::ALLOW_SELF_MATCH);
+		pyramid->knnCoarseToFine(q, coarseToFineIndices, coarseToFineDists2, level, levelCount - 1, k, 0, NNS::SORT_RESULTS | NNS::ALLOW_SELF_MATCH);
+		delete bruteForce;
+		for (int i = 0; i < q.cols(); ++i)
+		{
+			for (int j = 0; j < k; ++j)
+			{
+				if (!isInLevel[level][indices(j, i)])
+				{
+					cerr << "Level " << level << ", query " << i << ": neighbour " << j << " is point " << indices(j, i) << ", which is not in the level" << endl;
+					return false;
+				}
+				const T dist2((d.col(indices(j, i)) - q.col(i)).squaredNorm());
+				if (!sameDist2(dist2, dists2(j, i)) || !sameDist2(bfDists2(j, i), dists2(j, i)))
+				{
+					cerr << "Level " << level << ", query " << i << ": neighbour " << j << " is at squared distance " << dists2(j, i) << " (point " << indices(j, i) << " at " << dist2 << ") instead of " << bfDists2(j, i) << endl;
+					return false;
+				}
+				if (coarseToFineDists2(j, i) != dists2(j, i))
+				{
+					cerr << "Level " << level << ", query " << i << ": coarse-to-fine neighbour " << j << " is at squared distance " << coarseToFineDists2(j, i) << " instead of " << dists2(j, i) << endl;
+					return false;
+				}
+			}
+		}
+	}
+	delete pyramid;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		cerr << "Usage " << argv[0] << " DATA K LEVEL_COUNT" << endl;
+		return 1;
+	}
+	
+	const int K(atoi(argv[2]));
+	const unsigned levelCount(atoi(argv[3]));
+	
+	if (!testPyramid<float>(argv[1], K, levelCount))
+		return 1;
+	if (!testPyramid<double>(argv[1], K, levelCount))
+		return 1;
+	
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+using namespace Nabo;
+
+template<typename T>
+void doTestRotation(const char *fileName, const int K, const int method, const int searchCount, const T yaw)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	// turn the cloud around its vertical axis, so that walls aligned with the axes are not anymore
+	Matrix d(load<T>(fileName));
+	if (K >= d.cols())
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		exit(2);
+	}
+	const T c(cos(yaw)), s(sin(yaw));
+	for (int i = 0; i < d.cols(); ++i)
+	{
+		const T x(d(0, i)), y(d(1, i));
+		d(0, i) = c * x - s * y;
+		d(1, i) = s * x + c * y;
+	}
+	
+	const int itCount(method >= 0 ? method : d.cols() * 2);
+	const Matrix q(createQuery<T>(d, itCount, method));
+	IndexMatrix indices(K, q.cols());
+	Matrix dists2(K, q.cols());
+	
+	const char* rotations[] = { "none", "pca", "random" };
+	for (int r = 0; r < 3; ++r)
+	{
+		boost::timer t;
+		NNS* nns = NNS::createKDTreeLinearHeap(d, d.rows(), NNS::TOUCH_STATISTICS, Parameters("rotation", string(rotations[r])));
+		const double creationDuration(t.elapsed());
+		
+		double duration(0);
+		double visitCount(0);
+		for (int i = 0; i < searchCount; ++i)
+		{
+			t.restart();
+			visitCount += double(nns->knn(q, indices, dists2, K, 0, 0));
+			duration += t.elapsed();
+		}
+		cout << rotations[r] << " " << creationDuration << " " << duration/double(searchCount) << " " << visitCount/double(searchCount)/double(q.cols()) << endl;
+		
+		delete nns;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc != 5 && argc != 6)
+	{
+		cerr << "Usage " << argv[0] << " DATA K METHOD SEARCH_COUNT [YAW]" << endl;
+		cerr << "  YAW: angle in degrees by which the cloud is turned around its vertical axis before indexing, defaults to 30" << endl;
+		return 1;
+	}
+	
+	const int K(atoi(argv[2]));
+	const int method(atoi(argv[3]));
+	const int searchCount(atoi(argv[4]));
+	const double yaw((argc == 6 ? atof(argv[5]) : 30.) * M_PI / 180.);
+	
+	cout << "rotation creation_duration average_duration visits_per_query\n";
+	doTestRotation<float>(argv[1], K, method, searchCount, float(yaw));
+	
+	return 0;
+}
@@ -0,0 +1,273 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "server/server.h"
+#include "server/client.h"
+#include "server/protocol.h"
+#include "helpers.h"
+#include <iostream>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+using namespace Nabo;
+
+typedef NearestNeighbourSearch<float> NNS;
+typedef NNS::Matrix Matrix;
+typedef NNS::IndexMatrix IndexMatrix;
+
+SearchServer* server(0);
+
+// Stop the server on SIGTERM
+void stopServer(int)
+{
+	if (server)
+		server->stop();
+}
+
+// Send requests of various sizes, k and radii to the server and compare the results to a local search
+bool runClient(const char* socketPath, const Matrix& d, const int K, const int requestCount, const int seed)
+{
+	srand(seed);
+	NNS* nns = NNS::createKDTreeLinearHeap(d);
+	SearchClient client(socketPath);
+	if (client.getDim() != d.rows() || client.getPointCount() != d.cols())
+	{
+		cerr << "Server announced a cloud of " << client.getPointCount() << " points in " << client.getDim() << " dimensions instead of " << d.cols() << " in " << d.rows() << endl;
+		delete nns;
+		return false;
+	}
+	
+	bool ok(true);
+	for (int r = 0; r < requestCount && ok; ++r)
+	{
+		const int queryCount(1 + rand() % 64);
+		const int k(1 + rand() % K);
+		const float maxRadius(r % 3 == 0 ? 0.5f : numeric_limits<float>::infinity());
+		const unsigned optionFlags(r % 2 == 0 ? unsigned(NNS::SORT_RESULTS) : 0);
+		Matrix q(d.rows(), queryCount);
+		for (int i = 0; i < queryCount; ++i)
+			q.col(i) = createQuery<float>(d, *nns, i, 0);
+		
+		IndexMatrix indices, localIndices(k, queryCount);
+		Matrix dists2, localDists2(k, queryCount);
+		client.knn(q, indices, dists2, k, 0, optionFlags, maxRadius);
+		nns->knn(q, localIndices, localDists2, k, 0, optionFlags, maxRadius);
+		if (indices != localIndices || dists2 != localDists2)
+		{
+			cerr << "Client " << seed << ", request " << r << " (" << queryCount << " queries, k = " << k << ", radius " << maxRadius << "): results differ from local search" << endl;
+			ok = false;
+		}
+		
+		// errors are reported without closing the connection
+		if (r % 10 == 0)
+		{
+			try
+			{
+				client.knn(q, indices, dists2, d.cols() + 1);
+				cerr << "Client " << seed << ": requesting more neighbours than points did not fail" << endl;
+				ok = false;
+			}
+			catch (const runtime_error&)
+			{
+			}
+		}
+	}
+	delete nns;
+	return ok;
+}
+
+// Connect a raw socket to the server and read its hello, return -1 on failure
+int connectRaw(const char* socketPath)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	const int sock(socket(AF_UNIX, SOCK_STREAM, 0));
+	// do not wait forever for a server that stopped answering
+	struct timeval timeout = { 10, 0 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	Protocol::Hello hello;
+	if (sock < 0 || connect(sock, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+		recv(sock, &hello, sizeof(hello), MSG_WAITALL) != ssize_t(sizeof(hello)))
+		return -1;
+	return sock;
+}
+
+// Send a request for the first point of d with k neighbours, bypassing the checks of the client
+bool sendRawRequest(const int sock, const Matrix& d, const uint32_t k)
+{
+	Protocol::RequestHeader header;
+	header.magic = Protocol::MAGIC;
+	header.queryCount = 1;
+	header.k = k;
+	header.optionFlags = 0;
+	header.epsilon = 0;
+	header.maxRadius = numeric_limits<float>::infinity();
+	return send(sock, &header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+		send(sock, d.data(), d.rows() * sizeof(float), 0) == ssize_t(d.rows() * sizeof(float));
+}
+
+// Send invalid requests, which must be answered with errors without disturbing the server,
+// and requests from connections closed right away, whose responses must not reach the clients reusing their sockets
+bool runRawClient(const char* socketPath, const Matrix& d, const int K, const int requestCount)
+{
+	const uint32_t invalidKs[3] = { 0xFFFFFFFF, Protocol::MAX_K + 1, uint32_t(d.cols()) };
+	for (int i = 0; i < 3; ++i)
+	{
+		const int sock(connectRaw(socketPath));
+		Protocol::ResponseHeader response;
+		if (sock < 0 || !sendRawRequest(sock, d, invalidKs[i]) ||
+			recv(sock, &response, sizeof(response), MSG_WAITALL) != ssize_t(sizeof(response)) ||
+			response.magic != Protocol::MAGIC || response.errorLength == 0)
+		{
+			cerr << "Raw client: request with k = " << invalidKs[i] << " did not get an error response" << endl;
+			return false;
+		}
+		close(sock);
+	}
+	
+	for (int r = 0; r < requestCount; ++r)
+	{
+		const int sock(connectRaw(socketPath));
+		if (sock < 0 || !sendRawRequest(sock, d, K))
+		{
+			cerr << "Raw client: cannot send request " << r << endl;
+			return false;
+		}
+		close(sock);
+		if (!runClient(socketPath, d, K, 2, 1000 + r))
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		cerr << "Usage " << argv[0] << " DATA K CLIENT_COUNT REQUEST_COUNT" << endl;
+		return 1;
+	}
+	
+	const Matrix d(load<float>(argv[1]));
+	const int K(atoi(argv[2]));
+	const int clientCount(atoi(argv[3]));
+	const int requestCount(atoi(argv[4]));
+	if (K >= d.cols())
+	{
+		cerr << "Requested more nearest neighbour than points in the data set" << endl;
+		return 2;
+	}
+	
+	// listen before forking, so that clients can connect right away
+	const string socketPath((boost::format("/tmp/nabo-test-%1%.sock") % getpid()).str());
+	server = new SearchServer(d, socketPath);
+	const pid_t serverPid(fork());
+	if (serverPid == 0)
+	{
+		signal(SIGTERM, stopServer);
+		server->serve();
+		const SearchServer::Statistics& statistics(server->getStatistics());
+		cout << "Server answered " << statistics.requestCount << " requests of " << statistics.queryCount << " queries in " << statistics.batchCount << " searches" << endl;
+		_exit(0);
+	}
+	
+	vector<pid_t> clientPids;
+	for (int c = 0; c < clientCount; ++c)
+	{
+		const pid_t pid(fork());
+		if (pid == 0)
+		{
+			bool ok(false);
+			try
+			{
+				ok = runClient(socketPath.c_str(), d, K, requestCount, c + 1);
+			}
+			catch (const exception& e)
+			{
+				cerr << "Client " << c + 1 << " error: " << e.what() << endl;
+			}
+			_exit(ok ? 0 : 1);
+		}
+		clientPids.push_back(pid);
+	}
+	const pid_t rawPid(fork());
+	if (rawPid == 0)
+	{
+		bool ok(false);
+		try
+		{
+			ok = runRawClient(socketPath.c_str(), d, K, requestCount);
+		}
+		catch (const exception& e)
+		{
+			cerr << "Raw client error: " << e.what() << endl;
+		}
+		_exit(ok ? 0 : 1);
+	}
+	clientPids.push_back(rawPid);
+	
+	int failedCount(0);
+	for (size_t c = 0; c < clientPids.size(); ++c)
+	{
+		int status;
+		waitpid(clientPids[c], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++failedCount;
+	}
+	kill(serverPid, SIGTERM);
+	int status;
+	waitpid(serverPid, &status, 0);
+	delete server;
+	
+	if (failedCount > 0)
+	{
+		cerr << failedCount << " of " << clientPids.size() << " clients failed" << endl;
+		return 3;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		cerr << "Server did not stop cleanly" << endl;
+		return 4;
+	}
+	cout << clientCount << " clients got the same results as a local search" << endl;
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+
+Copyright (c) 2010--2011, Stephane Magnenat, ASL, ETHZ, Switzerland
+You can contact the author at <stephane at magnenat dot net>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETH-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "nabo/nabo.h"
+#include "helpers.h"
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+using namespace Nabo;
+
+// number of random queries per cloud of the set
+const int QUERY_COUNT = 20;
+
+// return whether squared distances a and b are equal up to rounding errors
+template<typename T>
+bool sameDist2(const T a, const T b)
+{
+	if (a == b)
+		return true;
+	return fabs(a - b) <= 1e-5 * max(fabs(a), fabs(b));
+}
+
+// compare the results of a search of the set with those of a brute-force search
+template<typename T>
+bool checkResults(const typename NearestNeighbourSearch<T>::Matrix& cloud, const typename NearestNeighbourSearch<T>::Matrix& q, const typename NearestNeighbourSearch<T>::IndexMatrix& indices, const typename NearestNeighbourSearch<T>::Matrix& dists2, const typename NearestNeighbourSearch<T>::Matrix& bfDists2, const int cloudIndex, const char* what)
+{
+	for (int i = 0; i < q.cols(); ++i)
+	{
+		for (int j = 0; j < indices.rows(); ++j)
+		{
+			// both searches found less than k points within the radius
+			if (dists2(j, i) == numeric_limits<T>::infinity() && bfDists2(j, i) == numeric_limits<T>::infinity())
+				continue;
+			const T dist2((cloud.col(indices(j, i)) - q.col(i)).squaredNorm());
+			if (!sameDist2(dist2, dists2(j, i)) || !sameDist2(bfDists2(j, i), dists2(j, i)))
+			{
+				cerr << "Cloud " << cloudIndex << ", " << what << " query " << i << ": neighbour " << j << " is at squared distance " << dists2(j, i) << " (point " << indices(j, i) << " at " << dist2 << ") instead of " << bfDists2(j, i) << endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+template<typename T>
+bool testSet(const char *fileName, const int K, const int maxCloudSize)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef Nabo::NearestNeighbourSearchSet<T> NNSSet;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	// split the cloud in consecutive clouds of varying sizes, down to a single point
+	const Matrix d(load<T>(fileName));
+	vector<Matrix> clouds;
+	for (int first = 0; first < d.cols(); )
+	{
+		const int size(min(1 + int(clouds.size() * 7919) % maxCloudSize, int(d.cols()) - first));
+		clouds.push_back(d.block(0, first, d.rows(), size));
+		first += size;
+	}
+	
+	boost::timer t;
+	NNSSet* set(NNSSet::create(clouds, d.rows(), 0, Parameters("bucketSize", 4u)));
+	cout << "Set of " << set->getSearchCount() << " kd-trees built in " << t.elapsed() << " s, arena of " << set->getArenaSize() << " bytes" << endl;
+	if (set->getSearchCount() != int(clouds.size()))
+	{
+		cerr << "Set has " << set->getSearchCount() << " searches instead of " << clouds.size() << endl;
+		return false;
+	}
+	
+	// the trees share the arena
+	size_t memory(0);
+	for (size_t c = 0; c < clouds.size(); ++c)
+		memory += set->getSearch(c).memoryUsage();
+	if (memory != set->getArenaSize())
+	{
+		cerr << "Searches use " << memory << " bytes, but the arena has " << set->getArenaSize() << " bytes" << endl;
+		return false;
+	}
+	
+	for (size_t c = 0; c < clouds.size(); ++c)
+	{
+		const Matrix& cloud(clouds[c]);
+		const NNS& search(set->getSearch(c));
+		NNS* bruteForce(NNS::createBruteForce(cloud));
+		
+		// random queries within the bounds of the cloud
+		const Matrix q(createQuery<T>(cloud, QUERY_COUNT, 1));
+		const int k(min(K, int(cloud.cols())));
+		IndexMatrix bfIndices(k, q.cols()), indices(k, q.cols());
+		Matrix bfDists2(k, q.cols()), dists2(k, q.cols());
+		bruteForce->knn(q, bfIndices, bfDists2, k, 0, NNS::SORT_RESULTS | NNS::ALLOW_SELF_MATCH);
+		search.knn(q, indices, dists2, k, 0, NNS::SORT_RESULTS | NNS::ALLOW_SELF_MATCH);
+		if (!checkResults<T>(cloud, q, indices, dists2, bfDists2, c, "random"))
+			return false;
+		
+		// the points of the cloud themselves, excluding self matches and within a radius
+		const int selfK(min(K, int(cloud.cols()) - 1));
+		if (selfK > 0)
+		{
+			const T maxRadius(sqrt((search.maxBound - search.minBound).squaredNorm()) / 4);
+			IndexMatrix bfSelfIndices(selfK, cloud.cols()), selfIndices(selfK, cloud.cols());
+			Matrix bfSelfDists2(selfK, cloud.cols()), selfDists2(selfK, cloud.cols());
+			bruteForce->knn(cloud, bfSelfIndices, bfSelfDists2, selfK, 0, NNS::SORT_RESULTS, maxRadius);
+			search.knn(cloud, selfIndices, selfDists2, selfK, 0, NNS::SORT_RESULTS, maxRadius);
+			if (!checkResults<T>(cloud, cloud, selfIndices, selfDists2, bfSelfDists2, c, "self"))
+				return false;
+		}
+		delete bruteForce;
+	}
+	
+	delete set;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		cerr << "Usage " << argv[0] << " DATA K MAX_CLOUD_SIZE" << endl;
+		return 1;
+	}
+	
+	const int K(atoi(argv[2]));
+	const int maxCloudSize(atoi(argv[3]));
+	
+	if (!testSet<float>(argv[1], K, maxCloudSize))
+		return 1;
+	if (!testSet<double>(argv[1], K, maxCloudSize))
+		return 1;
+	
+	return 0;
+}
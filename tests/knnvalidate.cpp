@@ -35,10 +35,35 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <functional>
 
 using namespace std;
 using namespace Nabo;
 
+//! Return whether searchType can be created in this build
+template<typename NNS>
+bool isAvailable(const typename NNS::SearchType searchType)
+{
+	#ifndef HAVE_OPENCL
+	if ((searchType == NNS::KDTREE_CL_PT_IN_NODES) ||
+		(searchType == NNS::KDTREE_CL_PT_IN_LEAVES) ||
+		(searchType == NNS::BRUTE_FORCE_CL))
+		return false;
+	#endif // HAVE_OPENCL
+	// CUDA support is not finished
+	if (searchType == NNS::KDTREE_CUDA_CLUSTERED)
+		return false;
+	return true;
+}
+
+//! Return whether searchType returns the exact nearest neighbours
+template<typename NNS>
+bool isExact(const typename NNS::SearchType searchType)
+{
+	return searchType != NNS::LSH;
+}
+
 template<typename T>
 void validate(const char *fileName, const int K, const int method, const T maxRadius)
 {
@@ -60,12 +85,17 @@ void validate(const char *fileName, const int K, const int method, const T maxRa
 	
 	// create different methods
 	NNSV nnss;
-	unsigned searchTypeCount(NNS::SEARCH_TYPE_COUNT);
-	#ifndef HAVE_OPENCL
-	searchTypeCount -= 3;
-	#endif // HAVE_OPENCL
-	for (unsigned i = 0; i < searchTypeCount; ++i)
-		nnss.push_back(NNS::create(d, d.rows(), typename NNS::SearchType(i)));
+	vector<typename NNS::SearchType> searchTypes;
+	vector<bool> exacts;
+	for (unsigned i = 0; i < NNS::SEARCH_TYPE_COUNT; ++i)
+	{
+		const typename NNS::SearchType searchType = typename NNS::SearchType(i);
+		if (!isAvailable<NNS>(searchType))
+			continue;
+		nnss.push_back(NNS::create(d, d.rows(), searchType));
+		searchTypes.push_back(searchType);
+		exacts.push_back(isExact<NNS>(searchType));
+	}
 	//nnss.push_back(new KDTreeBalancedPtInLeavesStack<T>(d, false));
 	
 	
@@ -152,6 +182,18 @@ void validate(const char *fileName, const int K, const int method, const T maxRa
 				}
 				const Vector pkdtree(d.col(pkdt));
 				const Vector pq(q.col(i));
+				// approximate searches must return correct distances, never smaller than the exact ones
+				if (!exacts[j])
+				{
+					if ((dists2_kdtree(k,i) != numeric_limits<T>::infinity()) &&
+						((fabsf(dists2_kdtree(k,i) - (pkdtree-pq).squaredNorm()) > numeric_limits<float>::epsilon()) ||
+						(dists2_kdtree(k,i) < dists2_bf(k,i) - numeric_limits<float>::epsilon())))
+					{
+						cerr << "Method " << j << ", query point " << i << ", neighbour " << k << " of " << K << " has distance " << dists2_kdtree(k,i) << " inconsistent with index " << pkdt << " or smaller than brute force (" << dists2_bf(k,i) << ")" << endl;
+						exit(4);
+					}
+					continue;
+				}
 				const float distDiff(fabsf((pbf-pq).squaredNorm() - (pkdtree-pq).squaredNorm()));
 				if (distDiff > numeric_limits<float>::epsilon())
 				{
@@ -176,6 +218,40 @@ void validate(const char *fileName, const int K, const int method, const T maxRa
 		}
 	}
 	
+	// check that cursors yield the brute-force neighbours in the same order
+	for (size_t j = 1; j < nnss.size(); ++j)
+	{
+		if ((searchTypes[j] != NNS::KDTREE_LINEAR_HEAP) && (searchTypes[j] != NNS::KDTREE_TREE_HEAP))
+			continue;
+		for (int i = 0; i < q.cols(); ++i)
+		{
+			const Vector pq(q.col(i));
+			typename NNS::Cursor* cursor(nnss[j]->createCursor(pq, 0, maxRadius));
+			for (int k = 0; k < K; ++k)
+			{
+				Index index;
+				T dist2;
+				const bool found(cursor->next(index, dist2));
+				if (dists2_bf(k,i) == numeric_limits<T>::infinity())
+				{
+					if (found)
+					{
+						cerr << "Method " << j << ", cursor of query point " << i << " yields neighbour " << k << " outside of maximum radius" << endl;
+						exit(6);
+					}
+					break;
+				}
+				if (!found || (index < 0) || (index >= d.cols()) ||
+					(fabsf((d.col(indexes_bf(k,i))-pq).squaredNorm() - (d.col(index)-pq).squaredNorm()) > numeric_limits<float>::epsilon()))
+				{
+					cerr << "Method " << j << ", cursor of query point " << i << ", neighbour " << k << " of " << K << " is different between bf and cursor" << endl;
+					exit(6);
+				}
+			}
+			delete cursor;
+		}
+	}
+	
 // 	cout << "\tstats kdtree: "
 // 		<< kdt.getStatistics().totalVisitCount << " on "
 // 		<< (long long)(itCount) * (long long)(d.cols()) << " ("
@@ -187,6 +263,693 @@ void validate(const char *fileName, const int K, const int method, const T maxRa
 		delete (*it);
 }
 
+//! Validate inner-product and cosine similarity search of all search types against a naive search
+template<typename T>
+void validateSimilarity(const char *fileName, const int K, const int method)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	// the naive search is quadratic, limit the number of queries
+	const int itCount(min(method != -1 ? method : int(d.cols()) * 2, 1000));
+	const Matrix q(createQuery<T>(d, itCount, method));
+	
+	const unsigned modes[2] = { NNS::INNER_PRODUCT, NNS::COSINE };
+	for (int m = 0; m < 2; ++m)
+	{
+		const bool cosine(modes[m] == NNS::COSINE);
+		Matrix nd(d);
+		Matrix nq(q);
+		if (cosine)
+		{
+			for (int i = 0; i < nd.cols(); ++i)
+				nd.col(i).normalize();
+			for (int i = 0; i < nq.cols(); ++i)
+				nq.col(i).normalize();
+		}
+		const Matrix similarities(nd.transpose() * nq);
+		const T maxNorm(nd.colwise().norm().maxCoeff());
+		
+		for (unsigned t = 0; t < NNS::SEARCH_TYPE_COUNT; ++t)
+		{
+			const typename NNS::SearchType searchType = typename NNS::SearchType(t);
+			if (!isAvailable<NNS>(searchType) || !isExact<NNS>(searchType))
+				continue;
+			NNS* nns(NNS::create(d, d.rows(), searchType, modes[m]));
+			IndexMatrix indices(K, q.cols());
+			Matrix sims(K, q.cols());
+			nns->knn(q, indices, sims, K, 0, NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS);
+			for (int i = 0; i < q.cols(); ++i)
+			{
+				vector<T> expected(similarities.col(i).data(), similarities.col(i).data() + d.cols());
+				partial_sort(expected.begin(), expected.begin() + K, expected.end(), greater<T>());
+				const T tolerance(T(1e-4) * (cosine ? T(1) : maxNorm * nq.col(i).norm()));
+				for (int k = 0; k < K; ++k)
+				{
+					const int index(indices(k, i));
+					if (index < 0 || index >= d.cols() ||
+						fabs(sims(k, i) - expected[k]) > tolerance ||
+						fabs(sims(k, i) - similarities(index, i)) > tolerance)
+					{
+						cerr << "Method " << t << (cosine ? ", cosine" : ", inner product") << ", query point " << i << ", neighbour " << k << " of " << K << " has index " << index << " and similarity " << sims(k, i) << " instead of " << expected[k] << endl;
+						exit(4);
+					}
+				}
+			}
+			delete nns;
+		}
+	}
+}
+
+//! Validate segment search of the kd-trees against a naive search
+template<typename T>
+void validateSegments(const char *fileName, const int method)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::Index Index;
+	
+	const Matrix d(load<T>(fileName));
+	const int dim(d.rows());
+	// the naive search is quadratic, limit the number of segments; every tenth is degenerated to a point
+	const int segmentCount(min(method != -1 ? method : int(d.cols()) * 2, 200));
+	Matrix origins(dim, segmentCount);
+	Matrix ends(dim, segmentCount);
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		origins.col(i) = d.col(rand() % d.cols());
+		if (i % 10 == 0)
+			ends.col(i) = origins.col(i);
+		else
+			ends.col(i) = d.col(rand() % d.cols());
+	}
+	T extent(0);
+	for (int k = 0; k < dim; ++k)
+		extent = max(extent, d.row(k).maxCoeff() - d.row(k).minCoeff());
+	const T radius(extent / 100);
+	
+	const typename NNS::SearchType searchTypes[2] = { NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP };
+	for (int t = 0; t < 2; ++t)
+	{
+		NNS* nns(NNS::create(d, dim, searchTypes[t]));
+		typename NNS::SegmentMatchesVector matches;
+		nns->findNearSegments(origins, ends, matches, radius);
+		for (int i = 0; i < segmentCount; ++i)
+		{
+			// naive search, with the same computations
+			vector<pair<T, Index> > expected;
+			const typename NNS::Vector direction(ends.col(i) - origins.col(i));
+			const T directionNorm2(direction.squaredNorm());
+			for (int j = 0; j < d.cols(); ++j)
+			{
+				T dot(0);
+				for (int k = 0; k < dim; ++k)
+					dot += (d(k, j) - origins(k, i)) * direction[k];
+				const T position(directionNorm2 > 0 ? max(T(0), min(T(1), dot / directionNorm2)) : T(0));
+				T dist(0);
+				for (int k = 0; k < dim; ++k)
+				{
+					const T diff(d(k, j) - origins(k, i) - position * direction[k]);
+					dist += diff*diff;
+				}
+				if (dist <= radius * radius)
+					expected.push_back(make_pair(position, j));
+			}
+			const typename NNS::SegmentMatches& m(matches[i]);
+			vector<pair<T, Index> > found;
+			bool ok(true);
+			for (int j = 0; j < m.indices.size(); ++j)
+			{
+				found.push_back(make_pair(m.positions[j], m.indices[j]));
+				ok = ok && (j == 0 || m.positions[j] >= m.positions[j-1]);
+			}
+			sort(found.begin(), found.end());
+			sort(expected.begin(), expected.end());
+			if (!ok || found != expected)
+			{
+				cerr << "Method " << searchTypes[t] << ", segment " << i << " has " << m.indices.size() << " points instead of " << expected.size() << ", or wrong or unsorted ones" << endl;
+				exit(7);
+			}
+		}
+		delete nns;
+	}
+}
+
+//! Validate the kd-trees in periodic domains against a naive search with wrapped distances
+template<typename T>
+void validatePeriodic(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::Vector Vector;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	// move the cloud into [0, size[, with some space left before wrapping around
+	Matrix d(load<T>(fileName));
+	const int dim(d.rows());
+	Vector box(dim);
+	for (int k = 0; k < dim; ++k)
+	{
+		const T minVal(d.row(k).minCoeff());
+		d.row(k).array() -= minVal;
+		box[k] = d.row(k).maxCoeff() * T(1.05) + T(1e-3);
+	}
+	// the naive search is quadratic, limit the number of queries
+	const int itCount(min(method != -1 ? method : int(d.cols()) * 2, 1000));
+	Matrix q(createQuery<T>(d, itCount, method));
+	// move some queries out of the domain, they must be wrapped
+	for (int i = 0; i < q.cols(); ++i)
+		q(0, i) += box[0] * T(i % 3 - 1);
+	
+	// all dimensions periodic, then only the first one
+	for (int p = 0; p < 2; ++p)
+	{
+		Vector periodicBox(box);
+		if (p == 1)
+			periodicBox.segment(1, dim - 1).setZero();
+		
+		// naive search
+		Matrix expected(K, q.cols());
+		for (int i = 0; i < q.cols(); ++i)
+		{
+			vector<T> dists2(d.cols());
+			for (int j = 0; j < d.cols(); ++j)
+			{
+				T dist(0);
+				for (int k = 0; k < dim; ++k)
+				{
+					T diff(q(k, i) - d(k, j));
+					if (periodicBox[k] > 0)
+					{
+						diff = fabs(diff - floor(diff / periodicBox[k]) * periodicBox[k]);
+						diff = min(diff, periodicBox[k] - diff);
+					}
+					dist += diff*diff;
+				}
+				dists2[j] = dist;
+			}
+			partial_sort(dists2.begin(), dists2.begin() + K, dists2.end());
+			for (int k = 0; k < K; ++k)
+				expected(k, i) = dists2[k] <= maxRadius * maxRadius ? dists2[k] : numeric_limits<T>::infinity();
+		}
+		
+		const typename NNS::SearchType searchTypes[2] = { NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP };
+		for (int t = 0; t < 2; ++t)
+		{
+			NNS* nns(NNS::create(d, dim, searchTypes[t], 0, Parameters("periodicBox", periodicBox)));
+			IndexMatrix indices(K, q.cols());
+			Matrix dists2(K, q.cols());
+			nns->knn(q, indices, dists2, K, 0, NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS, maxRadius);
+			for (int i = 0; i < q.cols(); ++i)
+			{
+				for (int k = 0; k < K; ++k)
+				{
+					const T tolerance(T(1e-4) * (T(1) + expected(k, i)));
+					if ((expected(k, i) == numeric_limits<T>::infinity()) ?
+						(dists2(k, i) != numeric_limits<T>::infinity()) :
+						(fabs(dists2(k, i) - expected(k, i)) > tolerance))
+					{
+						cerr << "Method " << searchTypes[t] << ", periodic box " << p << ", query point " << i << ", neighbour " << k << " of " << K << " has squared distance " << dists2(k, i) << " instead of " << expected(k, i) << endl;
+						exit(5);
+					}
+				}
+			}
+			
+			// cursors must yield the same distances in the same order
+			for (int i = 0; i < q.cols(); ++i)
+			{
+				typename NNS::Cursor* cursor(nns->createCursor(q.col(i), NNS::ALLOW_SELF_MATCH, maxRadius));
+				for (int k = 0; k < K; ++k)
+				{
+					typename NNS::Index index;
+					T dist2;
+					const bool found(cursor->next(index, dist2));
+					if ((found != (expected(k, i) != numeric_limits<T>::infinity())) ||
+						(found && fabs(dist2 - expected(k, i)) > T(1e-4) * (T(1) + expected(k, i))))
+					{
+						cerr << "Method " << searchTypes[t] << ", periodic box " << p << ", cursor of query point " << i << ", neighbour " << k << " of " << K << " has squared distance " << dist2 << " instead of " << expected(k, i) << endl;
+						exit(6);
+					}
+				}
+				delete cursor;
+			}
+			delete nns;
+		}
+	}
+}
+
+//! Validate the kd-trees with compact leaf storage against the kd-trees reading the cloud, results must be identical
+template<typename T>
+void validateLeafStorage(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	const int itCount(method != -1 ? method : d.cols() * 2);
+	const Matrix q(createQuery<T>(d, itCount, method));
+	
+	const typename NNS::SearchType searchTypes[2] = { NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP };
+	for (int t = 0; t < 2; ++t)
+	{
+		NNS* reference(NNS::create(d, d.rows(), searchTypes[t]));
+		IndexMatrix expectedIndices(K, q.cols());
+		Matrix expectedDists2(K, q.cols());
+		reference->knn(q, expectedIndices, expectedDists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+		delete reference;
+		
+		// half precision, then bfloat16
+		for (unsigned leafStorage = 1; leafStorage <= 2; ++leafStorage)
+		{
+			NNS* nns(NNS::create(d, d.rows(), searchTypes[t], 0, Parameters("leafStorage", leafStorage)));
+			IndexMatrix indices(K, q.cols());
+			Matrix dists2(K, q.cols());
+			nns->knn(q, indices, dists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+			for (int i = 0; i < q.cols(); ++i)
+			{
+				for (int k = 0; k < K; ++k)
+				{
+					if (indices(k, i) != expectedIndices(k, i) || dists2(k, i) != expectedDists2(k, i))
+					{
+						cerr << "Method " << searchTypes[t] << ", leaf storage " << leafStorage << ", query point " << i << ", neighbour " << k << " of " << K << " is point " << indices(k, i) << " at squared distance " << dists2(k, i) << " instead of point " << expectedIndices(k, i) << " at " << expectedDists2(k, i) << endl;
+						exit(8);
+					}
+				}
+			}
+			delete nns;
+		}
+	}
+}
+
+//! Return the squared distances to the K nearest neighbours of q in d, using cpu kernels kernelSet, or an empty matrix if they are not supported
+template<typename T>
+typename NearestNeighbourSearch<T>::Matrix knnWithCpuKernels(const typename NearestNeighbourSearch<T>::Matrix& d, const typename NearestNeighbourSearch<T>::Matrix& q, const int K, const T maxRadius, const typename NearestNeighbourSearch<T>::SearchType searchType, const string& kernelSet)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	NNS* nns;
+	try
+	{
+		nns = NNS::create(d, d.rows(), searchType, 0, Parameters("cpuKernels", kernelSet));
+	}
+	catch (const runtime_error&)
+	{
+		return typename NNS::Matrix();
+	}
+	typename NNS::IndexMatrix indices(K, q.cols());
+	typename NNS::Matrix dists2(K, q.cols());
+	nns->knn(q, indices, dists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+	delete nns;
+	return dists2;
+}
+
+//! Check that squared distances found with cpu kernels kernelSet match the expected ones up to rounding
+template<typename T>
+void checkCpuKernelDists2(const typename NearestNeighbourSearch<T>::Matrix& dists2, const typename NearestNeighbourSearch<T>::Matrix& expected, const typename NearestNeighbourSearch<T>::SearchType searchType, const string& kernelSet)
+{
+	for (int i = 0; i < expected.cols(); ++i)
+	{
+		for (int k = 0; k < expected.rows(); ++k)
+		{
+			const T expectedDist2(expected(k, i));
+			if (expectedDist2 == numeric_limits<T>::infinity() ?
+				dists2(k, i) != expectedDist2 :
+				fabs(dists2(k, i) - expectedDist2) > 16 * numeric_limits<T>::epsilon() * expectedDist2)
+			{
+				cerr << "Method " << searchType << ", cpu kernels " << kernelSet << ", query point " << i << ", neighbour " << k << " of " << expected.rows() << " is at squared distance " << dists2(k, i) << " instead of " << expectedDist2 << endl;
+				exit(9);
+			}
+		}
+	}
+}
+
+//! Validate every cpu kernel set supported by the running CPU against the scalar one
+template<typename T>
+void validateCpuKernels(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	
+	const Matrix d(load<T>(fileName));
+	const int itCount(min(method != -1 ? method : int(d.cols()) * 2, 1000));
+	const Matrix q(createQuery<T>(d, itCount, method));
+	// replicate and scale the coordinates to reach the dimensions where the kd-trees use the kernels as well
+	const int wideDim(32);
+	Matrix wideD(wideDim, d.cols());
+	Matrix wideQ(wideDim, q.cols());
+	for (int r = 0; r < wideDim; ++r)
+	{
+		const T scale(T(1) / T(1 + r));
+		wideD.row(r) = d.row(r % d.rows()) * scale;
+		wideQ.row(r) = q.row(r % q.rows()) * scale;
+	}
+	
+	const string kernelSets[4] = { "sse4.2", "avx2", "avx512", "neon" };
+	const typename NNS::SearchType searchTypes[2] = { NNS::BRUTE_FORCE, NNS::KDTREE_LINEAR_HEAP };
+	for (int t = 0; t < 2; ++t)
+	{
+		const Matrix expected(knnWithCpuKernels<T>(d, q, K, maxRadius, searchTypes[t], "scalar"));
+		const Matrix wideExpected(knnWithCpuKernels<T>(wideD, wideQ, K, maxRadius, searchTypes[t], "scalar"));
+		for (int s = 0; s < 4; ++s)
+		{
+			// kernels only differ by rounding, for instance because they use fused multiply-add
+			const Matrix dists2(knnWithCpuKernels<T>(d, q, K, maxRadius, searchTypes[t], kernelSets[s]));
+			if (dists2.size() == 0)
+				continue;
+			checkCpuKernelDists2<T>(dists2, expected, searchTypes[t], kernelSets[s]);
+			checkCpuKernelDists2<T>(knnWithCpuKernels<T>(wideD, wideQ, K, maxRadius, searchTypes[t], kernelSets[s]), wideExpected, searchTypes[t], kernelSets[s]);
+			cout << "Method " << searchTypes[t] << ": cpu kernels " << kernelSets[s] << " validated" << endl;
+		}
+	}
+}
+
+//! Validate queries of scalar type U against a search on T, results must be identical to those of queries converted beforehand
+template<typename T, typename U>
+void validateOtherScalarQuery(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	typedef typename NNS::Vector Vector;
+	typedef typename Nabo::NearestNeighbourSearch<U>::Matrix OtherMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	const int itCount(method != -1 ? method : d.cols() * 2);
+	const OtherMatrix q(createQuery<U>(load<U>(fileName), itCount, method));
+	const Matrix convertedQ(q.template cast<T>());
+	
+	const typename NNS::SearchType searchTypes[2] = { NNS::BRUTE_FORCE, NNS::KDTREE_LINEAR_HEAP };
+	for (int t = 0; t < 2; ++t)
+	{
+		NNS* nns(NNS::create(d, d.rows(), searchTypes[t]));
+		// with the scalar maximum radius, then with per-query radii, every third one being halved
+		Vector maxRadii(Vector::Constant(q.cols(), maxRadius));
+		for (int i = 0; i < q.cols(); i += 3)
+			maxRadii(i) /= 2;
+		for (int r = 0; r < 2; ++r)
+		{
+			IndexMatrix expectedIndices(K, q.cols());
+			Matrix expectedDists2(K, q.cols());
+			IndexMatrix indices(K, q.cols());
+			Matrix dists2(K, q.cols());
+			if (r == 0)
+			{
+				nns->knn(convertedQ, expectedIndices, expectedDists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+				nns->knn(q, indices, dists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+			}
+			else
+			{
+				nns->knn(convertedQ, expectedIndices, expectedDists2, maxRadii, K, 0, NNS::SORT_RESULTS);
+				nns->knn(q, indices, dists2, maxRadii, K, 0, NNS::SORT_RESULTS);
+			}
+			for (int i = 0; i < q.cols(); ++i)
+			{
+				for (int k = 0; k < K; ++k)
+				{
+					if (indices(k, i) != expectedIndices(k, i) || dists2(k, i) != expectedDists2(k, i))
+					{
+						cerr << "Method " << searchTypes[t] << (r == 0 ? "" : " with per-query radii") << ", query point " << i << " of another scalar type, neighbour " << k << " of " << K << " is point " << indices(k, i) << " at squared distance " << dists2(k, i) << " instead of point " << expectedIndices(k, i) << " at " << expectedDists2(k, i) << endl;
+						exit(10);
+					}
+				}
+			}
+		}
+		delete nns;
+	}
+}
+
+//! Validate the consistency of the construction statistics of kd-trees, with and without compact leaf storage and timing of phases
+template<typename T>
+void validateBuildStatistics(const char *fileName)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::BuildStatistics BuildStatistics;
+	
+	const Matrix d(load<T>(fileName));
+	for (unsigned leafStorage = 0; leafStorage <= 1; ++leafStorage)
+	{
+		for (unsigned creationOptionFlags = 0; creationOptionFlags <= NNS::TOUCH_STATISTICS; creationOptionFlags += NNS::TOUCH_STATISTICS)
+		{
+			NNS* nns(NNS::create(d, d.rows(), NNS::KDTREE_LINEAR_HEAP, creationOptionFlags, Parameters("leafStorage", leafStorage)));
+			const BuildStatistics s(nns->getBuildStatistics());
+			delete nns;
+			// every point is in a bucket entry holding a pointer, and phases are nested in the construction
+			const bool timed(creationOptionFlags & NNS::TOUCH_STATISTICS);
+			if (s.memory < size_t(d.cols()) * sizeof(T*) ||
+				s.peakBuildMemory < s.memory ||
+				s.boundsDuration + s.treeDuration + s.reorderingDuration > s.totalDuration ||
+				s.partitionDuration + s.nodeEmissionDuration > s.treeDuration ||
+				(timed != (s.partitionDuration > 0)) ||
+				((leafStorage != 0) != (s.reorderingDuration > 0)))
+			{
+				cerr << "Inconsistent build statistics with leaf storage " << leafStorage << " and creation options " << creationOptionFlags << ": bounds " << s.boundsDuration << ", tree " << s.treeDuration << " (partition " << s.partitionDuration << ", node emission " << s.nodeEmissionDuration << "), reordering " << s.reorderingDuration << ", total " << s.totalDuration << ", peak memory " << s.peakBuildMemory << ", memory " << s.memory << endl;
+				exit(11);
+			}
+		}
+	}
+}
+
+//! Validate that memory estimations match the memory of the built searches, exactly for balanced structures and closely for kd-trees
+template<typename T>
+void validateMemory(const char *fileName)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::MemoryEstimate MemoryEstimate;
+	
+	const Matrix d(load<T>(fileName));
+	const typename NNS::SearchType searchTypes[] = { NNS::BRUTE_FORCE, NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP, NNS::BALL_TREE, NNS::COVER_TREE, NNS::LSH };
+	const unsigned creationOptionFlags[] = { 0, NNS::COSINE, NNS::INNER_PRODUCT };
+	for (size_t t = 0; t < sizeof(searchTypes) / sizeof(searchTypes[0]); ++t)
+	{
+		for (size_t f = 0; f < sizeof(creationOptionFlags) / sizeof(creationOptionFlags[0]); ++f)
+		{
+			for (unsigned leafStorage = 0; leafStorage <= 1; ++leafStorage)
+			{
+				const typename NNS::SearchType searchType(searchTypes[t]);
+				const bool kdTree(searchType == NNS::KDTREE_LINEAR_HEAP || searchType == NNS::KDTREE_TREE_HEAP);
+				if (leafStorage != 0 && (!kdTree || creationOptionFlags[f] != 0))
+					continue;
+				Parameters parameters;
+				if (kdTree)
+					parameters["leafStorage"] = leafStorage;
+				NNS* nns(NNS::create(d, d.rows(), searchType, creationOptionFlags[f], parameters));
+				const size_t memory(nns->memoryUsage());
+				const size_t buildMemory(nns->getBuildStatistics().memory);
+				delete nns;
+				const MemoryEstimate estimate(NNS::estimateMemory(searchType, d.cols(), d.rows(), creationOptionFlags[f], parameters));
+				// kd-tree nodes are estimated from the average fill of leaves, and LSH bounds the number of distinct keys by the number of points
+				bool valid;
+				if (kdTree)
+					valid = (estimate.total() >= memory * 0.75 && estimate.total() <= memory * 1.25) && (creationOptionFlags[f] != 0 || buildMemory == memory);
+				else if (searchType == NNS::LSH)
+					valid = (estimate.total() >= memory);
+				else
+					valid = (estimate.total() == memory);
+				if (!valid)
+				{
+					cerr << "Memory of search type " << searchType << " with creation options " << creationOptionFlags[f] << " and leaf storage " << leafStorage << " is " << memory << " bytes (build statistics " << buildMemory << "), but was estimated to " << estimate.total() << " bytes (nodes " << estimate.nodes << ", buckets " << estimate.buckets << ", points " << estimate.points << ")" << endl;
+					exit(13);
+				}
+			}
+		}
+	}
+}
+
+//! Validate the searches on rotated clouds against the kd-tree on the original one, distances must be equal up to rounding
+template<typename T>
+void validateRotation(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	
+	const Matrix d(load<T>(fileName));
+	const int itCount(method != -1 ? method : d.cols() * 2);
+	// generated queries, then points of the cloud, whose self match must still be excluded
+	const Matrix queries[2] = { createQuery<T>(d, itCount, method), d.block(0, 0, d.rows(), min(int(d.cols()), 1000)) };
+	const T maxRadius2(maxRadius * maxRadius);
+	
+	const typename NNS::SearchType searchTypes[] = { NNS::KDTREE_LINEAR_HEAP, NNS::KDTREE_TREE_HEAP, NNS::BALL_TREE };
+	const char* rotations[] = { "pca", "random" };
+	for (int s = 0; s < 2; ++s)
+	{
+		const Matrix& q(queries[s]);
+		NNS* reference(NNS::create(d, d.rows(), NNS::KDTREE_LINEAR_HEAP));
+		IndexMatrix expectedIndices(K, q.cols());
+		Matrix expectedDists2(K, q.cols());
+		reference->knn(q, expectedIndices, expectedDists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+		delete reference;
+		
+		for (size_t t = 0; t < sizeof(searchTypes) / sizeof(searchTypes[0]); ++t)
+		{
+			for (size_t r = 0; r < sizeof(rotations) / sizeof(rotations[0]); ++r)
+			{
+				Parameters parameters("rotation", string(rotations[r]));
+				parameters["rotationSeed"] = unsigned(t);
+				NNS* nns(NNS::create(d, d.rows(), searchTypes[t], 0, parameters));
+				IndexMatrix indices(K, q.cols());
+				Matrix dists2(K, q.cols());
+				nns->knn(q, indices, dists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+				for (int i = 0; i < q.cols(); ++i)
+				{
+					for (int k = 0; k < K; ++k)
+					{
+						const T expected(expectedDists2(k, i));
+						const T dist2(dists2(k, i));
+						const T tolerance(T(1e-4) * (T(1) + expected));
+						bool valid;
+						if (expected == numeric_limits<T>::infinity() || dist2 == numeric_limits<T>::infinity())
+							// rounding may move a point across the maximum radius
+							valid = (expected == dist2) || fabs(min(expected, dist2) - maxRadius2) <= T(1e-4) * (T(1) + maxRadius2);
+						else
+							valid = fabs(dist2 - expected) <= tolerance;
+						if (!valid)
+						{
+							cerr << "Method " << searchTypes[t] << ", rotation " << rotations[r] << ", query set " << s << ", query point " << i << ", neighbour " << k << " of " << K << " has squared distance " << dist2 << " instead of " << expected << endl;
+							exit(14);
+						}
+					}
+				}
+				
+				// kd-tree cursors are forwarded with rotated queries
+				if (searchTypes[t] != NNS::BALL_TREE)
+				{
+					for (int i = 0; i < min(int(q.cols()), 100); ++i)
+					{
+						typename NNS::Cursor* cursor(nns->createCursor(q.col(i), 0, maxRadius));
+						for (int k = 0; k < K; ++k)
+						{
+							typename NNS::Index index;
+							T dist2(numeric_limits<T>::infinity());
+							cursor->next(index, dist2);
+							const T expected(expectedDists2(k, i));
+							if ((expected == numeric_limits<T>::infinity()) != (dist2 == numeric_limits<T>::infinity()) ||
+								(expected != numeric_limits<T>::infinity() && fabs(dist2 - expected) > T(1e-4) * (T(1) + expected)))
+							{
+								if (fabs(min(expected, dist2) - maxRadius2) <= T(1e-4) * (T(1) + maxRadius2))
+									break;
+								cerr << "Method " << searchTypes[t] << ", rotation " << rotations[r] << ", query set " << s << ", cursor of query point " << i << ", neighbour " << k << " of " << K << " has squared distance " << dist2 << " instead of " << expected << endl;
+								exit(14);
+							}
+						}
+						delete cursor;
+					}
+				}
+				delete nns;
+			}
+		}
+	}
+
+	// similarity searches cannot be rotated, creation and memory estimation must agree
+	const unsigned similarityFlags[] = { NNS::COSINE, NNS::INNER_PRODUCT };
+	for (size_t f = 0; f < sizeof(similarityFlags) / sizeof(similarityFlags[0]); ++f)
+	{
+		const Parameters parameters("rotation", string("pca"));
+		bool createThrown(false);
+		try
+		{
+			delete NNS::create(d, d.rows(), NNS::KDTREE_LINEAR_HEAP, similarityFlags[f], parameters);
+		}
+		catch (const runtime_error&)
+		{
+			createThrown = true;
+		}
+		bool estimateThrown(false);
+		try
+		{
+			NNS::estimateMemory(NNS::KDTREE_LINEAR_HEAP, d.cols(), d.rows(), similarityFlags[f], parameters);
+		}
+		catch (const runtime_error&)
+		{
+			estimateThrown = true;
+		}
+		if (!createThrown || !estimateThrown)
+		{
+			cerr << "Rotation with creation options " << similarityFlags[f] << " was accepted by " << (createThrown ? "estimateMemory()" : "create()") << endl;
+			exit(14);
+		}
+	}
+}
+
+//! Validate the metrics collected on calls to knn() from several threads, results must be identical to those of a search without metrics
+template<typename T>
+void validateMetrics(const char *fileName, const int K, const int method, const T maxRadius)
+{
+	typedef Nabo::NearestNeighbourSearch<T> NNS;
+	typedef typename NNS::Matrix Matrix;
+	typedef typename NNS::IndexMatrix IndexMatrix;
+	typedef typename NNS::Metrics Metrics;
+	
+	const Matrix d(load<T>(fileName));
+	const int itCount(method != -1 ? method : d.cols() * 2);
+	const Matrix q(createQuery<T>(d, itCount, method));
+	
+	NNS* reference(NNS::create(d, d.rows(), NNS::KDTREE_LINEAR_HEAP));
+	IndexMatrix expectedIndices(K, q.cols());
+	Matrix expectedDists2(K, q.cols());
+	reference->knn(q, expectedIndices, expectedDists2, K, 0, NNS::SORT_RESULTS, maxRadius);
+	bool thrown(false);
+	try
+	{
+		reference->getMetrics();
+	}
+	catch (const runtime_error&)
+	{
+		thrown = true;
+	}
+	delete reference;
+	if (!thrown)
+	{
+		cerr << "A search without metrics returned metrics" << endl;
+		exit(12);
+	}
+	
+	// every query point searched by its own call, with k alternating between K and 1
+	NNS* nns(NNS::create(d, d.rows(), NNS::KDTREE_LINEAR_HEAP, NNS::TOUCH_STATISTICS, Parameters("metrics", 1u)));
+	const Metrics before(nns->getMetrics());
+	bool ok(true);
+	unsigned long touchedCount(0);
+#pragma omp parallel for reduction(+:touchedCount)
+	for (int i = 0; i < q.cols(); ++i)
+	{
+		const int k(i % 2 == 0 ? K : 1);
+		IndexMatrix indices(k, 1);
+		Matrix dists2(k, 1);
+		touchedCount += nns->knn(q.col(i), indices, dists2, k, 0, NNS::SORT_RESULTS, maxRadius);
+		if (indices != expectedIndices.block(0, i, k, 1) || dists2 != expectedDists2.block(0, i, k, 1))
+			ok = false;
+	}
+	const Metrics metrics(nns->getMetrics() - before);
+	delete nns;
+	
+	if (!ok)
+	{
+		cerr << "A search with metrics returned different results than one without" << endl;
+		exit(12);
+	}
+	const uint64_t callCount(q.cols());
+	uint64_t kCount(0), latencyCount(0);
+	for (int i = 0; i < Metrics::K_BUCKET_COUNT; ++i)
+		kCount += metrics.kCounts[i];
+	for (int i = 0; i < Metrics::LATENCY_BUCKET_COUNT; ++i)
+		latencyCount += metrics.latencyCounts[i];
+	int kBucket(0);
+	while ((2 << kBucket) <= K)
+		++kBucket;
+	const uint64_t kCallCount(K == 1 ? callCount : (callCount + 1) / 2);
+	if (metrics.callCount != callCount || metrics.queryCount != callCount || kCount != callCount || latencyCount != callCount ||
+		metrics.kCounts[kBucket] != kCallCount || metrics.touchedCount != touchedCount || metrics.duration <= 0 ||
+		metrics.getLatencyPercentile(0.5) > metrics.getLatencyPercentile(0.99) || metrics.getLatencyPercentile(0.99) <= 0)
+	{
+		cerr << "Inconsistent metrics after " << callCount << " calls: " << metrics.callCount << " calls, " << metrics.queryCount << " queries, " << kCount << " calls counted by k of which " << metrics.kCounts[kBucket] << " in the bucket of k = " << K << ", " << latencyCount << " calls counted by latency, " << metrics.touchedCount << " points touched instead of " << touchedCount << ", median latency " << metrics.getLatencyPercentile(0.5) << ", p99 " << metrics.getLatencyPercentile(0.99) << endl;
+		exit(12);
+	}
+}
+
 int main(int argc, char* argv[])
 {
 	if (argc < 4)
@@ -200,6 +963,20 @@ int main(int argc, char* argv[])
 	const float maxRadius(argc >= 5 ? float(atof(argv[4])) : numeric_limits<float>::infinity());
 	
 	validate<float>(argv[1], K, method, maxRadius);
+	if (maxRadius == numeric_limits<float>::infinity())
+	{
+		validateSimilarity<float>(argv[1], K, method);
+		validateSegments<float>(argv[1], method);
+	}
+	validatePeriodic<float>(argv[1], K, method, maxRadius);
+	validateLeafStorage<float>(argv[1], K, method, maxRadius);
+	validateCpuKernels<float>(argv[1], K, method, maxRadius);
+	validateOtherScalarQuery<float, double>(argv[1], K, method, maxRadius);
+	validateOtherScalarQuery<double, float>(argv[1], K, method, maxRadius);
+	validateBuildStatistics<float>(argv[1]);
+	validateMetrics<float>(argv[1], K, method, maxRadius);
+	validateMemory<float>(argv[1]);
+	validateRotation<float>(argv[1], K, method, maxRadius);
 	//validate<double>(argv[1], K, method);
 	
 	return 0;